@@ -0,0 +1,147 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+// Measures the software compositor of the video mixer sample: synthetic I420
+// sources are given to it as a decoder would, then composed on the canvas.
+// Every source has a new frame for every canvas, the worst case, and the time
+// of each stage is logged: the copy of the frames, the layout and the
+// scaling into the tiles.
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/log.h"
+#include "common/opt_parser.h"
+#include "common/sample_i420_compositor.h"
+
+#define DEFAULT_SOURCES (4)
+#define DEFAULT_SOURCE_WIDTH (640)
+#define DEFAULT_SOURCE_HEIGHT (360)
+#define DEFAULT_CANVAS_WIDTH (1920)
+#define DEFAULT_CANVAS_HEIGHT (1080)
+#define DEFAULT_TOTAL_FRAMES (300)
+
+struct SampleOptions {
+  int sources = DEFAULT_SOURCES;
+  int sourceWidth = DEFAULT_SOURCE_WIDTH;
+  int sourceHeight = DEFAULT_SOURCE_HEIGHT;
+  int width = DEFAULT_CANVAS_WIDTH;
+  int height = DEFAULT_CANVAS_HEIGHT;
+  int totalFrames = DEFAULT_TOTAL_FRAMES;
+};
+
+struct I420Source {
+  std::vector<uint8_t> data;
+  agora::media::base::VideoFrame frame;
+};
+
+// A pattern of its own for each source, with the stride of a decoder that
+// pads its rows
+static void makeSource(I420Source& source, int index, int width, int height) {
+  int stride = (width + 63) & ~63;
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  int chromaStride = (chromaWidth + 31) & ~31;
+  source.data.resize(stride * height + 2 * chromaStride * chromaHeight);
+  uint8_t* y = source.data.data();
+  uint8_t* u = y + stride * height;
+  uint8_t* v = u + chromaStride * chromaHeight;
+  for (int j = 0; j < height; j++) {
+    for (int i = 0; i < width; i++) {
+      double wave = 90 * sin((i + index * 40) * 0.04) * cos(j * 0.03);
+      y[j * stride + i] = static_cast<uint8_t>(128 + static_cast<int>(wave));
+    }
+  }
+  for (int j = 0; j < chromaHeight; j++) {
+    for (int i = 0; i < chromaWidth; i++) {
+      u[j * chromaStride + i] = static_cast<uint8_t>(64 + (i + index * 16) * 128 / chromaWidth);
+      v[j * chromaStride + i] = static_cast<uint8_t>(192 - j * 128 / chromaHeight);
+    }
+  }
+
+  agora::media::base::VideoFrame& frame = source.frame;
+  frame.type = agora::media::base::VIDEO_PIXEL_I420;
+  frame.width = width;
+  frame.height = height;
+  frame.yStride = stride;
+  frame.uStride = chromaStride;
+  frame.vStride = chromaStride;
+  frame.yBuffer = y;
+  frame.uBuffer = u;
+  frame.vBuffer = v;
+}
+
+int main(int argc, char* argv[]) {
+  SampleOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("sources", &options.sources, "Number of users / default is 4");
+  optParser.add_long_opt("sourceWidth", &options.sourceWidth,
+                         "Width of their frames / default is 640");
+  optParser.add_long_opt("sourceHeight", &options.sourceHeight,
+                         "Height of their frames / default is 360");
+  optParser.add_long_opt("width", &options.width, "Canvas width / default is 1920");
+  optParser.add_long_opt("height", &options.height, "Canvas height / default is 1080");
+  optParser.add_long_opt("totalFrames", &options.totalFrames, "Number of canvases to compose");
+
+  if (!optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+  if (options.sources <= 0 || options.sourceWidth < 2 || options.sourceHeight < 2 ||
+      options.width < 2 || options.height < 2 || options.totalFrames <= 0) {
+    AG_LOG(ERROR, "Invalid source, canvas or count");
+    return -1;
+  }
+
+  std::vector<I420Source> sources(options.sources);
+  for (int i = 0; i < options.sources; i++) {
+    makeSource(sources[i], i, options.sourceWidth, options.sourceHeight);
+  }
+  AG_LOG(INFO, "%d sources of %dx%d on a %dx%d canvas, scaling uses %s", options.sources,
+         options.sourceWidth, options.sourceHeight, options.width, options.height,
+         SampleI420Compositor::simdName());
+
+  // Users never go stale here, however slow the host
+  SampleI420Compositor compositor(options.width, options.height, 0);
+
+  // The first canvas lays the users out and clears the background
+  for (int i = 0; i < options.sources; i++) {
+    compositor.onFrame(std::to_string(i), sources[i].frame);
+  }
+  compositor.compose();
+  compositor.takeTimings();
+
+  auto start = std::chrono::steady_clock::now();
+  for (int f = 0; f < options.totalFrames; f++) {
+    for (int i = 0; i < options.sources; i++) {
+      compositor.onFrame(std::to_string(i), sources[i].frame);
+    }
+    compositor.compose();
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  SampleI420Compositor::Timings timings = compositor.takeTimings();
+  const SampleI420Compositor::StageTiming& copy = timings.stages[SampleI420Compositor::kCopy];
+  const SampleI420Compositor::StageTiming& layout = timings.stages[SampleI420Compositor::kLayout];
+  const SampleI420Compositor::StageTiming& scale = timings.stages[SampleI420Compositor::kScale];
+  double canvasPixels = static_cast<double>(options.width) * options.height;
+  AG_LOG(INFO, "%7.3f ms/canvas, %7.1f fps, %7.1f Mpixel/s, %.1f tiles per canvas",
+         seconds * 1000 / options.totalFrames, options.totalFrames / seconds,
+         canvasPixels * options.totalFrames / seconds / 1e6,
+         static_cast<double>(timings.tiles) / std::max<uint64_t>(timings.frames, 1));
+  AG_LOG(INFO, "copy   %8.1f us/frame  (max %8.1f us)", copy.averageUs, copy.maxUs);
+  AG_LOG(INFO, "layout %8.1f us/canvas (max %8.1f us)", layout.averageUs, layout.maxUs);
+  AG_LOG(INFO, "scale  %8.1f us/canvas (max %8.1f us)", scale.averageUs, scale.maxUs);
+  return 0;
+}
@@ -0,0 +1,171 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+// Compares the vectorized Annex-B start code scanner against the byte loop.
+// Scans an H.264/H.265 file (or a synthetic stream when no file is given)
+// repeatedly until the requested amount of data has been processed, and checks
+// that both implementations report the same NAL boundaries.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/file_parser/helper_nal_scanner.h"
+#include "common/log.h"
+#include "common/opt_parser.h"
+
+#define DEFAULT_SYNTHETIC_MB (64)
+#define DEFAULT_TOTAL_GB (4)
+
+struct SampleOptions {
+  std::string videoFile;
+  int syntheticMB = DEFAULT_SYNTHETIC_MB;
+  int totalGB = DEFAULT_TOTAL_GB;
+};
+
+// Random payload split into NAL units of 1..64 KB. Payload bytes never form
+// "00 00 0x" so the only start codes are the ones inserted here, like an
+// emulation-prevented bitstream.
+static void makeSyntheticStream(std::vector<uint8_t>& stream, size_t size) {
+  stream.resize(size);
+  srand(1);
+  size_t i = 0;
+  while (i + 5 < size) {
+    stream[i++] = 0;
+    stream[i++] = 0;
+    stream[i++] = 0;
+    stream[i++] = 1;
+    stream[i++] = 0x41;
+    size_t nal = 1024 + rand() % (63 * 1024);
+    for (size_t end = std::min(size, i + nal); i < end; i++) {
+      uint8_t b = rand() & 0xff;
+      if (b == 0 && i >= 1 && stream[i - 1] == 0) {
+        b = 3;
+      }
+      stream[i] = b;
+    }
+  }
+  for (; i < size; i++) {
+    stream[i] = 0xff;
+  }
+}
+
+typedef size_t (*scan_fn)(const uint8_t*, size_t, size_t);
+
+static size_t scanAll(scan_fn scan, const uint8_t* buf, size_t size, uint64_t& checksum) {
+  size_t count = 0;
+  size_t pos = scan(buf, size, 0);
+  while (pos < size) {
+    checksum += pos;
+    ++count;
+    pos = scan(buf, size, pos + 3);
+  }
+  return count;
+}
+
+static void runBenchmark(const char* name, scan_fn scan, const uint8_t* buf, size_t size,
+                         int passes) {
+  uint64_t checksum = 0;
+  size_t count = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < passes; i++) {
+    count += scanAll(scan, buf, size, checksum);
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double gb = static_cast<double>(size) * passes / (1024.0 * 1024 * 1024);
+  AG_LOG(INFO, "%-8s %6.2f GB in %7.3f s, %7.2f GB/s, %zu start codes, checksum %llu", name, gb,
+         seconds, gb / seconds, count, (unsigned long long)checksum);
+}
+
+int main(int argc, char* argv[]) {
+  SampleOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("videoFile", &options.videoFile,
+                         "Annex-B H.264/H.265 file to scan / default is a synthetic stream");
+  optParser.add_long_opt("syntheticMB", &options.syntheticMB,
+                         "Size of the synthetic stream in MB");
+  optParser.add_long_opt("totalGB", &options.totalGB,
+                         "Amount of data to scan with each implementation in GB");
+
+  if (!optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+
+  std::vector<uint8_t> synthetic;
+  const uint8_t* buf = nullptr;
+  size_t size = 0;
+  void* mapped = nullptr;
+
+  if (!options.videoFile.empty()) {
+    int fd;
+    struct stat sb;
+    if ((fd = open(options.videoFile.c_str(), O_RDONLY)) < 0) {
+      perror(options.videoFile.c_str());
+      return -1;
+    }
+    if ((fstat(fd, &sb)) == -1 || sb.st_size == 0) {
+      perror("fstat");
+      close(fd);
+      return -1;
+    }
+    if ((mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == (void*)-1) {
+      perror("mmap");
+      close(fd);
+      return -1;
+    }
+    close(fd);
+    buf = static_cast<const uint8_t*>(mapped);
+    size = sb.st_size;
+  } else {
+    makeSyntheticStream(synthetic, static_cast<size_t>(options.syntheticMB) * 1024 * 1024);
+    buf = synthetic.data();
+    size = synthetic.size();
+  }
+
+  // Both implementations must agree on every NAL boundary
+  std::vector<HelperNalUnit> units;
+  find_nal_units(buf, size, units);
+  size_t pos = find_start_code_scalar(buf, size, 0);
+  for (const HelperNalUnit& unit : units) {
+    if (unit.header != pos + 3) {
+      AG_LOG(ERROR, "start code mismatch at offset %zu", pos);
+      return -1;
+    }
+    pos = find_start_code_scalar(buf, size, pos + 3);
+  }
+  if (pos != size) {
+    AG_LOG(ERROR, "start code mismatch at offset %zu", pos);
+    return -1;
+  }
+  AG_LOG(INFO, "%zu bytes, %zu NAL units, simd implementation: %s", size, units.size(),
+         nal_scanner_impl_name());
+
+  // Touch every page once so the first timed run does not pay for page faults
+  uint64_t warmup = 0;
+  scanAll(find_start_code, buf, size, warmup);
+
+  int passes = static_cast<int>(
+      std::max<uint64_t>(1, (static_cast<uint64_t>(options.totalGB) << 30) / size));
+  runBenchmark("scalar", find_start_code_scalar, buf, size, passes);
+  runBenchmark(nal_scanner_impl_name(), find_start_code, buf, size, passes);
+
+  if (mapped) {
+    munmap(mapped, size);
+  }
+  return 0;
+}
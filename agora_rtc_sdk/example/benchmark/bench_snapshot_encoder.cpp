@@ -0,0 +1,249 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+// Compares the snapshot encoders on the same I420 frames: the bundled libjpeg
+// with its integer and floating point DCT, and the built-in SIMD encoder.
+// Frames come from a raw I420 file (or are synthesized when no file is given).
+// Every JPEG of the first pass is decoded again with libjpeg, which checks
+// that the file is standard and measures its quality.
+//
+// Build it optimized (CMAKE_BUILD_TYPE=Release): the built-in encoder relies
+// on inlining and only beats libjpeg at -O2, e.g. 5.2 against 21.4 ms a frame,
+// while without optimization it takes 24.9 ms against 19.4 ms.
+
+#include <math.h>
+#include <setjmp.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/log.h"
+#include "common/opt_parser.h"
+#include "common/sample_jpeg_encoder.h"
+#include "common/sample_snapshot_encoder.h"
+#include "jpeglib.h"
+
+#define DEFAULT_WIDTH (1280)
+#define DEFAULT_HEIGHT (720)
+#define DEFAULT_SYNTHETIC_FRAMES (8)
+#define DEFAULT_TOTAL_FRAMES (300)
+#define DEFAULT_QUALITY (40)
+
+struct SampleOptions {
+  std::string yuvFile;
+  int width = DEFAULT_WIDTH;
+  int height = DEFAULT_HEIGHT;
+  int totalFrames = DEFAULT_TOTAL_FRAMES;
+  int quality = DEFAULT_QUALITY;
+  std::string encoders = SAMPLE_SNAPSHOT_ENCODERS;
+};
+
+struct I420Frame {
+  std::vector<uint8_t> data;
+  SampleSnapshotPicture picture;
+};
+
+static void setPlanes(I420Frame& frame, int width, int height) {
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  uint8_t* y = frame.data.data();
+  uint8_t* u = y + width * height;
+  uint8_t* v = u + chromaWidth * chromaHeight;
+  frame.picture = {y, u, v, width, chromaWidth, chromaWidth, width, height};
+}
+
+// Gradients moving from frame to frame, with some texture and noise so the
+// blocks are not all flat
+static void makeSyntheticFrames(std::vector<I420Frame>& frames, int width, int height) {
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  srand(1);
+  frames.resize(DEFAULT_SYNTHETIC_FRAMES);
+  for (int f = 0; f < DEFAULT_SYNTHETIC_FRAMES; f++) {
+    I420Frame& frame = frames[f];
+    frame.data.resize(width * height + 2 * chromaWidth * chromaHeight);
+    setPlanes(frame, width, height);
+    uint8_t* y = const_cast<uint8_t*>(frame.picture.y);
+    for (int j = 0; j < height; j++) {
+      for (int i = 0; i < width; i++) {
+        double wave = 60 * sin((i + f * 8) * 0.03) * cos(j * 0.02) + 20 * sin(i * 0.5 + j * 0.3);
+        int value = 128 + static_cast<int>(wave) + (rand() % 9) - 4;
+        y[j * width + i] = static_cast<uint8_t>(std::max(0, std::min(255, value)));
+      }
+    }
+    uint8_t* u = const_cast<uint8_t*>(frame.picture.u);
+    uint8_t* v = const_cast<uint8_t*>(frame.picture.v);
+    for (int j = 0; j < chromaHeight; j++) {
+      for (int i = 0; i < chromaWidth; i++) {
+        u[j * chromaWidth + i] = static_cast<uint8_t>(96 + (i + f * 4) * 64 / chromaWidth);
+        v[j * chromaWidth + i] = static_cast<uint8_t>(160 - j * 64 / chromaHeight);
+      }
+    }
+  }
+}
+
+static bool readFrames(std::vector<I420Frame>& frames, const std::string& path, int width,
+                       int height) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    AG_LOG(ERROR, "Failed to open %s", path.c_str());
+    return false;
+  }
+  size_t frameSize = width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+  // a bounded number of frames, enough to not only measure the cache
+  while (frames.size() < 64) {
+    I420Frame frame;
+    frame.data.resize(frameSize);
+    if (!file.read(reinterpret_cast<char*>(frame.data.data()), frameSize)) {
+      break;
+    }
+    frames.push_back(std::move(frame));
+    setPlanes(frames.back(), width, height);
+  }
+  if (frames.empty()) {
+    AG_LOG(ERROR, "%s holds no %dx%d I420 frame", path.c_str(), width, height);
+    return false;
+  }
+  return true;
+}
+
+struct DecodeError {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+static void decodeErrorExit(j_common_ptr cinfo) {
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  AG_LOG(ERROR, "libjpeg cannot decode: %s", message);
+  longjmp(reinterpret_cast<DecodeError*>(cinfo->err)->jump, 1);
+}
+
+// Decodes |jpeg| with libjpeg and returns the squared error of its luma
+static bool decodeLumaError(const std::vector<uint8_t>& jpeg, const SampleSnapshotPicture& picture,
+                            double& squaredError) {
+  struct jpeg_decompress_struct cinfo;
+  DecodeError error;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = decodeErrorExit;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, const_cast<unsigned char*>(jpeg.data()), jpeg.size());
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.out_color_space = JCS_YCbCr;
+  jpeg_start_decompress(&cinfo);
+  if (static_cast<int>(cinfo.output_width) != picture.width ||
+      static_cast<int>(cinfo.output_height) != picture.height) {
+    AG_LOG(ERROR, "Decoded %ux%u instead of %dx%d", cinfo.output_width, cinfo.output_height,
+           picture.width, picture.height);
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  std::vector<uint8_t> line(picture.width * 3);
+  JSAMPROW row = line.data();
+  while (cinfo.output_scanline < cinfo.output_height) {
+    const uint8_t* y = picture.y + cinfo.output_scanline * picture.yStride;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+    for (int i = 0; i < picture.width; i++) {
+      double diff = static_cast<double>(line[i * 3]) - y[i];
+      squaredError += diff * diff;
+    }
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+static bool runBenchmark(SampleSnapshotEncoder& encoder, const std::vector<I420Frame>& frames,
+                         int totalFrames, int quality) {
+  std::vector<uint8_t> jpeg;
+
+  // Check every frame once, which also warms up the tables and buffers
+  double squaredError = 0;
+  size_t bytes = 0;
+  for (const I420Frame& frame : frames) {
+    if (!encoder.encode(frame.picture, quality, jpeg) ||
+        !decodeLumaError(jpeg, frame.picture, squaredError)) {
+      AG_LOG(ERROR, "%s failed", encoder.name());
+      return false;
+    }
+    bytes += jpeg.size();
+  }
+  double pixels = static_cast<double>(frames[0].picture.width) * frames[0].picture.height;
+  double psnr = squaredError ? 10 * log10(255.0 * 255.0 * pixels * frames.size() / squaredError)
+                             : 99.0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < totalFrames; i++) {
+    encoder.encode(frames[i % frames.size()].picture, quality, jpeg);
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  AG_LOG(INFO, "%-14s %7.3f ms/frame, %7.1f fps, %7.1f Mpixel/s, %8zu bytes/frame, Y PSNR %.2f dB",
+         encoder.name(), seconds * 1000 / totalFrames, totalFrames / seconds,
+         pixels * totalFrames / seconds / 1e6, bytes / frames.size(), psnr);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  SampleOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("yuvFile", &options.yuvFile,
+                         "Raw I420 frames to encode / default is synthetic frames");
+  optParser.add_long_opt("width", &options.width, "Frame width / default is 1280");
+  optParser.add_long_opt("height", &options.height, "Frame height / default is 720");
+  optParser.add_long_opt("totalFrames", &options.totalFrames,
+                         "Number of frames to encode with each encoder");
+  optParser.add_long_opt("quality", &options.quality, "JPEG quality 1..100 / default is 40");
+  optParser.add_long_opt("encoders", &options.encoders,
+                         "Comma separated encoders / default is " SAMPLE_SNAPSHOT_ENCODERS);
+
+  if (!optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+  if (options.width <= 0 || options.height <= 0 || options.totalFrames <= 0) {
+    AG_LOG(ERROR, "Invalid frame size or count");
+    return -1;
+  }
+
+  std::vector<I420Frame> frames;
+  if (!options.yuvFile.empty()) {
+    if (!readFrames(frames, options.yuvFile, options.width, options.height)) {
+      return -1;
+    }
+  } else {
+    makeSyntheticFrames(frames, options.width, options.height);
+  }
+  AG_LOG(INFO, "%zu frames of %dx%d, quality %d, built-in encoder uses %s", frames.size(),
+         options.width, options.height, options.quality, SampleJpegEncoder::simdName());
+
+  std::stringstream names(options.encoders);
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    name.erase(0, name.find_first_not_of(' '));
+    std::unique_ptr<SampleSnapshotEncoder> encoder = createSnapshotEncoder(name);
+    if (!encoder) {
+      AG_LOG(ERROR, "Unknown encoder %s", name.c_str());
+      return -1;
+    }
+    if (!runBenchmark(*encoder, frames, options.totalFrames, options.quality)) {
+      return -1;
+    }
+  }
+  return 0;
+}
@@ -5,9 +5,14 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <map>
+#include <mutex>
+#include <vector>
+
 #include "common/log.h"
 
 #define ADTS_HEADER_SIZE (7)
+#define ADTS_CRC_SIZE (2)
 
 typedef struct AACAudioFrame_ {
   uint16_t syncword{0};
@@ -29,23 +34,96 @@ typedef struct AACAudioFrame_ {
 } AACAudioFrame;
 
 static const uint32_t AacFrameSampleRateMap[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
-                                                 22000, 16000, 12000, 11025, 8000,  7350};
+                                                 22050, 16000, 12000, 11025, 8000,  7350};
 
-HelperAacFileParser::HelperAacFileParser(const char* filepath)
-    : file_path_(filepath), data_buffer_(nullptr), data_offset_(0) {}
+// channel_configuration 0 means the layout is given by a program config
+// element, which is not parsed; such frames are sent as mono
+static const uint8_t AacFrameChannelsMap[] = {1, 1, 2, 3, 4, 5, 6, 8};
 
-HelperAacFileParser::~HelperAacFileParser() = default;
+static void parse_adts_header(const uint8_t* hdr, AACAudioFrame& aacframe) {
+  // parse adts_fixed_header()
+  aacframe.syncword = (hdr[0] << 4) | (hdr[1] >> 4);
+  aacframe.id = (hdr[1] >> 3) & 0x01;
+  aacframe.layer = (hdr[1] >> 1) & 0x03;
+  aacframe.protection_absent = hdr[1] & 0x01;
+  aacframe.profile = (hdr[2] >> 6) & 0x03;
+  aacframe.sampling_frequency_index = (hdr[2] >> 2) & 0x0f;
+  aacframe.private_bit = (hdr[2] >> 1) & 0x01;
+  aacframe.channel_configuration = ((hdr[2] & 0x1) << 2) | (hdr[3] >> 6);
+  aacframe.original_copy = (hdr[3] >> 5) & 0x01;
+  aacframe.home = (hdr[3] >> 4) & 0x01;
+  // parse adts_variable_header()
+  aacframe.copyrighted_id_bit = (hdr[3] >> 3) & 0x01;
+  aacframe.copyrighted_id_start = (hdr[3] >> 2) & 0x01;
+  aacframe.aac_frame_length = ((hdr[3] & 0x3) << 11) | (hdr[4] << 3) | (hdr[5] >> 5);
+  aacframe.adts_buffer_fullness = ((hdr[5] & 0x1f) << 6) | (hdr[6] >> 2);
+  aacframe.number_of_raw_data_blocks_in_frame = hdr[6] & 0x03;
+}
 
-bool HelperAacFileParser::initialize() {
+// A mapped ADTS file and the position/format of each of its frames
+class HelperAacFile {
+ public:
+  struct Frame {
+    size_t offset;
+    uint16_t length;
+    uint8_t channels;
+    uint32_t sampleRate;
+  };
+
+  static std::shared_ptr<const HelperAacFile> load(const std::string& filepath);
+  ~HelperAacFile();
+
+  uint8_t* data() const { return data_; }
+  const std::vector<Frame>& frames() const { return frames_; }
+
+ private:
+  bool map(const std::string& filepath);
+  void buildIndex(const std::string& filepath);
+
+  uint8_t* data_{nullptr};
+  size_t size_{0};
+  std::vector<Frame> frames_;
+};
+
+std::shared_ptr<const HelperAacFile> HelperAacFile::load(const std::string& filepath) {
+  static std::mutex lock;
+  static std::map<std::string, std::weak_ptr<const HelperAacFile>> loaded;
+
+  std::lock_guard<std::mutex> _(lock);
+  if (auto file = loaded[filepath].lock()) {
+    return file;
+  }
+  std::shared_ptr<HelperAacFile> file(new HelperAacFile);
+  if (!file->map(filepath)) {
+    return nullptr;
+  }
+  file->buildIndex(filepath);
+  if (file->frames_.empty()) {
+    AG_LOG(ERROR, "No ADTS frame in %s", filepath.c_str());
+    return nullptr;
+  }
+  loaded[filepath] = file;
+  return file;
+}
+
+HelperAacFile::~HelperAacFile() {
+  if (data_) {
+    // unmap the file
+    if ((munmap((void*)data_, size_)) == -1) {
+      perror("munmap");
+    }
+  }
+}
+
+bool HelperAacFile::map(const std::string& filepath) {
   int fd;
   struct stat sb;
   void* mapped;
 
-  if ((fd = open(file_path_.c_str(), O_RDONLY)) < 0) {
-    perror(file_path_.c_str());
+  if ((fd = open(filepath.c_str(), O_RDONLY)) < 0) {
+    perror(filepath.c_str());
     return false;
   }
-  AG_LOG(INFO, "Open aac file %s successfully", file_path_.c_str());
 
   // get the file property
   if ((fstat(fd, &sb)) == -1) {
@@ -55,62 +133,112 @@ bool HelperAacFileParser::initialize() {
   }
 
   // map the file to process address space
-  if ((mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == (void*)-1) {
+  if (sb.st_size == 0 ||
+      (mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
     perror("mmap");
     close(fd);
     return false;
   }
   close(fd);
 
-  data_size_ = sb.st_size;
-  data_buffer_ = (uint8_t*)mapped;
+  size_ = sb.st_size;
+  data_ = (uint8_t*)mapped;
   return true;
 }
 
-std::unique_ptr<HelperAudioFrame> HelperAacFileParser::getAudioFrame(int frameSizeDuration) {
-  std::unique_ptr<HelperAudioFrame> audioFrame = nullptr;
+void HelperAacFile::buildIndex(const std::string& filepath) {
   AACAudioFrame aacframe;
+  size_t skipped = 0;
+  size_t offset = 0;
+
+  while (offset + ADTS_HEADER_SIZE <= size_) {
+    parse_adts_header(&data_[offset], aacframe);
+    int header_size = ADTS_HEADER_SIZE + (aacframe.protection_absent ? 0 : ADTS_CRC_SIZE);
+    if (aacframe.syncword != 0xfff || aacframe.layer != 0 ||
+        aacframe.sampling_frequency_index >= sizeof(AacFrameSampleRateMap) / sizeof(uint32_t) ||
+        aacframe.aac_frame_length < header_size) {
+      // not a frame header, resync on the next byte
+      ++offset;
+      ++skipped;
+      continue;
+    }
+    if (offset + aacframe.aac_frame_length > size_) {
+      AG_LOG(ERROR, "Truncated AAC frame at %zu in %s", offset, filepath.c_str());
+      break;
+    }
+
+    Frame frame;
+    frame.offset = offset;
+    frame.length = aacframe.aac_frame_length;
+    frame.channels = AacFrameChannelsMap[aacframe.channel_configuration];
+    frame.sampleRate = AacFrameSampleRateMap[aacframe.sampling_frequency_index];
+    frames_.push_back(frame);
+    offset += aacframe.aac_frame_length;
+  }
 
-  // Check data offset and rewind to the file start if necessary
-  if (data_offset_ + ADTS_HEADER_SIZE > data_size_) {
-    data_offset_ = 0;
+  if (skipped) {
+    AG_LOG(ERROR, "Skipped %zu bytes of invalid AAC data in %s", skipped, filepath.c_str());
   }
+}
 
-  // Begin by reading the 7-byte fixed_variable headers
-  unsigned char* hdr = &data_buffer_[data_offset_];
+HelperAacFileParser::HelperAacFileParser(const char* filepath) : file_path_(filepath) {}
 
-  // parse adts_fixed_header()
-  aacframe.syncword = (hdr[0] << 4) | (hdr[1] >> 4);
-  if (aacframe.syncword != 0xfff) {
-    AG_LOG(ERROR, "Invalid AAC syncword 0x%x", aacframe.syncword);
-    return audioFrame;
+HelperAacFileParser::~HelperAacFileParser() = default;
+
+bool HelperAacFileParser::initialize() {
+  file_ = HelperAacFile::load(file_path_);
+  if (!file_) {
+    return false;
+  }
+  AG_LOG(INFO, "Open aac file %s successfully, %zu frames", file_path_.c_str(),
+         file_->frames().size());
+  next_frame_ = 0;
+  return true;
+}
+
+size_t HelperAacFileParser::frameCount() const { return file_ ? file_->frames().size() : 0; }
+
+bool HelperAacFileParser::getAudioFrame(int frameSizeDuration, HelperAudioFrame& audioFrame) {
+  if (!file_) {
+    return false;
   }
-  aacframe.id = (hdr[1] >> 3) & 0x01;
-  aacframe.layer = (hdr[1] >> 1) & 0x03;
-  aacframe.protection_absent = hdr[1] & 0x01;
-  aacframe.profile = (hdr[2] >> 6) & 0x03;
-  aacframe.sampling_frequency_index = (hdr[2] >> 2) & 0x0f;
-  aacframe.private_bit = (hdr[2] >> 1) & 0x01;
-  aacframe.channel_configuration = ((hdr[2] & 0x1) << 2) | (hdr[3] >> 6);
-  aacframe.original_copy = (hdr[3] >> 5) & 0x01;
-  aacframe.home = (hdr[3] >> 4) & 0x01;
-  // parse adts_variable_header()
-  aacframe.copyrighted_id_bit = (hdr[3] >> 3) & 0x01;
-  aacframe.copyrighted_id_start = (hdr[3] >> 2) & 0x01;
-  aacframe.aac_frame_length = ((hdr[3] & 0x3) << 11) | (hdr[4] << 3) | (hdr[5] >> 5);
-  aacframe.adts_buffer_fullness = ((hdr[5] & 0x1f) << 6) | (hdr[6] >> 2);
-  aacframe.number_of_raw_data_blocks_in_frame = hdr[6] & 0x03;
 
-  agora::rtc::EncodedAudioFrameInfo audioFrameInfo;
-  audioFrameInfo.numberOfChannels = 1;
-  audioFrameInfo.sampleRateHz = AacFrameSampleRateMap[aacframe.sampling_frequency_index];
+  // rewind to the file start if necessary
+  if (next_frame_ >= file_->frames().size()) {
+    next_frame_ = 0;
+  }
+  const HelperAacFile::Frame& frame = file_->frames()[next_frame_++];
+
+  agora::rtc::EncodedAudioFrameInfo& audioFrameInfo = audioFrame.audioFrameInfo;
+  audioFrameInfo.numberOfChannels = frame.channels;
+  audioFrameInfo.sampleRateHz = frame.sampleRate;
   audioFrameInfo.codec = agora::rtc::AUDIO_CODEC_AACLC;
   // calculate audio frame size per channel
-  audioFrameInfo.samplesPerChannel = audioFrameInfo.sampleRateHz * frameSizeDuration / 1000;
+  audioFrameInfo.samplesPerChannel = frame.sampleRate * frameSizeDuration / 1000;
 
-  audioFrame.reset(
-      new HelperAudioFrame{audioFrameInfo, &data_buffer_[data_offset_], aacframe.aac_frame_length});
+  audioFrame.buffer = file_->data() + frame.offset;
+  audioFrame.bufferLen = frame.length;
+  return true;
+}
 
-  data_offset_ += aacframe.aac_frame_length;
+std::unique_ptr<HelperAudioFrame> HelperAacFileParser::getAudioFrame(int frameSizeDuration) {
+  std::unique_ptr<HelperAudioFrame> audioFrame(new HelperAudioFrame);
+  if (!getAudioFrame(frameSizeDuration, *audioFrame)) {
+    audioFrame.reset();
+  }
   return audioFrame;
-}
\ No newline at end of file
+}
+
+HelperAacMediaSource::HelperAacMediaSource(const char* filepath, int frameSizeDuration)
+    : parser_(filepath), frame_size_duration_(frameSizeDuration) {}
+
+bool HelperAacMediaSource::readFrame(HelperMediaFrame& frame) {
+  HelperAudioFrame audioFrame;
+  if (!parser_.getAudioFrame(frame_size_duration_, audioFrame)) {
+    return false;
+  }
+  frame.view(audioFrame.buffer, audioFrame.bufferLen);
+  frame.isKeyFrame = true;
+  frame.audioFrameInfo = audioFrame.audioFrameInfo;
+  return true;
+}
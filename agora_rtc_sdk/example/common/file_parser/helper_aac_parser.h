@@ -1,6 +1,10 @@
+#include <memory>
 #include <string>
 
 #include "AgoraBase.h"
+#include "helper_media_source.h"
+
+class HelperAacFile;
 
 struct HelperAudioFrame {
   agora::rtc::EncodedAudioFrameInfo audioFrameInfo;
@@ -8,16 +12,35 @@ struct HelperAudioFrame {
   int bufferLen;
 };
 
+// Sends the ADTS frames of an AAC file. The file is mapped and indexed once
+// per process; every parser of the same file shares it and only keeps its
+// own position.
 class HelperAacFileParser {
  public:
   HelperAacFileParser(const char* filepath);
   ~HelperAacFileParser();
   bool initialize();
   std::unique_ptr<HelperAudioFrame> getAudioFrame(int frameSizeDuration);
+  // Fills |audioFrame| with the next frame without allocating; the buffer
+  // points into the mapped file. Loops at the end of the file.
+  bool getAudioFrame(int frameSizeDuration, HelperAudioFrame& audioFrame);
+  size_t frameCount() const;
 
  private:
   std::string file_path_;
-  int data_offset_;
-  int data_size_;
-  uint8_t* data_buffer_;
+  std::shared_ptr<const HelperAacFile> file_;
+  size_t next_frame_{0};
+};
+
+// Media source reading the frames of an AAC file
+class HelperAacMediaSource : public HelperMediaSource {
+ public:
+  HelperAacMediaSource(const char* filepath, int frameSizeDuration);
+
+  bool initialize() override { return parser_.initialize(); }
+  bool readFrame(HelperMediaFrame& frame) override;
+
+ private:
+  HelperAacFileParser parser_;
+  int frame_size_duration_;
 };
@@ -0,0 +1,199 @@
+#include "helper_annexb_stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "common/log.h"
+#include "helper_nal_scanner.h"
+
+// Sliding window: starts small and grows until it holds the largest frame
+#define INITIAL_WINDOW_SIZE (1024 * 1024)
+#define MAX_WINDOW_SIZE (64 * 1024 * 1024)
+// Prefetch distance of a mapped file
+#define READAHEAD_WINDOW (4 * 1024 * 1024)
+
+HelperAnnexBStream::HelperAnnexBStream(const std::string& path) : path_(path) {}
+
+HelperAnnexBStream::~HelperAnnexBStream() {
+  if (mapped_) {
+    if (munmap(window_, window_size_) == -1) {
+      perror("munmap");
+    }
+  } else {
+    free(window_);
+  }
+  if (fd_ > 0) {
+    close(fd_);
+  }
+}
+
+bool HelperAnnexBStream::open(bool readahead) {
+  struct stat sb;
+
+  if (path_ == "-") {
+    fd_ = STDIN_FILENO;
+  } else if ((fd_ = ::open(path_.c_str(), O_RDONLY)) < 0) {
+    perror(path_.c_str());
+    return false;
+  }
+
+  if (fstat(fd_, &sb) == -1) {
+    perror("fstat");
+    return false;
+  }
+
+  if (S_ISREG(sb.st_mode)) {
+    if (sb.st_size == 0) {
+      AG_LOG(ERROR, "%s is empty", path_.c_str());
+      return false;
+    }
+    // map the file to process address space
+    void* mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (mapped == MAP_FAILED) {
+      perror("mmap");
+      return false;
+    }
+    close(fd_);
+    fd_ = -1;
+
+    mapped_ = true;
+    window_ = static_cast<uint8_t*>(mapped);
+    window_size_ = sb.st_size;
+    input_done_ = true;
+
+    readahead_ = readahead;
+    if (readahead_) {
+      // frames are consumed front to back, let the kernel read ahead aggressively
+      if (madvise(window_, window_size_, MADV_SEQUENTIAL) == -1) {
+        perror("madvise");
+      }
+      this->readahead();
+    }
+    return true;
+  }
+
+  capacity_ = INITIAL_WINDOW_SIZE;
+  window_ = static_cast<uint8_t*>(malloc(capacity_));
+  return window_ != nullptr;
+}
+
+bool HelperAnnexBStream::fill() {
+  if (input_done_) {
+    return false;
+  }
+
+  // drop the released bytes once the free space runs low
+  size_t drop = std::min(released_, cursor_) - window_pos_;
+  if (drop && capacity_ - window_size_ < capacity_ / 4) {
+    memmove(window_, window_ + drop, window_size_ - drop);
+    window_size_ -= drop;
+    window_pos_ += drop;
+  }
+  if (capacity_ - window_size_ < capacity_ / 4 && capacity_ < MAX_WINDOW_SIZE) {
+    uint8_t* grown = static_cast<uint8_t*>(realloc(window_, capacity_ * 2));
+    if (grown) {
+      window_ = grown;
+      capacity_ *= 2;
+    }
+  }
+  if (window_size_ == capacity_) {
+    AG_LOG(ERROR, "Frame larger than %zu bytes in %s", capacity_, path_.c_str());
+    input_done_ = true;
+    return false;
+  }
+
+  ssize_t n;
+  do {
+    n = read(fd_, window_ + window_size_, capacity_ - window_size_);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    if (n < 0) {
+      perror("read");
+    }
+    input_done_ = true;
+    return false;
+  }
+  window_size_ += n;
+  return true;
+}
+
+bool HelperAnnexBStream::findStartCode(uint64_t from, uint64_t& pos) {
+  for (;;) {
+    size_t found = find_start_code(window_, window_size_, from - window_pos_);
+    if (found < window_size_) {
+      pos = window_pos_ + found;
+      return true;
+    }
+    // the last two bytes may begin a start code completed by the next read
+    uint64_t window_end = window_pos_ + window_size_;
+    if (window_end >= 2) {
+      from = std::max(from, window_end - 2);
+    }
+    if (!fill()) {
+      return false;
+    }
+  }
+}
+
+bool HelperAnnexBStream::nextNal(HelperAnnexBNal& nal) {
+  uint64_t start_code;
+  if (!findStartCode(cursor_, start_code)) {
+    eof_ = true;
+    return false;
+  }
+  // a zero in front makes it a 4-byte start code
+  nal.start = (start_code > cursor_ && *at(start_code - 1) == 0) ? start_code - 1 : start_code;
+  nal.header = start_code + 3;
+
+  uint64_t next;
+  if (findStartCode(nal.header, next)) {
+    nal.end = (next > nal.header && *at(next - 1) == 0) ? next - 1 : next;
+  } else {
+    nal.end = window_pos_ + window_size_;  // stream ended first
+  }
+  if (nal.end <= nal.header) {
+    eof_ = true;
+    return false;
+  }
+
+  cursor_ = nal.end;
+  readahead();
+  return true;
+}
+
+void HelperAnnexBStream::release(uint64_t offset) {
+  released_ = std::max(released_, offset);
+}
+
+bool HelperAnnexBStream::seek(uint64_t offset) {
+  if (!mapped_ || offset > window_size_) {
+    return false;
+  }
+  cursor_ = offset;
+  released_ = offset;
+  eof_ = false;
+  readahead_pos_ = offset;
+  readahead();
+  return true;
+}
+
+void HelperAnnexBStream::readahead() {
+  // keep the kernel fetching the next window while frames of the current one are sent
+  if (!readahead_ || cursor_ + READAHEAD_WINDOW / 2 < readahead_pos_ ||
+      readahead_pos_ >= window_size_) {
+    return;
+  }
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  uint64_t begin = std::max(readahead_pos_, cursor_) & ~(page - 1);
+  size_t len = std::min<uint64_t>(READAHEAD_WINDOW, window_size_ - begin);
+  madvise(window_ + begin, len, MADV_WILLNEED);
+  readahead_pos_ = begin + len;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Annex-B byte stream split into NAL units, with 64-bit offsets.
+//
+// Regular files are mapped as a whole. Anything else (pipes, FIFOs, "-" for
+// stdin) is read through a sliding window that only keeps the bytes that
+// have not been released yet, so an endless feed runs in constant memory.
+
+struct HelperAnnexBNal {
+  uint64_t start;   // offset of the first byte of the start code
+  uint64_t header;  // offset of the NAL header
+  uint64_t end;     // offset one past the last payload byte
+};
+
+class HelperAnnexBStream {
+ public:
+  explicit HelperAnnexBStream(const std::string& path);
+  ~HelperAnnexBStream();
+
+  // readahead: prefetch a mapped file ahead of the current position
+  bool open(bool readahead = false);
+
+  // True when the whole stream is mapped, so it can be rewound and indexed
+  bool seekable() const { return mapped_; }
+  // Size of a mapped file
+  uint64_t size() const { return window_size_; }
+
+  // Returns the next NAL unit, false at the end of the stream. The unit stays
+  // in memory until it is released.
+  bool nextNal(HelperAnnexBNal& nal);
+
+  // Memory at |offset|; valid until the next call to nextNal(), or for the
+  // lifetime of the stream if it is seekable.
+  const uint8_t* at(uint64_t offset) const { return window_ + (offset - window_pos_); }
+
+  // Bytes before |offset| are no longer needed.
+  void release(uint64_t offset);
+
+  // Continues from |offset|. Seekable streams only.
+  bool seek(uint64_t offset);
+
+  bool eof() const { return eof_; }
+
+ private:
+  bool findStartCode(uint64_t from, uint64_t& pos);
+  bool fill();
+  void readahead();
+
+  std::string path_;
+  int fd_{-1};
+  bool mapped_{false};
+  uint8_t* window_{nullptr};
+  size_t window_size_{0};   // valid bytes in the window
+  size_t capacity_{0};      // allocated bytes when reading through a window
+  uint64_t window_pos_{0};  // stream offset of window_[0]
+  uint64_t released_{0};
+  uint64_t cursor_{0};      // where the next start code search begins
+  bool input_done_{false};  // nothing left to read into the window
+  bool eof_{false};
+  bool readahead_{false};
+  uint64_t readahead_pos_{0};
+};
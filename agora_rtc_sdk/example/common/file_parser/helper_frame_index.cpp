@@ -0,0 +1,168 @@
+#include "helper_frame_index.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+
+#include "common/log.h"
+
+namespace {
+
+const char kSidecarMagic[8] = {'A', 'G', 'F', 'R', 'M', 'I', 'D', 'X'};
+const uint32_t kSidecarVersion = 1;
+
+// Sidecar layout (host byte order, the file is a local cache only):
+//   header, then |frameCount| records
+struct SidecarHeader {
+  char magic[8];
+  uint32_t version;
+  char format[12];
+  uint64_t fileSize;
+  int64_t fileMtimeNs;
+  uint64_t frameCount;
+};
+
+struct SidecarRecord {
+  uint64_t offset;
+  uint32_t length;
+  uint32_t flags;  // bit 0: key frame
+};
+
+std::string sidecarPath(const std::string& filepath) { return filepath + ".idx"; }
+
+void fillHeader(SidecarHeader& header, const std::string& format, uint64_t fileSize,
+                int64_t fileMtimeNs) {
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kSidecarMagic, sizeof(header.magic));
+  header.version = kSidecarVersion;
+  strncpy(header.format, format.c_str(), sizeof(header.format) - 1);
+  header.fileSize = fileSize;
+  header.fileMtimeNs = fileMtimeNs;
+}
+
+}  // namespace
+
+std::shared_ptr<const HelperFrameIndex> HelperFrameIndex::load(const std::string& filepath,
+                                                               const std::string& format,
+                                                               const Builder& build) {
+  static std::mutex lock;
+  static std::map<std::string, std::weak_ptr<const HelperFrameIndex>> loaded;
+
+  struct stat sb;
+  if (stat(filepath.c_str(), &sb) == -1) {
+    AG_LOG(ERROR, "Failed to stat %s", filepath.c_str());
+    return nullptr;
+  }
+  uint64_t fileSize = sb.st_size;
+  int64_t fileMtimeNs = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000 + sb.st_mtim.tv_nsec;
+
+  // held while building so concurrent channels wait for a single pass
+  std::lock_guard<std::mutex> _(lock);
+  std::string key = format + ":" + filepath;
+  if (auto index = loaded[key].lock()) {
+    return index;
+  }
+
+  std::shared_ptr<HelperFrameIndex> index(new HelperFrameIndex);
+  std::string sidecar = sidecarPath(filepath);
+  if (index->readSidecar(sidecar, format, fileSize, fileMtimeNs)) {
+    AG_LOG(INFO, "Loaded index of %s, %zu frames", filepath.c_str(), index->frameCount());
+  } else {
+    index->frames_.clear();
+    if (!build(filepath, index->frames_) || index->frames_.empty()) {
+      AG_LOG(ERROR, "Failed to index %s", filepath.c_str());
+      return nullptr;
+    }
+    index->writeSidecar(sidecar, format, fileSize, fileMtimeNs);
+    AG_LOG(INFO, "Indexed %s, %zu frames", filepath.c_str(), index->frameCount());
+  }
+  index->linkKeyFrames();
+
+  loaded[key] = index;
+  return index;
+}
+
+bool HelperFrameIndex::readSidecar(const std::string& path, const std::string& format,
+                                   uint64_t fileSize, int64_t fileMtimeNs) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+
+  SidecarHeader expected, header;
+  fillHeader(expected, format, fileSize, fileMtimeNs);
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 &&
+            header.version == expected.version &&
+            memcmp(header.format, expected.format, sizeof(header.format)) == 0 &&
+            header.fileSize == expected.fileSize && header.fileMtimeNs == expected.fileMtimeNs;
+  // the count must match the size of the sidecar before anything is allocated
+  // for it, a truncated or corrupt one is ignored
+  struct stat st;
+  ok = ok && fstat(fileno(file), &st) == 0 && static_cast<uint64_t>(st.st_size) >= sizeof(header) &&
+       (static_cast<uint64_t>(st.st_size) - sizeof(header)) % sizeof(SidecarRecord) == 0 &&
+       (static_cast<uint64_t>(st.st_size) - sizeof(header)) / sizeof(SidecarRecord) ==
+           header.frameCount;
+  if (ok) {
+    std::vector<SidecarRecord> records(header.frameCount);
+    ok = fread(records.data(), sizeof(SidecarRecord), records.size(), file) == records.size();
+    frames_.reserve(records.size());
+    for (size_t i = 0; ok && i < records.size(); i++) {
+      // a record pointing outside the file means a stale or corrupt sidecar
+      if (records[i].offset + records[i].length > fileSize) {
+        ok = false;
+        break;
+      }
+      HelperIndexedFrame frame;
+      frame.offset = records[i].offset;
+      frame.length = records[i].length;
+      frame.keyFrame = 0;
+      frame.isKeyFrame = records[i].flags & 1;
+      frames_.push_back(frame);
+    }
+  }
+  fclose(file);
+  return ok && !frames_.empty();
+}
+
+void HelperFrameIndex::writeSidecar(const std::string& path, const std::string& format,
+                                    uint64_t fileSize, int64_t fileMtimeNs) const {
+  SidecarHeader header;
+  fillHeader(header, format, fileSize, fileMtimeNs);
+  header.frameCount = frames_.size();
+
+  std::vector<SidecarRecord> records(frames_.size());
+  for (size_t i = 0; i < frames_.size(); i++) {
+    records[i].offset = frames_[i].offset;
+    records[i].length = frames_[i].length;
+    records[i].flags = frames_[i].isKeyFrame ? 1 : 0;
+  }
+
+  // write to a temporary file and rename it so that readers never see a
+  // partial index; failing to save is not an error, the index is rebuilt
+  std::string tmpPath = path + "." + std::to_string(getpid());
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    return;
+  }
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(records.data(), sizeof(SidecarRecord), records.size(), file) == records.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), path.c_str()) == -1) {
+    unlink(tmpPath.c_str());
+  }
+}
+
+void HelperFrameIndex::linkKeyFrames() {
+  uint32_t keyFrame = 0;
+  for (size_t i = 0; i < frames_.size(); i++) {
+    if (frames_[i].isKeyFrame) {
+      keyFrame = i;
+    }
+    frames_[i].keyFrame = keyFrame;
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Frame index of an encoded elementary stream file.
+//
+// The index is built once per file and shared read-only by every parser in
+// the process that opens the same file. It is also saved next to the file
+// as "<file>.idx" and reused by later runs as long as the file size and
+// modification time still match.
+
+struct HelperIndexedFrame {
+  uint64_t offset;    // offset of the first byte of the frame in the file
+  uint32_t length;    // frame length in bytes
+  uint32_t keyFrame;  // number of the last key frame at or before this one
+  bool isKeyFrame;
+};
+
+class HelperFrameIndex {
+ public:
+  // Fills |frames| (offset, length, isKeyFrame) in decoding order by parsing
+  // the file. Returns false if the file cannot be parsed.
+  typedef std::function<bool(const std::string& filepath, std::vector<HelperIndexedFrame>& frames)>
+      Builder;
+
+  // Returns the index of |filepath| for the given stream |format| ("h264",
+  // ...), or nullptr if it can neither be loaded nor built.
+  static std::shared_ptr<const HelperFrameIndex> load(const std::string& filepath,
+                                                      const std::string& format,
+                                                      const Builder& build);
+
+  size_t frameCount() const { return frames_.size(); }
+  const HelperIndexedFrame& frame(size_t n) const { return frames_[n]; }
+
+  // Number of the key frame to start decoding from to show frame |n|
+  size_t keyFrameFor(size_t n) const { return frames_[n].keyFrame; }
+
+  // Number of the frame following |n|, wrapping to the start of the file
+  size_t nextFrame(size_t n) const { return n + 1 < frames_.size() ? n + 1 : 0; }
+
+ private:
+  bool readSidecar(const std::string& path, const std::string& format, uint64_t fileSize,
+                   int64_t fileMtimeNs);
+  void writeSidecar(const std::string& path, const std::string& format, uint64_t fileSize,
+                    int64_t fileMtimeNs) const;
+  void linkKeyFrames();
+
+  std::vector<HelperIndexedFrame> frames_;
+};
@@ -1,27 +1,36 @@
 #include <memory>
 #include <string>
 
-struct HelperH264Frame {
-  bool isKeyFrame;
-  std::unique_ptr<uint8_t[]> buffer;
-  int bufferLen;
-};
+#include "helper_nal_parser.h"
 
-class HelperH264FileParser {
- public:
-  HelperH264FileParser(const char* filepath);
-  ~HelperH264FileParser();
+// H.264 codec traits for HelperNalFileParser
+struct HelperH264Traits {
+  static const char* name() { return "h264"; }
+  static const int kNalHeaderSize = 1;
+  // SPS and PPS
+  static const int kKeyFrameParameterSets = (1 << 7) | (1 << 8);
 
-  std::unique_ptr<HelperH264Frame> getH264Frame();
-  bool initialize();
-  void setFileParseRestart();
+  static int nalType(const uint8_t* header) { return header[0] & 0x1f; }
+  // non-IDR and IDR slices
+  static bool isSlice(int nalType) { return nalType == 1 || nalType == 5; }
+  static int parameterSet(int nalType) {
+    return (nalType == 7 || nalType == 8) ? 1 << nalType : 0;
+  }
+  // first_mb_in_slice is 0
+  static bool isFirstSlice(int nalType, const uint8_t* slice, size_t size);
+  // IDR, or an I/SI slice
+  static bool isIntraSlice(int nalType, const uint8_t* slice, size_t size);
+};
 
- private:
-  void _getH264Frame(std::unique_ptr<HelperH264Frame>& h264Frame, bool is_key_frame,
-                     int frame_start, int frame_end);
+typedef HelperNalFrame HelperH264Frame;
+typedef HelperNalFrameView HelperH264FrameView;
+typedef HelperNalMediaSource<HelperH264Traits> HelperH264MediaSource;
+
+class HelperH264FileParser : public HelperNalFileParser<HelperH264Traits> {
+ public:
+  HelperH264FileParser(const char* filepath) : HelperNalFileParser(filepath) {}
 
-  std::string file_path_;
-  int data_offset_;
-  int data_size_;
-  uint8_t* data_buffer_;
+  std::unique_ptr<HelperH264Frame> getH264Frame() { return getFrame(); }
+  // Same as getH264Frame() without allocating or copying the frame
+  bool getH264FrameView(HelperH264FrameView& view) { return getFrameView(view); }
 };
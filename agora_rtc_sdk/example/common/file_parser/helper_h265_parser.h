@@ -1,27 +1,40 @@
 #include <memory>
 #include <string>
 
-struct HelperH265Frame {
-  bool isKeyFrame;
-  std::unique_ptr<uint8_t[]> buffer;
-  int bufferLen;
-};
+#include "helper_nal_parser.h"
 
-class HelperH265FileParser {
- public:
-  HelperH265FileParser(const char* filepath);
-  ~HelperH265FileParser();
+// H.265 codec traits for HelperNalFileParser
+struct HelperH265Traits {
+  static const char* name() { return "h265"; }
+  static const int kNalHeaderSize = 2;
+  // VPS, SPS and PPS
+  static const int kKeyFrameParameterSets = 0x7;
 
-  std::unique_ptr<HelperH265Frame> getH265Frame();
-  bool initialize();
-  void setFileParseRestart();
+  static int nalType(const uint8_t* header) { return (header[0] & 0x7e) >> 1; }
+  // TRAIL_N .. RASL_R and the IRAP pictures BLA_W_LP .. CRA_NUT
+  static bool isSlice(int nalType) { return nalType <= 9 || (nalType >= 16 && nalType <= 21); }
+  static int parameterSet(int nalType) {
+    return (nalType >= 32 && nalType <= 34) ? 1 << (nalType - 32) : 0;
+  }
+  // first_slice_segment_in_pic_flag is set
+  static bool isFirstSlice(int nalType, const uint8_t* slice, size_t size) {
+    return size > 0 && (slice[0] & 0x80);
+  }
+  // IRAP pictures only contain I slices
+  static bool isIntraSlice(int nalType, const uint8_t* slice, size_t size) {
+    return nalType >= 16 && nalType <= 21;
+  }
+};
 
- private:
-  void _getH265Frame(std::unique_ptr<HelperH265Frame>& h265Frame, bool is_key_frame,
-                     int frame_start, int frame_end);
+typedef HelperNalFrame HelperH265Frame;
+typedef HelperNalFrameView HelperH265FrameView;
+typedef HelperNalMediaSource<HelperH265Traits> HelperH265MediaSource;
+
+class HelperH265FileParser : public HelperNalFileParser<HelperH265Traits> {
+ public:
+  HelperH265FileParser(const char* filepath) : HelperNalFileParser(filepath) {}
 
-  std::string file_path_;
-  int data_offset_;
-  int data_size_;
-  uint8_t* data_buffer_;
+  std::unique_ptr<HelperH265Frame> getH265Frame() { return getFrame(); }
+  // Same as getH265Frame() without allocating or copying the frame
+  bool getH265FrameView(HelperH265FrameView& view) { return getFrameView(view); }
 };
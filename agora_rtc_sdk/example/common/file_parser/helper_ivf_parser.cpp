@@ -0,0 +1,284 @@
+#include "helper_ivf_parser.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "common/log.h"
+
+#define IVF_HEADER_SIZE (32)
+#define IVF_FRAME_HEADER_SIZE (12)
+
+#define AV1_OBU_SEQUENCE_HEADER (1)
+#define AV1_OBU_FRAME_HEADER (3)
+#define AV1_OBU_FRAME (6)
+
+static uint16_t read_le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+static uint32_t read_le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static bool vp8_is_key_frame(const uint8_t* buf, int size) {
+  // frame tag: bit 0 is 0 for key frames
+  return size >= 3 && !(buf[0] & 0x01);
+}
+
+static bool vp9_is_key_frame(const uint8_t* buf, int size) {
+  // uncompressed header of the first frame (a superframe index is at the end)
+  if (size < 1 || (buf[0] >> 6) != 0x2) {  // frame_marker
+    return false;
+  }
+  int profile = ((buf[0] >> 5) & 1) | (((buf[0] >> 4) & 1) << 1);
+  int bit = profile == 3 ? 5 : 4;  // profile 3 has a reserved bit
+  bool show_existing_frame = (buf[0] >> (7 - bit)) & 1;
+  bool frame_type = (buf[0] >> (6 - bit)) & 1;
+  return !show_existing_frame && frame_type == 0;  // KEY_FRAME
+}
+
+static bool av1_read_leb128(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (int i = 0; i < 8 && p < end; i++) {
+    uint8_t byte = *p++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << (i * 7);
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool av1_is_key_frame(const uint8_t* buf, int size) {
+  // a temporal unit that starts decoding needs a sequence header and a key frame
+  const uint8_t* p = buf;
+  const uint8_t* end = buf + size;
+  bool has_sequence_header = false;
+  while (p < end) {
+    uint8_t header = *p++;
+    int obu_type = (header >> 3) & 0x0f;
+    bool has_extension = header & 0x04;
+    bool has_size = header & 0x02;
+    if (has_extension) {
+      ++p;
+    }
+    uint64_t obu_size = end - p;
+    if (has_size && !av1_read_leb128(p, end, obu_size)) {
+      return false;
+    }
+    if (p > end || obu_size > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    if (obu_type == AV1_OBU_SEQUENCE_HEADER) {
+      has_sequence_header = true;
+    } else if (obu_type == AV1_OBU_FRAME_HEADER || obu_type == AV1_OBU_FRAME) {
+      // show_existing_frame(1), frame_type(2): KEY_FRAME is 0
+      return has_sequence_header && obu_size > 0 && (p[0] & 0xe0) == 0;
+    }
+    p += obu_size;
+  }
+  return false;
+}
+
+// A mapped IVF file and the position of each of its frames
+class HelperIvfFile {
+ public:
+  struct Frame {
+    size_t offset;  // of the frame data, after the frame header
+    uint32_t size;
+    uint64_t timestamp;
+    bool isKeyFrame;
+  };
+
+  static std::shared_ptr<const HelperIvfFile> load(const std::string& filepath);
+  ~HelperIvfFile();
+
+  const uint8_t* data() const { return data_; }
+  const std::vector<Frame>& frames() const { return frames_; }
+
+  agora::rtc::VIDEO_CODEC_TYPE codec_{agora::rtc::VIDEO_CODEC_NONE};
+  int width_{0};
+  int height_{0};
+
+ private:
+  bool map(const std::string& filepath);
+  bool buildIndex(const std::string& filepath);
+
+  const uint8_t* data_{nullptr};
+  size_t size_{0};
+  std::vector<Frame> frames_;
+};
+
+std::shared_ptr<const HelperIvfFile> HelperIvfFile::load(const std::string& filepath) {
+  static std::mutex lock;
+  static std::map<std::string, std::weak_ptr<const HelperIvfFile>> loaded;
+
+  std::lock_guard<std::mutex> _(lock);
+  if (auto file = loaded[filepath].lock()) {
+    return file;
+  }
+  std::shared_ptr<HelperIvfFile> file(new HelperIvfFile);
+  if (!file->map(filepath) || !file->buildIndex(filepath)) {
+    return nullptr;
+  }
+  loaded[filepath] = file;
+  return file;
+}
+
+HelperIvfFile::~HelperIvfFile() {
+  if (data_) {
+    // unmap the file
+    if ((munmap((void*)data_, size_)) == -1) {
+      perror("munmap");
+    }
+  }
+}
+
+bool HelperIvfFile::map(const std::string& filepath) {
+  int fd;
+  struct stat sb;
+  void* mapped;
+
+  if ((fd = open(filepath.c_str(), O_RDONLY)) < 0) {
+    perror(filepath.c_str());
+    return false;
+  }
+
+  // get the file property
+  if ((fstat(fd, &sb)) == -1) {
+    perror("fstat");
+    close(fd);
+    return false;
+  }
+
+  // map the file to process address space
+  if (sb.st_size == 0 ||
+      (mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  size_ = sb.st_size;
+  data_ = (const uint8_t*)mapped;
+  return true;
+}
+
+bool HelperIvfFile::buildIndex(const std::string& filepath) {
+  if (size_ < IVF_HEADER_SIZE || memcmp(data_, "DKIF", 4) != 0) {
+    AG_LOG(ERROR, "%s is not an IVF file", filepath.c_str());
+    return false;
+  }
+
+  bool (*is_key_frame)(const uint8_t*, int);
+  const uint8_t* fourcc = data_ + 8;
+  if (memcmp(fourcc, "VP80", 4) == 0) {
+    codec_ = agora::rtc::VIDEO_CODEC_VP8;
+    is_key_frame = vp8_is_key_frame;
+  } else if (memcmp(fourcc, "VP90", 4) == 0) {
+    codec_ = agora::rtc::VIDEO_CODEC_VP9;
+    is_key_frame = vp9_is_key_frame;
+  } else if (memcmp(fourcc, "AV01", 4) == 0) {
+    codec_ = agora::rtc::VIDEO_CODEC_AV1;
+    is_key_frame = av1_is_key_frame;
+  } else {
+    AG_LOG(ERROR, "Unsupported IVF fourcc %.4s in %s", fourcc, filepath.c_str());
+    return false;
+  }
+  width_ = read_le16(data_ + 12);
+  height_ = read_le16(data_ + 14);
+
+  size_t offset = read_le16(data_ + 6);  // header length
+  if (offset < IVF_HEADER_SIZE) {
+    offset = IVF_HEADER_SIZE;
+  }
+  while (offset + IVF_FRAME_HEADER_SIZE <= size_) {
+    Frame frame;
+    frame.size = read_le32(data_ + offset);
+    frame.timestamp = read_le32(data_ + offset + 4) |
+                      (static_cast<uint64_t>(read_le32(data_ + offset + 8)) << 32);
+    frame.offset = offset + IVF_FRAME_HEADER_SIZE;
+    if (frame.size > size_ - frame.offset) {
+      AG_LOG(ERROR, "Truncated IVF frame at %zu in %s", offset, filepath.c_str());
+      break;
+    }
+    frame.isKeyFrame = is_key_frame(data_ + frame.offset, frame.size);
+    frames_.push_back(frame);
+    offset = frame.offset + frame.size;
+  }
+
+  if (frames_.empty()) {
+    AG_LOG(ERROR, "No frame in %s", filepath.c_str());
+    return false;
+  }
+  return true;
+}
+
+HelperIvfFileParser::HelperIvfFileParser(const char* filepath) : file_path_(filepath) {}
+
+HelperIvfFileParser::~HelperIvfFileParser() = default;
+
+bool HelperIvfFileParser::initialize() {
+  file_ = HelperIvfFile::load(file_path_);
+  if (!file_) {
+    return false;
+  }
+  AG_LOG(INFO, "Open ivf file %s successfully, codec %d %dx%d, %zu frames", file_path_.c_str(),
+         file_->codec_, file_->width_, file_->height_, file_->frames().size());
+  next_frame_ = 0;
+  return true;
+}
+
+bool HelperIvfFileParser::getFrame(HelperIvfFrame& frame) {
+  if (!file_) {
+    return false;
+  }
+
+  // rewind to the file start if necessary
+  if (next_frame_ >= file_->frames().size()) {
+    next_frame_ = 0;
+  }
+  const HelperIvfFile::Frame& next = file_->frames()[next_frame_++];
+  frame.isKeyFrame = next.isKeyFrame;
+  frame.buffer = file_->data() + next.offset;
+  frame.bufferLen = next.size;
+  frame.timestamp = next.timestamp;
+  return true;
+}
+
+bool HelperIvfFileParser::seekToFrame(size_t n) {
+  if (!file_ || n >= file_->frames().size()) {
+    return false;
+  }
+  while (n > 0 && !file_->frames()[n].isKeyFrame) {
+    --n;
+  }
+  next_frame_ = n;
+  return true;
+}
+
+agora::rtc::VIDEO_CODEC_TYPE HelperIvfFileParser::getCodecType() const {
+  return file_ ? file_->codec_ : agora::rtc::VIDEO_CODEC_NONE;
+}
+
+int HelperIvfFileParser::getWidth() const { return file_ ? file_->width_ : 0; }
+
+int HelperIvfFileParser::getHeight() const { return file_ ? file_->height_ : 0; }
+
+size_t HelperIvfFileParser::frameCount() const { return file_ ? file_->frames().size() : 0; }
+
+bool HelperIvfMediaSource::readFrame(HelperMediaFrame& frame) {
+  HelperIvfFrame ivfFrame;
+  if (!parser_.getFrame(ivfFrame)) {
+    return false;
+  }
+  frame.view(ivfFrame.buffer, ivfFrame.bufferLen);
+  frame.isKeyFrame = ivfFrame.isKeyFrame;
+  return true;
+}
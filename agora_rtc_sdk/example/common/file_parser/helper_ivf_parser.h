@@ -0,0 +1,57 @@
+#include <memory>
+#include <string>
+
+#include "AgoraBase.h"
+#include "helper_media_source.h"
+
+class HelperIvfFile;
+
+struct HelperIvfFrame {
+  bool isKeyFrame;
+  const uint8_t* buffer;  // points into the mapped file
+  int bufferLen;
+  uint64_t timestamp;  // in the file's time base
+};
+
+// Reads the frames of an IVF file (VP8, VP9 or AV1, from its fourcc). The
+// file is mapped and indexed once per process; every parser of the same file
+// shares it and only keeps its own position, so any number of streams and
+// codecs can be sent from one process.
+class HelperIvfFileParser {
+ public:
+  HelperIvfFileParser(const char* filepath);
+  ~HelperIvfFileParser();
+
+  bool initialize();
+  // Next frame, looping at the end of the file
+  bool getFrame(HelperIvfFrame& frame);
+  // Continues from the key frame needed to decode frame |n|
+  bool seekToFrame(size_t n);
+
+  agora::rtc::VIDEO_CODEC_TYPE getCodecType() const;
+  int getWidth() const;
+  int getHeight() const;
+  size_t frameCount() const;
+
+ private:
+  std::string file_path_;
+  std::shared_ptr<const HelperIvfFile> file_;
+  size_t next_frame_{0};
+};
+
+// Media source reading the frames of an IVF file
+class HelperIvfMediaSource : public HelperMediaSource {
+ public:
+  HelperIvfMediaSource(const char* filepath) : parser_(filepath) {}
+
+  bool initialize() override { return parser_.initialize(); }
+  bool readFrame(HelperMediaFrame& frame) override;
+
+  // valid once initialized
+  agora::rtc::VIDEO_CODEC_TYPE getCodecType() const { return parser_.getCodecType(); }
+  int getWidth() const { return parser_.getWidth(); }
+  int getHeight() const { return parser_.getHeight(); }
+
+ private:
+  HelperIvfFileParser parser_;
+};
@@ -0,0 +1,142 @@
+#include "helper_media_source.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "common/log.h"
+
+// how long the prefetch thread sleeps when the ring is full or the source
+// has nothing to give; a taken frame wakes it up earlier
+#define PREFETCH_RETRY_MS (10)
+
+HelperRawFileSource::HelperRawFileSource(const char* filepath, size_t frameBytes)
+    : file_path_(filepath), frame_bytes_(frameBytes) {}
+
+HelperRawFileSource::~HelperRawFileSource() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool HelperRawFileSource::initialize() {
+  if (!(file_ = fopen(file_path_.c_str(), "rb"))) {
+    AG_LOG(ERROR, "Failed to open file %s", file_path_.c_str());
+    return false;
+  }
+  AG_LOG(INFO, "Open file %s successfully", file_path_.c_str());
+  return true;
+}
+
+bool HelperRawFileSource::readFrame(HelperMediaFrame& frame) {
+  if (!file_ || !frame_bytes_) {
+    return false;
+  }
+  frame.buffer.resize(frame_bytes_);
+  frame.isKeyFrame = false;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (fread(frame.buffer.data(), 1, frame_bytes_, file_) == frame_bytes_) {
+      frame.view(frame.buffer.data(), frame_bytes_);
+      return true;
+    }
+    if (!feof(file_)) {
+      AG_LOG(ERROR, "Error reading file %s: %s", file_path_.c_str(), std::strerror(errno));
+      return false;
+    }
+    // the partial frame at the end of the file is dropped
+    AG_LOG(INFO, "End of file %s", file_path_.c_str());
+    rewind(file_);
+  }
+  return false;
+}
+
+HelperPrefetchSource::HelperPrefetchSource(std::unique_ptr<HelperMediaSource> source,
+                                           size_t lookahead)
+    : source_(std::move(source)), ring_(lookahead) {}
+
+HelperPrefetchSource::~HelperPrefetchSource() { stop(); }
+
+bool HelperPrefetchSource::start() {
+  if (!source_->initialize()) {
+    return false;
+  }
+  stop_ = false;
+  ended_ = false;
+  thread_ = std::thread(&HelperPrefetchSource::prefetch, this);
+  return true;
+}
+
+void HelperPrefetchSource::stop() {
+  stop_ = true;
+  space_.Set();
+  ready_.Set();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void HelperPrefetchSource::prefetch() {
+  while (!stop_) {
+    HelperMediaFrame* slot = ring_.back();
+    if (!slot) {
+      waiting_ = true;
+      // check again, a frame may have been taken before we said we wait
+      slot = ring_.back();
+      if (!slot) {
+        space_.Wait(PREFETCH_RETRY_MS);
+        waiting_ = false;
+        continue;
+      }
+      waiting_ = false;
+    }
+
+    if (!source_->readFrame(*slot)) {
+      if (source_->isEnd()) {
+        ended_ = true;
+        ready_.Set();
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(PREFETCH_RETRY_MS));
+      continue;
+    }
+    ring_.push();
+    if (reader_waiting_) {
+      ready_.Set();
+    }
+  }
+}
+
+const HelperMediaFrame* HelperPrefetchSource::front() {
+  const HelperMediaFrame* frame = ring_.front();
+  if (!frame && !ended_ && !late_) {
+    ++underruns_;
+    late_ = true;
+  }
+  return frame;
+}
+
+const HelperMediaFrame* HelperPrefetchSource::next(int timeoutMs) {
+  const HelperMediaFrame* frame = front();
+  if (frame || ended_) {
+    return frame;
+  }
+  reader_waiting_ = true;
+  // check again, a frame may have been added before we said we wait
+  if (!(frame = ring_.front()) && !ended_) {
+    ready_.Wait(timeoutMs);
+    frame = ring_.front();
+  }
+  reader_waiting_ = false;
+  return frame;
+}
+
+void HelperPrefetchSource::release() {
+  late_ = false;
+  ring_.pop();
+  if (waiting_) {
+    space_.Set();
+  }
+}
+
+bool HelperPrefetchSource::isEnd() { return ended_ && !ring_.front(); }
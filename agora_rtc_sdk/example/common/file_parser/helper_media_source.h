@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AgoraBase.h"
+#include "common/sample_event.h"
+#include "common/sample_spsc_ring.h"
+
+// A frame read from a media file, raw (YUV, PCM) or encoded
+struct HelperMediaFrame {
+  // The frame: a view of the file mapped by the source, or |buffer| when the
+  // source had to copy it
+  const uint8_t* data{nullptr};
+  size_t length{0};
+  bool isKeyFrame{false};
+  agora::rtc::EncodedAudioFrameInfo audioFrameInfo;  // encoded audio only
+  std::vector<uint8_t> buffer;  // keeps its capacity from one frame to the next
+
+  // Copies data that does not outlive the read (a pipe window, ...)
+  void assign(const uint8_t* from, size_t size) {
+    buffer.assign(from, from + size);
+    data = buffer.data();
+    length = size;
+  }
+  // Points at data that stays valid as long as the source, without copying it
+  void view(const uint8_t* from, size_t size) {
+    data = from;
+    length = size;
+  }
+};
+
+// Reads the frames of a media file one after the other. The file parsers
+// provide one for each format they read (HelperH264MediaSource, ...).
+class HelperMediaSource {
+ public:
+  virtual ~HelperMediaSource() {}
+
+  virtual bool initialize() = 0;
+  // Fills |frame| with the next frame, a view of the file when it is mapped,
+  // otherwise a copy in its reused buffer. Files loop at their end; false
+  // means no frame is available, which is final for a pipe.
+  virtual bool readFrame(HelperMediaFrame& frame) = 0;
+  virtual bool isEnd() const { return false; }
+};
+
+// Fixed-size frames of a raw file (I420 pictures, PCM blocks), looping at the
+// end of the file
+class HelperRawFileSource : public HelperMediaSource {
+ public:
+  HelperRawFileSource(const char* filepath, size_t frameBytes);
+  ~HelperRawFileSource() override;
+
+  bool initialize() override;
+  bool readFrame(HelperMediaFrame& frame) override;
+
+ private:
+  std::string file_path_;
+  size_t frame_bytes_;
+  FILE* file_{nullptr};
+};
+
+// Reads a source ahead of the send thread.
+//
+// A background thread keeps up to |lookahead| frames of the source in a
+// lock-free ring, so the send thread only takes ready frames and never waits
+// for the disk or the parser.
+class HelperPrefetchSource : public noncopyable {
+ public:
+  HelperPrefetchSource(std::unique_ptr<HelperMediaSource> source, size_t lookahead);
+  ~HelperPrefetchSource();
+
+  // Initializes the source and starts reading ahead
+  bool start();
+  void stop();
+
+  // The next frame, nullptr when none is ready yet. The frame stays valid
+  // until release() is called.
+  const HelperMediaFrame* front();
+  // Same as front(), waiting up to |timeoutMs| for a frame that is late
+  const HelperMediaFrame* next(int timeoutMs);
+  void release();
+
+  // The source ended (a pipe was closed) and every frame was taken
+  bool isEnd();
+  // Frames that were not ready when the send thread asked for them
+  uint64_t underruns() const { return underruns_; }
+
+ private:
+  void prefetch();
+
+  std::unique_ptr<HelperMediaSource> source_;
+  SampleSpscRing<HelperMediaFrame> ring_;
+  std::thread thread_;
+  SampleEvent space_;  // set when a frame was taken while the ring was full
+  std::atomic<bool> waiting_{false};
+  SampleEvent ready_;  // set when a frame was added while the ring was empty
+  std::atomic<bool> reader_waiting_{false};
+  bool late_{false};  // the next frame was already counted as an underrun
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> ended_{false};
+  uint64_t underruns_{0};
+};
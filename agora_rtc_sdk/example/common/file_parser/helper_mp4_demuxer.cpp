@@ -0,0 +1,839 @@
+#include "helper_mp4_demuxer.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/log.h"
+
+#define MP4_TRUN_DATA_OFFSET (0x000001)
+#define MP4_TRUN_FIRST_SAMPLE_FLAGS (0x000004)
+#define MP4_TRUN_SAMPLE_DURATION (0x000100)
+#define MP4_TRUN_SAMPLE_SIZE (0x000200)
+#define MP4_TRUN_SAMPLE_FLAGS (0x000400)
+#define MP4_TRUN_SAMPLE_CTS_OFFSET (0x000800)
+
+#define MP4_TFHD_BASE_DATA_OFFSET (0x000001)
+#define MP4_TFHD_SAMPLE_DESCRIPTION_INDEX (0x000002)
+#define MP4_TFHD_DEFAULT_DURATION (0x000008)
+#define MP4_TFHD_DEFAULT_SIZE (0x000010)
+#define MP4_TFHD_DEFAULT_FLAGS (0x000020)
+#define MP4_TFHD_DEFAULT_BASE_IS_MOOF (0x020000)
+
+#define MP4_SAMPLE_IS_NON_SYNC (0x10000)
+
+#define AAC_OBJECT_SBR (5)
+#define AAC_OBJECT_PS (29)
+#define ADTS_HEADER_SIZE (7)
+#define ADTS_MAX_FRAME_SIZE (0x1fff)
+
+static constexpr uint32_t box_type(const char* name) {
+  return (static_cast<uint32_t>(static_cast<uint8_t>(name[0])) << 24) |
+         (static_cast<uint8_t>(name[1]) << 16) | (static_cast<uint8_t>(name[2]) << 8) |
+         static_cast<uint8_t>(name[3]);
+}
+
+static uint16_t read_be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t read_be32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t read_be64(const uint8_t* p) {
+  return (static_cast<uint64_t>(read_be32(p)) << 32) | read_be32(p + 4);
+}
+
+// the payload of a box
+struct Mp4Box {
+  uint32_t type;
+  const uint8_t* data;
+  size_t size;
+};
+
+// Reads the box at |p| and moves |p| past it
+static bool next_box(const uint8_t*& p, const uint8_t* end, Mp4Box& box) {
+  if (end - p < 8) {
+    return false;
+  }
+  uint64_t size = read_be32(p);
+  box.type = read_be32(p + 4);
+  size_t header = 8;
+  if (size == 1) {
+    if (end - p < 16) {
+      return false;
+    }
+    size = read_be64(p + 8);
+    header = 16;
+  } else if (size == 0) {
+    // up to the end of the file
+    size = end - p;
+  }
+  if (size < header || size > static_cast<uint64_t>(end - p)) {
+    return false;
+  }
+  box.data = p + header;
+  box.size = size - header;
+  p += size;
+  return true;
+}
+
+// Finds the first child box of |type|
+static bool find_box(const uint8_t* data, size_t size, uint32_t type, Mp4Box& box) {
+  const uint8_t* p = data;
+  while (next_box(p, data + size, box)) {
+    if (box.type == type) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Length of an MPEG-4 descriptor, after its tag
+static bool read_descriptor_length(const uint8_t*& p, const uint8_t* end, size_t& length) {
+  length = 0;
+  for (int i = 0; i < 4 && p < end; i++) {
+    uint8_t byte = *p++;
+    length = (length << 7) | (byte & 0x7f);
+    if (!(byte & 0x80)) {
+      return length <= static_cast<size_t>(end - p);
+    }
+  }
+  return false;
+}
+
+// Advances |p| by |n| bytes, false if fewer are left before |end|
+static bool skip_bytes(const uint8_t*& p, const uint8_t* end, size_t n) {
+  if (n > static_cast<size_t>(end - p)) {
+    return false;
+  }
+  p += n;
+  return true;
+}
+
+// sample table boxes of a track, read after the whole trak
+struct HelperMp4Demuxer::TrackInfo {
+  Mp4Box stts{0, nullptr, 0};
+  Mp4Box ctts{0, nullptr, 0};
+  Mp4Box stsc{0, nullptr, 0};
+  Mp4Box stsz{0, nullptr, 0};
+  Mp4Box stco{0, nullptr, 0};
+  Mp4Box stss{0, nullptr, 0};
+};
+
+HelperMp4Demuxer::HelperMp4Demuxer(const char* filepath) : file_path_(filepath) {}
+
+HelperMp4Demuxer::~HelperMp4Demuxer() {
+  if (data_) {
+    if (munmap(const_cast<uint8_t*>(data_), size_) == -1) {
+      perror("munmap");
+    }
+  }
+}
+
+bool HelperMp4Demuxer::initialize() {
+  int fd;
+  struct stat sb;
+  void* mapped;
+
+  if ((fd = open(file_path_.c_str(), O_RDONLY)) < 0) {
+    perror(file_path_.c_str());
+    return false;
+  }
+
+  // get the file property
+  if ((fstat(fd, &sb)) == -1) {
+    perror("fstat");
+    close(fd);
+    return false;
+  }
+
+  // map the file to process address space
+  if (sb.st_size == 0 ||
+      (mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  data_ = static_cast<const uint8_t*>(mapped);
+  size_ = sb.st_size;
+
+  // the moov box comes before any fragment, but may follow a plain mdat
+  Mp4Box box;
+  const uint8_t* p = data_;
+  bool has_moov = false;
+  while (next_box(p, data_ + size_, box)) {
+    if (box.type == box_type("moov")) {
+      has_moov = parseMoov(box.data, box.size);
+      break;
+    }
+  }
+  if (!has_moov) {
+    AG_LOG(ERROR, "No usable moov box in %s", file_path_.c_str());
+    return false;
+  }
+  p = data_;
+  while (next_box(p, data_ + size_, box)) {
+    if (box.type == box_type("moof")) {
+      parseMoof(box.data - 8 - data_, box.data, box.size);
+    }
+  }
+
+  if (!hasVideo() && !hasAudio()) {
+    AG_LOG(ERROR, "No H.264/H.265 or AAC samples in %s", file_path_.c_str());
+    return false;
+  }
+  AG_LOG(INFO, "Open mp4 file %s successfully, %zu video frames (codec %d %dx%d), %zu audio frames",
+         file_path_.c_str(), video_.samples.size(), video_codec_, width_, height_,
+         audio_.samples.size());
+  return true;
+}
+
+bool HelperMp4Demuxer::parseMoov(const uint8_t* data, size_t size) {
+  Mp4Box box;
+  const uint8_t* p = data;
+  while (next_box(p, data + size, box)) {
+    if (box.type == box_type("trak")) {
+      parseTrak(box.data, box.size);
+    }
+  }
+  if (!video_.id && !audio_.id) {
+    return false;
+  }
+
+  // fragment defaults
+  Mp4Box mvex;
+  if (find_box(data, size, box_type("mvex"), mvex)) {
+    p = mvex.data;
+    while (next_box(p, mvex.data + mvex.size, box)) {
+      if (box.type != box_type("trex") || box.size < 24) {
+        continue;
+      }
+      Track* track = findTrack(read_be32(box.data + 4));
+      if (track) {
+        track->defaultDuration = read_be32(box.data + 12);
+        track->defaultSize = read_be32(box.data + 16);
+        track->defaultFlags = read_be32(box.data + 20);
+      }
+    }
+  }
+  return true;
+}
+
+bool HelperMp4Demuxer::parseTrak(const uint8_t* data, size_t size) {
+  Mp4Box tkhd, mdia, mdhd, hdlr, minf, stbl, stsd;
+  if (!find_box(data, size, box_type("tkhd"), tkhd) || tkhd.size < 24 ||
+      !find_box(data, size, box_type("mdia"), mdia) ||
+      !find_box(mdia.data, mdia.size, box_type("mdhd"), mdhd) || mdhd.size < 24 ||
+      !find_box(mdia.data, mdia.size, box_type("hdlr"), hdlr) || hdlr.size < 12 ||
+      !find_box(mdia.data, mdia.size, box_type("minf"), minf) ||
+      !find_box(minf.data, minf.size, box_type("stbl"), stbl) ||
+      !find_box(stbl.data, stbl.size, box_type("stsd"), stsd) || stsd.size < 16) {
+    return false;
+  }
+
+  // only the first sample description is used
+  Mp4Box entry;
+  const uint8_t* p = stsd.data + 8;
+  if (!next_box(p, stsd.data + stsd.size, entry)) {
+    return false;
+  }
+
+  Track* track = nullptr;
+  uint32_t handler = read_be32(hdlr.data + 8);
+  if (handler == box_type("vide") && !video_.id &&
+      parseVideoEntry(entry.data, entry.size, entry.type)) {
+    track = &video_;
+  } else if (handler == box_type("soun") && !audio_.id && entry.type == box_type("mp4a") &&
+             parseAudioEntry(entry.data, entry.size)) {
+    track = &audio_;
+  }
+  if (!track) {
+    return false;
+  }
+
+  bool v1 = tkhd.data[0] == 1;
+  track->id = read_be32(tkhd.data + (v1 ? 20 : 12));
+  track->timescale = read_be32(mdhd.data + (mdhd.data[0] == 1 ? 20 : 12));
+  if (!track->timescale) {
+    track->id = 0;
+    return false;
+  }
+
+  TrackInfo info;
+  p = stbl.data;
+  Mp4Box box;
+  while (next_box(p, stbl.data + stbl.size, box)) {
+    switch (box.type) {
+      case box_type("stts"):
+        info.stts = box;
+        break;
+      case box_type("ctts"):
+        info.ctts = box;
+        break;
+      case box_type("stsc"):
+        info.stsc = box;
+        break;
+      case box_type("stsz"):
+      case box_type("stz2"):
+        info.stsz = box;
+        break;
+      case box_type("stco"):
+      case box_type("co64"):
+        info.stco = box;
+        break;
+      case box_type("stss"):
+        info.stss = box;
+        break;
+    }
+  }
+  return buildSamples(*track, info);
+}
+
+bool HelperMp4Demuxer::parseVideoEntry(const uint8_t* data, size_t size, uint32_t type) {
+  // VisualSampleEntry fields come before the child boxes
+  const size_t fields = 78;
+  if (size < fields) {
+    return false;
+  }
+  Mp4Box config;
+  const uint8_t* c;
+  std::vector<uint8_t> parameter_sets;
+  const uint8_t start_code[] = {0, 0, 0, 1};
+
+  if (type == box_type("avc1") || type == box_type("avc3")) {
+    if (!find_box(data + fields, size - fields, box_type("avcC"), config) || config.size < 7) {
+      return false;
+    }
+    c = config.data;
+    const uint8_t* end = config.data + config.size;
+    nal_length_size_ = (c[4] & 0x03) + 1;
+    // SPS then PPS
+    c += 5;
+    for (int list = 0; list < 2 && c < end; list++) {
+      int count = list == 0 ? (*c++ & 0x1f) : *c++;
+      for (int i = 0; i < count; i++) {
+        if (end - c < 2 || end - c - 2 < read_be16(c)) {
+          return false;
+        }
+        parameter_sets.insert(parameter_sets.end(), start_code, start_code + 4);
+        parameter_sets.insert(parameter_sets.end(), c + 2, c + 2 + read_be16(c));
+        c += 2 + read_be16(c);
+      }
+    }
+    video_codec_ = agora::rtc::VIDEO_CODEC_H264;
+  } else if (type == box_type("hvc1") || type == box_type("hev1")) {
+    if (!find_box(data + fields, size - fields, box_type("hvcC"), config) || config.size < 23) {
+      return false;
+    }
+    c = config.data;
+    const uint8_t* end = config.data + config.size;
+    nal_length_size_ = (c[21] & 0x03) + 1;
+    // arrays of VPS, SPS, PPS and SEI
+    int arrays = c[22];
+    c += 23;
+    for (int a = 0; a < arrays; a++) {
+      if (end - c < 3) {
+        return false;
+      }
+      int count = read_be16(c + 1);
+      c += 3;
+      for (int i = 0; i < count; i++) {
+        if (end - c < 2 || end - c - 2 < read_be16(c)) {
+          return false;
+        }
+        parameter_sets.insert(parameter_sets.end(), start_code, start_code + 4);
+        parameter_sets.insert(parameter_sets.end(), c + 2, c + 2 + read_be16(c));
+        c += 2 + read_be16(c);
+      }
+    }
+    video_codec_ = agora::rtc::VIDEO_CODEC_H265;
+  } else {
+    return false;
+  }
+
+  if (nal_length_size_ == 3) {
+    video_codec_ = agora::rtc::VIDEO_CODEC_NONE;
+    return false;
+  }
+  parameter_sets_.swap(parameter_sets);
+  width_ = read_be16(data + 24);
+  height_ = read_be16(data + 26);
+  return true;
+}
+
+bool HelperMp4Demuxer::parseAudioEntry(const uint8_t* data, size_t size) {
+  // AudioSampleEntry fields, longer in QuickTime version 1 and 2 entries
+  size_t fields = 28;
+  if (size < fields) {
+    return false;
+  }
+  uint16_t version = read_be16(data + 8);
+  fields += version == 1 ? 16 : version == 2 ? 36 : 0;
+  Mp4Box esds;
+  if (size < fields || !find_box(data + fields, size - fields, box_type("esds"), esds) ||
+      esds.size < 4) {
+    return false;
+  }
+
+  // ES_Descriptor > DecoderConfigDescriptor > DecoderSpecificInfo
+  const uint8_t* p = esds.data + 4;
+  const uint8_t* end = esds.data + esds.size;
+  size_t length;
+  if (p >= end || *p++ != 0x03 || !read_descriptor_length(p, end, length) || length < 3) {
+    return false;
+  }
+  end = p + length;
+  uint8_t es_flags = p[2];
+  p += 3;
+  if ((es_flags & 0x80) && !skip_bytes(p, end, 2)) {
+    return false;  // dependsOn_ES_ID
+  }
+  if ((es_flags & 0x40) && (p >= end || !skip_bytes(p, end, 1 + *p))) {
+    return false;  // URL
+  }
+  if ((es_flags & 0x20) && !skip_bytes(p, end, 2)) {
+    return false;  // OCR_ES_Id
+  }
+  if (p >= end || *p++ != 0x04 || !read_descriptor_length(p, end, length) || length < 13) {
+    return false;
+  }
+  uint8_t object_type_indication = p[0];
+  end = p + length;
+  p += 13;
+  if (object_type_indication != 0x40 || p >= end || *p++ != 0x05 ||
+      !read_descriptor_length(p, end, length) || length < 2) {
+    return false;
+  }
+
+  // AudioSpecificConfig
+  int object_type = p[0] >> 3;
+  int frequency_index = ((p[0] & 0x07) << 1) | (p[1] >> 7);
+  int channel_config = (p[1] >> 3) & 0x0f;
+  int sample_rate_index = frequency_index;
+  audio_codec_ = agora::rtc::AUDIO_CODEC_AACLC;
+  samples_per_frame_ = 1024;
+  if (object_type == AAC_OBJECT_SBR || object_type == AAC_OBJECT_PS) {
+    // explicit SBR: the output rate, then the core object type
+    if (length < 4 || frequency_index == 15) {
+      return false;
+    }
+    sample_rate_index = ((p[1] & 0x07) << 1) | (p[2] >> 7);
+    object_type = (p[2] >> 2) & 0x1f;
+    audio_codec_ = object_type == AAC_OBJECT_PS ? agora::rtc::AUDIO_CODEC_HEAAC2
+                                                : agora::rtc::AUDIO_CODEC_HEAAC;
+    samples_per_frame_ = 2048;
+  }
+
+  static const int sample_rates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                     22050, 16000, 12000, 11025, 8000,  7350};
+  // ADTS can only carry the first 4 object types and the indexed rates
+  if (object_type < 1 || object_type > 4 || frequency_index > 12 || sample_rate_index > 12 ||
+      channel_config == 0) {
+    AG_LOG(ERROR, "Unsupported AAC configuration in %s", file_path_.c_str());
+    return false;
+  }
+  sample_rate_ = sample_rates[sample_rate_index];
+  channels_ = channel_config == 7 ? 8 : channel_config;
+
+  adts_header_[0] = 0xff;
+  adts_header_[1] = 0xf1;  // MPEG-4, no CRC
+  adts_header_[2] = ((object_type - 1) << 6) | (frequency_index << 2) | (channel_config >> 2);
+  adts_header_[3] = (channel_config & 0x03) << 6;
+  adts_header_[4] = 0;
+  adts_header_[5] = 0x1f;  // buffer fullness 0x7ff: variable rate
+  adts_header_[6] = 0xfc;
+  return true;
+}
+
+bool HelperMp4Demuxer::buildSamples(Track& track, const TrackInfo& info) {
+  // the tables may be empty in a fragmented file
+  if (!info.stsz.data || !info.stco.data || !info.stsc.data || !info.stts.data) {
+    return true;
+  }
+
+  // sample sizes
+  const Mp4Box& stsz = info.stsz;
+  if (stsz.size < 12) {
+    return false;
+  }
+  uint32_t count = read_be32(stsz.data + 8);
+  uint32_t constant_size = 0;
+  int field_size = 32;
+  if (stsz.type == box_type("stz2")) {
+    field_size = stsz.data[7];
+  } else {
+    constant_size = read_be32(stsz.data + 4);
+  }
+  if (!constant_size &&
+      ((field_size != 4 && field_size != 8 && field_size != 16 && field_size != 32) ||
+       (static_cast<uint64_t>(count) * field_size + 7) / 8 > stsz.size - 12)) {
+    return false;
+  }
+  auto sample_size = [&](uint32_t n) -> uint32_t {
+    const uint8_t* sizes = stsz.data + 12;
+    switch (constant_size ? 0 : field_size) {
+      case 0:
+        return constant_size;
+      case 4:
+        return n & 1 ? sizes[n / 2] & 0x0f : sizes[n / 2] >> 4;
+      case 8:
+        return sizes[n];
+      case 16:
+        return read_be16(sizes + n * 2);
+      default:
+        return read_be32(sizes + n * 4);
+    }
+  };
+
+  // chunk offsets
+  const Mp4Box& stco = info.stco;
+  bool co64 = stco.type == box_type("co64");
+  if (stco.size < 8) {
+    return false;
+  }
+  uint32_t chunks = read_be32(stco.data + 4);
+  if (static_cast<uint64_t>(chunks) * (co64 ? 8 : 4) > stco.size - 8) {
+    return false;
+  }
+
+  const Mp4Box& stsc = info.stsc;
+  uint32_t stsc_entries = stsc.size >= 8 ? read_be32(stsc.data + 4) : 0;
+  if (static_cast<uint64_t>(stsc_entries) * 12 > stsc.size - 8) {
+    return false;
+  }
+
+  // decode times
+  const Mp4Box& stts = info.stts;
+  uint32_t stts_entries = stts.size >= 8 ? read_be32(stts.data + 4) : 0;
+  if (static_cast<uint64_t>(stts_entries) * 8 > stts.size - 8) {
+    return false;
+  }
+  const Mp4Box& ctts = info.ctts;
+  uint32_t ctts_entries = ctts.size >= 8 ? read_be32(ctts.data + 4) : 0;
+  if (ctts.data && static_cast<uint64_t>(ctts_entries) * 8 > ctts.size - 8) {
+    ctts_entries = 0;
+  }
+  const Mp4Box& stss = info.stss;
+  uint32_t stss_entries = stss.size >= 8 ? read_be32(stss.data + 4) : 0;
+  if (stss.data && static_cast<uint64_t>(stss_entries) * 4 > stss.size - 8) {
+    stss_entries = 0;
+  }
+
+  track.samples.reserve(count < (1u << 20) ? count : (1u << 20));
+  uint32_t n = 0;
+  uint32_t stsc_index = 0, stts_index = 0, stts_left = 0, ctts_index = 0, ctts_left = 0;
+  uint32_t stss_index = 0;
+  uint32_t delta = 0;
+  int32_t cts_offset = 0;
+  int64_t dts = 0;
+  for (uint32_t chunk = 0; chunk < chunks && n < count && stsc_entries; chunk++) {
+    // stsc entries apply from their (1-based) first chunk
+    while (stsc_index + 1 < stsc_entries &&
+           read_be32(stsc.data + 8 + (stsc_index + 1) * 12) <= chunk + 1) {
+      stsc_index++;
+    }
+    uint32_t per_chunk = read_be32(stsc.data + 8 + stsc_index * 12 + 4);
+    uint64_t offset = co64 ? read_be64(stco.data + 8 + chunk * 8)
+                           : read_be32(stco.data + 8 + chunk * 4);
+
+    for (uint32_t i = 0; i < per_chunk && n < count; i++, n++) {
+      Sample sample;
+      sample.offset = offset;
+      sample.size = sample_size(n);
+      if (sample.offset > size_ || sample.size > size_ - sample.offset) {
+        AG_LOG(ERROR, "Truncated sample %u in %s", n, file_path_.c_str());
+        track.end = dts;
+        return true;
+      }
+      offset += sample.size;
+
+      while (!stts_left && stts_index < stts_entries) {
+        stts_left = read_be32(stts.data + 8 + stts_index * 8);
+        delta = read_be32(stts.data + 8 + stts_index * 8 + 4);
+        stts_index++;
+      }
+      if (stts_left) {
+        stts_left--;
+      }
+      while (!ctts_left && ctts_index < ctts_entries) {
+        ctts_left = read_be32(ctts.data + 8 + ctts_index * 8);
+        cts_offset = static_cast<int32_t>(read_be32(ctts.data + 8 + ctts_index * 8 + 4));
+        ctts_index++;
+      }
+      if (ctts_left) {
+        ctts_left--;
+      }
+      sample.dts = dts;
+      sample.ctsOffset = cts_offset;
+      dts += delta;
+
+      // all samples are sync samples without stss
+      while (stss_index < stss_entries && read_be32(stss.data + 8 + stss_index * 4) < n + 1) {
+        stss_index++;
+      }
+      sample.isKeyFrame = !stss.data || (stss_index < stss_entries &&
+                                         read_be32(stss.data + 8 + stss_index * 4) == n + 1);
+      track.samples.push_back(sample);
+    }
+  }
+  track.end = dts;
+  return true;
+}
+
+void HelperMp4Demuxer::parseMoof(size_t moof_offset, const uint8_t* data, size_t size) {
+  // without a base offset, a traf continues after the data of the previous one
+  uint64_t data_end = moof_offset;
+  Mp4Box box;
+  const uint8_t* p = data;
+  while (next_box(p, data + size, box)) {
+    if (box.type == box_type("traf")) {
+      parseTraf(moof_offset, box.data, box.size, data_end);
+    }
+  }
+}
+
+void HelperMp4Demuxer::parseTraf(size_t moof_offset, const uint8_t* data, size_t size,
+                                 uint64_t& data_end) {
+  Mp4Box tfhd;
+  if (!find_box(data, size, box_type("tfhd"), tfhd) || tfhd.size < 8) {
+    return;
+  }
+  const uint8_t* p = tfhd.data;
+  const uint8_t* end = tfhd.data + tfhd.size;
+  uint32_t flags = read_be32(p) & 0xffffff;
+  Track* track = findTrack(read_be32(p + 4));
+  if (!track) {
+    return;
+  }
+  p += 8;
+
+  uint64_t base = flags & MP4_TFHD_DEFAULT_BASE_IS_MOOF ? moof_offset : data_end;
+  uint32_t default_duration = track->defaultDuration;
+  uint32_t default_size = track->defaultSize;
+  uint32_t default_flags = track->defaultFlags;
+  if (flags & MP4_TFHD_BASE_DATA_OFFSET) {
+    if (end - p < 8) return;
+    base = read_be64(p);
+    p += 8;
+  }
+  if (flags & MP4_TFHD_SAMPLE_DESCRIPTION_INDEX) {
+    p += 4;
+  }
+  if (flags & MP4_TFHD_DEFAULT_DURATION) {
+    if (end - p < 4) return;
+    default_duration = read_be32(p);
+    p += 4;
+  }
+  if (flags & MP4_TFHD_DEFAULT_SIZE) {
+    if (end - p < 4) return;
+    default_size = read_be32(p);
+    p += 4;
+  }
+  if (flags & MP4_TFHD_DEFAULT_FLAGS) {
+    if (end - p < 4) return;
+    default_flags = read_be32(p);
+    p += 4;
+  }
+
+  // the decode time of the fragment, or right after the previous one
+  Mp4Box tfdt;
+  int64_t dts = track->end;
+  if (find_box(data, size, box_type("tfdt"), tfdt) && tfdt.size >= 8) {
+    dts = tfdt.data[0] == 1 && tfdt.size >= 12 ? read_be64(tfdt.data + 4)
+                                                : read_be32(tfdt.data + 4);
+  }
+
+  uint64_t offset = base;
+  Mp4Box trun;
+  const uint8_t* t = data;
+  while (next_box(t, data + size, trun)) {
+    if (trun.type != box_type("trun") || trun.size < 8) {
+      continue;
+    }
+    p = trun.data;
+    end = trun.data + trun.size;
+    uint32_t trun_flags = read_be32(p) & 0xffffff;
+    uint32_t count = read_be32(p + 4);
+    p += 8;
+    if (trun_flags & MP4_TRUN_DATA_OFFSET) {
+      if (end - p < 4) return;
+      offset = base + static_cast<int32_t>(read_be32(p));
+      p += 4;
+    }
+    uint32_t first_flags = default_flags;
+    bool has_first_flags = trun_flags & MP4_TRUN_FIRST_SAMPLE_FLAGS;
+    if (has_first_flags) {
+      if (end - p < 4) return;
+      first_flags = read_be32(p);
+      p += 4;
+    }
+    int fields = !!(trun_flags & MP4_TRUN_SAMPLE_DURATION) + !!(trun_flags & MP4_TRUN_SAMPLE_SIZE) +
+                 !!(trun_flags & MP4_TRUN_SAMPLE_FLAGS) +
+                 !!(trun_flags & MP4_TRUN_SAMPLE_CTS_OFFSET);
+    if (static_cast<uint64_t>(count) * fields * 4 > static_cast<uint64_t>(end - p)) {
+      return;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t duration = default_duration;
+      Sample sample;
+      sample.size = default_size;
+      uint32_t sample_flags = i == 0 && has_first_flags ? first_flags : default_flags;
+      sample.ctsOffset = 0;
+      if (trun_flags & MP4_TRUN_SAMPLE_DURATION) {
+        duration = read_be32(p);
+        p += 4;
+      }
+      if (trun_flags & MP4_TRUN_SAMPLE_SIZE) {
+        sample.size = read_be32(p);
+        p += 4;
+      }
+      if (trun_flags & MP4_TRUN_SAMPLE_FLAGS) {
+        sample_flags = read_be32(p);
+        p += 4;
+      }
+      if (trun_flags & MP4_TRUN_SAMPLE_CTS_OFFSET) {
+        // unsigned in version 0, the values in use fit both
+        sample.ctsOffset = static_cast<int32_t>(read_be32(p));
+        p += 4;
+      }
+      sample.offset = offset;
+      sample.dts = dts;
+      sample.isKeyFrame = track == &audio_ || !(sample_flags & MP4_SAMPLE_IS_NON_SYNC);
+      if (sample.offset > size_ || sample.size > size_ - sample.offset) {
+        AG_LOG(ERROR, "Truncated fragment sample in %s", file_path_.c_str());
+        return;
+      }
+      track->samples.push_back(sample);
+      offset += sample.size;
+      dts += duration;
+    }
+    data_end = offset;
+    track->end = dts;
+  }
+}
+
+HelperMp4Demuxer::Track* HelperMp4Demuxer::findTrack(uint32_t id) {
+  if (!id) {
+    return nullptr;
+  }
+  return id == video_.id ? &video_ : id == audio_.id ? &audio_ : nullptr;
+}
+
+bool HelperMp4Demuxer::nextSample(Track& track, const Sample*& sample, int64_t& dts) {
+  if (track.samples.empty()) {
+    return false;
+  }
+
+  // rewind to the file start if necessary, the time goes on
+  if (track.next >= track.samples.size()) {
+    track.next = 0;
+    track.loopOffset += track.end - track.samples.front().dts;
+  }
+  sample = &track.samples[track.next++];
+  dts = sample->dts - track.samples.front().dts + track.loopOffset;
+  return true;
+}
+
+bool HelperMp4Demuxer::writeAnnexB(const Sample& sample, std::vector<uint8_t>& out) const {
+  const uint8_t* nal = data_ + sample.offset;
+  const uint8_t* end = nal + sample.size;
+  size_t begin = out.size();
+
+  if (nal_length_size_ == 4) {
+    // same size as a start code: copy the sample and rewrite the lengths in place
+    out.insert(out.end(), nal, end);
+    for (size_t i = begin; i < out.size();) {
+      if (out.size() - i < 4) {
+        return false;
+      }
+      uint32_t length = read_be32(&out[i]);
+      out[i] = 0;
+      out[i + 1] = 0;
+      out[i + 2] = 0;
+      out[i + 3] = 1;
+      if (length > out.size() - i - 4) {
+        return false;
+      }
+      i += 4 + length;
+    }
+    return true;
+  }
+
+  const uint8_t start_code[] = {0, 0, 0, 1};
+  while (nal < end) {
+    if (end - nal < nal_length_size_) {
+      return false;
+    }
+    uint32_t length = nal_length_size_ == 2 ? read_be16(nal) : nal[0];
+    nal += nal_length_size_;
+    if (length > static_cast<size_t>(end - nal)) {
+      return false;
+    }
+    out.insert(out.end(), start_code, start_code + 4);
+    out.insert(out.end(), nal, nal + length);
+    nal += length;
+  }
+  return true;
+}
+
+bool HelperMp4Demuxer::getVideoFrame(HelperMp4Frame& frame) {
+  const Sample* sample;
+  int64_t dts;
+  std::vector<uint8_t>& buffer = video_.buffer;
+  // a bad sample is skipped, only a file without a good one ends the stream
+  for (size_t tries = 0;; tries++) {
+    if (tries == video_.samples.size() || !nextSample(video_, sample, dts)) {
+      return false;
+    }
+    buffer.clear();
+    if (sample->isKeyFrame) {
+      buffer.insert(buffer.end(), parameter_sets_.begin(), parameter_sets_.end());
+    }
+    if (writeAnnexB(*sample, buffer)) {
+      break;
+    }
+    AG_LOG(ERROR, "Bad NAL unit lengths at %llu in %s, sample skipped",
+           static_cast<unsigned long long>(sample->offset), file_path_.c_str());
+  }
+  frame.buffer = buffer.data();
+  frame.bufferLen = buffer.size();
+  frame.isKeyFrame = sample->isKeyFrame;
+  frame.dtsMs = dts * 1000 / video_.timescale;
+  frame.ptsMs = (dts + sample->ctsOffset) * 1000 / video_.timescale;
+  return true;
+}
+
+bool HelperMp4Demuxer::getAudioFrame(HelperMp4Frame& frame) {
+  const Sample* sample;
+  int64_t dts;
+  size_t length;
+  for (size_t tries = 0;; tries++) {
+    if (tries == audio_.samples.size() || !nextSample(audio_, sample, dts)) {
+      return false;
+    }
+    length = ADTS_HEADER_SIZE + sample->size;
+    if (length <= ADTS_MAX_FRAME_SIZE) {
+      break;
+    }
+    AG_LOG(ERROR, "AAC frame too large at %llu in %s, sample skipped",
+           static_cast<unsigned long long>(sample->offset), file_path_.c_str());
+  }
+  std::vector<uint8_t>& buffer = audio_.buffer;
+  buffer.assign(adts_header_, adts_header_ + ADTS_HEADER_SIZE);
+  buffer[3] |= length >> 11;
+  buffer[4] = (length >> 3) & 0xff;
+  buffer[5] |= (length & 0x07) << 5;
+  buffer.insert(buffer.end(), data_ + sample->offset, data_ + sample->offset + sample->size);
+
+  frame.buffer = buffer.data();
+  frame.bufferLen = buffer.size();
+  frame.isKeyFrame = true;
+  frame.dtsMs = dts * 1000 / audio_.timescale;
+  frame.ptsMs = frame.dtsMs;
+  return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AgoraBase.h"
+
+// MP4 and fragmented MP4 demuxer over a mapped file.
+//
+// The first H.264/H.265 track and the first AAC track are read, from the
+// sample tables of the moov box and from the moof fragments that follow it.
+// Video samples are rewritten from length-prefixed NAL units to Annex-B, with
+// the parameter sets of the track before each key frame; audio samples get an
+// ADTS header. Both are what the encoded senders expect.
+//
+// Video and audio have their own cursor and buffer, so each may be read from
+// its own thread.
+
+struct HelperMp4Frame {
+  // valid until the next frame of the same track is read
+  const uint8_t* buffer;
+  int bufferLen;
+  bool isKeyFrame;
+  // from the sample tables, starting at 0 and continuing when the file loops
+  int64_t dtsMs;
+  int64_t ptsMs;
+};
+
+class HelperMp4Demuxer {
+ public:
+  explicit HelperMp4Demuxer(const char* filepath);
+  ~HelperMp4Demuxer();
+
+  // Maps the file and indexes the samples of its tracks
+  bool initialize();
+
+  bool hasVideo() const { return !video_.samples.empty(); }
+  bool hasAudio() const { return !audio_.samples.empty(); }
+
+  agora::rtc::VIDEO_CODEC_TYPE getVideoCodec() const { return video_codec_; }
+  int getWidth() const { return width_; }
+  int getHeight() const { return height_; }
+
+  agora::rtc::AUDIO_CODEC_TYPE getAudioCodec() const { return audio_codec_; }
+  int getSampleRate() const { return sample_rate_; }
+  int getChannels() const { return channels_; }
+  int getSamplesPerFrame() const { return samples_per_frame_; }
+
+  // Next video access unit in Annex-B, looping at the end of the file. Bad
+  // samples are skipped, false only when there is no good one.
+  bool getVideoFrame(HelperMp4Frame& frame);
+  // Next AAC frame with its ADTS header, looping at the end of the file, bad
+  // samples skipped too
+  bool getAudioFrame(HelperMp4Frame& frame);
+
+ private:
+  struct Sample {
+    uint64_t offset;
+    uint32_t size;
+    int64_t dts;  // in the track time scale
+    int32_t ctsOffset;
+    bool isKeyFrame;
+  };
+
+  struct Track {
+    uint32_t id{0};
+    uint32_t timescale{0};
+    std::vector<Sample> samples;
+    int64_t end{0};  // decode time after the last sample
+
+    // defaults for the fragments, from trex
+    uint32_t defaultDuration{0};
+    uint32_t defaultSize{0};
+    uint32_t defaultFlags{0};
+
+    size_t next{0};
+    int64_t loopOffset{0};
+    std::vector<uint8_t> buffer;  // reused for every frame
+  };
+
+  struct TrackInfo;
+
+  bool parseMoov(const uint8_t* data, size_t size);
+  bool parseTrak(const uint8_t* data, size_t size);
+  bool parseVideoEntry(const uint8_t* data, size_t size, uint32_t type);
+  bool parseAudioEntry(const uint8_t* data, size_t size);
+  bool buildSamples(Track& track, const TrackInfo& info);
+  void parseMoof(size_t moof_offset, const uint8_t* data, size_t size);
+  void parseTraf(size_t moof_offset, const uint8_t* data, size_t size, uint64_t& data_end);
+
+  Track* findTrack(uint32_t id);
+  bool nextSample(Track& track, const Sample*& sample, int64_t& dts);
+  bool writeAnnexB(const Sample& sample, std::vector<uint8_t>& out) const;
+
+  std::string file_path_;
+  const uint8_t* data_{nullptr};
+  size_t size_{0};
+
+  Track video_;
+  agora::rtc::VIDEO_CODEC_TYPE video_codec_{agora::rtc::VIDEO_CODEC_NONE};
+  int width_{0};
+  int height_{0};
+  int nal_length_size_{4};
+  std::vector<uint8_t> parameter_sets_;  // Annex-B
+
+  Track audio_;
+  agora::rtc::AUDIO_CODEC_TYPE audio_codec_{agora::rtc::AUDIO_CODEC_AACLC};
+  int sample_rate_{0};
+  int channels_{0};
+  int samples_per_frame_{1024};
+  uint8_t adts_header_[7]{0};
+};
@@ -0,0 +1,781 @@
+#include "helper_mp4_muxer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "common/log.h"
+
+#define MP4_VIDEO_TIMESCALE (90000)
+#define MP4_OPUS_TIMESCALE (48000)
+#define MP4_VIDEO_TRACK_ID (1)
+#define MP4_AUDIO_TRACK_ID (2)
+
+// how long the header waits for an expected track that does not show up
+#define MP4_HEADER_WAIT_MS (3000)
+// duration given to the last video sample when nothing follows it
+#define MP4_DEFAULT_VIDEO_DURATION (MP4_VIDEO_TIMESCALE / 30)
+
+#define MP4_TFHD_DEFAULT_BASE_IS_MOOF (0x020000)
+#define MP4_TRUN_DATA_OFFSET (0x000001)
+#define MP4_TRUN_SAMPLE_DURATION (0x000100)
+#define MP4_TRUN_SAMPLE_SIZE (0x000200)
+#define MP4_TRUN_SAMPLE_FLAGS (0x000400)
+#define MP4_TRUN_SAMPLE_CTS_OFFSET (0x000800)
+
+// sample_depends_on = 2: a key frame depends on no other sample
+#define MP4_SAMPLE_FLAGS_SYNC (0x02000000)
+// sample_depends_on = 1 and sample_is_non_sync_sample
+#define MP4_SAMPLE_FLAGS_NON_SYNC (0x01010000)
+
+#define ADTS_HEADER_SIZE (7)
+
+static const int kAacSampleRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                      22050, 16000, 12000, 11025, 8000,  7350};
+
+static int64_t steady_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static void put8(std::vector<uint8_t>& out, uint32_t v) { out.push_back(static_cast<uint8_t>(v)); }
+
+static void put16(std::vector<uint8_t>& out, uint32_t v) {
+  put8(out, v >> 8);
+  put8(out, v);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+  put16(out, v >> 16);
+  put16(out, v);
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t v) {
+  put32(out, static_cast<uint32_t>(v >> 32));
+  put32(out, static_cast<uint32_t>(v));
+}
+
+static void put_bytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  out.insert(out.end(), p, p + size);
+}
+
+static void put_zeros(std::vector<uint8_t>& out, size_t count) { out.resize(out.size() + count, 0); }
+
+static void patch32(std::vector<uint8_t>& out, size_t pos, uint32_t v) {
+  out[pos] = static_cast<uint8_t>(v >> 24);
+  out[pos + 1] = static_cast<uint8_t>(v >> 16);
+  out[pos + 2] = static_cast<uint8_t>(v >> 8);
+  out[pos + 3] = static_cast<uint8_t>(v);
+}
+
+// Starts a box whose size is set by end_box()
+static size_t begin_box(std::vector<uint8_t>& out, const char* type) {
+  size_t pos = out.size();
+  put32(out, 0);
+  put_bytes(out, type, 4);
+  return pos;
+}
+
+static size_t begin_full_box(std::vector<uint8_t>& out, const char* type, uint8_t version,
+                             uint32_t flags) {
+  size_t pos = begin_box(out, type);
+  put32(out, (static_cast<uint32_t>(version) << 24) | flags);
+  return pos;
+}
+
+static void end_box(std::vector<uint8_t>& out, size_t pos) {
+  patch32(out, pos, static_cast<uint32_t>(out.size() - pos));
+}
+
+static void put_matrix(std::vector<uint8_t>& out) {
+  static const uint32_t unity[9] = {0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x40000000};
+  for (uint32_t v : unity) {
+    put32(out, v);
+  }
+}
+
+static int nal_type(agora::rtc::VIDEO_CODEC_TYPE codec, const uint8_t* header) {
+  return codec == agora::rtc::VIDEO_CODEC_H265 ? (header[0] >> 1) & 0x3f : header[0] & 0x1f;
+}
+
+static bool is_access_unit_delimiter(agora::rtc::VIDEO_CODEC_TYPE codec, int type) {
+  return codec == agora::rtc::VIDEO_CODEC_H265 ? type == 35 : type == 9;
+}
+
+// The NAL units of an Annex-B buffer, without the trailing zero bytes
+static void split_nal_units(const uint8_t* data, size_t length, std::vector<HelperNalUnit>& units) {
+  units.clear();
+  find_nal_units(data, length, units);
+  for (auto& unit : units) {
+    while (unit.end > unit.header && data[unit.end - 1] == 0) {
+      --unit.end;
+    }
+  }
+}
+
+// Samples of an Opus packet at 48 kHz, from its TOC byte (RFC 6716 3.1)
+static uint32_t opus_packet_samples(const uint8_t* data, size_t length) {
+  static const uint32_t silk[] = {480, 960, 1920, 2880};
+  static const uint32_t hybrid[] = {480, 960};
+  static const uint32_t celt[] = {120, 240, 480, 960};
+  if (!length) {
+    return 0;
+  }
+  int config = data[0] >> 3;
+  uint32_t frame = config < 12 ? silk[config & 3] : config < 16 ? hybrid[config & 1] : celt[config & 3];
+  switch (data[0] & 3) {
+    case 0:
+      return frame;
+    case 1:
+    case 2:
+      return 2 * frame;
+    default:
+      return length > 1 ? (data[1] & 0x3f) * frame : 0;
+  }
+}
+
+HelperMp4Muxer::HelperMp4Muxer(const char* filepath, bool hasVideo, bool hasAudio, int fragmentMs)
+    : file_path_(filepath), fragment_ms_(fragmentMs) {
+  video_.id = MP4_VIDEO_TRACK_ID;
+  video_.expected = hasVideo;
+  video_.timescale = MP4_VIDEO_TIMESCALE;
+  audio_.id = MP4_AUDIO_TRACK_ID;
+  audio_.expected = hasAudio;
+}
+
+HelperMp4Muxer::~HelperMp4Muxer() { finish(); }
+
+bool HelperMp4Muxer::initialize() {
+  fd_ = open(file_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    AG_LOG(ERROR, "Failed to create file %s: %s", file_path_.c_str(), strerror(errno));
+    return false;
+  }
+  // a fragment of video holds about a second of frames
+  video_.samples.reserve(64);
+  video_.data.reserve(1024 * 1024);
+  audio_.samples.reserve(64);
+  audio_.data.reserve(64 * 1024);
+  moof_.reserve(4096);
+  units_.reserve(16);
+  return true;
+}
+
+bool HelperMp4Muxer::configureVideo(const uint8_t* data, size_t length) {
+  split_nal_units(data, length, units_);
+  for (auto& unit : units_) {
+    if (unit.end <= unit.header) {
+      continue;
+    }
+    int type = nal_type(video_codec_, data + unit.header);
+    std::vector<uint8_t>* set = nullptr;
+    if (video_codec_ == agora::rtc::VIDEO_CODEC_H265) {
+      set = type == 32 ? &vps_ : type == 33 ? &sps_ : type == 34 ? &pps_ : nullptr;
+    } else {
+      set = type == 7 ? &sps_ : type == 8 ? &pps_ : nullptr;
+    }
+    if (set) {
+      set->assign(data + unit.header, data + unit.end);
+    }
+  }
+
+  // the sample entries need the profile fields of the SPS
+  size_t min_sps = video_codec_ == agora::rtc::VIDEO_CODEC_H265 ? 15 : 4;
+  if (sps_.size() < min_sps || pps_.empty() ||
+      (video_codec_ == agora::rtc::VIDEO_CODEC_H265 && vps_.empty())) {
+    return false;
+  }
+  video_.configured = true;
+  return true;
+}
+
+bool HelperMp4Muxer::configureAudio(const uint8_t* data, size_t length,
+                                    agora::rtc::AUDIO_CODEC_TYPE codec) {
+  if (length >= ADTS_HEADER_SIZE && data[0] == 0xff && (data[1] & 0xf0) == 0xf0) {
+    int object = ((data[2] >> 6) & 3) + 1;
+    int rate_index = (data[2] >> 2) & 0xf;
+    int channel_config = ((data[2] & 1) << 2) | (data[3] >> 6);
+    if (rate_index >= static_cast<int>(sizeof(kAacSampleRates) / sizeof(kAacSampleRates[0]))) {
+      return false;
+    }
+    audio_codec_ = agora::rtc::AUDIO_CODEC_AACLC;
+    sample_rate_ = kAacSampleRates[rate_index];
+    channels_ = channel_config ? channel_config : 2;
+    audio_config_[0] = static_cast<uint8_t>((object << 3) | (rate_index >> 1));
+    audio_config_[1] = static_cast<uint8_t>(((rate_index & 1) << 7) | (channel_config << 3));
+  } else if (codec == agora::rtc::AUDIO_CODEC_OPUS && length) {
+    audio_codec_ = agora::rtc::AUDIO_CODEC_OPUS;
+    sample_rate_ = MP4_OPUS_TIMESCALE;
+    channels_ = (data[0] & 0x04) ? 2 : 1;
+  } else {
+    return false;
+  }
+  audio_.timescale = sample_rate_;
+  audio_.configured = true;
+  return true;
+}
+
+int64_t HelperMp4Muxer::startOffsetMs() {
+  int64_t now = steady_ms();
+  if (start_ms_ < 0) {
+    start_ms_ = now;
+  }
+  return now - start_ms_;
+}
+
+bool HelperMp4Muxer::readyForHeader() {
+  if (header_written_) {
+    return true;
+  }
+  bool waiting = (video_.expected && !video_.configured) || (audio_.expected && !audio_.configured);
+  if (waiting) {
+    // do without the tracks that are still missing after a while
+    if (start_ms_ < 0 || steady_ms() - start_ms_ < MP4_HEADER_WAIT_MS ||
+        !(video_.configured || audio_.configured)) {
+      return false;
+    }
+    if (!video_.configured) {
+      AG_LOG(INFO, "No video received, %s is written without video", file_path_.c_str());
+    }
+    if (!audio_.configured) {
+      AG_LOG(INFO, "No audio received, %s is written without audio", file_path_.c_str());
+    }
+  }
+  return writeHeader();
+}
+
+bool HelperMp4Muxer::writeVideoFrame(const uint8_t* data, size_t length,
+                                     agora::rtc::VIDEO_CODEC_TYPE codec, bool isKeyFrame,
+                                     int width, int height, int64_t dtsMs, int64_t ptsMs) {
+  if (fd_ < 0 || !length || (header_written_ && !video_.inFile)) {
+    return false;
+  }
+  if (codec != agora::rtc::VIDEO_CODEC_H264 && codec != agora::rtc::VIDEO_CODEC_H265) {
+    return false;
+  }
+  if (!video_.configured) {
+    // the file starts with a key frame carrying its parameter sets
+    video_codec_ = codec;
+    width_ = width;
+    height_ = height;
+    if (!video_.expected || !isKeyFrame || !configureVideo(data, length)) {
+      startOffsetMs();
+      return false;
+    }
+  } else if (codec != video_codec_) {
+    return false;
+  }
+
+  int64_t offset = startOffsetMs();
+  if (!video_.started) {
+    video_.started = true;
+    video_.firstTimeMs = dtsMs - offset;
+  }
+  int64_t dts = (dtsMs - video_.firstTimeMs) * (MP4_VIDEO_TIMESCALE / 1000);
+  if (dts < video_.nextDts) {
+    dts = video_.nextDts;
+  }
+  int32_t cts_offset = 0;
+  if (ptsMs > dtsMs) {
+    cts_offset = static_cast<int32_t>((ptsMs - dtsMs) * (MP4_VIDEO_TIMESCALE / 1000));
+  }
+
+  // the previous frame lasts until this one
+  if (!video_.samples.empty()) {
+    last_video_duration_ = static_cast<uint32_t>(dts - last_video_dts_);
+    video_.samples.back().duration = last_video_duration_;
+  }
+  if (isKeyFrame && readyForHeader() && !video_.samples.empty() &&
+      dts - video_.fragmentStart >= static_cast<int64_t>(fragment_ms_) * (MP4_VIDEO_TIMESCALE / 1000)) {
+    if (!writeFragment()) {
+      return false;
+    }
+  }
+
+  appendVideoSample(data, length, isKeyFrame, dts, cts_offset);
+  return true;
+}
+
+void HelperMp4Muxer::appendVideoSample(const uint8_t* data, size_t length, bool isKeyFrame,
+                                       int64_t dts, int32_t ctsOffset) {
+  if (video_.samples.empty()) {
+    video_.fragmentStart = dts;
+  }
+
+  // Annex-B to 4-byte length prefixes, in the buffer of the fragment
+  split_nal_units(data, length, units_);
+  size_t start = video_.data.size();
+  for (auto& unit : units_) {
+    size_t size = unit.end - unit.header;
+    if (!size || is_access_unit_delimiter(video_codec_, nal_type(video_codec_, data + unit.header))) {
+      continue;
+    }
+    put32(video_.data, static_cast<uint32_t>(size));
+    put_bytes(video_.data, data + unit.header, size);
+  }
+
+  Sample sample;
+  sample.size = static_cast<uint32_t>(video_.data.size() - start);
+  sample.duration = 0;  // set by the next frame
+  sample.ctsOffset = ctsOffset;
+  sample.isKeyFrame = isKeyFrame;
+  video_.samples.push_back(sample);
+  last_video_dts_ = dts;
+  video_.nextDts = dts + 1;
+}
+
+bool HelperMp4Muxer::writeAudioFrame(const uint8_t* data, size_t length,
+                                     agora::rtc::AUDIO_CODEC_TYPE codec, int64_t timeMs) {
+  if (fd_ < 0 || !length || (header_written_ && !audio_.inFile)) {
+    return false;
+  }
+  if (!audio_.configured && (!audio_.expected || !configureAudio(data, length, codec))) {
+    startOffsetMs();
+    return false;
+  }
+
+  int64_t offset = startOffsetMs();
+  if (!audio_.started) {
+    audio_.started = true;
+    audio_.nextDts = offset * sample_rate_ / 1000;
+    audio_.firstTimeMs = timeMs - offset;
+  }
+  // a gap in the received audio (loss, discontinuous transmission) moves the
+  // next frame to the time it was sent
+  if (timeMs > 0) {
+    int64_t sent = (timeMs - audio_.firstTimeMs) * sample_rate_ / 1000;
+    int64_t gap = sent - audio_.nextDts;
+    if (gap > sample_rate_ / 10) {
+      if (!audio_.samples.empty()) {
+        audio_.samples.back().duration += static_cast<uint32_t>(gap);
+      }
+      audio_.nextDts = sent;
+    }
+  }
+
+  bool ready = readyForHeader();
+  if (audio_codec_ == agora::rtc::AUDIO_CODEC_OPUS) {
+    uint32_t samples = opus_packet_samples(data, length);
+    if (!samples) {
+      return false;
+    }
+    appendAudioSample(data, length, samples, audio_.nextDts);
+  } else {
+    // one sample for each ADTS frame of the packet
+    size_t pos = 0;
+    while (length - pos >= ADTS_HEADER_SIZE && data[pos] == 0xff && (data[pos + 1] & 0xf0) == 0xf0) {
+      const uint8_t* adts = data + pos;
+      size_t frame = ((adts[3] & 0x03) << 11) | (adts[4] << 3) | (adts[5] >> 5);
+      size_t header = (adts[1] & 0x01) ? ADTS_HEADER_SIZE : ADTS_HEADER_SIZE + 2;
+      if (frame <= header || frame > length - pos) {
+        break;
+      }
+      appendAudioSample(adts + header, frame - header, 1024, audio_.nextDts);
+      pos += frame;
+    }
+  }
+
+  // without video the fragments are cut on audio
+  bool video = header_written_ ? video_.inFile : video_.expected;
+  if (ready && !video &&
+      audio_.nextDts - audio_.fragmentStart >= static_cast<int64_t>(fragment_ms_) * sample_rate_ / 1000) {
+    return writeFragment();
+  }
+  return true;
+}
+
+void HelperMp4Muxer::appendAudioSample(const uint8_t* data, size_t length, uint32_t duration,
+                                       int64_t dts) {
+  if (audio_.samples.empty()) {
+    audio_.fragmentStart = dts;
+  }
+  put_bytes(audio_.data, data, length);
+  Sample sample;
+  sample.size = static_cast<uint32_t>(length);
+  sample.duration = duration;
+  sample.ctsOffset = 0;
+  sample.isKeyFrame = true;
+  audio_.samples.push_back(sample);
+  audio_.nextDts = dts + duration;
+}
+
+void HelperMp4Muxer::buildVideoEntry(std::vector<uint8_t>& out) const {
+  bool hevc = video_codec_ == agora::rtc::VIDEO_CODEC_H265;
+  size_t entry = begin_box(out, hevc ? "hev1" : "avc3");
+  put_zeros(out, 6);
+  put16(out, 1);  // data_reference_index
+  put_zeros(out, 16);
+  put16(out, width_);
+  put16(out, height_);
+  put32(out, 0x00480000);  // 72 dpi
+  put32(out, 0x00480000);
+  put32(out, 0);
+  put16(out, 1);  // frame_count
+  put_zeros(out, 32);  // compressorname
+  put16(out, 0x0018);  // depth
+  put16(out, 0xffff);
+
+  if (!hevc) {
+    size_t avcc = begin_box(out, "avcC");
+    put8(out, 1);
+    put8(out, sps_[1]);  // profile_idc
+    put8(out, sps_[2]);  // constraint flags
+    put8(out, sps_[3]);  // level_idc
+    put8(out, 0xff);     // 4-byte NAL lengths
+    put8(out, 0xe1);     // one SPS
+    put16(out, sps_.size());
+    put_bytes(out, sps_.data(), sps_.size());
+    put8(out, 1);  // one PPS
+    put16(out, pps_.size());
+    put_bytes(out, pps_.data(), pps_.size());
+    end_box(out, avcc);
+  } else {
+    // profile_tier_level of the SPS, without emulation prevention bytes
+    std::vector<uint8_t> rbsp;
+    for (size_t i = 2; i < sps_.size() && rbsp.size() < 13; i++) {
+      if (i >= 4 && sps_[i] == 3 && sps_[i - 1] == 0 && sps_[i - 2] == 0) {
+        continue;
+      }
+      rbsp.push_back(sps_[i]);
+    }
+    rbsp.resize(13, 0);
+    int sub_layers = ((rbsp[0] >> 1) & 7) + 1;
+    int temporal_id_nested = rbsp[0] & 1;
+
+    size_t hvcc = begin_box(out, "hvcC");
+    put8(out, 1);
+    put_bytes(out, rbsp.data() + 1, 12);  // profile, compatibility, constraints, level
+    put16(out, 0xf000);                  // min_spatial_segmentation_idc
+    put8(out, 0xfc);                     // parallelismType
+    put8(out, 0xfc | 1);                 // 4:2:0
+    put8(out, 0xf8);                     // 8-bit luma
+    put8(out, 0xf8);                     // 8-bit chroma
+    put16(out, 0);                       // avgFrameRate
+    put8(out, (sub_layers << 3) | (temporal_id_nested << 2) | 3);
+    put8(out, 3);  // VPS, SPS, PPS arrays
+    const std::vector<uint8_t>* sets[] = {&vps_, &sps_, &pps_};
+    for (int i = 0; i < 3; i++) {
+      put8(out, 0x80 | (32 + i));
+      put16(out, 1);
+      put16(out, sets[i]->size());
+      put_bytes(out, sets[i]->data(), sets[i]->size());
+    }
+    end_box(out, hvcc);
+  }
+  end_box(out, entry);
+}
+
+void HelperMp4Muxer::buildAudioEntry(std::vector<uint8_t>& out) const {
+  bool opus = audio_codec_ == agora::rtc::AUDIO_CODEC_OPUS;
+  size_t entry = begin_box(out, opus ? "Opus" : "mp4a");
+  put_zeros(out, 6);
+  put16(out, 1);  // data_reference_index
+  put_zeros(out, 8);
+  put16(out, channels_);
+  put16(out, 16);  // samplesize
+  put32(out, 0);
+  put32(out, static_cast<uint32_t>(sample_rate_) << 16);
+
+  if (opus) {
+    size_t dops = begin_box(out, "dOps");
+    put8(out, 0);  // Version
+    put8(out, channels_);
+    put16(out, 0);  // PreSkip, the stream is joined in the middle
+    put32(out, sample_rate_);
+    put16(out, 0);  // OutputGain
+    put8(out, 0);   // ChannelMappingFamily
+    end_box(out, dops);
+  } else {
+    // ES_Descriptor > DecoderConfigDescriptor > DecoderSpecificInfo
+    size_t esds = begin_full_box(out, "esds", 0, 0);
+    put8(out, 0x03);
+    put8(out, 3 + 15 + 2 + 2 + 3);
+    put16(out, 0);  // ES_ID
+    put8(out, 0);
+    put8(out, 0x04);
+    put8(out, 13 + 2 + 2);
+    put8(out, 0x40);  // MPEG-4 audio
+    put8(out, 0x15);  // audio stream
+    put_zeros(out, 3 + 4 + 4);  // buffer size, max and average bitrate
+    put8(out, 0x05);
+    put8(out, 2);
+    put_bytes(out, audio_config_, 2);
+    put8(out, 0x06);  // SLConfigDescriptor
+    put8(out, 1);
+    put8(out, 0x02);
+    end_box(out, esds);
+  }
+  end_box(out, entry);
+}
+
+void HelperMp4Muxer::buildTrak(std::vector<uint8_t>& out, const Track& track, bool video) const {
+  size_t trak = begin_box(out, "trak");
+
+  size_t tkhd = begin_full_box(out, "tkhd", 0, 3);  // enabled, in movie
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, track.id);
+  put32(out, 0);
+  put32(out, 0);  // duration, given by the fragments
+  put_zeros(out, 8);
+  put16(out, 0);  // layer
+  put16(out, 0);  // alternate_group
+  put16(out, video ? 0 : 0x0100);
+  put16(out, 0);
+  put_matrix(out);
+  put32(out, video ? static_cast<uint32_t>(width_) << 16 : 0);
+  put32(out, video ? static_cast<uint32_t>(height_) << 16 : 0);
+  end_box(out, tkhd);
+
+  size_t mdia = begin_box(out, "mdia");
+  size_t mdhd = begin_full_box(out, "mdhd", 0, 0);
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, track.timescale);
+  put32(out, 0);
+  put16(out, 0x55c4);  // "und"
+  put16(out, 0);
+  end_box(out, mdhd);
+
+  size_t hdlr = begin_full_box(out, "hdlr", 0, 0);
+  put32(out, 0);
+  put_bytes(out, video ? "vide" : "soun", 4);
+  put_zeros(out, 12);
+  const char* name = video ? "VideoHandler" : "SoundHandler";
+  put_bytes(out, name, strlen(name) + 1);
+  end_box(out, hdlr);
+
+  size_t minf = begin_box(out, "minf");
+  if (video) {
+    size_t vmhd = begin_full_box(out, "vmhd", 0, 1);
+    put_zeros(out, 8);
+    end_box(out, vmhd);
+  } else {
+    size_t smhd = begin_full_box(out, "smhd", 0, 0);
+    put32(out, 0);
+    end_box(out, smhd);
+  }
+  size_t dinf = begin_box(out, "dinf");
+  size_t dref = begin_full_box(out, "dref", 0, 0);
+  put32(out, 1);
+  end_box(out, begin_full_box(out, "url ", 0, 1));  // data in this file
+  end_box(out, dref);
+  end_box(out, dinf);
+
+  // the samples are in the fragments, the tables stay empty
+  size_t stbl = begin_box(out, "stbl");
+  size_t stsd = begin_full_box(out, "stsd", 0, 0);
+  put32(out, 1);
+  if (video) {
+    buildVideoEntry(out);
+  } else {
+    buildAudioEntry(out);
+  }
+  end_box(out, stsd);
+  const char* tables[] = {"stts", "stsc", "stco"};
+  for (const char* table : tables) {
+    size_t box = begin_full_box(out, table, 0, 0);
+    put32(out, 0);
+    end_box(out, box);
+  }
+  size_t stsz = begin_full_box(out, "stsz", 0, 0);
+  put32(out, 0);
+  put32(out, 0);
+  end_box(out, stsz);
+  end_box(out, stbl);
+
+  end_box(out, minf);
+  end_box(out, mdia);
+  end_box(out, trak);
+}
+
+bool HelperMp4Muxer::writeHeader() {
+  video_.inFile = video_.configured;
+  audio_.inFile = audio_.configured;
+
+  std::vector<uint8_t> header;
+  header.reserve(2048);
+  size_t ftyp = begin_box(header, "ftyp");
+  put_bytes(header, "isom", 4);
+  put32(header, 0x200);
+  put_bytes(header, "isomiso5iso6mp41", 16);
+  end_box(header, ftyp);
+
+  size_t moov = begin_box(header, "moov");
+  size_t mvhd = begin_full_box(header, "mvhd", 0, 0);
+  put32(header, 0);
+  put32(header, 0);
+  put32(header, 1000);  // timescale
+  put32(header, 0);     // duration, given by the fragments
+  put32(header, 0x00010000);  // rate
+  put16(header, 0x0100);      // volume
+  put_zeros(header, 10);
+  put_matrix(header);
+  put_zeros(header, 24);
+  put32(header, MP4_AUDIO_TRACK_ID + 1);  // next_track_ID
+  end_box(header, mvhd);
+
+  if (video_.inFile) {
+    buildTrak(header, video_, true);
+  }
+  if (audio_.inFile) {
+    buildTrak(header, audio_, false);
+  }
+
+  size_t mvex = begin_box(header, "mvex");
+  const Track* tracks[] = {&video_, &audio_};
+  for (const Track* track : tracks) {
+    if (!track->inFile) {
+      continue;
+    }
+    size_t trex = begin_full_box(header, "trex", 0, 0);
+    put32(header, track->id);
+    put32(header, 1);  // default_sample_description_index
+    put32(header, 0);
+    put32(header, 0);
+    put32(header, 0);
+    end_box(header, trex);
+  }
+  end_box(header, mvex);
+  end_box(header, moov);
+
+  struct iovec iov = {header.data(), header.size()};
+  if (!writeAll(&iov, 1)) {
+    return false;
+  }
+  header_written_ = true;
+  AG_LOG(INFO, "Created file %s to save received media", file_path_.c_str());
+  return true;
+}
+
+bool HelperMp4Muxer::writeFragment() {
+  Track* tracks[] = {&video_, &audio_};
+  bool has_samples = false;
+  for (Track* track : tracks) {
+    has_samples |= track->inFile && !track->samples.empty();
+  }
+  if (!has_samples) {
+    return true;
+  }
+
+  moof_.clear();
+  size_t moof = begin_box(moof_, "moof");
+  size_t mfhd = begin_full_box(moof_, "mfhd", 0, 0);
+  put32(moof_, ++sequence_);
+  end_box(moof_, mfhd);
+
+  size_t data_offset_pos[2] = {0, 0};
+  for (int i = 0; i < 2; i++) {
+    Track& track = *tracks[i];
+    if (!track.inFile || track.samples.empty()) {
+      continue;
+    }
+    bool video = &track == &video_;
+    size_t traf = begin_box(moof_, "traf");
+
+    size_t tfhd = begin_full_box(moof_, "tfhd", 0, MP4_TFHD_DEFAULT_BASE_IS_MOOF);
+    put32(moof_, track.id);
+    end_box(moof_, tfhd);
+
+    size_t tfdt = begin_full_box(moof_, "tfdt", 1, 0);
+    put64(moof_, static_cast<uint64_t>(track.fragmentStart));
+    end_box(moof_, tfdt);
+
+    uint32_t flags = MP4_TRUN_DATA_OFFSET | MP4_TRUN_SAMPLE_DURATION | MP4_TRUN_SAMPLE_SIZE |
+                     MP4_TRUN_SAMPLE_FLAGS | (video ? MP4_TRUN_SAMPLE_CTS_OFFSET : 0);
+    // version 1: signed composition offsets
+    size_t trun = begin_full_box(moof_, "trun", video ? 1 : 0, flags);
+    put32(moof_, static_cast<uint32_t>(track.samples.size()));
+    data_offset_pos[i] = moof_.size();
+    put32(moof_, 0);
+    for (auto& sample : track.samples) {
+      put32(moof_, sample.duration);
+      put32(moof_, sample.size);
+      put32(moof_, sample.isKeyFrame ? MP4_SAMPLE_FLAGS_SYNC : MP4_SAMPLE_FLAGS_NON_SYNC);
+      if (video) {
+        put32(moof_, static_cast<uint32_t>(sample.ctsOffset));
+      }
+    }
+    end_box(moof_, trun);
+    end_box(moof_, traf);
+  }
+  end_box(moof_, moof);
+
+  // the data of each track follows the mdat header, video first
+  uint8_t mdat[8];
+  size_t data_size = 0;
+  int count = 0;
+  struct iovec iov[4];
+  iov[count++] = {moof_.data(), moof_.size()};
+  iov[count++] = {mdat, sizeof(mdat)};
+  for (int i = 0; i < 2; i++) {
+    if (!data_offset_pos[i]) {
+      continue;
+    }
+    patch32(moof_, data_offset_pos[i], static_cast<uint32_t>(moof_.size() + sizeof(mdat) + data_size));
+    iov[count++] = {tracks[i]->data.data(), tracks[i]->data.size()};
+    data_size += tracks[i]->data.size();
+  }
+  uint32_t mdat_size = static_cast<uint32_t>(sizeof(mdat) + data_size);
+  mdat[0] = static_cast<uint8_t>(mdat_size >> 24);
+  mdat[1] = static_cast<uint8_t>(mdat_size >> 16);
+  mdat[2] = static_cast<uint8_t>(mdat_size >> 8);
+  mdat[3] = static_cast<uint8_t>(mdat_size);
+  memcpy(mdat + 4, "mdat", 4);
+
+  bool ok = writeAll(iov, count);
+  for (Track* track : tracks) {
+    if (track->inFile) {
+      track->samples.clear();
+      track->data.clear();
+    }
+  }
+  return ok;
+}
+
+bool HelperMp4Muxer::writeAll(struct iovec* iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd_, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      AG_LOG(ERROR, "Error writing %s: %s", file_path_.c_str(), strerror(errno));
+      return false;
+    }
+    while (count > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+void HelperMp4Muxer::finish() {
+  if (fd_ < 0) {
+    return;
+  }
+  if (!header_written_ && (video_.configured || audio_.configured)) {
+    writeHeader();
+  }
+  if (header_written_) {
+    if (!video_.samples.empty()) {
+      video_.samples.back().duration =
+          last_video_duration_ ? last_video_duration_ : MP4_DEFAULT_VIDEO_DURATION;
+    }
+    writeFragment();
+  }
+  close(fd_);
+  fd_ = -1;
+}
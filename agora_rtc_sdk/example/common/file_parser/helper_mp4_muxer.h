@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AgoraBase.h"
+#include "helper_nal_scanner.h"
+
+// Fragmented MP4 writer for received H.264/H.265 video and AAC/Opus audio.
+//
+// The header (ftyp, moov) is written once the codec configuration of every
+// expected track is known: the parameter sets of the first key frame for
+// video, the ADTS header or Opus TOC of the first packet for audio. Samples
+// are then written in fragments (moof, mdat) of about |fragmentMs|, cut on
+// video key frames, so the file can be played while it is being recorded
+// and stays playable up to its last fragment if the recording is killed.
+//
+// Video keeps its parameter sets in-band (avc3/hev1 sample entries), so a
+// stream that changes resolution remains decodable. Not thread-safe: feed it
+// from one thread.
+
+class HelperMp4Muxer {
+ public:
+  // |hasVideo|/|hasAudio|: the tracks to wait for before writing the header
+  HelperMp4Muxer(const char* filepath, bool hasVideo, bool hasAudio, int fragmentMs = 1000);
+  ~HelperMp4Muxer();
+
+  bool initialize();
+
+  // An Annex-B access unit. |dtsMs|/|ptsMs| only need to be consistent with
+  // each other, the track starts at the time the first frame arrives.
+  bool writeVideoFrame(const uint8_t* data, size_t length, agora::rtc::VIDEO_CODEC_TYPE codec,
+                       bool isKeyFrame, int width, int height, int64_t dtsMs, int64_t ptsMs);
+  // AAC frames with their ADTS header, or one Opus packet. |timeMs| (e.g. the
+  // send time, 0 if unknown) is only used to keep the audio in place across
+  // gaps; otherwise the audio time is counted in samples.
+  bool writeAudioFrame(const uint8_t* data, size_t length, agora::rtc::AUDIO_CODEC_TYPE codec,
+                       int64_t timeMs);
+
+  // Writes the last fragment and closes the file
+  void finish();
+
+ private:
+  struct Sample {
+    uint32_t size;
+    uint32_t duration;
+    int32_t ctsOffset;
+    bool isKeyFrame;
+  };
+
+  // Samples of the fragment being gathered, reused from one fragment to the next
+  struct Track {
+    uint32_t id{0};
+    bool expected{false};
+    bool configured{false};
+    bool inFile{false};  // has a trak in the header
+    uint32_t timescale{0};
+
+    std::vector<Sample> samples;
+    std::vector<uint8_t> data;
+    int64_t fragmentStart{0};  // decode time of the first sample of the fragment
+    int64_t nextDts{0};        // decode time of the next sample
+    bool started{false};
+    int64_t firstTimeMs{0};
+  };
+
+  bool configureVideo(const uint8_t* data, size_t length);
+  bool configureAudio(const uint8_t* data, size_t length, agora::rtc::AUDIO_CODEC_TYPE codec);
+  void appendVideoSample(const uint8_t* data, size_t length, bool isKeyFrame, int64_t dts,
+                         int32_t ctsOffset);
+  void appendAudioSample(const uint8_t* data, size_t length, uint32_t duration, int64_t dts);
+  int64_t startOffsetMs();
+  bool readyForHeader();
+  bool writeHeader();
+  bool writeFragment();
+  bool writeAll(struct iovec* iov, int count);
+
+  void buildVideoEntry(std::vector<uint8_t>& out) const;
+  void buildAudioEntry(std::vector<uint8_t>& out) const;
+  void buildTrak(std::vector<uint8_t>& out, const Track& track, bool video) const;
+
+  std::string file_path_;
+  int fd_{-1};
+  int fragment_ms_;
+  bool header_written_{false};
+  uint32_t sequence_{0};
+  int64_t start_ms_{-1};  // arrival of the first frame, on the steady clock
+
+  // boxes are built in buffers kept from one fragment to the next
+  std::vector<uint8_t> moof_;
+  // NAL units of the frame being written, kept from one frame to the next
+  std::vector<HelperNalUnit> units_;
+
+  Track video_;
+  agora::rtc::VIDEO_CODEC_TYPE video_codec_{agora::rtc::VIDEO_CODEC_NONE};
+  int width_{0};
+  int height_{0};
+  std::vector<uint8_t> vps_;
+  std::vector<uint8_t> sps_;
+  std::vector<uint8_t> pps_;
+  int64_t last_video_dts_{0};
+  uint32_t last_video_duration_{0};
+
+  Track audio_;
+  agora::rtc::AUDIO_CODEC_TYPE audio_codec_{agora::rtc::AUDIO_CODEC_AACLC};
+  int sample_rate_{0};
+  int channels_{0};
+  uint8_t audio_config_[2]{0};  // AAC AudioSpecificConfig
+  int64_t first_audio_time_ms_{0};
+};
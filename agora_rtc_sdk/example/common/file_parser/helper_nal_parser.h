@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "helper_annexb_stream.h"
+#include "helper_frame_index.h"
+#include "helper_media_source.h"
+
+// Access unit parser for Annex-B video, shared by H.264 and H.265.
+//
+// The codec is a traits class resolved at compile time:
+//
+//   struct Codec {
+//     static const char* name();             // "h264", also the index format
+//     static const int kNalHeaderSize;       // bytes before the slice header
+//     static const int kKeyFrameParameterSets;  // parameterSet() bits a key
+//                                               // frame must carry
+//     static int nalType(const uint8_t* header);
+//     static bool isSlice(int nalType);      // VCL NAL carrying a slice
+//     static int parameterSet(int nalType);  // bit of a parameter set, or 0
+//     // |slice|/|size| is the slice header following the NAL header
+//     static bool isFirstSlice(int nalType, const uint8_t* slice, size_t size);
+//     static bool isIntraSlice(int nalType, const uint8_t* slice, size_t size);
+//   };
+//
+// A frame starts at the first NAL unit after the previous frame and ends
+// with the last slice of its picture. The template is instantiated by the
+// codec parsers (helper_h264_parser.cpp, helper_h265_parser.cpp).
+
+struct HelperNalFrame {
+  bool isKeyFrame;
+  std::unique_ptr<uint8_t[]> buffer;
+  int bufferLen;
+};
+
+// A frame that points into the parser's memory. It stays valid as long as the
+// parser that returned it is alive for regular files, and until the next call
+// for pipes.
+struct HelperNalFrameView {
+  bool isKeyFrame;
+  const uint8_t* buffer;
+  int bufferLen;
+};
+
+// Parses Annex-B files, or pipes/FIFOs ("-" for stdin) which are read through
+// a bounded window and end instead of looping.
+template <typename Codec>
+class HelperNalFileParser {
+ public:
+  HelperNalFileParser(const char* filepath);
+  ~HelperNalFileParser();
+
+  std::unique_ptr<HelperNalFrame> getFrame();
+  // Same as getFrame() without allocating or copying the frame
+  bool getFrameView(HelperNalFrameView& view);
+  // readahead: advise the kernel that the file is read sequentially and
+  // prefetch the mapping ahead of the parse position
+  bool initialize(bool readahead = false);
+  void setFileParseRestart();
+  // True once a stream that cannot loop has been consumed
+  bool isEnd() const;
+  // The file is mapped: views stay valid as long as the parser
+  bool seekable() const { return stream_ && stream_->seekable(); }
+
+  // Locates frames through the frame index of the file, shared with the other
+  // parsers of the same file, instead of parsing slice headers. Call after
+  // initialize(); regular files only.
+  bool useFrameIndex();
+  // Continues from the key frame needed to decode frame |n|. Needs the index.
+  bool seekToFrame(size_t n);
+  // Number of the frame returned by the next call, 0 without the index
+  size_t currentFrame() const { return frame_number_; }
+
+ private:
+  static bool _buildIndex(const std::string& filepath, std::vector<HelperIndexedFrame>& frames);
+  bool _nextFrame(bool& is_key_frame, uint64_t& frame_start, size_t& frame_len);
+  bool _nextNal(HelperAnnexBNal& nal);
+  bool _endOfStream();
+  const uint8_t* _sliceHeader(const HelperAnnexBNal& nal, size_t& size) const;
+
+  std::string file_path_;
+  std::unique_ptr<HelperAnnexBStream> stream_;
+  HelperAnnexBNal pending_nal_;
+  bool has_pending_nal_{false};
+  std::shared_ptr<const HelperFrameIndex> index_;
+  size_t frame_number_{0};
+};
+
+// Media source reading the frames of an Annex-B file or pipe
+template <typename Codec>
+class HelperNalMediaSource : public HelperMediaSource {
+ public:
+  // frameIndex: locate the frames with the index of the file, see useFrameIndex()
+  HelperNalMediaSource(const char* filepath, bool frameIndex = false);
+
+  bool initialize() override;
+  bool readFrame(HelperMediaFrame& frame) override;
+  bool isEnd() const override { return parser_.isEnd(); }
+
+ private:
+  HelperNalFileParser<Codec> parser_;
+  bool frame_index_;
+};
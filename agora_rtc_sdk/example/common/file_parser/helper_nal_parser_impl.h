@@ -0,0 +1,269 @@
+#pragma once
+
+// Definitions of HelperNalFileParser, included by the codec parsers that
+// instantiate it.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common/log.h"
+#include "helper_nal_parser.h"
+
+template <typename Codec>
+HelperNalFileParser<Codec>::HelperNalFileParser(const char *filepath) : file_path_(filepath)
+{
+}
+
+template <typename Codec>
+HelperNalFileParser<Codec>::~HelperNalFileParser()
+{
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::initialize(bool readahead)
+{
+	std::unique_ptr<HelperAnnexBStream> stream(new HelperAnnexBStream(file_path_));
+	if (!stream->open(readahead)) {
+		return false;
+	}
+	AG_LOG(INFO, "Open %s %s %s successfully", Codec::name(),
+		   stream->seekable() ? "file" : "stream", file_path_.c_str());
+	stream_ = std::move(stream);
+	has_pending_nal_ = false;
+	frame_number_ = 0;
+	return true;
+}
+
+template <typename Codec>
+void HelperNalFileParser<Codec>::setFileParseRestart()
+{
+	if (stream_ && stream_->seek(0)) {
+		has_pending_nal_ = false;
+		frame_number_ = 0;
+	}
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::isEnd() const
+{
+	return !stream_ || (!stream_->seekable() && stream_->eof() && !has_pending_nal_);
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::_buildIndex(const std::string &filepath,
+											 std::vector<HelperIndexedFrame> &frames)
+{
+	HelperNalFileParser parser(filepath.c_str());
+	if (!parser.initialize(true)) {
+		return false;
+	}
+
+	bool is_key_frame = false;
+	uint64_t frame_start = 0;
+	size_t frame_len = 0;
+	// the parser rewinds once it reaches the end of the file
+	while (parser._nextFrame(is_key_frame, frame_start, frame_len)) {
+		HelperIndexedFrame frame;
+		frame.offset = frame_start;
+		frame.length = frame_len;
+		frame.keyFrame = 0;
+		frame.isKeyFrame = is_key_frame;
+		frames.push_back(frame);
+	}
+	return true;
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::useFrameIndex()
+{
+	if (!stream_ || !stream_->seekable()) {
+		return false;
+	}
+	std::shared_ptr<const HelperFrameIndex> index =
+			HelperFrameIndex::load(file_path_, Codec::name(), _buildIndex);
+	if (!index) {
+		return false;
+	}
+	const HelperIndexedFrame &last = index->frame(index->frameCount() - 1);
+	if (last.offset + last.length > stream_->size()) {
+		AG_LOG(ERROR, "Index of %s does not match the file", file_path_.c_str());
+		return false;
+	}
+	index_ = index;
+	setFileParseRestart();
+	return true;
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::seekToFrame(size_t n)
+{
+	if (!index_ || n >= index_->frameCount()) {
+		return false;
+	}
+	frame_number_ = index_->keyFrameFor(n);
+	return stream_->seek(index_->frame(frame_number_).offset);
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::_nextNal(HelperAnnexBNal &nal)
+{
+	// the first nalu of a frame is found while looking for the end of the previous one
+	if (has_pending_nal_) {
+		nal = pending_nal_;
+		has_pending_nal_ = false;
+		return true;
+	}
+	return stream_->nextNal(nal);
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::_endOfStream()
+{
+	if (stream_->seekable()) {
+		AG_LOG(INFO, "End of video file %s", file_path_.c_str());
+		setFileParseRestart();
+	} else {
+		AG_LOG(INFO, "End of video stream %s", file_path_.c_str());
+	}
+	return false;
+}
+
+template <typename Codec>
+const uint8_t *HelperNalFileParser<Codec>::_sliceHeader(const HelperAnnexBNal &nal,
+														size_t &size) const
+{
+	uint64_t begin = nal.header + Codec::kNalHeaderSize;
+	size = nal.end > begin ? nal.end - begin : 0;
+	return stream_->at(nal.header) + (size ? Codec::kNalHeaderSize : 0);
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::_nextFrame(bool &is_key, uint64_t &frame_start,
+											size_t &frame_len)
+{
+	HelperAnnexBNal nal;
+	int nal_type = 0;
+	int parameter_sets = 0;
+	const uint8_t *slice = nullptr;
+	size_t slice_size = 0;
+
+	if (isEnd()) {
+		return false;
+	}
+
+	if (index_) {
+		const HelperIndexedFrame &frame = index_->frame(frame_number_);
+		is_key = frame.isKeyFrame;
+		frame_start = frame.offset;
+		frame_len = frame.length;
+		frame_number_ = index_->nextFrame(frame_number_);
+		stream_->seek(frame_number_ ? frame_start + frame_len : 0);
+		return true;
+	}
+
+	// get first nalu for frame_start
+	if (!_nextNal(nal)) {
+		return _endOfStream();
+	}
+	frame_start = nal.start;
+	stream_->release(frame_start);
+
+	// parameter sets, SEI, ... up to the first slice of the picture
+	nal_type = Codec::nalType(stream_->at(nal.header));
+	while (!Codec::isSlice(nal_type)) {
+		parameter_sets |= Codec::parameterSet(nal_type);
+		if (!_nextNal(nal)) {
+			return _endOfStream();
+		}
+		nal_type = Codec::nalType(stream_->at(nal.header));
+	}
+
+	// a key frame must be decodable with nothing but this access unit
+	slice = _sliceHeader(nal, slice_size);
+	is_key = (parameter_sets & Codec::kKeyFrameParameterSets) == Codec::kKeyFrameParameterSets &&
+			 Codec::isIntraSlice(nal_type, slice, slice_size);
+	uint64_t frame_end = nal.end;
+
+	// the remaining slices of the picture, up to the first nalu of the next frame
+	while (stream_->nextNal(nal)) {
+		nal_type = Codec::nalType(stream_->at(nal.header));
+		slice = _sliceHeader(nal, slice_size);
+		if (!Codec::isSlice(nal_type) || Codec::isFirstSlice(nal_type, slice, slice_size)) {
+			pending_nal_ = nal;
+			has_pending_nal_ = true;
+			break;
+		}
+		frame_end = nal.end;
+	}
+
+	frame_len = frame_end - frame_start;
+	return true;
+}
+
+template <typename Codec>
+std::unique_ptr<HelperNalFrame> HelperNalFileParser<Codec>::getFrame()
+{
+	std::unique_ptr<HelperNalFrame> frame = nullptr;
+	bool is_key_frame = false;
+	uint64_t frame_start = 0;
+	size_t frame_len = 0;
+
+	if (_nextFrame(is_key_frame, frame_start, frame_len)) {
+		int datalen = frame_len;
+		std::unique_ptr<uint8_t[]> buffer(new uint8_t[datalen]);
+		memcpy(buffer.get(), stream_->at(frame_start), datalen);
+		frame.reset(new HelperNalFrame{ is_key_frame, std::move(buffer), datalen });
+	}
+	return frame;
+}
+
+template <typename Codec>
+bool HelperNalFileParser<Codec>::getFrameView(HelperNalFrameView &view)
+{
+	bool is_key_frame = false;
+	uint64_t frame_start = 0;
+	size_t frame_len = 0;
+
+	if (!_nextFrame(is_key_frame, frame_start, frame_len)) {
+		return false;
+	}
+	view.isKeyFrame = is_key_frame;
+	view.buffer = stream_->at(frame_start);
+	view.bufferLen = frame_len;
+	return true;
+}
+
+template <typename Codec>
+HelperNalMediaSource<Codec>::HelperNalMediaSource(const char *filepath, bool frameIndex)
+	: parser_(filepath), frame_index_(frameIndex)
+{
+}
+
+template <typename Codec>
+bool HelperNalMediaSource<Codec>::initialize()
+{
+	if (!parser_.initialize(true)) {
+		return false;
+	}
+	if (frame_index_ && !parser_.useFrameIndex()) {
+		AG_LOG(ERROR, "Failed to index video file, parsing it instead");
+	}
+	return true;
+}
+
+template <typename Codec>
+bool HelperNalMediaSource<Codec>::readFrame(HelperMediaFrame &frame)
+{
+	HelperNalFrameView view;
+	if (!parser_.getFrameView(view)) {
+		return false;
+	}
+	// a pipe window moves on, only a mapped file can be handed out as is
+	if (parser_.seekable()) {
+		frame.view(view.buffer, view.bufferLen);
+	} else {
+		frame.assign(view.buffer, view.bufferLen);
+	}
+	frame.isKeyFrame = view.isKeyFrame;
+	return true;
+}
@@ -0,0 +1,158 @@
+#include "helper_nal_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NAL_SCANNER_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NAL_SCANNER_NEON 1
+#endif
+
+size_t find_start_code_scalar(const uint8_t* buf, size_t size, size_t from) {
+  if (size < 3) {
+    return size;
+  }
+  for (size_t i = from; i + 3 <= size; i++) {
+    if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1) {
+      return i;
+    }
+  }
+  return size;
+}
+
+#if defined(NAL_SCANNER_X86)
+
+// Each lane i of the mask is set when buf[i] == 0 && buf[i + 1] == 0 &&
+// buf[i + 2] == 1, so a chunk needs 2 bytes of lookahead.
+static size_t find_start_code_sse2(const uint8_t* buf, size_t size, size_t from) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  size_t i = from;
+  for (; i + 16 + 2 <= size; i += 16) {
+    __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i));
+    // most chunks have no zero byte at all, skip them with a single compare
+    int zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(b0, zero));
+    if (!zeros) {
+      continue;
+    }
+    __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i + 1));
+    __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + i + 2));
+    int mask = zeros & _mm_movemask_epi8(_mm_cmpeq_epi8(b1, zero)) &
+               _mm_movemask_epi8(_mm_cmpeq_epi8(b2, one));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return find_start_code_scalar(buf, size, i);
+}
+
+__attribute__((target("avx2"))) static size_t find_start_code_avx2(const uint8_t* buf,
+                                                                    size_t size, size_t from) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  size_t i = from;
+  for (; i + 32 + 2 <= size; i += 32) {
+    __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i));
+    uint32_t zeros = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b0, zero)));
+    if (!zeros) {
+      continue;
+    }
+    __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i + 1));
+    __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf + i + 2));
+    uint32_t mask = zeros &
+                    static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b1, zero))) &
+                    static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(b2, one)));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return find_start_code_sse2(buf, size, i);
+}
+
+#elif defined(NAL_SCANNER_NEON)
+
+static size_t find_start_code_neon(const uint8_t* buf, size_t size, size_t from) {
+  const uint8x16_t zero = vdupq_n_u8(0);
+  const uint8x16_t one = vdupq_n_u8(1);
+  size_t i = from;
+  for (; i + 16 + 2 <= size; i += 16) {
+    uint8x16_t m = vceqq_u8(vld1q_u8(buf + i), zero);
+    m = vandq_u8(m, vceqq_u8(vld1q_u8(buf + i + 1), zero));
+    m = vandq_u8(m, vceqq_u8(vld1q_u8(buf + i + 2), one));
+    // narrow to 4 bits per lane, NEON has no movemask
+    uint64_t bits =
+        vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+    if (bits) {
+      return i + (__builtin_ctzll(bits) >> 2);
+    }
+  }
+  return find_start_code_scalar(buf, size, i);
+}
+
+#endif
+
+typedef size_t (*find_start_code_fn)(const uint8_t*, size_t, size_t);
+
+static find_start_code_fn select_find_start_code(const char** name) {
+#if defined(NAL_SCANNER_X86)
+  // may run from a static constructor, before the CPU model is initialized
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    *name = "avx2";
+    return find_start_code_avx2;
+  }
+  *name = "sse2";
+  return find_start_code_sse2;
+#elif defined(NAL_SCANNER_NEON)
+  *name = "neon";
+  return find_start_code_neon;
+#else
+  *name = "scalar";
+  return find_start_code_scalar;
+#endif
+}
+
+struct NalScannerImpl {
+  NalScannerImpl() : fn(select_find_start_code(&name)) {}
+  const char* name;
+  find_start_code_fn fn;
+};
+
+static const NalScannerImpl& nal_scanner_impl() {
+  static const NalScannerImpl impl;
+  return impl;
+}
+
+size_t find_start_code(const uint8_t* buf, size_t size, size_t from) {
+  if (size < 3 || from > size - 3) {
+    return size;
+  }
+  return nal_scanner_impl().fn(buf, size, from);
+}
+
+size_t find_nal_units(const uint8_t* buf, size_t size, std::vector<HelperNalUnit>& units) {
+  size_t found = 0;
+  size_t pos = find_start_code(buf, size, 0);
+  while (pos < size) {
+    HelperNalUnit unit;
+    // a zero in front makes it a 4-byte start code
+    unit.start = (pos > 0 && buf[pos - 1] == 0) ? pos - 1 : pos;
+    unit.header = pos + 3;
+    if (found) {
+      HelperNalUnit& prev = units.back();
+      if (unit.start < prev.header) {
+        unit.start = prev.header;
+      }
+      prev.end = unit.start;
+    }
+    unit.end = size;
+    units.push_back(unit);
+    ++found;
+    pos = find_start_code(buf, size, unit.header);
+  }
+  return found;
+}
+
+const char* nal_scanner_impl_name() {
+  return nal_scanner_impl().name;
+}
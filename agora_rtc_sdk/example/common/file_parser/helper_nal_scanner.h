@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Annex-B start code (00 00 01 / 00 00 00 01) scanner shared by the NAL
+// parsers. The search runs 16/32 bytes at a time using zero-byte masks
+// (SSE2, AVX2 when the CPU supports it, NEON on ARM) and falls back to a byte
+// loop elsewhere and on the buffer tail.
+
+struct HelperNalUnit {
+  size_t start;   // offset of the first byte of the start code
+  size_t header;  // offset of the NAL header (first byte after the start code)
+  size_t end;     // offset one past the last payload byte
+};
+
+// Returns the offset of the first "00 00 01" at or after |from| whose three
+// bytes lie inside |size|, or |size| if there is none.
+size_t find_start_code(const uint8_t* buf, size_t size, size_t from = 0);
+
+// Byte-by-byte reference implementation of find_start_code().
+size_t find_start_code_scalar(const uint8_t* buf, size_t size, size_t from = 0);
+
+// Splits a whole buffer into NAL units. Units are appended to |units|; the
+// last one extends to the end of the buffer. Returns the number of units found.
+size_t find_nal_units(const uint8_t* buf, size_t size, std::vector<HelperNalUnit>& units);
+
+// Name of the start code search implementation selected for this CPU.
+const char* nal_scanner_impl_name();
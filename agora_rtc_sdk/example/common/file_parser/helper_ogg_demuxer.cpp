@@ -0,0 +1,270 @@
+#include "helper_ogg_demuxer.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/log.h"
+
+#define OGG_PAGE_HEADER_SIZE (27)
+#define OGG_FLAG_CONTINUED (0x01)
+#define OGG_FLAG_BOS (0x02)
+#define OPUS_HEAD_SIZE (19)
+// 120 ms at 48 kHz, the longest Opus packet
+#define OPUS_MAX_PACKET_SAMPLES (5760)
+
+static uint32_t read_le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static int64_t read_le64(const uint8_t* p) {
+  return static_cast<int64_t>(read_le32(p) | (static_cast<uint64_t>(read_le32(p + 4)) << 32));
+}
+
+int opus_packet_samples(const uint8_t* packet, int length) {
+  if (length < 1) {
+    return 0;
+  }
+  // frame size from the configuration in the TOC byte
+  int config = packet[0] >> 3;
+  int frame_samples;
+  if (config < 12) {
+    // SILK: 10, 20, 40, 60 ms
+    static const int silk[] = {480, 960, 1920, 2880};
+    frame_samples = silk[config & 3];
+  } else if (config < 16) {
+    // Hybrid: 10, 20 ms
+    frame_samples = (config & 1) ? 960 : 480;
+  } else {
+    // CELT: 2.5, 5, 10, 20 ms
+    frame_samples = 120 << (config & 3);
+  }
+
+  int frames;
+  switch (packet[0] & 3) {
+    case 0:
+      frames = 1;
+      break;
+    case 1:
+    case 2:
+      frames = 2;
+      break;
+    default:
+      if (length < 2) {
+        return 0;
+      }
+      frames = packet[1] & 0x3f;
+      break;
+  }
+  int samples = frame_samples * frames;
+  return samples <= OPUS_MAX_PACKET_SAMPLES ? samples : 0;
+}
+
+HelperOggOpusDemuxer::HelperOggOpusDemuxer(const char* filepath) : file_path_(filepath) {}
+
+HelperOggOpusDemuxer::~HelperOggOpusDemuxer() {
+  if (data_) {
+    if (munmap(const_cast<uint8_t*>(data_), size_) == -1) {
+      perror("munmap");
+    }
+  }
+}
+
+bool HelperOggOpusDemuxer::initialize() {
+  int fd;
+  struct stat sb;
+  void* mapped;
+
+  if ((fd = open(file_path_.c_str(), O_RDONLY)) < 0) {
+    perror(file_path_.c_str());
+    return false;
+  }
+
+  // get the file property
+  if ((fstat(fd, &sb)) == -1) {
+    perror("fstat");
+    close(fd);
+    return false;
+  }
+
+  // map the file to process address space
+  if (sb.st_size == 0 ||
+      (mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return false;
+  }
+  close(fd);
+  madvise(mapped, sb.st_size, MADV_SEQUENTIAL);
+
+  data_ = static_cast<const uint8_t*>(mapped);
+  size_ = sb.st_size;
+
+  if (!readHeaders()) {
+    AG_LOG(ERROR, "No Opus stream in %s", file_path_.c_str());
+    return false;
+  }
+  AG_LOG(INFO, "Open opus file %s successfully, %d channels", file_path_.c_str(), channels_);
+  return true;
+}
+
+bool HelperOggOpusDemuxer::readHeaders() {
+  // OpusHead is alone on the first page (BOS) of its logical stream
+  for (size_t offset = 0; offset + OGG_PAGE_HEADER_SIZE <= size_;) {
+    const uint8_t* page = data_ + offset;
+    if (memcmp(page, "OggS", 4) != 0) {
+      ++offset;
+      continue;
+    }
+    int segments = page[26];
+    size_t body = offset + OGG_PAGE_HEADER_SIZE + segments;
+    size_t length = 0;
+    for (int i = 0; i < segments && body <= size_; i++) {
+      length += page[OGG_PAGE_HEADER_SIZE + i];
+    }
+    if (body + length > size_) {
+      return false;
+    }
+    if ((page[5] & OGG_FLAG_BOS) && length >= OPUS_HEAD_SIZE &&
+        memcmp(data_ + body, "OpusHead", 8) == 0) {
+      const uint8_t* head = data_ + body;
+      serial_ = read_le32(page + 14);
+      channels_ = head[9];
+      pre_skip_ = head[10] | (head[11] << 8);
+      input_sample_rate_ = read_le32(head + 12);
+      page_offset_ = body + length;
+      break;
+    }
+    offset = body + length;
+  }
+  if (!channels_) {
+    return false;
+  }
+
+  // OpusTags may span several pages, audio starts on the page after it
+  packets_.clear();
+  while (packets_.empty()) {
+    if (!readPage()) {
+      return false;
+    }
+  }
+  first_audio_page_ = page_offset_;
+  rewind();
+  return true;
+}
+
+void HelperOggOpusDemuxer::rewind() {
+  page_offset_ = first_audio_page_;
+  packets_.clear();
+  next_packet_ = 0;
+  partial_.clear();
+  last_granule_ = 0;
+}
+
+bool HelperOggOpusDemuxer::readPage() {
+  while (page_offset_ + OGG_PAGE_HEADER_SIZE <= size_) {
+    const uint8_t* page = data_ + page_offset_;
+    if (memcmp(page, "OggS", 4) != 0 || page[4] != 0) {
+      // lost sync, look for the next capture pattern
+      const void* next = memmem(page + 1, size_ - page_offset_ - 1, "OggS", 4);
+      page_offset_ = next ? static_cast<const uint8_t*>(next) - data_ : size_;
+      continue;
+    }
+
+    uint8_t flags = page[5];
+    int64_t granule = read_le64(page + 6);
+    uint32_t serial = read_le32(page + 14);
+    int segments = page[26];
+    const uint8_t* lacing = page + OGG_PAGE_HEADER_SIZE;
+    size_t body = page_offset_ + OGG_PAGE_HEADER_SIZE + segments;
+    size_t length = 0;
+    if (body > size_) {
+      break;
+    }
+    for (int i = 0; i < segments; i++) {
+      length += lacing[i];
+    }
+    if (body + length > size_) {
+      AG_LOG(ERROR, "Truncated ogg page at %zu in %s", page_offset_, file_path_.c_str());
+      break;
+    }
+    page_offset_ = body + length;
+    if (serial != serial_) {
+      continue;
+    }
+
+    // the first packet continues one from the previous page, unless we
+    // lost that part (e.g. after a rewind), then it is dropped
+    bool continued = (flags & OGG_FLAG_CONTINUED) != 0;
+    bool drop_first = continued && partial_.empty();
+    if (!continued) {
+      partial_.clear();
+    }
+
+    packets_.clear();
+    next_packet_ = 0;
+    size_t start = body;
+    size_t pos = body;
+    for (int i = 0; i < segments; i++) {
+      pos += lacing[i];
+      if (lacing[i] == 255) {
+        continue;
+      }
+      // a lacing value below 255 ends the packet
+      if (drop_first) {
+        drop_first = false;
+      } else if (!partial_.empty()) {
+        assembled_.assign(partial_.begin(), partial_.end());
+        assembled_.insert(assembled_.end(), data_ + start, data_ + pos);
+        partial_.clear();
+        packets_.push_back({0, static_cast<int>(assembled_.size()), -1, true});
+      } else if (pos > start) {
+        packets_.push_back({start, static_cast<int>(pos - start), -1, false});
+      }
+      start = pos;
+    }
+    if (start < pos && !drop_first) {
+      // the last packet continues on the next page
+      partial_.insert(partial_.end(), data_ + start, data_ + pos);
+    }
+    if (packets_.empty()) {
+      continue;
+    }
+
+    // the page granule is the end of its last completed packet
+    int64_t end = granule;
+    if (end == -1) {
+      end = last_granule_;
+      for (const PagePacket& packet : packets_) {
+        const uint8_t* p = packet.assembled ? assembled_.data() : data_ + packet.offset;
+        end += opus_packet_samples(p, packet.length);
+      }
+    }
+    last_granule_ = end;
+    for (size_t i = packets_.size(); i-- > 0;) {
+      PagePacket& packet = packets_[i];
+      const uint8_t* p = packet.assembled ? assembled_.data() : data_ + packet.offset;
+      packet.granulePosition = end;
+      end -= opus_packet_samples(p, packet.length);
+    }
+    return true;
+  }
+  return false;
+}
+
+bool HelperOggOpusDemuxer::nextPacket(HelperOggPacket& packet) {
+  while (next_packet_ >= packets_.size()) {
+    if (!readPage()) {
+      return false;
+    }
+  }
+  const PagePacket& next = packets_[next_packet_++];
+  packet.data = next.assembled ? assembled_.data() : data_ + next.offset;
+  packet.length = next.length;
+  packet.granulePosition = next.granulePosition;
+  packet.samples = opus_packet_samples(packet.data, packet.length);
+  packet.mapped = !next.assembled;
+  return true;
+}
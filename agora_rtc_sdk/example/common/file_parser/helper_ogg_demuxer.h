@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Ogg/Opus demuxer over a mapped file.
+//
+// Packets are returned as spans into the mapping, nothing is decoded. Only a
+// packet continued across pages is assembled, into a buffer owned by the
+// demuxer. The first Opus logical stream of the file is used.
+
+struct HelperOggPacket {
+  const uint8_t* data;
+  int length;
+  // granule position (48 kHz samples) at the end of the packet
+  int64_t granulePosition;
+  // duration of the packet in 48 kHz samples, from its TOC byte
+  int samples;
+  // |data| is in the mapping and stays valid as long as the demuxer, not
+  // only until the next call
+  bool mapped;
+};
+
+class HelperOggOpusDemuxer {
+ public:
+  explicit HelperOggOpusDemuxer(const char* filepath);
+  ~HelperOggOpusDemuxer();
+
+  // Maps the file and reads the OpusHead/OpusTags headers
+  bool initialize();
+
+  // Returns the next audio packet, false at the end of the stream. The
+  // packet stays valid until the next call.
+  bool nextPacket(HelperOggPacket& packet);
+  // Continues from the first audio packet
+  void rewind();
+
+  int channels() const { return channels_; }
+  int inputSampleRate() const { return input_sample_rate_; }
+  // samples to drop from the start of the decoded stream
+  int preSkip() const { return pre_skip_; }
+
+ private:
+  struct PagePacket {
+    size_t offset;  // in the file, unless the packet was assembled
+    int length;
+    int64_t granulePosition;
+    bool assembled;
+  };
+
+  bool readPage();
+  bool readHeaders();
+
+  std::string file_path_;
+  const uint8_t* data_{nullptr};
+  size_t size_{0};
+
+  uint32_t serial_{0};
+  size_t first_audio_page_{0};
+  int channels_{0};
+  int input_sample_rate_{0};
+  int pre_skip_{0};
+
+  size_t page_offset_{0};  // next page to read
+  std::vector<PagePacket> packets_;  // packets completed by the current page
+  size_t next_packet_{0};
+  std::vector<uint8_t> partial_;    // packet continued from previous pages
+  std::vector<uint8_t> assembled_;  // the assembled packet being returned
+  int64_t last_granule_{0};
+};
+
+// Number of 48 kHz samples in an Opus packet, 0 if the packet is invalid
+int opus_packet_samples(const uint8_t* packet, int length);
@@ -0,0 +1,233 @@
+#include "helper_ogg_opus_writer.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "common/log.h"
+
+#define OGG_OPUS_GRANULE_RATE (48000)
+#define OGG_OPUS_FRAME_MS (20)
+// pages are written at least this often
+#define OGG_OPUS_PAGE_MS (1000)
+// about half the CPU of the default 10 for little loss, many users share a thread
+#define OGG_OPUS_COMPLEXITY (5)
+// recommended by libopus for a single frame
+#define OGG_OPUS_MAX_PACKET (1500)
+
+static void put_le16(std::vector<uint8_t>& out, uint32_t value) {
+  out.push_back(static_cast<uint8_t>(value));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+static void put_le32(std::vector<uint8_t>& out, uint32_t value) {
+  put_le16(out, value & 0xFFFF);
+  put_le16(out, value >> 16);
+}
+
+static bool is_opus_rate(int sampleRate) {
+  return sampleRate == 8000 || sampleRate == 12000 || sampleRate == 16000 ||
+         sampleRate == 24000 || sampleRate == 48000;
+}
+
+HelperOggOpusWriter::HelperOggOpusWriter(PageSink sink, int bitrateBps)
+    : sink_(std::move(sink)), bitrate_bps_(bitrateBps), random_(std::random_device()()) {}
+
+HelperOggOpusWriter::~HelperOggOpusWriter() {
+  finish();
+  if (encoder_) {
+    opus_encoder_destroy(encoder_);
+  }
+}
+
+int64_t HelperOggOpusWriter::streamMs() const {
+  return started_ ? input_samples_ * 1000 / sample_rate_ : 0;
+}
+
+bool HelperOggOpusWriter::write(const int16_t* pcm, int samplesPerChannel, int sampleRate,
+                                int channels) {
+  if (!pcm || samplesPerChannel <= 0) {
+    return false;
+  }
+  if (started_ && (sampleRate != sample_rate_ || channels != channels_)) {
+    finish();
+  }
+  if (!started_ && !startStream(sampleRate, channels)) {
+    return false;
+  }
+  input_samples_ += samplesPerChannel;
+
+  size_t frameValues = static_cast<size_t>(frame_samples_) * channels_;
+  size_t values = static_cast<size_t>(samplesPerChannel) * channels_;
+
+  // complete the frame started by the previous blocks
+  if (!pending_.empty()) {
+    size_t take = std::min(frameValues - pending_.size(), values);
+    pending_.insert(pending_.end(), pcm, pcm + take);
+    pcm += take;
+    values -= take;
+    if (pending_.size() < frameValues) {
+      return true;
+    }
+    bool encoded = encodeFrame(pending_.data(), false);
+    pending_.clear();
+    if (!encoded) {
+      return false;
+    }
+  }
+
+  // whole frames are encoded straight from the caller's buffer
+  for (; values >= frameValues; pcm += frameValues, values -= frameValues) {
+    if (!encodeFrame(pcm, false)) {
+      return false;
+    }
+  }
+  pending_.assign(pcm, pcm + values);
+  return true;
+}
+
+void HelperOggOpusWriter::finish() {
+  if (!started_) {
+    return;
+  }
+
+  // Encode until the decoder delay is covered: the last frame is padded with
+  // silence and its granule position tells the player where the audio ends
+  int step = frame_samples_ * (OGG_OPUS_GRANULE_RATE / sample_rate_);
+  int64_t end = pre_skip_ + input_samples_ * (OGG_OPUS_GRANULE_RATE / sample_rate_);
+  pending_.resize(static_cast<size_t>(frame_samples_) * channels_, 0);
+  while (granule_ < end) {
+    if (!encodeFrame(pending_.data(), granule_ + step >= end)) {
+      outputPages(true);
+      break;
+    }
+    std::fill(pending_.begin(), pending_.end(), 0);
+  }
+  pending_.clear();
+
+  ogg_stream_clear(&ogg_);
+  started_ = false;
+}
+
+bool HelperOggOpusWriter::startStream(int sampleRate, int channels) {
+  if (!is_opus_rate(sampleRate) || channels < 1 || channels > 2) {
+    AG_LOG(ERROR, "Opus cannot encode %d Hz audio with %d channels", sampleRate, channels);
+    return false;
+  }
+
+  if (encoder_ && sampleRate == sample_rate_ && channels == channels_) {
+    opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+  } else {
+    if (encoder_) {
+      opus_encoder_destroy(encoder_);
+    }
+    int error = OPUS_OK;
+    encoder_ = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_AUDIO, &error);
+    if (error != OPUS_OK) {
+      AG_LOG(ERROR, "Failed to create Opus encoder: %s", opus_strerror(error));
+      encoder_ = nullptr;
+      return false;
+    }
+    // 20x less than PCM for 16 kHz speech, 30x for 48 kHz
+    int bitrate = bitrate_bps_ ? bitrate_bps_ : (sampleRate <= 16000 ? 12000 : 24000) * channels;
+    opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(OGG_OPUS_COMPLEXITY));
+    sample_rate_ = sampleRate;
+    channels_ = channels;
+    frame_samples_ = sampleRate * OGG_OPUS_FRAME_MS / 1000;
+  }
+
+  int lookahead = 0;
+  opus_encoder_ctl(encoder_, OPUS_GET_LOOKAHEAD(&lookahead));
+  pre_skip_ = lookahead * (OGG_OPUS_GRANULE_RATE / sampleRate);
+
+  ogg_stream_init(&ogg_, static_cast<int>(random_()));
+  started_ = true;
+  boundary_ = true;
+  packet_no_ = 0;
+  input_samples_ = 0;
+  granule_ = 0;
+  page_granule_ = 0;
+  stream_bytes_ = 0;
+  pending_.clear();
+
+  ogg_packet op;
+  memset(&op, 0, sizeof(op));
+
+  // the ID header is alone on the first page
+  packet_.clear();
+  packet_.insert(packet_.end(), {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1});
+  packet_.push_back(static_cast<uint8_t>(channels));
+  put_le16(packet_, pre_skip_);
+  put_le32(packet_, sampleRate);
+  put_le16(packet_, 0);  // output gain
+  packet_.push_back(0);  // mapping family: mono or stereo
+  op.packet = packet_.data();
+  op.bytes = packet_.size();
+  op.b_o_s = 1;
+  op.packetno = packet_no_++;
+  ogg_stream_packetin(&ogg_, &op);
+  outputPages(true);
+
+  // the comment header ends its page too
+  const char* vendor = opus_get_version_string();
+  packet_.clear();
+  packet_.insert(packet_.end(), {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'});
+  put_le32(packet_, strlen(vendor));
+  packet_.insert(packet_.end(), vendor, vendor + strlen(vendor));
+  put_le32(packet_, 0);  // no user comment
+  op.packet = packet_.data();
+  op.bytes = packet_.size();
+  op.b_o_s = 0;
+  op.packetno = packet_no_++;
+  ogg_stream_packetin(&ogg_, &op);
+  outputPages(true);
+  return true;
+}
+
+bool HelperOggOpusWriter::encodeFrame(const int16_t* pcm, bool last) {
+  packet_.resize(OGG_OPUS_MAX_PACKET);
+  opus_int32 bytes = opus_encode(encoder_, pcm, frame_samples_, packet_.data(), packet_.size());
+  if (bytes < 0) {
+    AG_LOG(ERROR, "Failed to encode Opus frame: %s", opus_strerror(bytes));
+    return false;
+  }
+  granule_ += frame_samples_ * (OGG_OPUS_GRANULE_RATE / sample_rate_);
+
+  ogg_packet op;
+  memset(&op, 0, sizeof(op));
+  op.packet = packet_.data();
+  op.bytes = bytes;
+  op.e_o_s = last;
+  // the last packet drops the padding from the end of the audio
+  op.granulepos =
+      last ? pre_skip_ + input_samples_ * (OGG_OPUS_GRANULE_RATE / sample_rate_) : granule_;
+  op.packetno = packet_no_++;
+  ogg_stream_packetin(&ogg_, &op);
+
+  outputPages(last ||
+              granule_ - page_granule_ >= OGG_OPUS_GRANULE_RATE / 1000 * OGG_OPUS_PAGE_MS);
+  return true;
+}
+
+void HelperOggOpusWriter::outputPages(bool flush) {
+  ogg_page page;
+  while (ogg_stream_pageout(&ogg_, &page)) {
+    outputPage(page);
+  }
+  while (flush && ogg_stream_flush(&ogg_, &page)) {
+    outputPage(page);
+  }
+}
+
+void HelperOggOpusWriter::outputPage(const ogg_page& page) {
+  int64_t granule = ogg_page_granulepos(&page);
+  if (granule > 0) {
+    page_granule_ = granule;
+  }
+  stream_bytes_ += page.header_len + page.body_len;
+  page_.assign(page.header, page.header + page.header_len);
+  page_.insert(page_.end(), page.body, page.body + page.body_len);
+  sink_(page_.data(), page_.size(), boundary_);
+  boundary_ = false;
+}
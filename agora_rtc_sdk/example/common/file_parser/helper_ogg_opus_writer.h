@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "ogg/ogg.h"
+#include "opus/opus.h"
+
+// Encodes 16-bit PCM with libopus into an Ogg Opus stream (RFC 7845).
+//
+// The PCM is gathered into 20 ms frames whatever the length of the blocks
+// written. Pages go to |sink| as libogg completes them, and at least every
+// second, so a recording that is killed loses little. finish() ends the
+// logical stream; the next write() starts a new one with its own headers,
+// whose first page is flagged as a boundary where a file may be cut.
+// Not thread-safe: feed it from one thread.
+
+class HelperOggOpusWriter {
+ public:
+  // Called once per page, header and body together, so that a sink dropping
+  // data under backpressure drops whole pages
+  typedef std::function<void(const uint8_t* data, size_t length, bool boundary)> PageSink;
+
+  // |bitrateBps| 0 picks one from the sample rate and channels
+  explicit HelperOggOpusWriter(PageSink sink, int bitrateBps = 0);
+  ~HelperOggOpusWriter();
+
+  // Interleaved samples, 1 or 2 channels at 8, 12, 16, 24 or 48 kHz. A change
+  // of format ends the stream and starts a new one.
+  bool write(const int16_t* pcm, int samplesPerChannel, int sampleRate, int channels);
+
+  // Encodes the buffered samples padded with silence, and ends the stream
+  void finish();
+
+  // Bytes of the current stream given to the sink, headers included
+  uint64_t streamBytes() const { return stream_bytes_; }
+  // Duration of the PCM written to the current stream
+  int64_t streamMs() const;
+
+ private:
+  bool startStream(int sampleRate, int channels);
+  bool encodeFrame(const int16_t* pcm, bool last);
+  void outputPages(bool flush);
+  void outputPage(const ogg_page& page);
+
+  PageSink sink_;
+  int bitrate_bps_;
+  std::mt19937 random_;
+
+  OpusEncoder* encoder_{nullptr};
+  int sample_rate_{0};
+  int channels_{0};
+  int frame_samples_{0};  // per channel, at the input rate
+
+  bool started_{false};
+  ogg_stream_state ogg_;
+  int pre_skip_{0};                // 48 kHz samples
+  std::vector<int16_t> pending_;   // less than one frame
+  std::vector<uint8_t> packet_;
+  std::vector<uint8_t> page_;      // header and body of the page output
+  int64_t packet_no_{0};
+  int64_t input_samples_{0};       // per channel, at the input rate
+  int64_t granule_{0};             // end of the last packet, 48 kHz
+  int64_t page_granule_{0};        // end of the last page
+  uint64_t stream_bytes_{0};
+  bool boundary_{false};           // the next page starts the stream
+};
@@ -1,8 +1,9 @@
+#include <memory>
 #include <string>
 
 #include "AgoraBase.h"
-
-class OggOpusFileParser;
+#include "helper_media_source.h"
+#include "helper_ogg_demuxer.h"
 
 struct HelperAudioFrame {
   agora::rtc::EncodedAudioFrameInfo audioFrameInfo;
@@ -16,9 +17,23 @@ class HelperOpusFileParser {
   ~HelperOpusFileParser();
   bool initialize();
   std::unique_ptr<HelperAudioFrame> getAudioFrame(int frameSizeDuration);
+  // Next Opus packet as a span into the file, without decoding or copying it.
+  // Loops at the end of the file. The packet stays valid until the next call.
+  bool getAudioPacket(HelperOggPacket& packet, agora::rtc::EncodedAudioFrameInfo& audioFrameInfo);
 
  private:
   std::string file_path;
-  std::unique_ptr<OggOpusFileParser> file_parser_;
-  int64_t sent_audio_frames_{0};
+  std::unique_ptr<HelperOggOpusDemuxer> demuxer_;
+};
+
+// Media source reading the packets of an Ogg/Opus file
+class HelperOpusMediaSource : public HelperMediaSource {
+ public:
+  HelperOpusMediaSource(const char* filepath) : parser_(filepath) {}
+
+  bool initialize() override { return parser_.initialize(); }
+  bool readFrame(HelperMediaFrame& frame) override;
+
+ private:
+  HelperOpusFileParser parser_;
 };
@@ -0,0 +1,398 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "sample_spsc_ring.h"
+
+// lines a thread may have waiting to be written, the next ones are dropped
+#define LOG_THREAD_RECORDS (1024)
+// the background thread writes the lines this often
+#define LOG_DRAIN_INTERVAL_MS (20)
+
+namespace sample_log {
+
+namespace {
+
+enum State { kIdle, kRunning, kStopped };
+std::atomic<int> state{kIdle};
+
+struct ThreadBuffer {
+  ThreadBuffer() : ring(LOG_THREAD_RECORDS) {}
+  SampleSpscRing<Record> ring;
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> closed{false};
+};
+
+// Marks the buffer of a thread closed when the thread exits; the logger
+// removes it once it is empty
+struct ThreadHolder {
+  std::shared_ptr<ThreadBuffer> buffer;
+  ~ThreadHolder();
+};
+
+thread_local ThreadBuffer* threadBuffer = nullptr;
+thread_local bool threadExited = false;
+thread_local ThreadHolder threadHolder;
+
+ThreadHolder::~ThreadHolder() {
+  threadBuffer = nullptr;
+  threadExited = true;
+  if (buffer) {
+    buffer->closed = true;
+  }
+}
+
+uint64_t argValue(const uint8_t*& arg, int& size) {
+  size = arg[1];
+  int64_t value;
+  memcpy(&value, arg + 2, sizeof(value));
+  arg += 2 + sizeof(value);
+  return static_cast<uint64_t>(value);
+}
+
+// snprintf of |spec| with the values of its * fields, then |value|
+template <typename T>
+void printArg(std::string& out, const std::string& spec, const int* stars, int starCount,
+              T value) {
+  char buffer[512];
+  int written = starCount == 2 ? snprintf(buffer, sizeof(buffer), spec.c_str(), stars[0],
+                                          stars[1], value)
+                : starCount == 1 ? snprintf(buffer, sizeof(buffer), spec.c_str(), stars[0], value)
+                                 : snprintf(buffer, sizeof(buffer), spec.c_str(), value);
+  if (written > 0) {
+    out.append(buffer, std::min<size_t>(written, sizeof(buffer) - 1));
+  }
+}
+
+// Formats the next argument with |spec|, the conversion so far without its
+// |length| modifier: the values were widened to 64 bits and double
+void formatArg(std::string& out, std::string& spec, char conversion, char length,
+               const uint8_t*& arg, const uint8_t* end, const int* stars, int starCount) {
+  uint8_t type = arg < end ? arg[0] : 0xff;
+  if (strchr("diouxXc", conversion) && (type == kSigned || type == kUnsigned)) {
+    int size;
+    uint64_t value = argValue(arg, size);
+    // smaller types were promoted to int, a length modifier narrows the value
+    // as printf would
+    if (length == 'H') {
+      size = 1;
+    } else if (length == 'h') {
+      size = 2;
+    } else {
+      size = std::max(size, 4);
+    }
+    int bits = size * 8;
+    if (conversion == 'c') {
+      spec += 'c';
+      printArg(out, spec, stars, starCount, static_cast<int>(value));
+      return;
+    }
+    if (bits < 64) {
+      value &= (1ULL << bits) - 1;
+      if (conversion == 'd' || conversion == 'i') {
+        uint64_t sign = 1ULL << (bits - 1);
+        value = (value ^ sign) - sign;
+      }
+    }
+    spec += "ll";
+    spec += conversion;
+    printArg(out, spec, stars, starCount, static_cast<long long>(value));
+  } else if (strchr("fFeEgGaA", conversion) && type == kDouble) {
+    double value;
+    memcpy(&value, arg + 1, sizeof(value));
+    arg += 1 + sizeof(value);
+    spec += conversion;
+    printArg(out, spec, stars, starCount, value);
+  } else if (conversion == 's' && type == kString) {
+    uint32_t size;
+    memcpy(&size, arg + 1, sizeof(size));
+    const char* value = reinterpret_cast<const char*>(arg + 1 + sizeof(size));
+    arg += 1 + sizeof(size) + size;
+    if (spec.size() == 1) {
+      // the common case, and strings longer than the buffer
+      out.append(value, size);
+      return;
+    }
+    spec += 's';
+    printArg(out, spec, stars, starCount, std::string(value, size).c_str());
+  } else if (conversion == 'p' && type == kPointer) {
+    const void* value;
+    memcpy(&value, arg + 1, sizeof(value));
+    arg += 1 + sizeof(value);
+    spec += 'p';
+    printArg(out, spec, stars, starCount, value);
+  } else {
+    // an argument that does not match: the next ones cannot be trusted
+    out += "(?)";
+    arg = end;
+  }
+}
+
+// printf of the format of the site with the arguments of the record
+void format(const Record& record, std::string& out) {
+  const char* format = record.site->format;
+  const uint8_t* arg = record.args.data();
+  const uint8_t* end = arg + record.args.size();
+  std::string spec;
+
+  for (const char* p = format; *p;) {
+    if (*p != '%') {
+      const char* next = strchr(p, '%');
+      if (!next) {
+        next = p + strlen(p);
+      }
+      out.append(p, next - p);
+      p = next;
+      continue;
+    }
+    if (p[1] == '%') {
+      out += '%';
+      p += 2;
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion
+    spec.assign(1, '%');
+    p++;
+    int stars[2] = {0, 0};
+    int starCount = 0;
+    while (*p && strchr("-+ #0'", *p)) {
+      spec += *p++;
+    }
+    for (int part = 0; part < 2; part++) {
+      if (part == 1) {
+        if (*p != '.') {
+          break;
+        }
+        spec += *p++;
+      }
+      if (*p == '*') {
+        int size;
+        stars[starCount++] =
+            arg < end && (arg[0] == kSigned || arg[0] == kUnsigned)
+                ? static_cast<int>(argValue(arg, size))
+                : 0;
+        spec += *p++;
+      }
+      while (*p >= '0' && *p <= '9') {
+        spec += *p++;
+      }
+    }
+    char length = 0;
+    while (*p && strchr("hlLqjzt", *p)) {
+      // hh is noted H, the other modifiers are replaced
+      length = (length == 'h' && *p == 'h') ? 'H' : *p;
+      p++;
+    }
+    if (!*p) {
+      break;
+    }
+    formatArg(out, spec, *p++, length, arg, end, stars, starCount);
+  }
+
+  if (record.suppressed) {
+    bool newline = !out.empty() && out.back() == '\n';
+    if (newline) {
+      out.pop_back();
+    }
+    out += " (" + std::to_string(record.suppressed) + " similar lines suppressed)";
+    if (newline) {
+      out += '\n';
+    }
+  }
+}
+
+class Logger {
+ public:
+  // Never destroyed: a thread or a static destructor may log at any time
+  // during exit, the logger is stopped by an atexit handler instead
+  static Logger& instance() {
+    static Logger* logger = new Logger();
+    return *logger;
+  }
+
+  std::shared_ptr<ThreadBuffer> addThread() {
+    std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+    std::lock_guard<std::mutex> _(buffers_lock_);
+    buffers_.push_back(buffer);
+    return buffer;
+  }
+
+  // Takes a record of a thread without a buffer (e.g. a static destructor),
+  // false once the logger is stopped
+  bool addRecord(Record* record) {
+    std::lock_guard<std::mutex> _(buffers_lock_);
+    if (state != kRunning) {
+      return false;
+    }
+    records_.push_back(record);
+    return true;
+  }
+
+  // Formats the lines of every thread and writes them in the order they
+  // were logged. Called by the background thread, and by the threads
+  // flushing an error.
+  void drain() {
+    std::lock_guard<std::mutex> _(drain_lock_);
+    text_.clear();
+    lines_.clear();
+    uint64_t dropped = 0;
+    {
+      std::lock_guard<std::mutex> __(buffers_lock_);
+      for (auto it = buffers_.begin(); it != buffers_.end();) {
+        ThreadBuffer& buffer = **it;
+        // a closed buffer gets no new line, it is removed once read
+        bool closed = buffer.closed;
+        while (Record* record = buffer.ring.front()) {
+          size_t offset = text_.size();
+          format(*record, text_);
+          lines_.push_back({record->timeNs, offset, text_.size() - offset});
+          buffer.ring.pop();
+        }
+        dropped += buffer.dropped.exchange(0);
+        if (closed) {
+          it = buffers_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      for (Record* record : records_) {
+        size_t offset = text_.size();
+        format(*record, text_);
+        lines_.push_back({record->timeNs, offset, text_.size() - offset});
+        delete record;
+      }
+      records_.clear();
+    }
+    if (lines_.empty() && !dropped) {
+      return;
+    }
+
+    std::stable_sort(lines_.begin(), lines_.end(),
+                     [](const Line& a, const Line& b) { return a.timeNs < b.timeNs; });
+    output_.clear();
+    for (const Line& line : lines_) {
+      output_.append(text_, line.offset, line.length);
+    }
+    if (dropped) {
+      output_ += "[ APP_LOG_WARNING ] " + std::to_string(dropped) +
+                 " log lines dropped, the log buffers were full\n";
+    }
+    fwrite(output_.data(), 1, output_.size(), stderr);
+    fflush(stderr);
+  }
+
+ private:
+  struct Line {
+    int64_t timeNs;
+    size_t offset;
+    size_t length;
+  };
+
+  Logger() {
+    state = kRunning;
+    thread_ = std::thread(&Logger::run, this);
+    atexit([] { instance().stop(); });
+  }
+
+  void stop() {
+    {
+      // no line is handed to the logger after its last drain
+      std::lock_guard<std::mutex> _(buffers_lock_);
+      state = kStopped;
+    }
+    {
+      std::lock_guard<std::mutex> _(lock_);
+      stop_ = true;
+    }
+    wakeup_.notify_one();
+    thread_.join();
+    // the lines logged while the thread was stopping
+    drain();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stop_) {
+      wakeup_.wait_for(lock, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MS));
+      lock.unlock();
+      drain();
+      lock.lock();
+    }
+  }
+
+  std::mutex buffers_lock_;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+  std::vector<Record*> records_;
+
+  // one drain at a time reads the buffers
+  std::mutex drain_lock_;
+  std::string text_;
+  std::vector<Line> lines_;
+  std::string output_;
+
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  bool stop_{false};
+  std::thread thread_;
+};
+
+}  // namespace
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Record* begin() {
+  if (!threadBuffer && !threadExited && state != kStopped) {
+    threadHolder.buffer = Logger::instance().addThread();
+    threadBuffer = threadHolder.buffer.get();
+  }
+  if (!threadBuffer || state == kStopped) {
+    Record* record = new Record();
+    record->direct = true;
+    return record;
+  }
+  Record* record = threadBuffer->ring.back();
+  if (!record) {
+    threadBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+  return record;
+}
+
+void commit(Record* record) {
+  if (!record->direct) {
+    threadBuffer->ring.push();
+    return;
+  }
+  if (state == kRunning && Logger::instance().addRecord(record)) {
+    return;
+  }
+  // the logger is stopped, e.g. a line logged by a late static destructor
+  std::string line;
+  format(*record, line);
+  fwrite(line.data(), 1, line.size(), stderr);
+  delete record;
+}
+
+void flush() {
+  if (state != kIdle) {
+    Logger::instance().drain();
+  }
+}
+
+}  // namespace sample_log
@@ -1,5 +1,216 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
 #include <cstdio>
+#include <type_traits>
+#include <vector>
 
 enum {ERROR=-1, INFO=0, WARNING, FATAL};
 
-#define AG_LOG(level, format, ...) ((void)fprintf(stderr, "[ APP_LOG_" #level " ] " format "\n", ##__VA_ARGS__)) 
+// Levels of AG_LOG; the lines below AG_LOG_MIN_LEVEL are compiled out
+#define AG_LOG_LEVEL_DEBUG 0
+#define AG_LOG_LEVEL_INFO 1
+#define AG_LOG_LEVEL_WARNING 2
+#define AG_LOG_LEVEL_ERROR 3
+#define AG_LOG_LEVEL_FATAL 4
+#ifndef AG_LOG_MIN_LEVEL
+#define AG_LOG_MIN_LEVEL AG_LOG_LEVEL_INFO
+#endif
+
+// Lines a call site may log each second, the next ones are only counted
+#ifndef AG_LOG_SITE_LINES_PER_SECOND
+#define AG_LOG_SITE_LINES_PER_SECOND 10
+#endif
+
+// AG_LOG(INFO, "format", ...) logs a printf-style line to stderr.
+//
+// The calling thread does not format the line nor write it: it copies the
+// arguments (and the strings they point to) into a lock-free buffer of its
+// own, and a background thread formats and writes the lines of all the
+// threads every few milliseconds, one write for all of them. A call site
+// logging more than AG_LOG_SITE_LINES_PER_SECOND lines a second has the
+// others dropped, and its next line tells how many. Lines still buffered are
+// written at exit.
+//
+// ERROR and FATAL lines are never dropped: the calling thread writes them
+// with the lines buffered before them, so a crash right after does not lose
+// them.
+#define AG_LOG(level, format, ...)                                                   \
+  AG_LOG_SITE(level, AG_LOG_LEVEL_##level >= AG_LOG_LEVEL_ERROR                      \
+                         ? sample_log::kFlush                                        \
+                         : sample_log::kLimited,                                     \
+              format, ##__VA_ARGS__)
+
+// Same as AG_LOG without the rate limit, for the lines of a periodic report
+// logged in a loop (one line per user, ...)
+#define AG_LOG_REPORT(level, format, ...)                                            \
+  AG_LOG_SITE(level, AG_LOG_LEVEL_##level >= AG_LOG_LEVEL_ERROR ? sample_log::kFlush : 0, \
+              format, ##__VA_ARGS__)
+
+#define AG_LOG_SITE(level, flags, format, ...)                                       \
+  ((void)(AG_LOG_LEVEL_##level >= AG_LOG_MIN_LEVEL && [&]() {                       \
+     static sample_log::Site site("[ APP_LOG_" #level " ] " format "\n", flags);     \
+     if (false) sample_log::checkFormat(format, ##__VA_ARGS__);                      \
+     return sample_log::log(site, ##__VA_ARGS__);                                    \
+   }()))
+
+namespace sample_log {
+
+enum SiteFlags {
+  kLimited = 1,  // at most AG_LOG_SITE_LINES_PER_SECOND lines a second
+  kFlush = 2,    // written by the calling thread with the lines before it
+};
+
+// A call of AG_LOG, with its format and rate limit
+struct Site {
+  constexpr Site(const char* format, int flags) : format(format), flags(flags) {}
+
+  // Counts the line in the second of |nowNs|, false when the site already
+  // logged its share of that second. |suppressed|: lines dropped since the
+  // previous one logged.
+  bool admit(int64_t nowNs, uint32_t& suppressed) {
+    if (!(flags & kLimited)) {
+      return true;
+    }
+    int64_t second = nowNs / 1000000000;
+    int64_t window = window_.load(std::memory_order_relaxed);
+    if (second != window && window_.compare_exchange_strong(window, second)) {
+      count_.store(0, std::memory_order_relaxed);
+    }
+    if (count_.fetch_add(1, std::memory_order_relaxed) < AG_LOG_SITE_LINES_PER_SECOND) {
+      suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+      return true;
+    }
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  const char* format;
+  const int flags;
+
+ private:
+  std::atomic<int64_t> window_{0};
+  std::atomic<uint32_t> count_{0};
+  std::atomic<uint32_t> suppressed_{0};
+};
+
+// A line waiting to be formatted: its arguments, each a type byte followed
+// by its value
+struct Record {
+  const Site* site{nullptr};
+  int64_t timeNs{0};
+  uint32_t suppressed{0};
+  bool direct{false};  // not in the buffer of a thread
+  std::vector<uint8_t> args;
+};
+
+enum ArgType : uint8_t { kSigned, kUnsigned, kDouble, kString, kPointer };
+
+int64_t nowNs();
+// The record of this thread to fill, nullptr when its buffer is full
+Record* begin();
+// Hands the record returned by begin() to the background thread
+void commit(Record* record);
+// Writes the lines of every thread now
+void flush();
+
+inline void putValue(std::vector<uint8_t>& out, const void* value, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(value);
+  out.insert(out.end(), bytes, bytes + size);
+}
+
+// Integers keep their size, %x of a negative int prints 32 bits
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type put(std::vector<uint8_t>& out,
+                                                                     T value) {
+  out.push_back(std::is_signed<T>::value ? kSigned : kUnsigned);
+  out.push_back(static_cast<uint8_t>(sizeof(T)));
+  int64_t widened = static_cast<int64_t>(value);
+  putValue(out, &widened, sizeof(widened));
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type put(std::vector<uint8_t>& out,
+                                                                 T value) {
+  put(out, static_cast<long long>(value));
+}
+
+inline void put(std::vector<uint8_t>& out, double value) {
+  out.push_back(kDouble);
+  putValue(out, &value, sizeof(value));
+}
+
+inline void put(std::vector<uint8_t>& out, long double value) {
+  put(out, static_cast<double>(value));
+}
+
+// Strings are copied, they may be gone when the line is formatted
+inline void put(std::vector<uint8_t>& out, const char* value) {
+  if (!value) {
+    value = "(null)";
+  }
+  uint32_t length = static_cast<uint32_t>(strlen(value));
+  out.push_back(kString);
+  putValue(out, &length, sizeof(length));
+  putValue(out, value, length);
+}
+
+inline void put(std::vector<uint8_t>& out, char* value) {
+  put(out, static_cast<const char*>(value));
+}
+
+template <typename T>
+inline void put(std::vector<uint8_t>& out, T* value) {
+  out.push_back(kPointer);
+  const void* pointer = value;
+  putValue(out, &pointer, sizeof(pointer));
+}
+
+inline void putAll(std::vector<uint8_t>&) {}
+
+template <typename T, typename... Args>
+inline void putAll(std::vector<uint8_t>& out, T value, Args... args) {
+  put(out, value);
+  putAll(out, args...);
+}
+
+template <typename... Args>
+inline bool log(Site& site, Args... args) {
+  int64_t now = nowNs();
+  uint32_t suppressed = 0;
+  if (!site.admit(now, suppressed)) {
+    return false;
+  }
+  Record* record = begin();
+  if (!record && (site.flags & kFlush)) {
+    // make room rather than drop an error
+    flush();
+    record = begin();
+  }
+  if (!record) {
+    return false;
+  }
+  record->site = &site;
+  record->timeNs = now;
+  record->suppressed = suppressed;
+  record->args.clear();
+  putAll(record->args, args...);
+  commit(record);
+  if (site.flags & kFlush) {
+    flush();
+  }
+  return true;
+}
+
+// Only compiled, for the format warnings of printf
+inline void checkFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void checkFormat(const char*, ...) {}
+
+}  // namespace sample_log
@@ -0,0 +1,76 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_active_speaker.h"
+
+#include <string.h>
+
+#include "log.h"
+
+SampleActiveSpeaker::SampleActiveSpeaker(unsigned int minVolume, int cooldownMs, int holdMs)
+    : min_volume_(minVolume), cooldown_(cooldownMs), hold_(holdMs) {}
+
+void SampleActiveSpeaker::onAudioVolumeIndication(
+    const agora::rtc::AudioVolumeInformation* speakers, unsigned int speakerNumber) {
+  // The local user comes in a callback of its own with the uid 0; an
+  // audience never speaks, so its callback is ignored
+  const agora::rtc::AudioVolumeInformation* loudest = nullptr;
+  for (unsigned int i = 0; i < speakerNumber; i++) {
+    const char* userId = speakers[i].userId;
+    if (!userId || !*userId || !strcmp(userId, "0")) {
+      continue;
+    }
+    if (!loudest || speakers[i].volume > loudest->volume) {
+      loudest = &speakers[i];
+    }
+  }
+  if (loudest && loudest->volume >= min_volume_) {
+    std::lock_guard<std::mutex> _(lock_);
+    setSpeaker(loudest->userId, std::chrono::steady_clock::now());
+  }
+}
+
+void SampleActiveSpeaker::onActiveSpeaker(agora::user_id_t userId) {
+  if (!userId || !*userId || !strcmp(userId, "0")) {
+    return;
+  }
+  std::lock_guard<std::mutex> _(lock_);
+  setSpeaker(userId, std::chrono::steady_clock::now());
+}
+
+bool SampleActiveSpeaker::shouldCapture(agora::user_id_t userId) {
+  if (!userId) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> _(lock_);
+  if (!speaking(now) || speaker_ != userId) {
+    return false;
+  }
+  if (captured_ && now - last_capture_ < cooldown_) {
+    return false;
+  }
+  captured_ = true;
+  last_capture_ = now;
+  return true;
+}
+
+std::string SampleActiveSpeaker::speaker() {
+  std::lock_guard<std::mutex> _(lock_);
+  return speaking(std::chrono::steady_clock::now()) ? speaker_ : std::string();
+}
+
+void SampleActiveSpeaker::setSpeaker(const char* userId,
+                                     std::chrono::steady_clock::time_point now) {
+  if (speaker_ != userId) {
+    AG_LOG(INFO, "Active speaker is now %s", userId);
+    speaker_ = userId;
+  }
+  last_heard_ = now;
+}
+
+bool SampleActiveSpeaker::speaking(std::chrono::steady_clock::time_point now) const {
+  return !speaker_.empty() && now - last_heard_ <= hold_;
+}
@@ -0,0 +1,49 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "NGIAgoraLocalUser.h"
+
+// Follows who speaks in one channel and paces the snapshots of the speaker.
+//
+// Feed it the volume indications and active speaker events of
+// ILocalUserObserver (after ILocalUser::setAudioVolumeIndicationParameters).
+// The loudest remote user at or above |minVolume| becomes the speaker, and
+// stays so for |holdMs| after last being heard. The video callback asks
+// shouldCapture() for each frame: only frames of the speaker are taken, at
+// most one every |cooldownMs| for the channel, whoever speaks.
+class SampleActiveSpeaker {
+ public:
+  SampleActiveSpeaker(unsigned int minVolume, int cooldownMs, int holdMs);
+
+  void onAudioVolumeIndication(const agora::rtc::AudioVolumeInformation* speakers,
+                               unsigned int speakerNumber);
+  void onActiveSpeaker(agora::user_id_t userId);
+
+  // True when a frame of |userId| is to be captured now; the next one is
+  // then due after the cooldown
+  bool shouldCapture(agora::user_id_t userId);
+
+  // The current speaker, empty when nobody was heard lately
+  std::string speaker();
+
+ private:
+  void setSpeaker(const char* userId, std::chrono::steady_clock::time_point now);
+  bool speaking(std::chrono::steady_clock::time_point now) const;
+
+  const unsigned int min_volume_;
+  const std::chrono::milliseconds cooldown_;
+  const std::chrono::milliseconds hold_;
+
+  std::mutex lock_;
+  std::string speaker_;
+  std::chrono::steady_clock::time_point last_heard_;
+  std::chrono::steady_clock::time_point last_capture_;
+  bool captured_{false};
+};
@@ -0,0 +1,144 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_audio_level.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_LEVEL_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_LEVEL_NEON 1
+#endif
+
+// the noise floor rises this fast when the level stays above it
+#define VAD_FLOOR_RISE_DB_PER_SECOND (3.0f)
+// and moves this part of the way down to a quieter frame, so one dropout
+// does not take it to the bottom
+#define VAD_FLOOR_FALL (0.2f)
+
+SampleAudioLevel SampleAudioLevel::measure(const int16_t* samples, size_t count) {
+  SampleAudioLevel level;
+  if (!samples || !count) {
+    return level;
+  }
+
+  uint64_t squares = 0;
+  int peak = 0;
+  size_t i = 0;
+
+#if defined(AUDIO_LEVEL_SSE2)
+  // pmaddwd adds two squares, up to 2^31 for -32768: it is widened as unsigned
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  __m128i maxAbs = zero;
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+    __m128i pairs = _mm_madd_epi16(x, x);
+    sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(pairs, zero));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(pairs, zero));
+    // saturated, -32768 counts as 32767
+    maxAbs = _mm_max_epi16(maxAbs, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+  }
+  alignas(16) uint64_t sums[2];
+  alignas(16) int16_t maxes[8];
+  _mm_store_si128(reinterpret_cast<__m128i*>(sums), sum);
+  _mm_store_si128(reinterpret_cast<__m128i*>(maxes), maxAbs);
+  squares = sums[0] + sums[1];
+  peak = *std::max_element(maxes, maxes + 8);
+#elif defined(AUDIO_LEVEL_NEON)
+  int64x2_t sum = vdupq_n_s64(0);
+  int16x8_t maxAbs = vdupq_n_s16(0);
+  for (; i + 8 <= count; i += 8) {
+    int16x8_t x = vld1q_s16(samples + i);
+    sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+    sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+    maxAbs = vmaxq_s16(maxAbs, vqabsq_s16(x));
+  }
+  squares = static_cast<uint64_t>(vaddvq_s64(sum));
+  peak = vmaxvq_s16(maxAbs);
+#endif
+
+  // the vectors saturate -32768, so the tail does too and all paths agree
+  for (; i < count; i++) {
+    int sample = samples[i];
+    squares += static_cast<uint64_t>(sample * sample);
+    peak = std::max(peak, std::min(abs(sample), 32767));
+  }
+  level.peak = peak;
+  level.rms = static_cast<float>(sqrt(static_cast<double>(squares) / count));
+  level.dbfs = level.rms > 0 ? std::max(-100.0f, 20 * log10f(level.rms / 32768)) : -100.0f;
+  return level;
+}
+
+const char* SampleAudioLevel::simdName() {
+#if defined(AUDIO_LEVEL_SSE2)
+  return "sse2";
+#elif defined(AUDIO_LEVEL_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+bool SampleVoiceDetector::process(const SampleAudioLevel& level, int frameMs) {
+  if (!frames_++) {
+    noise_floor_dbfs_ = level.dbfs;
+  } else if (level.dbfs < noise_floor_dbfs_) {
+    noise_floor_dbfs_ += (level.dbfs - noise_floor_dbfs_) * VAD_FLOOR_FALL;
+  } else {
+    noise_floor_dbfs_ = std::min(
+        level.dbfs, noise_floor_dbfs_ + VAD_FLOOR_RISE_DB_PER_SECOND * frameMs / 1000);
+  }
+
+  bool voice = level.dbfs >= std::max(options_.thresholdDbfs,
+                                      noise_floor_dbfs_ + options_.marginDb);
+  if (voice) {
+    hangover_ms_ = std::max(options_.hangoverMs, frameMs);
+  } else {
+    hangover_ms_ = std::max(hangover_ms_ - frameMs, 0);
+  }
+  return hangover_ms_ > 0;
+}
+
+bool SampleAudioActivity::update(const std::string& user, const int16_t* samples,
+                                 int samplesPerChannel, int channels, int sampleRate) {
+  // measured out of the lock, levels() only waits for the copy
+  SampleAudioLevel level =
+      SampleAudioLevel::measure(samples, static_cast<size_t>(samplesPerChannel) * channels);
+  int frameMs = sampleRate > 0 ? samplesPerChannel * 1000 / sampleRate : 0;
+
+  std::lock_guard<std::mutex> _(lock_);
+  auto it = users_.find(user);
+  if (it == users_.end()) {
+    it = users_.emplace(user, User{SampleVoiceDetector(options_), UserLevel()}).first;
+    it->second.level.user = user;
+  }
+  User& state = it->second;
+  bool active = state.detector.process(level, frameMs);
+  state.level.level = level;
+  state.level.noiseFloorDbfs = state.detector.noiseFloorDbfs();
+  state.level.active = active;
+  state.level.frames++;
+  if (!active) {
+    state.level.silentFrames++;
+  }
+  return active;
+}
+
+std::vector<SampleAudioActivity::UserLevel> SampleAudioActivity::levels() const {
+  std::vector<UserLevel> levels;
+  std::lock_guard<std::mutex> _(lock_);
+  levels.reserve(users_.size());
+  for (auto& user : users_) {
+    levels.push_back(user.second.level);
+  }
+  return levels;
+}
@@ -0,0 +1,96 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sample_event.h"
+
+// Loudness of a block of 16-bit samples
+struct SampleAudioLevel {
+  float rms{0};     // 0..32768
+  int peak{0};      // largest magnitude, 0..32768
+  float dbfs{-100};  // rms relative to full scale, -100 for silence
+
+  // Measured with SSE2 or NEON (plain C elsewhere), all channels together
+  static SampleAudioLevel measure(const int16_t* samples, size_t count);
+
+  // "sse2", "neon" or "scalar"
+  static const char* simdName();
+};
+
+// Energy based voice activity detector.
+//
+// A frame is voice when its level is above |thresholdDbfs| and |marginDb|
+// above the noise floor. The floor quickly follows the quieter frames and
+// rises slowly otherwise, so a steady noise (fan, hiss) is not voice for
+// long while the pauses between words keep the floor down during speech.
+// The detector stays active |hangoverMs| after the last voice frame, which
+// keeps the ends of words and the short pauses of a sentence.
+class SampleVoiceDetector {
+ public:
+  struct Options {
+    float thresholdDbfs = -50;
+    float marginDb = 10;
+    int hangoverMs = 300;
+  };
+
+  SampleVoiceDetector() = default;
+  explicit SampleVoiceDetector(const Options& options) : options_(options) {}
+
+  // Returns whether the frame of |frameMs| belongs to an active segment
+  bool process(const SampleAudioLevel& level, int frameMs);
+
+  bool active() const { return hangover_ms_ > 0; }
+  float noiseFloorDbfs() const { return noise_floor_dbfs_; }
+
+ private:
+  Options options_;
+  uint64_t frames_{0};
+  float noise_floor_dbfs_{-100};
+  int hangover_ms_{0};
+};
+
+// Levels and voice activity of each remote user.
+//
+// update() is called by the audio callback with the frames of the users,
+// levels() may be called from any other thread, e.g. to report them.
+class SampleAudioActivity : public noncopyable {
+ public:
+  struct UserLevel {
+    std::string user;
+    SampleAudioLevel level;  // of the last frame
+    float noiseFloorDbfs;
+    bool active;
+    uint64_t frames;
+    uint64_t silentFrames;  // frames outside of the active segments
+  };
+
+  explicit SampleAudioActivity(const SampleVoiceDetector::Options& options =
+                                   SampleVoiceDetector::Options())
+      : options_(options) {}
+
+  // Returns whether the frame of |user| belongs to an active segment
+  bool update(const std::string& user, const int16_t* samples, int samplesPerChannel,
+              int channels, int sampleRate);
+
+  std::vector<UserLevel> levels() const;
+
+ private:
+  struct User {
+    SampleVoiceDetector detector;
+    UserLevel level;
+  };
+
+  SampleVoiceDetector::Options options_;
+  mutable std::mutex lock_;
+  std::map<std::string, User> users_;
+};
@@ -2,6 +2,7 @@
 #include "sample_connection_observer.h"
 
 #include "log.h"
+#include "sample_encoder_controller.h"
 
 void SampleConnectionObserver::onConnected(const agora::rtc::TConnectionInfo &connectionInfo,
 										   agora::rtc::CONNECTION_CHANGED_REASON_TYPE reason)
@@ -59,6 +60,9 @@ void SampleConnectionObserver::onUplinkNetworkInfoUpdated(const agora::rtc::Upli
 {
 	AG_LOG(INFO, "onBandwidthEstimationUpdated: video_encoder_target_bitrate_bps %d\n",
 		   info.video_encoder_target_bitrate_bps);
+	if (encoder_controller_) {
+		encoder_controller_->onUplinkNetworkInfoUpdated(info);
+	}
 }
 
 void SampleConnectionObserver::onUserJoined(agora::user_id_t userId)
@@ -2,6 +2,8 @@
 #include "NGIAgoraRtmpConnection.h"
 #include "sample_event.h"
 
+class SampleEncoderController;
+
 class SampleConnectionObserver : public agora::rtc::IRtcConnectionObserver,
 								 public agora::rtc::INetworkObserver {
 public:
@@ -12,6 +14,10 @@ public:
 	{
 		return connect_ready_.Wait(waitMs);
 	}
+	void setEncoderController(SampleEncoderController *controller)
+	{
+		encoder_controller_ = controller;
+	}
 
 public: // IRtcConnectionObserver
 	void onConnected(const agora::rtc::TConnectionInfo &connectionInfo,
@@ -56,6 +62,7 @@ public: // INetworkObserver
 private:
 	SampleEvent connect_ready_;
 	SampleEvent disconnect_ready_;
+	SampleEncoderController *encoder_controller_{nullptr};
 };
 
 class RtmpConnectionObserver : public agora::rtc::IRtmpConnectionObserver {
@@ -0,0 +1,188 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_encoder_controller.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "log.h"
+
+namespace {
+
+// Resolution/framerate ladder, from the configured maximum downwards
+const struct {
+  int scaleNum;
+  int fpsDiv;
+} kLevels[] = {{4, 1}, {3, 1}, {2, 1}, {2, 2}, {1, 2}};
+const int kNumLevels = sizeof(kLevels) / sizeof(kLevels[0]);
+
+// A level is usable down to half of its nominal bitrate
+const int kLevelMinPercent = 50;
+// Upgrade only when the estimate exceeds the next level's minimum by 30% ...
+const int kUpgradeHeadroomPercent = 130;
+// ... for at least this long
+const int kUpgradeHoldMs = 5000;
+// Ignore bitrate moves smaller than 10%
+const int kBitrateHysteresisPercent = 10;
+// Minimum interval between bitrate-only updates
+const int kMinUpdateIntervalMs = 1000;
+// Encoder is considered overloaded when it encodes less than 70% of its input
+const int kEncodeRatioPercent = 70;
+// ... for this many consecutive statistics reports
+const int kOverloadReports = 3;
+// Back to a level the encoder overloaded at after this many healthy reports ...
+const int kHealthyReports = 5;
+// ... and a back-off doubling with each overload at that level, up to 8x
+const int kCpuBackoffMs = 30000;
+const int kMaxCpuBackoffShift = 3;
+
+int64_t elapsedMs(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                               since)
+      .count();
+}
+
+}  // namespace
+
+SampleEncoderController::SampleEncoderController(
+    agora::agora_refptr<agora::rtc::ILocalVideoTrack> videoTrack,
+    const agora::rtc::VideoEncoderConfiguration& maxConfig, int maxBitrateBps)
+    : video_track_(videoTrack),
+      max_config_(maxConfig),
+      max_bitrate_bps_(maxBitrateBps),
+      bitrate_bps_(maxBitrateBps),
+      target_bps_(maxBitrateBps),
+      last_change_(std::chrono::steady_clock::now()) {}
+
+void SampleEncoderController::start() {
+  std::lock_guard<std::mutex> _(lock_);
+  level_ = 0;
+  bitrate_bps_ = max_bitrate_bps_;
+  apply();
+}
+
+int SampleEncoderController::levelMaxBitrateBps(int level) const {
+  int64_t bps = static_cast<int64_t>(max_bitrate_bps_) * kLevels[level].scaleNum *
+                kLevels[level].scaleNum / 16 / kLevels[level].fpsDiv;
+  return static_cast<int>(bps);
+}
+
+int SampleEncoderController::levelMinBitrateBps(int level) const {
+  return levelMaxBitrateBps(level) * kLevelMinPercent / 100;
+}
+
+void SampleEncoderController::onUplinkNetworkInfoUpdated(
+    const agora::rtc::UplinkNetworkInfo& info) {
+  if (info.video_encoder_target_bitrate_bps <= 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> _(lock_);
+  target_bps_ = std::min(info.video_encoder_target_bitrate_bps, max_bitrate_bps_);
+  evaluate(target_bps_, false);
+}
+
+void SampleEncoderController::onLocalVideoTrackStatistics(
+    const agora::rtc::LocalVideoTrackStats& stats) {
+  std::lock_guard<std::mutex> _(lock_);
+  if (stats.input_frame_rate > 0 &&
+      stats.encode_frame_rate * 100 < stats.input_frame_rate * kEncodeRatioPercent) {
+    ++overloaded_reports_;
+    healthy_reports_ = 0;
+  } else {
+    overloaded_reports_ = 0;
+    if (stats.input_frame_rate > 0) {
+      ++healthy_reports_;
+    }
+  }
+  bool overloaded = overloaded_reports_ >= kOverloadReports;
+  if (overloaded) {
+    overloaded_reports_ = 0;
+  }
+  evaluate(target_bps_, overloaded);
+}
+
+bool SampleEncoderController::canUpgradeTo(int level) const {
+  if (level > cpu_ceiling_) {
+    return true;
+  }
+  int shift = std::min(ceiling_overloads_ - 1, kMaxCpuBackoffShift);
+  return healthy_reports_ >= kHealthyReports &&
+         elapsedMs(ceiling_since_) >= static_cast<int64_t>(kCpuBackoffMs) << shift;
+}
+
+void SampleEncoderController::evaluate(int targetBps, bool encoderOverloaded) {
+  int level = level_;
+
+  if (encoderOverloaded) {
+    // the same level overloading again backs off longer
+    if (level_ == cpu_ceiling_) {
+      ++ceiling_overloads_;
+    } else {
+      cpu_ceiling_ = level_;
+      ceiling_overloads_ = 1;
+    }
+    ceiling_since_ = std::chrono::steady_clock::now();
+  }
+
+  // Step down immediately when the estimate or the encoder cannot keep up
+  while (level + 1 < kNumLevels && targetBps < levelMinBitrateBps(level)) {
+    ++level;
+  }
+  if (encoderOverloaded && level == level_ && level + 1 < kNumLevels) {
+    ++level;
+  }
+
+  // no upgrade while the encoder may be overloading, nor past its ceiling
+  // before it recovered
+  if (level != level_ || encoderOverloaded || overloaded_reports_ > 0 ||
+      (level > 0 && !canUpgradeTo(level - 1))) {
+    has_headroom_ = false;
+  } else if (level > 0 &&
+             static_cast<int64_t>(targetBps) * 100 >=
+                 static_cast<int64_t>(levelMinBitrateBps(level - 1)) * kUpgradeHeadroomPercent) {
+    // Step up only after the headroom has been stable for a while
+    if (!has_headroom_) {
+      has_headroom_ = true;
+      headroom_since_ = std::chrono::steady_clock::now();
+    } else if (elapsedMs(headroom_since_) >= kUpgradeHoldMs) {
+      --level;
+      has_headroom_ = false;
+    }
+  } else {
+    has_headroom_ = false;
+  }
+
+  int bitrate = std::max(std::min(targetBps, levelMaxBitrateBps(level)), levelMinBitrateBps(level));
+  bool levelChanged = level != level_;
+  bool bitrateChanged =
+      static_cast<int64_t>(std::abs(bitrate - bitrate_bps_)) * 100 >
+          static_cast<int64_t>(bitrate_bps_) * kBitrateHysteresisPercent &&
+      elapsedMs(last_change_) >= kMinUpdateIntervalMs;
+  if (!levelChanged && !bitrateChanged) {
+    return;
+  }
+
+  level_ = level;
+  bitrate_bps_ = bitrate;
+  apply();
+}
+
+void SampleEncoderController::apply() {
+  agora::rtc::VideoEncoderConfiguration config(max_config_);
+  // keep the dimensions even for I420
+  config.dimensions.width = (max_config_.dimensions.width * kLevels[level_].scaleNum / 4) & ~1;
+  config.dimensions.height = (max_config_.dimensions.height * kLevels[level_].scaleNum / 4) & ~1;
+  config.frameRate = std::max(1, max_config_.frameRate / kLevels[level_].fpsDiv);
+  config.bitrate = bitrate_bps_ / 1000;  // Kbps
+
+  if (video_track_) {
+    video_track_->setVideoEncoderConfiguration(config);
+  }
+  last_change_ = std::chrono::steady_clock::now();
+  AG_LOG(INFO, "encoder level %d: %dx%d@%d, %d kbps (estimate %d kbps)", level_,
+         config.dimensions.width, config.dimensions.height, config.frameRate, config.bitrate,
+         target_bps_ / 1000);
+}
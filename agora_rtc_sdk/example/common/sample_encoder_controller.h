@@ -0,0 +1,70 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <chrono>
+#include <mutex>
+
+#include "AgoraBase.h"
+#include "NGIAgoraVideoTrack.h"
+
+// Adapts the encoder of a local video track to the uplink capacity.
+//
+// Feed it the bandwidth estimation from INetworkObserver and the statistics
+// from ILocalUserObserver. The bitrate follows the estimate once it moves by
+// more than 10%, and the track steps down/up a ladder of
+// resolution/framerate levels when the estimate (or the encoder itself) cannot
+// sustain the current level. Upgrades require the headroom to persist longer
+// than downgrades so the configuration does not oscillate. A level the encoder
+// could not keep up with is a CPU ceiling: the bandwidth alone does not bring
+// it back, the encoder must also be healthy for a while, longer after each
+// overload at that level.
+class SampleEncoderController {
+ public:
+  SampleEncoderController(agora::agora_refptr<agora::rtc::ILocalVideoTrack> videoTrack,
+                          const agora::rtc::VideoEncoderConfiguration& maxConfig,
+                          int maxBitrateBps);
+
+  // Applies the top level of the ladder.
+  void start();
+
+  void onUplinkNetworkInfoUpdated(const agora::rtc::UplinkNetworkInfo& info);
+  void onLocalVideoTrackStatistics(const agora::rtc::LocalVideoTrackStats& stats);
+
+  int currentLevel() const {
+    std::lock_guard<std::mutex> _(lock_);
+    return level_;
+  }
+  int currentBitrateBps() const {
+    std::lock_guard<std::mutex> _(lock_);
+    return bitrate_bps_;
+  }
+
+ private:
+  int levelMinBitrateBps(int level) const;
+  int levelMaxBitrateBps(int level) const;
+  bool canUpgradeTo(int level) const;
+  void evaluate(int targetBps, bool encoderOverloaded);
+  void apply();
+
+  agora::agora_refptr<agora::rtc::ILocalVideoTrack> video_track_;
+  agora::rtc::VideoEncoderConfiguration max_config_;
+  int max_bitrate_bps_;
+
+  mutable std::mutex lock_;
+  int level_{0};
+  int bitrate_bps_{0};
+  int target_bps_{0};
+  std::chrono::steady_clock::time_point last_change_;
+  std::chrono::steady_clock::time_point headroom_since_;
+  bool has_headroom_{false};
+  int overloaded_reports_{0};
+  int healthy_reports_{0};
+
+  // highest level the encoder overloaded at, -1 when none
+  int cpu_ceiling_{-1};
+  int ceiling_overloads_{0};  // overloads at |cpu_ceiling_|, grow the back-off
+  std::chrono::steady_clock::time_point ceiling_since_;
+};
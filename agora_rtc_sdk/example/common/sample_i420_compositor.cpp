@@ -0,0 +1,468 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_i420_compositor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "NGIAgoraMediaNode.h"
+#include "log.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define COMPOSITOR_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define COMPOSITOR_NEON 1
+#endif
+
+// black of limited range video
+#define CANVAS_BLACK_Y (16)
+#define CANVAS_BLACK_UV (128)
+
+static int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                              start)
+      .count();
+}
+
+static void copyPlane(uint8_t* dst, const uint8_t* src, int stride, int width, int height) {
+  if (stride == width) {
+    memcpy(dst, src, static_cast<size_t>(width) * height);
+    return;
+  }
+  for (int j = 0; j < height; j++) {
+    memcpy(dst + static_cast<size_t>(j) * width, src + static_cast<size_t>(j) * stride, width);
+  }
+}
+
+// Position of the source sample under the center of each of the |dst|
+// samples, in 1/256 of sample: the first of the two samples to blend, and the
+// weights of both (256 - w, w) side by side. The first is at most |src| - 2,
+// the last sample is reached with a weight of 256.
+static void filterPositions(std::vector<int>& firsts, std::vector<int16_t>& weights, int src,
+                            int dst) {
+  firsts.resize(dst);
+  weights.resize(2 * dst);
+  int64_t last = static_cast<int64_t>(src - 1) * 256;
+  for (int i = 0; i < dst; i++) {
+    int64_t position = (static_cast<int64_t>(2 * i + 1) * src * 256) / (2 * dst) - 128;
+    position = std::max<int64_t>(0, std::min(last, position));
+    int first = std::min(static_cast<int>(position >> 8), src - 2);
+    int weight = static_cast<int>(position - static_cast<int64_t>(first) * 256);
+    firsts[i] = first;
+    weights[2 * i] = static_cast<int16_t>(256 - weight);
+    weights[2 * i + 1] = static_cast<int16_t>(weight);
+  }
+}
+
+// The two samples at |src|, the first in the low byte
+static inline uint16_t loadPair(const uint8_t* src) {
+  return static_cast<uint16_t>(src[0] | (src[1] << 8));
+}
+
+// dst = (a * (256 - weight) + b * weight + 128) >> 8, weight 1..255
+static void blendRows(uint8_t* dst, const uint8_t* a, const uint8_t* b, int width, int weight) {
+  int i = 0;
+#if defined(COMPOSITOR_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weightA = _mm_set1_epi16(static_cast<int16_t>(256 - weight));
+  const __m128i weightB = _mm_set1_epi16(static_cast<int16_t>(weight));
+  const __m128i round = _mm_set1_epi16(128);
+  // up to 255 * 256 + 128, the 16-bit lanes are unsigned
+  for (; i + 16 <= width; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), weightA),
+                                _mm_mullo_epi16(_mm_unpacklo_epi8(y, zero), weightB));
+    __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), weightA),
+                                 _mm_mullo_epi16(_mm_unpackhi_epi8(y, zero), weightB));
+    low = _mm_srli_epi16(_mm_add_epi16(low, round), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, round), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+  }
+#elif defined(COMPOSITOR_NEON)
+  const uint8x8_t weightA = vdup_n_u8(static_cast<uint8_t>(256 - weight));
+  const uint8x8_t weightB = vdup_n_u8(static_cast<uint8_t>(weight));
+  for (; i + 16 <= width; i += 16) {
+    uint8x16_t x = vld1q_u8(a + i);
+    uint8x16_t y = vld1q_u8(b + i);
+    uint16x8_t low = vmlal_u8(vmull_u8(vget_low_u8(x), weightA), vget_low_u8(y), weightB);
+    uint16x8_t high = vmlal_u8(vmull_u8(vget_high_u8(x), weightA), vget_high_u8(y), weightB);
+    vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(low, 8), vrshrn_n_u16(high, 8)));
+  }
+#endif
+  for (; i < width; i++) {
+    dst[i] = static_cast<uint8_t>((a[i] * (256 - weight) + b[i] * weight + 128) >> 8);
+  }
+}
+
+// dst[i] = (src[2i] + src[2i + 1] + 1) >> 1, which is the bilinear filter of
+// a halved row
+static void halveRow(uint8_t* dst, const uint8_t* src, int width) {
+  int i = 0;
+#if defined(COMPOSITOR_SSE2)
+  const __m128i even = _mm_set1_epi16(0x00ff);
+  for (; i + 16 <= width; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16));
+    __m128i low = _mm_avg_epu16(_mm_and_si128(x, even), _mm_srli_epi16(x, 8));
+    __m128i high = _mm_avg_epu16(_mm_and_si128(y, even), _mm_srli_epi16(y, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+  }
+#elif defined(COMPOSITOR_NEON)
+  for (; i + 16 <= width; i += 16) {
+    uint8x16x2_t x = vld2q_u8(src + 2 * i);
+    vst1q_u8(dst + i, vrhaddq_u8(x.val[0], x.val[1]));
+  }
+#endif
+  for (; i < width; i++) {
+    dst[i] = static_cast<uint8_t>((src[2 * i] + src[2 * i + 1] + 1) >> 1);
+  }
+}
+
+// The pairs of samples are gathered one by one, the filter is applied on
+// eight samples at once
+static void filterRow(uint8_t* dst, const uint8_t* src, int width, const int* firsts,
+                      const int16_t* weights) {
+  int i = 0;
+#if defined(COMPOSITOR_SSE2)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i round = _mm_set1_epi32(128);
+  for (; i + 8 <= width; i += 8) {
+    __m128i pairs = zero;
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i]), 0);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 1]), 1);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 2]), 2);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 3]), 3);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 4]), 4);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 5]), 5);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 6]), 6);
+    pairs = _mm_insert_epi16(pairs, loadPair(src + firsts[i + 7]), 7);
+    // pmaddwd multiplies each sample by its weight and adds the two of a pair
+    __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pairs, zero),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + 2 * i)));
+    __m128i high =
+        _mm_madd_epi16(_mm_unpackhi_epi8(pairs, zero),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + 2 * i + 8)));
+    low = _mm_srai_epi32(_mm_add_epi32(low, round), 8);
+    high = _mm_srai_epi32(_mm_add_epi32(high, round), 8);
+    __m128i packed = _mm_packs_epi32(low, high);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(packed, packed));
+  }
+#elif defined(COMPOSITOR_NEON)
+  for (; i + 8 <= width; i += 8) {
+    uint16x8_t pairs = vdupq_n_u16(0);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i]), pairs, 0);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 1]), pairs, 1);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 2]), pairs, 2);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 3]), pairs, 3);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 4]), pairs, 4);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 5]), pairs, 5);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 6]), pairs, 6);
+    pairs = vsetq_lane_u16(loadPair(src + firsts[i + 7]), pairs, 7);
+    // up to 255 * 256 + 128, the 16-bit lanes are unsigned
+    int16x8x2_t weight = vld2q_s16(weights + 2 * i);
+    uint16x8_t sum = vmulq_u16(vmovl_u8(vmovn_u16(pairs)), vreinterpretq_u16_s16(weight.val[0]));
+    sum = vmlaq_u16(sum, vshrq_n_u16(pairs, 8), vreinterpretq_u16_s16(weight.val[1]));
+    vst1_u8(dst + i, vrshrn_n_u16(sum, 8));
+  }
+#endif
+  for (; i < width; i++) {
+    const uint8_t* s = src + firsts[i];
+    dst[i] = static_cast<uint8_t>((s[0] * weights[2 * i] + s[1] * weights[2 * i + 1] + 128) >> 8);
+  }
+}
+
+void SampleI420Compositor::Counter::add(uint64_t ns) {
+  count++;
+  totalNs += ns;
+  uint64_t max = maxNs.load();
+  while (ns > max && !maxNs.compare_exchange_weak(max, ns)) {
+  }
+}
+
+SampleI420Compositor::SampleI420Compositor(int width, int height, int staleMs)
+    : width_(width & ~1),
+      height_(height & ~1),
+      stale_us_(static_cast<int64_t>(staleMs) * 1000),
+      canvas_(static_cast<size_t>(width_) * height_ * 3 / 2),
+      layout_(width_, height_),
+      last_timings_(std::chrono::steady_clock::now()) {
+  clearCanvas();
+}
+
+void SampleI420Compositor::onFrame(const std::string& user,
+                                   const agora::media::base::VideoFrame& frame) {
+  // the filter blends two samples in each direction
+  if (frame.width < 2 || frame.height < 2 || !frame.yBuffer || !frame.uBuffer || !frame.vBuffer) {
+    return;
+  }
+
+  std::shared_ptr<Slot> slot;
+  {
+    std::lock_guard<std::mutex> _(slots_lock_);
+    std::shared_ptr<Slot>& found = slots_[user];
+    if (!found) {
+      found = std::make_shared<Slot>();
+    }
+    slot = found;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  int chromaWidth = (frame.width + 1) / 2;
+  int chromaHeight = (frame.height + 1) / 2;
+  size_t lumaSize = static_cast<size_t>(frame.width) * frame.height;
+  size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+  {
+    std::lock_guard<std::mutex> _(slot->lock);
+    slot->pending.resize(lumaSize + 2 * chromaSize);
+    uint8_t* y = slot->pending.data();
+    copyPlane(y, frame.yBuffer, frame.yStride, frame.width, frame.height);
+    copyPlane(y + lumaSize, frame.uBuffer, frame.uStride, chromaWidth, chromaHeight);
+    copyPlane(y + lumaSize + chromaSize, frame.vBuffer, frame.vStride, chromaWidth, chromaHeight);
+    slot->pendingWidth = frame.width;
+    slot->pendingHeight = frame.height;
+    slot->fresh = true;
+    slot->lastFrameUs = nowUs();
+  }
+  counters_[kCopy].add(elapsedNs(start));
+}
+
+void SampleI420Compositor::removeUser(const std::string& user) {
+  std::lock_guard<std::mutex> _(slots_lock_);
+  slots_.erase(user);
+}
+
+void SampleI420Compositor::clearCanvas() {
+  size_t lumaSize = static_cast<size_t>(width_) * height_;
+  memset(canvas_.data(), CANVAS_BLACK_Y, lumaSize);
+  memset(canvas_.data() + lumaSize, CANVAS_BLACK_UV, lumaSize / 2);
+}
+
+void SampleI420Compositor::scalePlane(const uint8_t* src, int srcWidth, int srcHeight,
+                                      uint8_t* dst, int dstStride, int dstWidth, int dstHeight) {
+  if (srcWidth < 2 || srcHeight < 2) {
+    // a chroma plane of a 2 or 3 sample wide picture: nearest sample
+    for (int j = 0; j < dstHeight; j++) {
+      const uint8_t* s = src + static_cast<size_t>(j * srcHeight / dstHeight) * srcWidth;
+      for (int i = 0; i < dstWidth; i++) {
+        dst[static_cast<size_t>(j) * dstStride + i] = s[i * srcWidth / dstWidth];
+      }
+    }
+    return;
+  }
+
+  filterPositions(column_firsts_, column_weights_, srcWidth, dstWidth);
+  row_.resize(srcWidth);
+  int64_t last = static_cast<int64_t>(srcHeight - 1) * 256;
+  for (int j = 0; j < dstHeight; j++) {
+    int64_t position = (static_cast<int64_t>(2 * j + 1) * srcHeight * 256) / (2 * dstHeight) - 128;
+    position = std::max<int64_t>(0, std::min(last, position));
+    int first = static_cast<int>(position >> 8);
+    int weight = static_cast<int>(position & 255);
+    const uint8_t* a = src + static_cast<size_t>(first) * srcWidth;
+    // rows are only blended when the position falls between two of them
+    const uint8_t* row = a;
+    if (weight) {
+      blendRows(row_.data(), a, a + srcWidth, srcWidth, weight);
+      row = row_.data();
+    }
+    uint8_t* out = dst + static_cast<size_t>(j) * dstStride;
+    if (srcWidth == dstWidth) {
+      memcpy(out, row, dstWidth);
+    } else if (srcWidth == 2 * dstWidth) {
+      halveRow(out, row, dstWidth);
+    } else {
+      filterRow(out, row, dstWidth, column_firsts_.data(), column_weights_.data());
+    }
+  }
+}
+
+void SampleI420Compositor::drawTile(const Slot& slot,
+                                    const agora::rtc::MixerLayoutConfig& tile) {
+  int width = std::min(tile.width, width_ - tile.x);
+  int height = std::min(tile.height, height_ - tile.y);
+  if (width < 2 || height < 2 || tile.x < 0 || tile.y < 0) {
+    return;
+  }
+
+  int chromaWidth = (slot.width + 1) / 2;
+  int chromaHeight = (slot.height + 1) / 2;
+  size_t lumaSize = static_cast<size_t>(slot.width) * slot.height;
+  size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+  const uint8_t* y = slot.current.data();
+
+  size_t canvasLuma = static_cast<size_t>(width_) * height_;
+  int canvasChromaWidth = width_ / 2;
+  uint8_t* dstY = canvas_.data() + static_cast<size_t>(tile.y) * width_ + tile.x;
+  size_t chromaOffset = static_cast<size_t>(tile.y / 2) * canvasChromaWidth + tile.x / 2;
+  uint8_t* dstU = canvas_.data() + canvasLuma + chromaOffset;
+  uint8_t* dstV = canvas_.data() + canvasLuma + canvasLuma / 4 + chromaOffset;
+
+  scalePlane(y, slot.width, slot.height, dstY, width_, width, height);
+  scalePlane(y + lumaSize, chromaWidth, chromaHeight, dstU, canvasChromaWidth, width / 2,
+             height / 2);
+  scalePlane(y + lumaSize + chromaSize, chromaWidth, chromaHeight, dstV, canvasChromaWidth,
+             width / 2, height / 2);
+}
+
+int SampleI420Compositor::compose() {
+  auto start = std::chrono::steady_clock::now();
+  int64_t now = nowUs();
+
+  // Take the new frames, and forget the users gone quiet
+  std::map<std::string, std::shared_ptr<Slot>> slots;
+  {
+    std::lock_guard<std::mutex> _(slots_lock_);
+    for (auto it = slots_.begin(); it != slots_.end();) {
+      bool stale;
+      {
+        std::lock_guard<std::mutex> __(it->second->lock);
+        stale = stale_us_ > 0 && now - it->second->lastFrameUs > stale_us_;
+      }
+      if (stale) {
+        it = slots_.erase(it);
+      } else {
+        slots.insert(*it++);
+      }
+    }
+  }
+
+  // the users to draw, with their slot
+  std::vector<std::pair<const std::string*, const Slot*>> draws;
+  for (auto& item : slots) {
+    Slot& slot = *item.second;
+    bool resized = false;
+    {
+      std::lock_guard<std::mutex> _(slot.lock);
+      if (!slot.fresh) {
+        continue;
+      }
+      resized = slot.pendingWidth != slot.width || slot.pendingHeight != slot.height;
+      slot.current.swap(slot.pending);
+      slot.width = slot.pendingWidth;
+      slot.height = slot.pendingHeight;
+      slot.fresh = false;
+    }
+    if (resized || !layout_.hasStream(item.first)) {
+      layout_.setStream(item.first, slot.width, slot.height);
+    }
+    draws.emplace_back(&item.first, &slot);
+  }
+  for (auto& tile : tiles_) {
+    if (!slots.count(tile.first)) {
+      layout_.removeStream(tile.first);
+    }
+  }
+
+  std::vector<SampleMixerLayout::Change> changes = layout_.update();
+  for (auto& change : changes) {
+    if (change.removed) {
+      tiles_.erase(change.id);
+    } else {
+      tiles_[change.id] = change.config;
+    }
+  }
+  if (!changes.empty()) {
+    // Tiles moved: clear what they left and draw every user again
+    clearCanvas();
+    draws.clear();
+    for (auto& item : slots) {
+      if (!item.second->current.empty()) {
+        draws.emplace_back(&item.first, item.second.get());
+      }
+    }
+  }
+  counters_[kLayout].add(elapsedNs(start));
+
+  start = std::chrono::steady_clock::now();
+  int drawn = 0;
+  for (auto& draw : draws) {
+    auto tile = tiles_.find(*draw.first);
+    if (tile != tiles_.end()) {
+      drawTile(*draw.second, tile->second);
+      drawn++;
+    }
+  }
+  counters_[kScale].add(elapsedNs(start));
+
+  frames_++;
+  tiles_drawn_ += drawn;
+  return drawn;
+}
+
+int SampleI420Compositor::send(agora::rtc::IVideoFrameSender* sender, int64_t timestampMs) {
+  compose();
+
+  auto start = std::chrono::steady_clock::now();
+  agora::media::base::ExternalVideoFrame videoFrame;
+  videoFrame.type = agora::media::base::ExternalVideoFrame::VIDEO_BUFFER_RAW_DATA;
+  videoFrame.format = agora::media::base::VIDEO_PIXEL_I420;
+  videoFrame.buffer = canvas_.data();
+  videoFrame.stride = width_;
+  videoFrame.height = height_;
+  videoFrame.cropLeft = 0;
+  videoFrame.cropTop = 0;
+  videoFrame.cropRight = 0;
+  videoFrame.cropBottom = 0;
+  videoFrame.rotation = 0;
+  videoFrame.timestamp = timestampMs;
+  int result = sender->sendVideoFrame(videoFrame);
+  counters_[kSend].add(elapsedNs(start));
+  return result;
+}
+
+SampleI420Compositor::Timings SampleI420Compositor::takeTimings() {
+  Timings timings;
+  auto now = std::chrono::steady_clock::now();
+  timings.seconds = std::chrono::duration<double>(now - last_timings_).count();
+  last_timings_ = now;
+  for (int i = 0; i < kStages; i++) {
+    StageTiming& stage = timings.stages[i];
+    stage.count = counters_[i].count.exchange(0);
+    uint64_t totalNs = counters_[i].totalNs.exchange(0);
+    stage.maxUs = counters_[i].maxNs.exchange(0) / 1000.0;
+    stage.averageUs = stage.count ? totalNs / 1000.0 / stage.count : 0;
+  }
+  timings.frames = frames_.exchange(0);
+  timings.tiles = tiles_drawn_.exchange(0);
+  return timings;
+}
+
+void SampleI420Compositor::report() {
+  static const char* names[kStages] = {"copy", "layout", "scale", "send"};
+  Timings timings = takeTimings();
+  std::string stages;
+  for (int i = 0; i < kStages; i++) {
+    char stage[96];
+    snprintf(stage, sizeof(stage), ", %s %.0f us (max %.0f us)", names[i],
+             timings.stages[i].averageUs, timings.stages[i].maxUs);
+    stages += stage;
+  }
+  AG_LOG(INFO, "Compositor %dx%d (%s): %.1f fps, %.1f tiles per frame%s", width_, height_,
+         simdName(), timings.seconds > 0 ? timings.frames / timings.seconds : 0.0,
+         timings.frames ? static_cast<double>(timings.tiles) / timings.frames : 0.0,
+         stages.c_str());
+}
+
+const char* SampleI420Compositor::simdName() {
+#if defined(COMPOSITOR_SSE2)
+  return "sse2";
+#elif defined(COMPOSITOR_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,136 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AgoraMediaBase.h"
+#include "sample_event.h"
+#include "sample_mixer_layout.h"
+
+namespace agora {
+namespace rtc {
+class IVideoFrameSender;
+}
+}  // namespace agora
+
+// Software compositor of the decoded video of the remote users into one
+// I420 canvas, in place of the mixer of the SDK.
+//
+// The decoding threads give the frames of each user to onFrame(), which keeps
+// a copy of the latest one. compose() places the users on the grid of a
+// SampleMixerLayout and scales every new frame straight into its tile of the
+// canvas with a bilinear filter (SSE2 or NEON, plain C elsewhere), one pass
+// per plane without intermediate pictures. The canvas is kept from one frame
+// to the next: only the tiles with a new frame are drawn again, and the
+// background is only cleared when the layout changes. send() composes and
+// gives the canvas to a video frame sender.
+//
+// The time of each stage is measured so the cost of compositing can be
+// benchmarked and tuned: the copy of the frames received, the layout, the
+// scaling and the sending. onFrame() may be called from any thread, the
+// other calls must come from one thread at a time.
+class SampleI420Compositor : public noncopyable {
+ public:
+  enum Stage { kCopy, kLayout, kScale, kSend, kStages };
+
+  struct StageTiming {
+    uint64_t count{0};
+    double averageUs{0};
+    double maxUs{0};
+  };
+
+  // The timings of a period, from takeTimings()
+  struct Timings {
+    StageTiming stages[kStages];
+    uint64_t frames{0};  // canvases composed
+    uint64_t tiles{0};   // tiles drawn
+    double seconds{0};
+  };
+
+  // |width| and |height| of the canvas are rounded down to even numbers.
+  // Users without a frame for |staleMs| leave the canvas.
+  SampleI420Compositor(int width, int height, int staleMs = 2000);
+
+  // Keeps a copy of the latest I420 frame of |user|
+  void onFrame(const std::string& user, const agora::media::base::VideoFrame& frame);
+  void removeUser(const std::string& user);
+
+  // Draws the new frames on the canvas, returns the number of tiles drawn
+  int compose();
+  // Composes and sends the canvas with |timestampMs| (0 lets the SDK stamp
+  // it), returns the result of sendVideoFrame()
+  int send(agora::rtc::IVideoFrameSender* sender, int64_t timestampMs = 0);
+
+  // The canvas: the Y, U and V planes one after another, without padding
+  const uint8_t* canvas() const { return canvas_.data(); }
+  int width() const { return width_; }
+  int height() const { return height_; }
+
+  // The timings since the previous call, and the start of new ones
+  Timings takeTimings();
+  // Logs takeTimings()
+  void report();
+
+  // "sse2", "neon" or "scalar"
+  static const char* simdName();
+
+ private:
+  // Latest frame of a user, tightly packed. The decoding thread fills
+  // |pending|, compose() swaps it with |current| and scales from there
+  // without holding the lock.
+  struct Slot {
+    std::mutex lock;
+    std::vector<uint8_t> pending;
+    int pendingWidth{0};
+    int pendingHeight{0};
+    bool fresh{false};
+    int64_t lastFrameUs{0};
+
+    std::vector<uint8_t> current;
+    int width{0};
+    int height{0};
+  };
+
+  struct Counter {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+    void add(uint64_t ns);
+  };
+
+  void clearCanvas();
+  void drawTile(const Slot& slot, const agora::rtc::MixerLayoutConfig& tile);
+  void scalePlane(const uint8_t* src, int srcWidth, int srcHeight, uint8_t* dst, int dstStride,
+                  int dstWidth, int dstHeight);
+
+  const int width_;
+  const int height_;
+  const int64_t stale_us_;
+  std::vector<uint8_t> canvas_;
+
+  std::mutex slots_lock_;
+  std::map<std::string, std::shared_ptr<Slot>> slots_;
+
+  // owned by the composing thread
+  SampleMixerLayout layout_;
+  std::map<std::string, agora::rtc::MixerLayoutConfig> tiles_;
+  std::vector<uint8_t> row_;              // vertically filtered source row
+  std::vector<int> column_firsts_;        // first source sample of each column
+  std::vector<int16_t> column_weights_;   // and the weights of the two
+
+  Counter counters_[kStages];
+  std::atomic<uint64_t> frames_{0};
+  std::atomic<uint64_t> tiles_drawn_{0};
+  std::chrono::steady_clock::time_point last_timings_;
+};
@@ -0,0 +1,655 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_jpeg_encoder.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define JPEG_ENCODER_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define JPEG_ENCODER_NEON 1
+#endif
+
+// Tables K.1 and K.2 of the JPEG standard, natural order
+static const uint8_t kLumaQuant[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
+static const uint8_t kChromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99};
+
+// Natural index of the k-th coefficient in zigzag order
+static const uint8_t kZigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// Tables K.3 to K.6: number of codes of each length 1..16, then the symbols
+static const uint8_t kDcLumaBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t kDcChromaBits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t kDcValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t kAcLumaBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t kAcLumaValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61,
+    0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+    0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25,
+    0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+    0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64,
+    0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+    0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+    0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+    0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3,
+    0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+    0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+static const uint8_t kAcChromaBits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t kAcChromaValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61,
+    0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+    0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18,
+    0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+    0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63,
+    0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+    0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+    0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+    0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca,
+    0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+    0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+// Scale of the AAN DCT output for each frequency: cos(k * pi / 16) * sqrt(2)
+static const double kAanScale[8] = {1.0,         1.387039845, 1.306562965, 1.175875602,
+                                    1.0,         0.785694958, 0.541196100, 0.275899379};
+
+// AAN multipliers with 15 fractional bits; 1.306562965 is applied as
+// x + x * 0.306562965 to stay below 1
+#define FIX_0_306562965 ((int16_t)10045)
+#define FIX_0_382683433 ((int16_t)12540)
+#define FIX_0_541196100 ((int16_t)17734)
+#define FIX_0_707106781 ((int16_t)23170)
+
+// Baseline Huffman tables only code AC coefficients of 10 bits
+#define MAX_COEF (1023)
+
+// Worst case of 6 blocks with every coefficient coded and every byte stuffed
+#define MAX_MCU_BYTES (6 * 64 * 4 * 2)
+
+struct HuffmanCodes {
+  uint16_t code[256];
+  uint8_t size[256];
+};
+
+// Annex C: canonical codes from the code lengths
+static void buildCodes(HuffmanCodes& codes, const uint8_t* bits, const uint8_t* values) {
+  memset(&codes, 0, sizeof(codes));
+  int code = 0;
+  int k = 0;
+  for (int length = 1; length <= 16; length++) {
+    for (int i = 0; i < bits[length - 1]; i++) {
+      codes.code[values[k]] = static_cast<uint16_t>(code++);
+      codes.size[values[k]] = static_cast<uint8_t>(length);
+      k++;
+    }
+    code <<= 1;
+  }
+}
+
+struct StandardCodes {
+  StandardCodes() {
+    buildCodes(dc[0], kDcLumaBits, kDcValues);
+    buildCodes(ac[0], kAcLumaBits, kAcLumaValues);
+    buildCodes(dc[1], kDcChromaBits, kDcValues);
+    buildCodes(ac[1], kAcChromaBits, kAcChromaValues);
+  }
+  HuffmanCodes dc[2];
+  HuffmanCodes ac[2];
+};
+
+static const StandardCodes& standard_codes() {
+  static const StandardCodes codes;
+  return codes;
+}
+
+// One pass of the AAN forward DCT (jfdctfst.c) over 8 values. With SIMD each
+// value is a vector of 8 lanes, so one call transforms 8 columns or rows.
+template <typename Ops>
+static inline void fdct_pass(typename Ops::V* d) {
+  typedef typename Ops::V V;
+  V tmp0 = Ops::add(d[0], d[7]);
+  V tmp7 = Ops::sub(d[0], d[7]);
+  V tmp1 = Ops::add(d[1], d[6]);
+  V tmp6 = Ops::sub(d[1], d[6]);
+  V tmp2 = Ops::add(d[2], d[5]);
+  V tmp5 = Ops::sub(d[2], d[5]);
+  V tmp3 = Ops::add(d[3], d[4]);
+  V tmp4 = Ops::sub(d[3], d[4]);
+
+  // even part
+  V tmp10 = Ops::add(tmp0, tmp3);
+  V tmp13 = Ops::sub(tmp0, tmp3);
+  V tmp11 = Ops::add(tmp1, tmp2);
+  V tmp12 = Ops::sub(tmp1, tmp2);
+  d[0] = Ops::add(tmp10, tmp11);
+  d[4] = Ops::sub(tmp10, tmp11);
+  V z1 = Ops::mul(Ops::add(tmp12, tmp13), FIX_0_707106781);
+  d[2] = Ops::add(tmp13, z1);
+  d[6] = Ops::sub(tmp13, z1);
+
+  // odd part
+  tmp10 = Ops::add(tmp4, tmp5);
+  tmp11 = Ops::add(tmp5, tmp6);
+  tmp12 = Ops::add(tmp6, tmp7);
+  V z5 = Ops::mul(Ops::sub(tmp10, tmp12), FIX_0_382683433);
+  V z2 = Ops::add(Ops::mul(tmp10, FIX_0_541196100), z5);
+  V z4 = Ops::add(Ops::add(tmp12, Ops::mul(tmp12, FIX_0_306562965)), z5);
+  V z3 = Ops::mul(tmp11, FIX_0_707106781);
+  V z11 = Ops::add(tmp7, z3);
+  V z13 = Ops::sub(tmp7, z3);
+  d[5] = Ops::add(z13, z2);
+  d[3] = Ops::sub(z13, z2);
+  d[1] = Ops::add(z11, z4);
+  d[7] = Ops::sub(z11, z4);
+}
+
+#if defined(JPEG_ENCODER_SSE2)
+
+struct Sse2Ops {
+  typedef __m128i V;
+  static V add(V a, V b) { return _mm_add_epi16(a, b); }
+  static V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+  static V mul(V a, int16_t k) { return _mm_mulhi_epi16(_mm_slli_epi16(a, 1), _mm_set1_epi16(k)); }
+};
+
+static inline void transpose_sse2(__m128i* r) {
+  __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+  __m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+  __m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+  __m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+  __m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+  r[0] = _mm_unpacklo_epi64(b0, b4);
+  r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5);
+  r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6);
+  r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7);
+  r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void transform_block_sse2(const uint8_t* const rows[8], const float* reciprocal,
+                                 int16_t* coef) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i center = _mm_set1_epi16(128);
+  __m128i r[8];
+  for (int i = 0; i < 8; i++) {
+    __m128i pixels = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[i]));
+    r[i] = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), center);
+  }
+
+  // columns, then rows; the second transpose restores the natural order
+  fdct_pass<Sse2Ops>(r);
+  transpose_sse2(r);
+  fdct_pass<Sse2Ops>(r);
+  transpose_sse2(r);
+
+  const __m128i maxCoef = _mm_set1_epi16(MAX_COEF);
+  const __m128i minCoef = _mm_set1_epi16(-MAX_COEF);
+  for (int i = 0; i < 8; i++) {
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(r[i], r[i]), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(r[i], r[i]), 16);
+    __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), _mm_load_ps(reciprocal + i * 8));
+    __m128 fhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), _mm_load_ps(reciprocal + i * 8 + 4));
+    __m128i q = _mm_packs_epi32(_mm_cvtps_epi32(flo), _mm_cvtps_epi32(fhi));
+    q = _mm_max_epi16(_mm_min_epi16(q, maxCoef), minCoef);
+    _mm_store_si128(reinterpret_cast<__m128i*>(coef + i * 8), q);
+  }
+}
+
+static uint64_t nonzero_mask_sse2(const int16_t* zz) {
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t zeros = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(zz + i * 16));
+    __m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(zz + i * 16 + 8));
+    __m128i eq = _mm_packs_epi16(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero));
+    zeros |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq))) << (i * 16);
+  }
+  return ~zeros;
+}
+
+#elif defined(JPEG_ENCODER_NEON)
+
+struct NeonOps {
+  typedef int16x8_t V;
+  static V add(V a, V b) { return vaddq_s16(a, b); }
+  static V sub(V a, V b) { return vsubq_s16(a, b); }
+  static V mul(V a, int16_t k) { return vqdmulhq_n_s16(a, k); }
+};
+
+static inline void transpose_neon(int16x8_t* r) {
+  int16x8x2_t t01 = vtrnq_s16(r[0], r[1]);
+  int16x8x2_t t23 = vtrnq_s16(r[2], r[3]);
+  int16x8x2_t t45 = vtrnq_s16(r[4], r[5]);
+  int16x8x2_t t67 = vtrnq_s16(r[6], r[7]);
+  int32x4x2_t u02 =
+      vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]), vreinterpretq_s32_s16(t23.val[0]));
+  int32x4x2_t u13 =
+      vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]), vreinterpretq_s32_s16(t23.val[1]));
+  int32x4x2_t u46 =
+      vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]), vreinterpretq_s32_s16(t67.val[0]));
+  int32x4x2_t u57 =
+      vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]), vreinterpretq_s32_s16(t67.val[1]));
+  int16x8_t c02 = vreinterpretq_s16_s32(u02.val[0]);
+  int16x8_t c13 = vreinterpretq_s16_s32(u13.val[0]);
+  int16x8_t c46 = vreinterpretq_s16_s32(u46.val[0]);
+  int16x8_t c57 = vreinterpretq_s16_s32(u57.val[0]);
+  int16x8_t d02 = vreinterpretq_s16_s32(u02.val[1]);
+  int16x8_t d13 = vreinterpretq_s16_s32(u13.val[1]);
+  int16x8_t d46 = vreinterpretq_s16_s32(u46.val[1]);
+  int16x8_t d57 = vreinterpretq_s16_s32(u57.val[1]);
+  r[0] = vcombine_s16(vget_low_s16(c02), vget_low_s16(c46));
+  r[4] = vcombine_s16(vget_high_s16(c02), vget_high_s16(c46));
+  r[1] = vcombine_s16(vget_low_s16(c13), vget_low_s16(c57));
+  r[5] = vcombine_s16(vget_high_s16(c13), vget_high_s16(c57));
+  r[2] = vcombine_s16(vget_low_s16(d02), vget_low_s16(d46));
+  r[6] = vcombine_s16(vget_high_s16(d02), vget_high_s16(d46));
+  r[3] = vcombine_s16(vget_low_s16(d13), vget_low_s16(d57));
+  r[7] = vcombine_s16(vget_high_s16(d13), vget_high_s16(d57));
+}
+
+static void transform_block_neon(const uint8_t* const rows[8], const float* reciprocal,
+                                 int16_t* coef) {
+  const uint8x8_t center = vdup_n_u8(128);
+  int16x8_t r[8];
+  for (int i = 0; i < 8; i++) {
+    r[i] = vreinterpretq_s16_u16(vsubl_u8(vld1_u8(rows[i]), center));
+  }
+
+  // columns, then rows; the second transpose restores the natural order
+  fdct_pass<NeonOps>(r);
+  transpose_neon(r);
+  fdct_pass<NeonOps>(r);
+  transpose_neon(r);
+
+  const int16x8_t maxCoef = vdupq_n_s16(MAX_COEF);
+  const int16x8_t minCoef = vdupq_n_s16(-MAX_COEF);
+  for (int i = 0; i < 8; i++) {
+    float32x4_t flo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(r[i]))),
+                                vld1q_f32(reciprocal + i * 8));
+    float32x4_t fhi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(r[i]))),
+                                vld1q_f32(reciprocal + i * 8 + 4));
+    int16x8_t q = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(flo)), vqmovn_s32(vcvtnq_s32_f32(fhi)));
+    vst1q_s16(coef + i * 8, vmaxq_s16(vminq_s16(q, maxCoef), minCoef));
+  }
+}
+
+static uint64_t nonzero_mask_neon(const int16_t* zz) {
+  static const uint8_t kWeights[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x8_t weights = vld1_u8(kWeights);
+  uint64_t mask = 0;
+  for (int i = 0; i < 8; i++) {
+    int16x8_t v = vld1q_s16(zz + i * 8);
+    uint8x8_t nonzero = vmovn_u16(vtstq_s16(v, v));
+    mask |= static_cast<uint64_t>(vaddv_u8(vand_u8(nonzero, weights))) << (i * 8);
+  }
+  return mask;
+}
+
+#else
+
+// The SIMD versions compute the same products: (x << 1) * k >> 16 with SSE2
+// and 2 * x * k >> 16 with NEON are both x * k >> 15.
+struct ScalarOps {
+  typedef int V;
+  static V add(V a, V b) { return a + b; }
+  static V sub(V a, V b) { return a - b; }
+  static V mul(V a, int16_t k) { return (a * k) >> 15; }
+};
+
+static void transform_block_scalar(const uint8_t* const rows[8], const float* reciprocal,
+                                   int16_t* coef) {
+  int block[64];
+  int d[8];
+  for (int c = 0; c < 8; c++) {
+    for (int r = 0; r < 8; r++) {
+      d[r] = rows[r][c] - 128;
+    }
+    fdct_pass<ScalarOps>(d);
+    for (int r = 0; r < 8; r++) {
+      block[r * 8 + c] = d[r];
+    }
+  }
+  for (int r = 0; r < 8; r++) {
+    fdct_pass<ScalarOps>(block + r * 8);
+  }
+  for (int i = 0; i < 64; i++) {
+    int q = static_cast<int>(lrintf(static_cast<float>(block[i]) * reciprocal[i]));
+    coef[i] = static_cast<int16_t>(std::max(-MAX_COEF, std::min(MAX_COEF, q)));
+  }
+}
+
+static uint64_t nonzero_mask_scalar(const int16_t* zz) {
+  uint64_t mask = 0;
+  for (int k = 0; k < 64; k++) {
+    if (zz[k]) {
+      mask |= 1ull << k;
+    }
+  }
+  return mask;
+}
+
+#endif
+
+static inline void transform_block(const uint8_t* const rows[8], const float* reciprocal,
+                                   int16_t* coef) {
+#if defined(JPEG_ENCODER_SSE2)
+  transform_block_sse2(rows, reciprocal, coef);
+#elif defined(JPEG_ENCODER_NEON)
+  transform_block_neon(rows, reciprocal, coef);
+#else
+  transform_block_scalar(rows, reciprocal, coef);
+#endif
+}
+
+static inline uint64_t nonzero_mask(const int16_t* zz) {
+#if defined(JPEG_ENCODER_SSE2)
+  return nonzero_mask_sse2(zz);
+#elif defined(JPEG_ENCODER_NEON)
+  return nonzero_mask_neon(zz);
+#else
+  return nonzero_mask_scalar(zz);
+#endif
+}
+
+const char* SampleJpegEncoder::simdName() {
+#if defined(JPEG_ENCODER_SSE2)
+  return "sse2";
+#elif defined(JPEG_ENCODER_NEON)
+  return "neon";
+#else
+  return "scalar";
+#endif
+}
+
+// Entropy coded data of the scan. Bits are gathered in a 64-bit register and
+// stored 32 at a time; the rare words holding a 0xFF byte are stored byte by
+// byte to insert the stuffed zero.
+class JpegBitWriter {
+ public:
+  explicit JpegBitWriter(std::vector<uint8_t>& out) : out_(out) {
+    size_t used = out_.size();
+    out_.resize(std::max<size_t>(out_.capacity(), used + 64 * 1024));
+    pos_ = out_.data() + used;
+    end_ = out_.data() + out_.size();
+  }
+
+  // Makes room for one more MCU
+  void reserve() {
+    if (end_ - pos_ >= MAX_MCU_BYTES) {
+      return;
+    }
+    size_t used = pos_ - out_.data();
+    out_.resize(out_.size() * 2 + MAX_MCU_BYTES);
+    pos_ = out_.data() + used;
+    end_ = out_.data() + out_.size();
+  }
+
+  // |size| <= 27, a code and the bits of its value
+  inline void put(uint32_t bits, int size) {
+    acc_ = (acc_ << size) | bits;
+    count_ += size;
+    if (count_ >= 32) {
+      count_ -= 32;
+      storeWord(static_cast<uint32_t>(acc_ >> count_));
+    }
+  }
+
+  // Pads the last byte with 1 bits and leaves |out| with the written data
+  void finish() {
+    if (count_ & 7) {
+      int pad = 8 - (count_ & 7);
+      put((1u << pad) - 1, pad);
+    }
+    while (count_ >= 8) {
+      count_ -= 8;
+      storeByte(static_cast<uint8_t>(acc_ >> count_));
+    }
+    out_.resize(pos_ - out_.data());
+  }
+
+ private:
+  inline void storeByte(uint8_t byte) {
+    *pos_++ = byte;
+    if (byte == 0xFF) {
+      *pos_++ = 0;
+    }
+  }
+
+  inline void storeWord(uint32_t word) {
+    // nonzero when one of the bytes of |word| is 0xFF
+    if (((~word - 0x01010101u) & word & 0x80808080u) == 0) {
+      pos_[0] = static_cast<uint8_t>(word >> 24);
+      pos_[1] = static_cast<uint8_t>(word >> 16);
+      pos_[2] = static_cast<uint8_t>(word >> 8);
+      pos_[3] = static_cast<uint8_t>(word);
+      pos_ += 4;
+      return;
+    }
+    storeByte(static_cast<uint8_t>(word >> 24));
+    storeByte(static_cast<uint8_t>(word >> 16));
+    storeByte(static_cast<uint8_t>(word >> 8));
+    storeByte(static_cast<uint8_t>(word));
+  }
+
+  std::vector<uint8_t>& out_;
+  uint8_t* pos_;
+  uint8_t* end_;
+  uint64_t acc_{0};
+  int count_{0};
+};
+
+// Magnitude category of a coefficient and its value bits
+static inline int coef_bits(int value, uint32_t& bits) {
+  int magnitude = value < 0 ? -value : value;
+  int size = magnitude ? 32 - __builtin_clz(magnitude) : 0;
+  bits = static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << size) - 1);
+  return size;
+}
+
+static void encode_block(JpegBitWriter& writer, const int16_t* coef, int& lastDc,
+                         const HuffmanCodes& dc, const HuffmanCodes& ac) {
+  alignas(16) int16_t zz[64];
+  for (int k = 0; k < 64; k++) {
+    zz[k] = coef[kZigzag[k]];
+  }
+
+  uint32_t bits;
+  int size = coef_bits(zz[0] - lastDc, bits);
+  lastDc = zz[0];
+  writer.put((static_cast<uint32_t>(dc.code[size]) << size) | bits, dc.size[size] + size);
+
+  uint64_t nonzero = nonzero_mask(zz) & ~1ull;
+  int last = 0;
+  while (nonzero) {
+    int k = __builtin_ctzll(nonzero);
+    int run = k - last - 1;
+    for (; run >= 16; run -= 16) {
+      writer.put(ac.code[0xF0], ac.size[0xF0]);
+    }
+    size = coef_bits(zz[k], bits);
+    int symbol = (run << 4) | size;
+    writer.put((static_cast<uint32_t>(ac.code[symbol]) << size) | bits, ac.size[symbol] + size);
+    last = k;
+    nonzero &= nonzero - 1;
+  }
+  if (last != 63) {
+    writer.put(ac.code[0], ac.size[0]);
+  }
+}
+
+// Row pointers of the 8x8 block at |x|, |y|, repeating the last column and
+// row of the plane past its edges
+static inline void block_rows(const uint8_t* plane, int stride, int width, int height, int x,
+                              int y, const uint8_t* rows[8], uint8_t* edge) {
+  for (int r = 0; r < 8; r++) {
+    const uint8_t* line = plane + static_cast<ptrdiff_t>(std::min(y + r, height - 1)) * stride;
+    if (x + 8 <= width) {
+      rows[r] = line + x;
+      continue;
+    }
+    for (int c = 0; c < 8; c++) {
+      edge[r * 8 + c] = line[std::min(x + c, width - 1)];
+    }
+    rows[r] = edge + r * 8;
+  }
+}
+
+void SampleJpegEncoder::setQuality(int quality) {
+  if (quality == quality_) {
+    return;
+  }
+  quality_ = quality;
+
+  // jpeg_quality_scaling() and jpeg_add_quant_table() of libjpeg, baseline
+  int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+  for (int t = 0; t < 2; t++) {
+    const uint8_t* base = t ? kChromaQuant : kLumaQuant;
+    int quant[64];
+    for (int i = 0; i < 64; i++) {
+      quant[i] = std::max(1, std::min(255, (base[i] * scale + 50) / 100));
+    }
+    for (int k = 0; k < 64; k++) {
+      quant_[t][k] = static_cast<uint8_t>(quant[kZigzag[k]]);
+    }
+    // the AAN DCT leaves each coefficient multiplied by 8 and its scale factors
+    for (int i = 0; i < 64; i++) {
+      reciprocal_[t][i] =
+          static_cast<float>(1.0 / (quant[i] * kAanScale[i / 8] * kAanScale[i % 8] * 8.0));
+    }
+  }
+}
+
+static inline void put_marker(std::vector<uint8_t>& out, uint8_t marker, int length) {
+  out.push_back(0xFF);
+  out.push_back(marker);
+  if (length) {
+    out.push_back(static_cast<uint8_t>(length >> 8));
+    out.push_back(static_cast<uint8_t>(length));
+  }
+}
+
+static void put_huffman_table(std::vector<uint8_t>& out, uint8_t id, const uint8_t* bits,
+                              const uint8_t* values) {
+  int count = 0;
+  out.push_back(id);
+  for (int i = 0; i < 16; i++) {
+    out.push_back(bits[i]);
+    count += bits[i];
+  }
+  out.insert(out.end(), values, values + count);
+}
+
+void SampleJpegEncoder::writeHeaders(std::vector<uint8_t>& out, int width, int height) const {
+  put_marker(out, 0xD8, 0);  // SOI
+
+  static const uint8_t kJfif[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+  put_marker(out, 0xE0, 2 + sizeof(kJfif));  // APP0
+  out.insert(out.end(), kJfif, kJfif + sizeof(kJfif));
+
+  put_marker(out, 0xDB, 2 + 2 * 65);  // DQT
+  for (int t = 0; t < 2; t++) {
+    out.push_back(static_cast<uint8_t>(t));
+    out.insert(out.end(), quant_[t], quant_[t] + 64);
+  }
+
+  put_marker(out, 0xC0, 17);  // SOF0
+  const uint8_t frame[15] = {8,
+                             static_cast<uint8_t>(height >> 8),
+                             static_cast<uint8_t>(height),
+                             static_cast<uint8_t>(width >> 8),
+                             static_cast<uint8_t>(width),
+                             3,
+                             1, 0x22, 0,  // Y, 2x2, table 0
+                             2, 0x11, 1,  // Cb
+                             3, 0x11, 1}; // Cr
+  out.insert(out.end(), frame, frame + sizeof(frame));
+
+  put_marker(out, 0xC4, 2 + 4 * 17 + 2 * 12 + 2 * 162);  // DHT
+  put_huffman_table(out, 0x00, kDcLumaBits, kDcValues);
+  put_huffman_table(out, 0x10, kAcLumaBits, kAcLumaValues);
+  put_huffman_table(out, 0x01, kDcChromaBits, kDcValues);
+  put_huffman_table(out, 0x11, kAcChromaBits, kAcChromaValues);
+
+  put_marker(out, 0xDA, 12);  // SOS
+  static const uint8_t kScan[10] = {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+  out.insert(out.end(), kScan, kScan + sizeof(kScan));
+}
+
+bool SampleJpegEncoder::encode(const SampleSnapshotPicture& picture, int quality,
+                               std::vector<uint8_t>& out) {
+  int width = picture.width;
+  int height = picture.height;
+  if (!picture.y || !picture.u || !picture.v || width <= 0 || height <= 0 || width > 0xFFFF ||
+      height > 0xFFFF) {
+    return false;
+  }
+  setQuality(std::max(1, std::min(100, quality)));
+
+  out.clear();
+  writeHeaders(out, width, height);
+
+  const StandardCodes& codes = standard_codes();
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  int lastDc[3] = {0, 0, 0};
+  const uint8_t* rows[8];
+  uint8_t edge[64];
+  alignas(16) int16_t coef[64];
+
+  JpegBitWriter writer(out);
+  for (int y = 0; y < height; y += 16) {
+    for (int x = 0; x < width; x += 16) {
+      writer.reserve();
+      for (int i = 0; i < 4; i++) {
+        block_rows(picture.y, picture.yStride, width, height, x + (i & 1) * 8, y + (i >> 1) * 8,
+                   rows, edge);
+        transform_block(rows, reciprocal_[0], coef);
+        encode_block(writer, coef, lastDc[0], codes.dc[0], codes.ac[0]);
+      }
+      block_rows(picture.u, picture.uStride, chromaWidth, chromaHeight, x / 2, y / 2, rows, edge);
+      transform_block(rows, reciprocal_[1], coef);
+      encode_block(writer, coef, lastDc[1], codes.dc[1], codes.ac[1]);
+      block_rows(picture.v, picture.vStride, chromaWidth, chromaHeight, x / 2, y / 2, rows, edge);
+      transform_block(rows, reciprocal_[1], coef);
+      encode_block(writer, coef, lastDc[2], codes.dc[1], codes.ac[1]);
+    }
+  }
+  writer.finish();
+
+  put_marker(out, 0xD9, 0);  // EOI
+  return true;
+}
@@ -0,0 +1,50 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <vector>
+
+#include "sample_snapshot_encoder.h"
+
+// Baseline JPEG encoder for I420 snapshots, independent of libjpeg.
+//
+// Writes the quantization tables of the JPEG standard scaled to the quality
+// the way libjpeg does, and the standard Huffman tables, so any decoder reads
+// the files. Each 8x8 block is loaded, level shifted, transformed by an
+// integer AAN forward DCT and quantized with SSE2 or NEON (plain C
+// elsewhere). The entropy coder accumulates its codes in a 64-bit register,
+// stores them 32 bits at a time and walks the nonzero coefficients of a block
+// through a bit mask.
+// Blocks crossing the right or bottom edge repeat the last column and row,
+// as libjpeg does.
+//
+// Like the fast DCT of libjpeg, the 16-bit transform limits the fidelity
+// at the top of the quality range (about 52 dB of luma PSNR at 100); for
+// snapshots above quality 90 prefer the libjpeg backends. The encoder relies
+// on inlining: it only beats libjpeg in an optimized build (-O2,
+// CMAKE_BUILD_TYPE=Release), unoptimized it is slower.
+class SampleJpegEncoder : public SampleSnapshotEncoder {
+ public:
+  SampleJpegEncoder() = default;
+
+  const char* name() const override { return "builtin"; }
+
+  bool encode(const SampleSnapshotPicture& picture, int quality,
+              std::vector<uint8_t>& out) override;
+
+  // "sse2", "neon" or "scalar"
+  static const char* simdName();
+
+ private:
+  void setQuality(int quality);
+  void writeHeaders(std::vector<uint8_t>& out, int width, int height) const;
+
+  int quality_{-1};
+  uint8_t quant_[2][64];  // zigzag order, as written in DQT
+  // 1 / (quantizer * AAN scale factors), natural order
+  alignas(16) float reciprocal_[2][64];
+};
@@ -7,6 +7,8 @@
 #include "sample_local_user_observer.h"
 
 #include "log.h"
+#include "sample_active_speaker.h"
+#include "sample_encoder_controller.h"
 
 SampleLocalUserObserver::SampleLocalUserObserver(agora::rtc::IRtcConnection *connection)
 		: connection_(connection)
@@ -84,8 +86,16 @@ void SampleLocalUserObserver::onUserVideoTrackSubscribed(
 	if (remote_video_track_ && video_frame_observer_) {
 		local_user_->registerVideoFrameObserver(video_frame_observer_);
 	}
-	if (remote_video_track_ && video_mixer_ && enable_video_mix_) {
-		video_mixer_->addVideoTrack(userId, remote_video_track_);
+	// the mixer is called without pinning the state, its callbacks may update it
+	agora::agora_refptr<agora::rtc::IVideoMixerSource> mixer;
+	{
+		SampleRcu<MixerState>::Reader state(mixer_state_);
+		if (state->enabled) {
+			mixer = state->mixer;
+		}
+	}
+	if (remote_video_track_ && mixer) {
+		mixer->addVideoTrack(userId, remote_video_track_);
 		remote_video_track_map_[std::string(userId)] = remote_video_track_;
 	}
 }
@@ -93,47 +103,64 @@ void SampleLocalUserObserver::onUserVideoTrackSubscribed(
 void SampleLocalUserObserver::onFirstRemoteVideoDecoded(agora::user_id_t userId, int width,
 														int height, int elapsed)
 {
-	/*  Note:   
-	    before refresh(),we must set all-StreamLayout again 
-	*/
-	// agora::rtc::MixerLayoutConfig mixConfig;
-	// mixConfig.height = height;
-	// mixConfig.width = width;
-	// mixConfig.zOrder = 1;
-	// mixConfig.x = x_offset_;
-	// mixConfig.y = y_offset_;
-	// x_offset_ += 300;
-	// y_offset_ += 300;
-	if (video_mixer_ && enable_video_mix_) {
-		remote_source_map_[std::string(userId)] = videoInfo(width, height,false);
-		x_offset_ = 0;
-		y_offset_ = 0;
-		for (auto it = remote_source_map_.begin(); it != remote_source_map_.end(); it++) {
-			video_mixer_->setStreamLayout(it->first.c_str(), calculate_layout(it->second.width,it->second.height));
+	if (!is_mixing()) {
+		return;
+	}
+	mixer_state_.update([&](MixerState& state) {
+		if (!(state.mixer && state.enabled)) {
+			return false;
+		}
+		state.layout.setStream(userId, width, height);
+		state.layout.setVisible(userId, true);
+		apply_mixer_layout(state);
+		return true;
+	});
+}
+
+void SampleLocalUserObserver::onVideoSizeChanged(agora::user_id_t userId, int width, int height,
+												 int rotation)
+{
+	if (!userId) {
+		return;
+	}
+	// most size changes are not of mixed streams, they are only read
+	{
+		SampleRcu<MixerState>::Reader state(mixer_state_);
+		if (!(state->mixer && state->enabled && state->layout.hasStream(userId))) {
+			return;
 		}
-		video_mixer_->refresh();
 	}
+	mixer_state_.update([&](MixerState& state) {
+		if (!state.layout.hasStream(userId)) {
+			return false;
+		}
+		state.layout.setStream(userId, width, height);
+		apply_mixer_layout(state);
+		return true;
+	});
 }
 
-agora::rtc::MixerLayoutConfig SampleLocalUserObserver::calculate_layout(int width, int height)
-{
-	agora::rtc::MixerLayoutConfig mixConfig;
-	mixConfig.height = height;
-	mixConfig.width = width;
-	mixConfig.zOrder = 1;
-	mixConfig.x = x_offset_;
-	mixConfig.y = y_offset_;
-	// x_offset_ += 300;
-	// y_offset_ += 300;
-	if (x_offset_ + width < 1920) {
-		x_offset_ += width;
-		y_offset_ = y_offset_;
-	} else {
-		x_offset_ = width;
-		y_offset_ += height;
+bool SampleLocalUserObserver::is_mixing() const
+{
+	SampleRcu<MixerState>::Reader state(mixer_state_);
+	return state->mixer && state->enabled;
+}
+
+void SampleLocalUserObserver::apply_mixer_layout(MixerState& state)
+{
+	std::vector<SampleMixerLayout::Change> changes = state.layout.update();
+	if (changes.empty()) {
+		return;
+	}
+	for (auto& change : changes) {
+		if (change.removed) {
+			state.mixer->delStreamLayout(change.id.c_str());
+		} else {
+			state.mixer->setStreamLayout(change.id.c_str(), change.config);
+		}
 	}
-	AG_LOG(INFO, "the x_offset id %d y_offset is %d ", x_offset_, y_offset_);
-	return mixConfig;
+	state.mixer->refresh();
+	AG_LOG(INFO, "Mixer layout: %zu streams changed", changes.size());
 }
 
 void SampleLocalUserObserver::onUserVideoTrackStateChanged(
@@ -141,30 +168,21 @@ void SampleLocalUserObserver::onUserVideoTrackStateChanged(
     agora::agora_refptr<agora::rtc::IRemoteVideoTrack> videoTrack,
     agora::rtc::REMOTE_VIDEO_STATE state,
     agora::rtc::REMOTE_VIDEO_STATE_REASON reason, int elapsed) {
-   if(!(video_mixer_ && enable_video_mix_)) return;
-  if (state == 0) {
-	  if(remote_source_map_.find(std::string(userId))!=remote_source_map_.end())
-    remote_source_map_[std::string(userId)].muted = true;
-    x_offset_ = 0;
-    y_offset_ = 0;
-    for (auto it = remote_source_map_.begin(); it != remote_source_map_.end();
-         it++) {
-	if(!it->second.muted)
-      video_mixer_->setStreamLayout(it->first.c_str(), calculate_layout(it->second.width,it->second.height));
-    }
-    video_mixer_->refresh();
-   }else if(state == 1){
-	  if(remote_source_map_.find(std::string(userId))!=remote_source_map_.end())
-	   	remote_source_map_[std::string(userId)].muted = false;
-    x_offset_ = 0;
-    y_offset_ = 0;
-    for (auto it = remote_source_map_.begin(); it != remote_source_map_.end();
-         it++) {
-	if(!it->second.muted)
-      video_mixer_->setStreamLayout(it->first.c_str(), calculate_layout(it->second.width,it->second.height));
+  if (!userId || (state != agora::rtc::REMOTE_VIDEO_STATE_STOPPED &&
+                  state != agora::rtc::REMOTE_VIDEO_STATE_STARTING) ||
+      !is_mixing()) {
+    return;
+  }
+  // a stopped stream leaves the grid, it comes back at its place when it starts again
+  bool visible = state == agora::rtc::REMOTE_VIDEO_STATE_STARTING;
+  mixer_state_.update([&](MixerState& mixerState) {
+    if (!(mixerState.mixer && mixerState.enabled)) {
+      return false;
     }
-    video_mixer_->refresh();
-   }
+    mixerState.layout.setVisible(userId, visible);
+    apply_mixer_layout(mixerState);
+    return true;
+  });
 }
 
 void SampleLocalUserObserver::onUserInfoUpdated(agora::user_id_t userId,
@@ -191,6 +209,31 @@ void SampleLocalUserObserver::onUserAudioTrackStateChanged(
 		   reason);
 }
 
+void SampleLocalUserObserver::onLocalVideoTrackStatistics(
+		agora::agora_refptr<agora::rtc::ILocalVideoTrack> videoTrack,
+		const agora::rtc::LocalVideoTrackStats &stats)
+{
+	if (encoder_controller_) {
+		encoder_controller_->onLocalVideoTrackStatistics(stats);
+	}
+}
+
+void SampleLocalUserObserver::onAudioVolumeIndication(
+		const agora::rtc::AudioVolumeInformation *speakers, unsigned int speakerNumber,
+		int totalVolume)
+{
+	if (active_speaker_) {
+		active_speaker_->onAudioVolumeIndication(speakers, speakerNumber);
+	}
+}
+
+void SampleLocalUserObserver::onActiveSpeaker(agora::user_id_t userId)
+{
+	if (active_speaker_) {
+		active_speaker_->onActiveSpeaker(userId);
+	}
+}
+
 void SampleLocalUserObserver::onIntraRequestReceived()
 {
 	AG_LOG(INFO, "onIntraRequestReceived");
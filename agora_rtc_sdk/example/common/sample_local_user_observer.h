@@ -18,15 +18,11 @@
 #include "NGIAgoraVideoTrack.h"
 #include "NGIAgoraRtcConnection.h"
 #include "NGIAgoraVideoMixerSource.h"
+#include "sample_mixer_layout.h"
+#include "sample_rcu.h"
 
-
-struct videoInfo{
-  int width;
-  int height;
-  bool muted;
-  videoInfo():width(0),height(0),muted(true) {};
-  videoInfo(int w ,int h ,bool mute):width(w),height(h),muted(mute) {};
-};
+class SampleActiveSpeaker;
+class SampleEncoderController;
 
 class SampleLocalUserObserver : public agora::rtc::ILocalUserObserver {
  public:
@@ -83,15 +79,33 @@ class SampleLocalUserObserver : public agora::rtc::ILocalUserObserver {
   }
 
   void setEnableVideoMix(bool enable){
-       enable_video_mix_ = enable;
+    mixer_state_.update([enable](MixerState& state) {
+      state.enabled = enable;
+      return true;
+    });
   }
 
 void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, size_t length) {
         printf("the message is %s \n",data);
     }
 
-  void setVideoMixer( agora::agora_refptr<agora::rtc::IVideoMixerSource> video_mixer){
-       video_mixer_ = video_mixer;
+  // The remote streams are laid out on a grid of the |canvasWidth| x
+  // |canvasHeight| background of the mixer
+  void setVideoMixer(agora::agora_refptr<agora::rtc::IVideoMixerSource> video_mixer,
+                     int canvasWidth = 1920, int canvasHeight = 1080) {
+    mixer_state_.update([&](MixerState& state) {
+      state.mixer = video_mixer;
+      state.layout = SampleMixerLayout(canvasWidth, canvasHeight);
+      return true;
+    });
+  }
+
+  void setEncoderController(SampleEncoderController* controller) {
+    encoder_controller_ = controller;
+  }
+
+  void setActiveSpeaker(SampleActiveSpeaker* activeSpeaker) {
+    active_speaker_ = activeSpeaker;
   }
 
  public:
@@ -135,10 +149,10 @@ void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, si
                                      agora::rtc::LOCAL_VIDEO_STREAM_REASON reason) override {}
 
   void onLocalVideoTrackStatistics(agora::agora_refptr<agora::rtc::ILocalVideoTrack> videoTrack,
-                                   const agora::rtc::LocalVideoTrackStats& stats) override {}
+                                   const agora::rtc::LocalVideoTrackStats& stats) override;
 
   void onAudioVolumeIndication(const agora::rtc::AudioVolumeInformation* speakers,
-                               unsigned int speakerNumber, int totalVolume) override {}
+                               unsigned int speakerNumber, int totalVolume) override;
 
   void onLocalAudioTrackStatistics(const agora::rtc::LocalAudioStats& stats) override {}
 
@@ -185,11 +199,23 @@ void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, si
 
   void onVideoTrackUnpublished(agora::agora_refptr<agora::rtc::ILocalVideoTrack> videoTrack)override {}
 
-  void onVideoSizeChanged(agora::user_id_t userId, int width, int height, int rotation) {}
-  void onActiveSpeaker(agora::user_id_t userId){}
+  void onVideoSizeChanged(agora::user_id_t userId, int width, int height, int rotation) override;
+  void onActiveSpeaker(agora::user_id_t userId) override;
  private:
 
-  agora::rtc::MixerLayoutConfig calculate_layout(int width,int height);
+  // The video mixer and the layout of its streams. The SDK threads read it
+  // without locking, the writers publish new versions of it.
+  struct MixerState {
+    agora::agora_refptr<agora::rtc::IVideoMixerSource> mixer;
+    bool enabled{false};
+    SampleMixerLayout layout{1920, 1080};
+  };
+
+  // Gives the mixer the layout of the streams that moved, then refreshes
+  // it once; called by the writers of |mixer_state_| on their new version
+  static void apply_mixer_layout(MixerState& state);
+  // Whether the remote streams go to a video mixer, read without locking
+  bool is_mixing() const;
 
   agora::rtc::IRtcConnection* connection_{nullptr};
   agora::rtc::ILocalUser* local_user_{nullptr};
@@ -197,23 +223,19 @@ void onStreamMessage(agora::user_id_t userId, int streamId, const char* data, si
   agora::agora_refptr<agora::rtc::IRemoteAudioTrack> remote_audio_track_;
   agora::agora_refptr<agora::rtc::IRemoteVideoTrack> remote_video_track_;
 
-  agora::agora_refptr<agora::rtc::IVideoMixerSource> video_mixer_{nullptr};
-
   agora::media::IVideoEncodedFrameObserver* video_encoded_receiver_{nullptr};
   agora::rtc::IAudioEncodedFrameReceiver* audio_encoded_receiver_{nullptr};
 
   agora::media::IAudioFrameObserverBase* audio_frame_observer_{nullptr};
   agora::rtc::IVideoFrameObserver2* video_frame_observer_{nullptr};
+  SampleEncoderController* encoder_controller_{nullptr};
+  SampleActiveSpeaker* active_speaker_{nullptr};
 
   std::map<std::string ,agora::agora_refptr<agora::rtc::IRemoteVideoTrack>> remote_video_track_map_;
-  std::map<std::string ,videoInfo> remote_source_map_;
+  SampleRcu<MixerState> mixer_state_;
 
 
   std::mutex observer_lock_;
   bool use_string_uid_{false};
   std::string  user_string_; 
-
-  bool enable_video_mix_{false};
-  int x_offset_{0};
-  int y_offset_{0};
 };
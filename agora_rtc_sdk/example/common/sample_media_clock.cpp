@@ -0,0 +1,54 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_media_clock.h"
+
+#include "AgoraBase.h"
+
+SampleMediaClock::SampleMediaClock() : base_ms_(getAgoraCurrentMonotonicTimeInMs()) {}
+
+int64_t SampleMediaClock::nextAudioTimestampMs(int samplesPerChannel, int sampleRate) {
+  if (sampleRate <= 0) {
+    return last_audio_ms_ < 0 ? base_ms_ : last_audio_ms_;
+  }
+  if (sampleRate != audio_sample_rate_) {
+    // fold the time elapsed at the previous rate into the offset
+    if (audio_sample_rate_ > 0) {
+      audio_offset_ms_ += audio_samples_ * 1000 / audio_sample_rate_;
+    }
+    audio_samples_ = 0;
+    audio_sample_rate_ = sampleRate;
+  }
+  int64_t ts = base_ms_ + audio_offset_ms_ + audio_samples_ * 1000 / audio_sample_rate_;
+  audio_samples_ += samplesPerChannel;
+
+  // keep timestamps strictly increasing across rate changes
+  if (ts <= last_audio_ms_) {
+    ts = last_audio_ms_ + 1;
+  }
+  last_audio_ms_ = ts;
+  return ts;
+}
+
+int64_t SampleMediaClock::nextVideoTimestampMs(int frameRate) {
+  if (frameRate <= 0) {
+    return last_video_ms_ < 0 ? base_ms_ : last_video_ms_;
+  }
+  if (frameRate != video_frame_rate_) {
+    if (video_frame_rate_ > 0) {
+      video_offset_ms_ += video_frames_ * 1000 / video_frame_rate_;
+    }
+    video_frames_ = 0;
+    video_frame_rate_ = frameRate;
+  }
+  int64_t ts = base_ms_ + video_offset_ms_ + video_frames_ * 1000 / video_frame_rate_;
+  ++video_frames_;
+
+  if (ts <= last_video_ms_) {
+    ts = last_video_ms_ + 1;
+  }
+  last_video_ms_ = ts;
+  return ts;
+}
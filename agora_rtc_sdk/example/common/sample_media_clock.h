@@ -0,0 +1,45 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <cstdint>
+
+#include "sample_event.h"
+
+// Shared per-channel media clock for raw audio/video senders.
+//
+// Timestamps are derived from the amount of media already sent (samples for
+// audio, frames for video) on top of a common base taken from the SDK
+// monotonic clock, so they stay aligned even when a send thread wakes up late.
+// Each stream must be advanced by a single thread; the base is shared.
+class SampleMediaClock : public noncopyable {
+ public:
+  SampleMediaClock();
+
+  // Returns the capture timestamp (ms) of the next audio frame holding
+  // |samplesPerChannel| samples at |sampleRate|, then advances the audio clock.
+  int64_t nextAudioTimestampMs(int samplesPerChannel, int sampleRate);
+
+  // Returns the capture timestamp (ms) of the next video frame at |frameRate|,
+  // then advances the video clock.
+  int64_t nextVideoTimestampMs(int frameRate);
+
+  int64_t baseTimestampMs() const { return base_ms_; }
+
+ private:
+  const int64_t base_ms_;
+
+  // positions are kept in samples/frames since the last rate change so that
+  // non-integral frame durations (e.g. 1000/15 ms) do not accumulate drift
+  uint64_t audio_samples_{0};
+  int audio_sample_rate_{0};
+  int64_t audio_offset_ms_{0};
+  int64_t last_audio_ms_{-1};
+
+  uint64_t video_frames_{0};
+  int video_frame_rate_{0};
+  int64_t video_offset_ms_{0};
+  int64_t last_video_ms_{-1};
+};
@@ -0,0 +1,137 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_mixer_layout.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+
+SampleMixerLayout::SampleMixerLayout(int canvasWidth, int canvasHeight)
+    : canvas_width_(canvasWidth), canvas_height_(canvasHeight) {}
+
+void SampleMixerLayout::setStream(const std::string& id, int width, int height) {
+  for (auto& stream : streams_) {
+    if (stream.id == id) {
+      stream.width = width;
+      stream.height = height;
+      return;
+    }
+  }
+  streams_.push_back({id, width, height, true});
+}
+
+void SampleMixerLayout::setVisible(const std::string& id, bool visible) {
+  for (auto& stream : streams_) {
+    if (stream.id == id) {
+      stream.visible = visible;
+    }
+  }
+}
+
+void SampleMixerLayout::removeStream(const std::string& id) {
+  streams_.erase(std::remove_if(streams_.begin(), streams_.end(),
+                                [&id](const Stream& stream) { return stream.id == id; }),
+                 streams_.end());
+}
+
+bool SampleMixerLayout::hasStream(const std::string& id) const {
+  for (auto& stream : streams_) {
+    if (stream.id == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Scales the stream into the cell with its aspect ratio kept, centered. Even
+// positions and sizes keep the chroma of I420 aligned.
+SampleMixerLayout::Rect SampleMixerLayout::fit(const Stream& stream, int cellX, int cellY,
+                                               int cellWidth, int cellHeight) const {
+  int width = cellWidth;
+  int height = cellHeight;
+  if (stream.width > 0 && stream.height > 0) {
+    if (static_cast<int64_t>(cellWidth) * stream.height >
+        static_cast<int64_t>(cellHeight) * stream.width) {
+      width = static_cast<int>(static_cast<int64_t>(cellHeight) * stream.width / stream.height);
+    } else {
+      height = static_cast<int>(static_cast<int64_t>(cellWidth) * stream.height / stream.width);
+    }
+  }
+  width &= ~1;
+  height &= ~1;
+  return {(cellX + (cellWidth - width) / 2) & ~1, (cellY + (cellHeight - height) / 2) & ~1, width,
+          height};
+}
+
+int SampleMixerLayout::bestColumns(const std::vector<const Stream*>& visible) const {
+  int count = static_cast<int>(visible.size());
+  int best = 1;
+  double bestArea = -1;
+  for (int columns = 1; columns <= count; columns++) {
+    int rows = (count + columns - 1) / columns;
+    // a layout with an empty row is never better than one with fewer columns
+    if (columns > 1 && (count + columns - 2) / (columns - 1) == rows) {
+      continue;
+    }
+    int cellWidth = canvas_width_ / columns;
+    int cellHeight = canvas_height_ / rows;
+    double area = 0;
+    for (const Stream* stream : visible) {
+      Rect rect = fit(*stream, 0, 0, cellWidth, cellHeight);
+      area += static_cast<double>(rect.width) * rect.height;
+    }
+    if (area > bestArea) {
+      bestArea = area;
+      best = columns;
+    }
+  }
+  return best;
+}
+
+std::vector<SampleMixerLayout::Change> SampleMixerLayout::update() {
+  std::vector<const Stream*> visible;
+  for (auto& stream : streams_) {
+    if (stream.visible) {
+      visible.push_back(&stream);
+    }
+  }
+
+  std::map<std::string, Rect> layout;
+  if (!visible.empty()) {
+    int count = static_cast<int>(visible.size());
+    int columns = bestColumns(visible);
+    int rows = (count + columns - 1) / columns;
+    int cellWidth = canvas_width_ / columns;
+    int cellHeight = canvas_height_ / rows;
+    int top = (canvas_height_ - rows * cellHeight) / 2;
+    for (int i = 0; i < count; i++) {
+      int row = i / columns;
+      int column = i % columns;
+      int inRow = std::min(columns, count - row * columns);
+      int left = (canvas_width_ - inRow * cellWidth) / 2;
+      layout[visible[i]->id] = fit(*visible[i], left + column * cellWidth,
+                                   top + row * cellHeight, cellWidth, cellHeight);
+    }
+  }
+
+  std::vector<Change> changes;
+  for (auto& item : applied_) {
+    if (!layout.count(item.first)) {
+      changes.push_back({item.first, true, agora::rtc::MixerLayoutConfig()});
+    }
+  }
+  for (auto& item : layout) {
+    auto applied = applied_.find(item.first);
+    if (applied != applied_.end() && applied->second == item.second) {
+      continue;
+    }
+    const Rect& rect = item.second;
+    changes.push_back(
+        {item.first, false, agora::rtc::MixerLayoutConfig(rect.x, rect.y, rect.width, rect.height, 1)});
+  }
+  applied_.swap(layout);
+  return changes;
+}
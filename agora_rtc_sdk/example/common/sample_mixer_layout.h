@@ -0,0 +1,66 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AgoraMediaBase.h"
+
+// Grid layout of the streams of a video mixer.
+//
+// The visible streams are placed on a grid of the canvas in the order they
+// joined. The number of columns is the one that shows the most of the
+// streams once each is scaled into its cell with its aspect ratio kept; the
+// last row is centered when it is not full. update() returns only the
+// streams that moved, appeared or disappeared since the previous update, so
+// a join that keeps the grid only sets one stream. Not thread-safe.
+class SampleMixerLayout {
+ public:
+  struct Change {
+    std::string id;
+    bool removed;  // delete the layout of the stream, |config| is unused
+    agora::rtc::MixerLayoutConfig config;
+  };
+
+  SampleMixerLayout(int canvasWidth, int canvasHeight);
+
+  // Adds a stream at the end of the grid, or updates the size of its source
+  void setStream(const std::string& id, int width, int height);
+  // Hidden streams keep their place in the join order but leave the grid
+  void setVisible(const std::string& id, bool visible);
+  void removeStream(const std::string& id);
+  bool hasStream(const std::string& id) const;
+
+  // Computes the grid and returns the changes since the previous update
+  std::vector<Change> update();
+
+  int canvasWidth() const { return canvas_width_; }
+  int canvasHeight() const { return canvas_height_; }
+
+ private:
+  struct Stream {
+    std::string id;
+    int width;
+    int height;
+    bool visible;
+  };
+
+  struct Rect {
+    int x, y, width, height;
+    bool operator==(const Rect& other) const {
+      return x == other.x && y == other.y && width == other.width && height == other.height;
+    }
+  };
+
+  Rect fit(const Stream& stream, int cellX, int cellY, int cellWidth, int cellHeight) const;
+  int bestColumns(const std::vector<const Stream*>& visible) const;
+
+  int canvas_width_;
+  int canvas_height_;
+  std::vector<Stream> streams_;          // in join order
+  std::map<std::string, Rect> applied_;  // layout given to the mixer
+};
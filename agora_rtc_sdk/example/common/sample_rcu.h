@@ -0,0 +1,88 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "sample_event.h"
+
+// Read-copy-update holder of a state read by many threads and rarely changed.
+//
+// Readers pin the current version with a Reader and use it without any lock:
+// entering and leaving are two atomic increments. A writer copies the current
+// version, changes the copy and publishes it with one atomic store, then waits
+// until the readers that may still hold the previous version are gone before
+// deleting it. The readers are counted by the parity of an epoch that each
+// writer advances, so new readers never delay the writer.
+//
+// Writers run one at a time, in the order they update, so they can apply the
+// change of their version to the outside world (e.g. an SDK object) and it
+// sees the versions in order. A writer must not hold a Reader.
+template <typename T>
+class SampleRcu : public noncopyable {
+ public:
+  class Reader : public noncopyable {
+   public:
+    explicit Reader(const SampleRcu& rcu) : rcu_(rcu) {
+      for (;;) {
+        unsigned epoch = rcu_.epoch_.load();
+        rcu_.readers_[epoch & 1].fetch_add(1);
+        // a writer may have waited for this parity before it was counted
+        if (rcu_.epoch_.load() == epoch) {
+          parity_ = epoch & 1;
+          break;
+        }
+        rcu_.readers_[epoch & 1].fetch_sub(1);
+      }
+      value_ = rcu_.current_.load();
+    }
+    ~Reader() { rcu_.readers_[parity_].fetch_sub(1); }
+
+    const T& operator*() const { return *value_; }
+    const T* operator->() const { return value_; }
+
+   private:
+    const SampleRcu& rcu_;
+    unsigned parity_{0};
+    const T* value_{nullptr};
+  };
+
+  explicit SampleRcu(T initial = T()) : current_(new T(std::move(initial))) {}
+  ~SampleRcu() { delete current_.load(); }
+
+  // Publishes a copy of the current version changed by |modify(T&)|, unless
+  // it returns false. Returns what |modify| returned.
+  template <typename F>
+  bool update(F&& modify) {
+    std::lock_guard<std::mutex> _(writer_lock_);
+    T* next = new T(*current_.load());
+    if (!modify(*next)) {
+      delete next;
+      return false;
+    }
+    const T* previous = current_.exchange(next);
+    synchronize();
+    delete previous;
+    return true;
+  }
+
+ private:
+  // Waits until the readers that entered before the exchange are gone: the
+  // next ones count in the other parity and see the new version
+  void synchronize() {
+    unsigned epoch = epoch_.fetch_add(1);
+    while (readers_[epoch & 1].load()) {
+      std::this_thread::yield();
+    }
+  }
+
+  std::atomic<const T*> current_;
+  mutable std::atomic<unsigned> epoch_{0};
+  mutable std::atomic<int> readers_[2]{{0}, {0}};
+  std::mutex writer_lock_;
+};
@@ -0,0 +1,186 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_receive_stats.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "log.h"
+
+// an interval this many times the average, and at least this long, is a gap
+#define STATS_GAP_FACTOR (3)
+#define STATS_GAP_MIN_US (40000)
+// weight of a new interval in the average, and of a new delay in the jitter
+// (RFC 3550)
+#define STATS_SMOOTHING (1.0 / 16)
+// a track without frames for this long is removed
+#define STATS_FORGET_US (60 * 1000000LL)
+
+const int SampleReceiveStats::kBucketMs[kBuckets - 1] = {5, 12, 25, 50, 100, 200, 400};
+
+static std::atomic<uint64_t> next_stats_id{1};
+
+static int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Upper bound in ms of the bucket holding the |percent| of the intervals,
+// -1 for the unbounded bucket
+static int bucketPercentile(const uint64_t* buckets, uint64_t total, int percent) {
+  uint64_t rank = (total * percent + 99) / 100;
+  uint64_t count = 0;
+  for (int i = 0; i < SampleReceiveStats::kBuckets - 1; i++) {
+    count += buckets[i];
+    if (count >= rank) {
+      return SampleReceiveStats::kBucketMs[i];
+    }
+  }
+  return -1;
+}
+
+SampleReceiveStats::SampleReceiveStats()
+    : id_(next_stats_id++), last_report_(std::chrono::steady_clock::now()) {}
+
+SampleReceiveStats::Shard* SampleReceiveStats::localShard() {
+  // The shards of this thread, by the id of their stats; ids are never
+  // reused, so a destroyed stats object is never looked up again
+  thread_local std::vector<std::pair<uint64_t, Shard*>> localShards;
+  for (auto& shard : localShards) {
+    if (shard.first == id_) {
+      return shard.second;
+    }
+  }
+  Shard* shard = new Shard();
+  {
+    std::lock_guard<std::mutex> _(shards_lock_);
+    shards_.emplace_back(shard);
+  }
+  localShards.emplace_back(id_, shard);
+  return shard;
+}
+
+void SampleReceiveStats::onFrame(Media media, const std::string& user, int64_t mediaTimeMs,
+                                 int width, int height) {
+  int64_t arrivalUs = nowUs();
+  Shard* shard = localShard();
+
+  std::lock_guard<std::mutex> _(shard->lock);
+  Track& track = shard->tracks[TrackKey(media, user)];
+  Window& window = track.window;
+  window.frames++;
+
+  if (track.lastArrivalUs >= 0) {
+    int64_t intervalUs = arrivalUs - track.lastArrivalUs;
+    int bucket = 0;
+    while (bucket < kBuckets - 1 && intervalUs > kBucketMs[bucket] * 1000) {
+      bucket++;
+    }
+    window.buckets[bucket]++;
+    window.maxIntervalUs = std::max(window.maxIntervalUs, intervalUs);
+
+    if (track.averageIntervalUs &&
+        intervalUs >= std::max<double>(STATS_GAP_MIN_US,
+                                       STATS_GAP_FACTOR * track.averageIntervalUs)) {
+      window.gaps++;
+    } else {
+      // gaps are left out of the average, they would hide the next ones
+      track.averageIntervalUs = track.averageIntervalUs
+                                    ? track.averageIntervalUs +
+                                          (intervalUs - track.averageIntervalUs) * STATS_SMOOTHING
+                                    : intervalUs;
+    }
+
+    if (mediaTimeMs >= 0 && track.lastMediaMs >= 0) {
+      double delayMs = intervalUs / 1000.0 - (mediaTimeMs - track.lastMediaMs);
+      track.jitterMs += (fabs(delayMs) - track.jitterMs) * STATS_SMOOTHING;
+    }
+  }
+  track.lastArrivalUs = arrivalUs;
+  track.lastMediaMs = mediaTimeMs;
+
+  if (media == kVideo && (width != track.width || height != track.height)) {
+    if (track.width || track.height) {
+      window.resolutionChanges++;
+    }
+    track.width = width;
+    track.height = height;
+  }
+}
+
+void SampleReceiveStats::report() {
+  auto now = std::chrono::steady_clock::now();
+  int64_t reportUs = nowUs();
+  double seconds = std::chrono::duration<double>(now - last_report_).count();
+  last_report_ = now;
+
+  // The tracks of a user may be counted by several threads
+  std::map<TrackKey, Track> tracks;
+  {
+    std::lock_guard<std::mutex> _(shards_lock_);
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> __(shard->lock);
+      for (auto it = shard->tracks.begin(); it != shard->tracks.end();) {
+        if (!it->second.window.frames && reportUs - it->second.lastArrivalUs > STATS_FORGET_US) {
+          it = shard->tracks.erase(it);
+          continue;
+        }
+        auto& item = *it++;
+        Track& merged = tracks[item.first];
+        const Track& track = item.second;
+        const Window& window = track.window;
+        if (track.lastArrivalUs > merged.lastArrivalUs) {
+          merged.lastArrivalUs = track.lastArrivalUs;
+          merged.jitterMs = track.jitterMs;
+          merged.width = track.width;
+          merged.height = track.height;
+        }
+        merged.window.frames += window.frames;
+        for (int i = 0; i < kBuckets; i++) {
+          merged.window.buckets[i] += window.buckets[i];
+        }
+        merged.window.maxIntervalUs = std::max(merged.window.maxIntervalUs, window.maxIntervalUs);
+        merged.window.gaps += window.gaps;
+        merged.window.resolutionChanges += window.resolutionChanges;
+        item.second.window = Window();
+      }
+    }
+  }
+
+  for (auto& item : tracks) {
+    const Track& track = item.second;
+    const Window& window = track.window;
+    const char* media = item.first.first == kVideo ? "Video" : "Audio";
+    if (!window.frames) {
+      AG_LOG_REPORT(INFO, "%s of user %s: no frame for %.1f s", media, item.first.second.c_str(),
+                    (reportUs - track.lastArrivalUs) / 1e6);
+      continue;
+    }
+    uint64_t intervals = 0;
+    for (int i = 0; i < kBuckets; i++) {
+      intervals += window.buckets[i];
+    }
+    int p50 = bucketPercentile(window.buckets, intervals, 50);
+    int p99 = bucketPercentile(window.buckets, intervals, 99);
+    std::string resolution =
+        item.first.first == kVideo
+            ? ", " + std::to_string(track.width) + "x" + std::to_string(track.height)
+            : std::string();
+    // one line per track, never rate limited
+    AG_LOG_REPORT(INFO,
+                  "%s of user %s: %.1f fps%s, interval p50 %s%d ms p99 %s%d ms max %.1f ms, "
+                  "jitter %.1f ms, %llu gaps, %llu resolution changes",
+                  media, item.first.second.c_str(), seconds > 0 ? window.frames / seconds : 0.0,
+                  resolution.c_str(), p50 < 0 ? ">" : "<=",
+                  p50 < 0 ? kBucketMs[kBuckets - 2] : p50, p99 < 0 ? ">" : "<=",
+                  p99 < 0 ? kBucketMs[kBuckets - 2] : p99, window.maxIntervalUs / 1000.0,
+                  track.jitterMs, static_cast<unsigned long long>(window.gaps),
+                  static_cast<unsigned long long>(window.resolutionChanges));
+  }
+}
@@ -0,0 +1,83 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sample_event.h"
+
+// Arrival telemetry of the frames received from each remote user.
+//
+// The SDK callbacks call onFrame() for every audio or video frame. Each
+// callback thread counts into a shard of its own, found through a thread
+// local pointer, so the threads do not contend: the lock of a shard is only
+// taken by another thread while report() collects it. report() merges the
+// shards and logs, per user and media, the frame rate, the distribution of
+// the intervals between arrivals, the jitter against the media timestamps,
+// the gaps and the resolution changes since the previous report. Intervals
+// that grow while the senders are steady show that the decoding and the
+// callbacks no longer keep up, before the recordings suffer.
+class SampleReceiveStats : public noncopyable {
+ public:
+  enum Media { kAudio, kVideo };
+
+  SampleReceiveStats();
+
+  // |mediaTimeMs|: timestamp given by the sender (render or capture time),
+  // -1 when unknown. |width| and |height| of video frames, 0 for audio.
+  void onFrame(Media media, const std::string& user, int64_t mediaTimeMs, int width = 0,
+               int height = 0);
+
+  // Logs the statistics since the previous report and starts new ones.
+  // Users not heard from for a minute are forgotten.
+  void report();
+
+  // Upper bounds of the interval histogram buckets, the last is unbounded;
+  // 10 ms audio, 30 and 15 fps video fall in buckets of their own
+  static const int kBuckets = 8;
+  static const int kBucketMs[kBuckets - 1];
+
+ private:
+  // counters of one report period
+  struct Window {
+    uint64_t frames{0};
+    uint64_t buckets[kBuckets]{};
+    int64_t maxIntervalUs{0};
+    uint64_t gaps{0};
+    uint64_t resolutionChanges{0};
+  };
+
+  struct Track {
+    int64_t lastArrivalUs{-1};
+    int64_t lastMediaMs{-1};
+    double averageIntervalUs{0};
+    double jitterMs{0};
+    int width{0};
+    int height{0};
+    Window window;
+  };
+
+  typedef std::pair<Media, std::string> TrackKey;
+
+  struct Shard {
+    std::mutex lock;
+    std::map<TrackKey, Track> tracks;
+  };
+
+  Shard* localShard();
+
+  const uint64_t id_;
+  std::mutex shards_lock_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::chrono::steady_clock::time_point last_report_;
+};
@@ -0,0 +1,300 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_recording_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+static const size_t kNoBoundary = static_cast<size_t>(-1);
+
+bool SampleRecordingStream::write(const void* data, size_t length, bool boundary,
+                                  bool newFile) {
+  if (!length) {
+    return true;
+  }
+
+  // reserve the bytes before copying them, the budget covers every stream
+  SampleRecordingWriter* writer = writer_;
+  if (writer->buffered_bytes_.fetch_add(length) + length > writer->options_.maxBufferedBytes) {
+    writer->buffered_bytes_ -= length;
+    writer->dropped_bytes_ += length;
+    return false;
+  }
+
+  bool sealed = false;
+  {
+    std::lock_guard<std::mutex> _(lock_);
+    // a chunk only holds whole blocks, so a file never ends in the middle of one;
+    // a new file starts with a chunk
+    if (current_ && (current_->data.size() + length >
+                         std::max(writer->options_.chunkBytes, length) ||
+                     (newFile && !current_->data.empty()))) {
+      pending_.push_back(std::move(current_));
+      sealed = true;
+    }
+    if (!current_) {
+      current_ = writer->takeChunk(length);
+    }
+    if ((boundary || newFile) && current_->boundary == kNoBoundary) {
+      current_->boundary = current_->data.size();
+      current_->newFile = newFile;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    current_->data.insert(current_->data.end(), bytes, bytes + length);
+  }
+
+  if (sealed) {
+    writer->wakeup_.Set();
+  }
+  return true;
+}
+
+SampleRecordingWriter::SampleRecordingWriter(const Options& options) : options_(options) {}
+
+SampleRecordingWriter::~SampleRecordingWriter() { stop(); }
+
+bool SampleRecordingWriter::start() {
+  if (thread_.joinable()) {
+    return true;
+  }
+  stop_ = false;
+  thread_ = std::thread(&SampleRecordingWriter::run, this);
+  return true;
+}
+
+void SampleRecordingWriter::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  stop_ = true;
+  wakeup_.Set();
+  thread_.join();
+
+  std::lock_guard<std::mutex> _(streams_lock_);
+  for (auto& stream : streams_) {
+    closeFile(*stream);
+  }
+  if (dropped_bytes_) {
+    AG_LOG(ERROR, "Recording dropped %llu bytes, the disk could not keep up",
+           static_cast<unsigned long long>(dropped_bytes_.load()));
+  }
+}
+
+std::shared_ptr<SampleRecordingStream> SampleRecordingWriter::openStream(const std::string& path) {
+  std::shared_ptr<SampleRecordingStream> stream(new SampleRecordingStream(this, path));
+  std::lock_guard<std::mutex> _(streams_lock_);
+  streams_.push_back(stream);
+  return stream;
+}
+
+std::string SampleRecordingWriter::userFilePath(const std::string& path, const std::string& uid) {
+  size_t dot = path.find_last_of('.');
+  size_t slash = path.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return path + "_" + uid;
+  }
+  return path.substr(0, dot) + "_" + uid + path.substr(dot);
+}
+
+std::unique_ptr<SampleRecordingWriter::Chunk> SampleRecordingWriter::takeChunk(size_t length) {
+  std::unique_ptr<Chunk> chunk;
+  {
+    std::lock_guard<std::mutex> _(pool_lock_);
+    if (!pool_.empty()) {
+      chunk = std::move(pool_.back());
+      pool_.pop_back();
+    }
+  }
+  if (!chunk) {
+    chunk.reset(new Chunk);
+  }
+  chunk->data.clear();
+  chunk->data.reserve(std::max(options_.chunkBytes, length));
+  chunk->boundary = kNoBoundary;
+  chunk->newFile = false;
+  chunk->created = std::chrono::steady_clock::now();
+  return chunk;
+}
+
+void SampleRecordingWriter::recycleChunk(std::unique_ptr<Chunk> chunk) {
+  buffered_bytes_ -= chunk->data.size();
+  // chunks grown by large blocks are released instead of being kept
+  if (chunk->data.capacity() > 2 * options_.chunkBytes) {
+    return;
+  }
+  std::lock_guard<std::mutex> _(pool_lock_);
+  if ((pool_.size() + 1) * options_.chunkBytes <= options_.maxBufferedBytes) {
+    pool_.push_back(std::move(chunk));
+  }
+}
+
+void SampleRecordingWriter::run() {
+  while (true) {
+    wakeup_.Wait(options_.flushIntervalMs);
+    bool stopping = stop_;
+
+    std::vector<std::shared_ptr<SampleRecordingStream>> streams;
+    {
+      std::lock_guard<std::mutex> _(streams_lock_);
+      streams = streams_;
+    }
+    for (auto& stream : streams) {
+      flushStream(*stream, stopping);
+    }
+
+    if (stopping) {
+      break;
+    }
+  }
+}
+
+void SampleRecordingWriter::flushStream(SampleRecordingStream& stream, bool all) {
+  std::vector<std::unique_ptr<Chunk>> chunks;
+  {
+    std::lock_guard<std::mutex> _(stream.lock_);
+    while (!stream.pending_.empty()) {
+      chunks.push_back(std::move(stream.pending_.front()));
+      stream.pending_.pop_front();
+    }
+    if (stream.current_ && !stream.current_->data.empty() &&
+        (all || std::chrono::steady_clock::now() - stream.current_->created >=
+                    std::chrono::milliseconds(options_.flushIntervalMs))) {
+      chunks.push_back(std::move(stream.current_));
+    }
+  }
+  if (chunks.empty()) {
+    return;
+  }
+
+  writeChunks(stream, chunks);
+  for (auto& chunk : chunks) {
+    recycleChunk(std::move(chunk));
+  }
+}
+
+void SampleRecordingWriter::writeChunks(SampleRecordingStream& stream,
+                                        const std::vector<std::unique_ptr<Chunk>>& chunks) {
+  std::vector<struct iovec> batch;
+  uint64_t batched = 0;
+
+  for (auto& chunk : chunks) {
+    uint8_t* data = chunk->data.data();
+    size_t size = chunk->data.size();
+
+    if (stream.fd_ < 0 && !openFile(stream)) {
+      dropped_bytes_ += size;
+      continue;
+    }
+    if (chunk->boundary != kNoBoundary) {
+      // a new file is only started after something was written to this one
+      bool rotate =
+          (chunk->newFile && stream.file_size_ + batched > 0) ||
+          (options_.rotateBytes && stream.file_size_ + batched >= options_.rotateBytes) ||
+          (options_.rotateSeconds && std::chrono::steady_clock::now() - stream.file_opened_ >=
+                                         std::chrono::seconds(options_.rotateSeconds));
+      if (rotate) {
+        // what comes before the boundary still belongs to the current file
+        if (chunk->boundary) {
+          batch.push_back({data, chunk->boundary});
+          data += chunk->boundary;
+          size -= chunk->boundary;
+        }
+        writeBatch(stream, batch);
+        batched = 0;
+        closeFile(stream);
+        if (!openFile(stream)) {
+          dropped_bytes_ += size;
+          continue;
+        }
+      }
+    }
+
+    batch.push_back({data, size});
+    batched += size;
+    if (batch.size() == IOV_MAX) {
+      writeBatch(stream, batch);
+      batched = 0;
+    }
+  }
+  writeBatch(stream, batch);
+}
+
+bool SampleRecordingWriter::writeBatch(SampleRecordingStream& stream,
+                                       std::vector<struct iovec>& batch) {
+  if (batch.empty()) {
+    return true;
+  }
+  if (stream.fd_ < 0) {
+    // the file could not be written any more
+    for (auto& iov : batch) {
+      dropped_bytes_ += iov.iov_len;
+    }
+    batch.clear();
+    return false;
+  }
+
+  struct iovec* iov = batch.data();
+  int count = static_cast<int>(batch.size());
+  while (count > 0) {
+    ssize_t written = writev(stream.fd_, iov, count);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      AG_LOG(ERROR, "Error writing %s: %s", stream.path_.c_str(), strerror(errno));
+      for (; count > 0; ++iov, --count) {
+        dropped_bytes_ += iov->iov_len;
+      }
+      closeFile(stream);
+      batch.clear();
+      return false;
+    }
+    stream.file_size_ += written;
+
+    // continue after a short write
+    while (count > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+  batch.clear();
+  return true;
+}
+
+bool SampleRecordingWriter::openFile(SampleRecordingStream& stream) {
+  std::string fileName = (++stream.file_count_ > 1)
+                             ? (stream.path_ + std::to_string(stream.file_count_))
+                             : stream.path_;
+  stream.fd_ = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (stream.fd_ < 0) {
+    AG_LOG(ERROR, "Failed to create recording file %s: %s", fileName.c_str(),
+           strerror(errno));
+    return false;
+  }
+  stream.file_size_ = 0;
+  stream.file_opened_ = std::chrono::steady_clock::now();
+  AG_LOG(INFO, "Created file %s to save received data", fileName.c_str());
+  return true;
+}
+
+void SampleRecordingWriter::closeFile(SampleRecordingStream& stream) {
+  if (stream.fd_ >= 0) {
+    close(stream.fd_);
+    stream.fd_ = -1;
+  }
+}
@@ -0,0 +1,131 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sample_event.h"
+
+class SampleRecordingWriter;
+
+// A recorded file, e.g. the audio of one remote user.
+//
+// write() only copies the data into a buffer of the writer, the file is
+// written by the writer thread. It is called from one thread at a time.
+class SampleRecordingStream : public noncopyable {
+ public:
+  // |boundary|: the file may be rotated before this data (key frames of
+  // encoded video; every block of raw media is one)
+  // |newFile|: this data starts a new file whatever the limits, e.g. a new
+  // Ogg stream that the limits would not cut at the same place
+  bool write(const void* data, size_t length, bool boundary = true, bool newFile = false);
+
+  const std::string& path() const { return path_; }
+
+ private:
+  friend class SampleRecordingWriter;
+
+  struct Chunk {
+    std::vector<uint8_t> data;
+    size_t boundary;  // offset of the first boundary data, npos if none
+    bool newFile;     // the boundary starts a new file
+    std::chrono::steady_clock::time_point created;
+  };
+
+  SampleRecordingStream(SampleRecordingWriter* writer, const std::string& path)
+      : writer_(writer), path_(path) {}
+
+  SampleRecordingWriter* writer_;
+  std::string path_;
+
+  // written by the callback thread, taken by the writer thread
+  std::mutex lock_;
+  std::unique_ptr<Chunk> current_;
+  std::deque<std::unique_ptr<Chunk>> pending_;
+
+  // writer thread only
+  int fd_{-1};
+  int file_count_{0};
+  uint64_t file_size_{0};
+  std::chrono::steady_clock::time_point file_opened_;
+};
+
+// Writes recorded media to disk from a thread of its own, so the SDK
+// callbacks never wait for the disk.
+//
+// The data of each stream is gathered in chunks of |chunkBytes|; the writer
+// thread writes all the chunks of a stream that are ready with one writev().
+// At most |maxBufferedBytes| wait to be written: when the disk cannot keep
+// up, new data is dropped and counted instead of growing without bounds.
+class SampleRecordingWriter : public noncopyable {
+ public:
+  struct Options {
+    size_t chunkBytes = 256 * 1024;
+    size_t maxBufferedBytes = 32 * 1024 * 1024;
+    // a chunk that is not full is written after this delay
+    int flushIntervalMs = 500;
+    // a file is closed and the next one opened once it holds |rotateBytes|
+    // or was opened |rotateSeconds| ago, 0 to disable
+    uint64_t rotateBytes = 0;
+    int rotateSeconds = 0;
+  };
+
+  explicit SampleRecordingWriter(const Options& options);
+  ~SampleRecordingWriter();
+
+  bool start();
+  // Writes everything that is buffered and closes the files
+  void stop();
+
+  // The files of the stream are |path|, then |path|2, |path|3... when
+  // rotating. The stream stays valid until the writer is destroyed.
+  std::shared_ptr<SampleRecordingStream> openStream(const std::string& path);
+
+  // Appends the id of a user to the name of a file:
+  // received_audio.pcm -> received_audio_<uid>.pcm
+  static std::string userFilePath(const std::string& path, const std::string& uid);
+
+  // Bytes that were dropped because |maxBufferedBytes| was reached
+  uint64_t droppedBytes() const { return dropped_bytes_; }
+
+ private:
+  friend class SampleRecordingStream;
+  typedef SampleRecordingStream::Chunk Chunk;
+
+  std::unique_ptr<Chunk> takeChunk(size_t length);
+  void recycleChunk(std::unique_ptr<Chunk> chunk);
+  void run();
+  void flushStream(SampleRecordingStream& stream, bool all);
+  void writeChunks(SampleRecordingStream& stream,
+                   const std::vector<std::unique_ptr<Chunk>>& chunks);
+  bool writeBatch(SampleRecordingStream& stream, std::vector<struct iovec>& batch);
+  bool openFile(SampleRecordingStream& stream);
+  void closeFile(SampleRecordingStream& stream);
+
+  Options options_;
+
+  std::mutex streams_lock_;
+  std::vector<std::shared_ptr<SampleRecordingStream>> streams_;
+
+  std::mutex pool_lock_;
+  std::vector<std::unique_ptr<Chunk>> pool_;
+  std::atomic<size_t> buffered_bytes_{0};
+  std::atomic<uint64_t> dropped_bytes_{0};
+
+  std::thread thread_;
+  SampleEvent wakeup_;
+  std::atomic<bool> stop_{false};
+};
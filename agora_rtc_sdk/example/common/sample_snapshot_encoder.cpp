@@ -0,0 +1,175 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#include "sample_snapshot_encoder.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "jpeglib.h"
+#include "log.h"
+#include "sample_jpeg_encoder.h"
+
+// libjpeg calls error_exit() instead of returning errors
+struct LibjpegError {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+};
+
+static void libjpeg_error_exit(j_common_ptr cinfo) {
+  LibjpegError* error = reinterpret_cast<LibjpegError*>(cinfo->err);
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  AG_LOG(ERROR, "libjpeg: %s", message);
+  longjmp(error->jump, 1);
+}
+
+// Destination writing into the output vector, which keeps its capacity
+struct LibjpegVectorDest {
+  struct jpeg_destination_mgr mgr;
+  std::vector<uint8_t>* out;
+};
+
+static void vector_dest_init(j_compress_ptr cinfo) {
+  LibjpegVectorDest* dest = reinterpret_cast<LibjpegVectorDest*>(cinfo->dest);
+  dest->out->resize(std::max<size_t>(dest->out->capacity(), 64 * 1024));
+  dest->mgr.next_output_byte = dest->out->data();
+  dest->mgr.free_in_buffer = dest->out->size();
+}
+
+static boolean vector_dest_empty(j_compress_ptr cinfo) {
+  // called when the whole buffer is full
+  LibjpegVectorDest* dest = reinterpret_cast<LibjpegVectorDest*>(cinfo->dest);
+  size_t used = dest->out->size();
+  dest->out->resize(used * 2);
+  dest->mgr.next_output_byte = dest->out->data() + used;
+  dest->mgr.free_in_buffer = dest->out->size() - used;
+  return TRUE;
+}
+
+static void vector_dest_term(j_compress_ptr cinfo) {
+  LibjpegVectorDest* dest = reinterpret_cast<LibjpegVectorDest*>(cinfo->dest);
+  dest->out->resize(dest->out->size() - dest->mgr.free_in_buffer);
+}
+
+// Feeds the I420 planes to libjpeg as downsampled data, so it does neither
+// color conversion nor downsampling
+class LibjpegSnapshotEncoder : public SampleSnapshotEncoder {
+ public:
+  LibjpegSnapshotEncoder(J_DCT_METHOD dctMethod, const char* name)
+      : dct_method_(dctMethod), name_(name) {}
+
+  const char* name() const override { return name_; }
+
+  bool encode(const SampleSnapshotPicture& picture, int quality,
+              std::vector<uint8_t>& out) override;
+
+ private:
+  // Rows of a plane padded to whole blocks for jpeg_write_raw_data()
+  JSAMPROW paddedRow(const uint8_t* plane, int stride, int width, int paddedWidth, int row,
+                     int height, uint8_t* scratch);
+
+  J_DCT_METHOD dct_method_;
+  const char* name_;
+  std::vector<uint8_t> scratch_;
+};
+
+JSAMPROW LibjpegSnapshotEncoder::paddedRow(const uint8_t* plane, int stride, int width,
+                                           int paddedWidth, int row, int height,
+                                           uint8_t* scratch) {
+  const uint8_t* line = plane + static_cast<ptrdiff_t>(std::min(row, height - 1)) * stride;
+  if (width == paddedWidth) {
+    return const_cast<JSAMPROW>(line);
+  }
+  memcpy(scratch, line, width);
+  memset(scratch + width, line[width - 1], paddedWidth - width);
+  return scratch;
+}
+
+bool LibjpegSnapshotEncoder::encode(const SampleSnapshotPicture& picture, int quality,
+                                    std::vector<uint8_t>& out) {
+  int width = picture.width;
+  int height = picture.height;
+  if (!picture.y || !picture.u || !picture.v || width <= 0 || height <= 0 || width > 0xFFFF ||
+      height > 0xFFFF) {
+    return false;
+  }
+  int chromaWidth = (width + 1) / 2;
+  int chromaHeight = (height + 1) / 2;
+  int paddedWidth = (width + 15) & ~15;
+  // 16 rows of luma, then 8 rows holding one row of each chroma plane
+  scratch_.resize(paddedWidth * 24);
+
+  struct jpeg_compress_struct cinfo;
+  LibjpegError error;
+  LibjpegVectorDest dest;
+  cinfo.err = jpeg_std_error(&error.mgr);
+  error.mgr.error_exit = libjpeg_error_exit;
+  if (setjmp(error.jump)) {
+    jpeg_destroy_compress(&cinfo);
+    return false;
+  }
+  jpeg_create_compress(&cinfo);
+
+  out.clear();
+  dest.out = &out;
+  dest.mgr.init_destination = vector_dest_init;
+  dest.mgr.empty_output_buffer = vector_dest_empty;
+  dest.mgr.term_destination = vector_dest_term;
+  cinfo.dest = &dest.mgr;
+
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);  // 2x2 luma, 1x1 chroma
+  jpeg_set_quality(&cinfo, std::max(1, std::min(100, quality)), TRUE);
+  cinfo.dct_method = dct_method_;
+  cinfo.raw_data_in = TRUE;
+  jpeg_start_compress(&cinfo, TRUE);
+
+  // one MCU row: 16 rows of luma, 8 of each chroma
+  JSAMPROW yRows[16];
+  JSAMPROW uRows[8];
+  JSAMPROW vRows[8];
+  JSAMPARRAY planes[3] = {yRows, uRows, vRows};
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int row = cinfo.next_scanline;
+    for (int i = 0; i < 16; i++) {
+      yRows[i] = paddedRow(picture.y, picture.yStride, width, paddedWidth, row + i, height,
+                           scratch_.data() + i * paddedWidth);
+    }
+    for (int i = 0; i < 8; i++) {
+      uint8_t* scratch = scratch_.data() + paddedWidth * 16 + i * paddedWidth;
+      uRows[i] = paddedRow(picture.u, picture.uStride, chromaWidth, paddedWidth / 2, row / 2 + i,
+                           chromaHeight, scratch);
+      vRows[i] = paddedRow(picture.v, picture.vStride, chromaWidth, paddedWidth / 2, row / 2 + i,
+                           chromaHeight, scratch + paddedWidth / 2);
+    }
+    jpeg_write_raw_data(&cinfo, planes, 16);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return true;
+}
+
+std::unique_ptr<SampleSnapshotEncoder> createSnapshotEncoder(const std::string& name) {
+  if (name == "libjpeg") {
+    return std::unique_ptr<SampleSnapshotEncoder>(
+        new LibjpegSnapshotEncoder(JDCT_ISLOW, "libjpeg"));
+  }
+  if (name == "libjpeg-float") {
+    return std::unique_ptr<SampleSnapshotEncoder>(
+        new LibjpegSnapshotEncoder(JDCT_FLOAT, "libjpeg-float"));
+  }
+  if (name == "builtin") {
+    return std::unique_ptr<SampleSnapshotEncoder>(new SampleJpegEncoder);
+  }
+  return nullptr;
+}
@@ -0,0 +1,51 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sample_event.h"
+
+// An I420 picture, e.g. the planes of a received VideoFrame. Only read.
+struct SampleSnapshotPicture {
+  const uint8_t* y;
+  const uint8_t* u;
+  const uint8_t* v;
+  int yStride;
+  int uStride;
+  int vStride;
+  int width;
+  int height;
+};
+
+// Encodes snapshots of received video to JPEG.
+//
+// Every backend writes a baseline JFIF file with 4:2:0 sampling. An encoder
+// keeps its tables and scratch buffers from one picture to the next, so each
+// thread taking snapshots should own one.
+class SampleSnapshotEncoder : public noncopyable {
+ public:
+  virtual ~SampleSnapshotEncoder() {}
+
+  virtual const char* name() const = 0;
+
+  // Replaces the content of |out| with the JPEG file of |picture|.
+  // |quality| is 1..100 with the scale of libjpeg.
+  virtual bool encode(const SampleSnapshotPicture& picture, int quality,
+                      std::vector<uint8_t>& out) = 0;
+};
+
+// The backends that createSnapshotEncoder() knows, for usage strings
+#define SAMPLE_SNAPSHOT_ENCODERS "libjpeg, libjpeg-float, builtin"
+
+// "libjpeg": the bundled libjpeg with its integer DCT
+// "libjpeg-float": the bundled libjpeg with its floating point DCT
+// "builtin": SampleJpegEncoder, vectorized and without libjpeg
+// Returns nullptr for an unknown name.
+std::unique_ptr<SampleSnapshotEncoder> createSnapshotEncoder(const std::string& name);
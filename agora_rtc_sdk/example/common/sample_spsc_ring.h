@@ -0,0 +1,227 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "sample_event.h"
+
+#define SAMPLE_CACHE_LINE_SIZE (64)
+
+// Lock-free ring between one producer thread and one consumer thread.
+//
+// The slots are allocated once and reused: the producer fills the slot
+// returned by back() and publishes it with push(), the consumer reads the
+// slot returned by front() in place and releases it with pop(). Objects
+// owning buffers (e.g. std::vector) keep their capacity from one use to the
+// next, so nothing is allocated once the ring is warm.
+template <typename T>
+class SampleSpscRing : public noncopyable {
+ public:
+  // |capacity| is rounded up to a power of two
+  explicit SampleSpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  size_t capacity() const { return slots_.size(); }
+
+  // Producer: the slot to fill next, nullptr when the ring is full
+  T* back() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == slots_.size()) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == slots_.size()) {
+        return nullptr;
+      }
+    }
+    return &slots_[tail & mask_];
+  }
+
+  // Producer: makes the slot returned by back() visible to the consumer
+  void push() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Producer: fills the next slot with |fill(T&)| and publishes it, false
+  // when the ring is full
+  template <typename F>
+  bool tryPush(F&& fill) {
+    T* slot = back();
+    if (!slot) {
+      return false;
+    }
+    fill(*slot);
+    push();
+    return true;
+  }
+
+  // Consumer: the oldest published slot, nullptr when the ring is empty
+  T* front() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) {
+        return nullptr;
+      }
+    }
+    return &slots_[head & mask_];
+  }
+
+  // Consumer: gives the slot returned by front() back to the producer
+  void pop() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer: calls |fn(T&)| on up to |max| published slots in order, then
+  // gives them back to the producer at once. Returns the number of slots.
+  template <typename F>
+  size_t consume(F&& fn, size_t max = SIZE_MAX) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ - head < max) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    size_t count = cached_tail_ - head;
+    if (count > max) {
+      count = max;
+    }
+    for (size_t i = 0; i < count; i++) {
+      fn(slots_[(head + i) & mask_]);
+    }
+    if (count) {
+      head_.store(head + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  // Number of published slots, exact only from the producer or the consumer
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::vector<T> slots_;
+  size_t mask_{0};
+
+  // each index and the copy its owner keeps of the other one share a cache
+  // line, so the two threads only touch each other's line when needed
+  char pad0_[SAMPLE_CACHE_LINE_SIZE];
+  std::atomic<size_t> head_{0};  // written by the consumer
+  size_t cached_tail_{0};
+  char pad1_[SAMPLE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+  std::atomic<size_t> tail_{0};  // written by the producer
+  size_t cached_head_{0};
+  char pad2_[SAMPLE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+};
+
+// Lock-free ring between any number of producer threads and one consumer
+// thread, with the same preallocated slots as SampleSpscRing.
+//
+// Producers claim a slot by advancing the shared tail, fill it and publish it
+// through the sequence number of the slot. Slots are consumed in the order
+// they were claimed, so a producer that is preempted between the two steps
+// holds back the slots claimed after its own until it publishes.
+template <typename T>
+class SampleMpscRing : public noncopyable {
+ public:
+  // |capacity| is rounded up to a power of two
+  explicit SampleMpscRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    slots_.reset(new Slot[size]);
+    for (size_t i = 0; i < size; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    size_ = size;
+    mask_ = size - 1;
+  }
+
+  size_t capacity() const { return size_; }
+
+  // Producer: fills a slot with |fill(T&)| and publishes it, false when the
+  // ring is full
+  template <typename F>
+  bool tryPush(F&& fill) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots_[tail & mask_];
+      intptr_t lap = static_cast<intptr_t>(slot->sequence.load(std::memory_order_acquire) - tail);
+      if (lap == 0) {
+        if (tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (lap < 0) {
+        // the slot was not consumed since the previous lap
+        return false;
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(slot->value);
+    slot->sequence.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: the oldest published slot, nullptr when there is none
+  T* front() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[head & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+      return nullptr;
+    }
+    return &slot.value;
+  }
+
+  // Consumer: gives the slot returned by front() back to the producers
+  void pop() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    slots_[head & mask_].sequence.store(head + size_, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_relaxed);
+  }
+
+  // Consumer: calls |fn(T&)| on up to |max| published slots in order and
+  // gives each one back. Returns the number of slots.
+  template <typename F>
+  size_t consume(F&& fn, size_t max = SIZE_MAX) {
+    size_t count = 0;
+    T* value;
+    while (count < max && (value = front())) {
+      fn(*value);
+      pop();
+      count++;
+    }
+    return count;
+  }
+
+  // Number of claimed slots, approximate while producers are running
+  size_t size() const {
+    return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  size_t size_{0};
+  size_t mask_{0};
+
+  char pad0_[SAMPLE_CACHE_LINE_SIZE];
+  std::atomic<size_t> head_{0};  // written by the consumer
+  char pad1_[SAMPLE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_{0};  // claimed by the producers
+  char pad2_[SAMPLE_CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
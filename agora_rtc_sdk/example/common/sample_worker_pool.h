@@ -0,0 +1,66 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "sample_worker_stage.h"
+
+// Spreads the work of SDK callbacks over several worker threads.
+//
+// Each worker is a SampleWorkerStage with a ring of its own. Items are routed
+// by a key, e.g. a hash of the remote user, so the items of one key are
+// handled in order by one worker and the state of a key needs no lock.
+// |handler| also gets the index of its worker, for state kept per worker.
+template <typename T, typename Ring = SampleSpscRing<T>>
+class SampleWorkerPool : public noncopyable {
+ public:
+  SampleWorkerPool(size_t workers, size_t capacity, std::function<void(size_t, T&)> handler) {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); i++) {
+      stages_.emplace_back(new Stage(capacity, [handler, i](T& item) { handler(i, item); }));
+    }
+  }
+
+  void start() {
+    for (auto& stage : stages_) {
+      stage->start();
+    }
+  }
+
+  // Handles the items already posted, then stops the workers
+  void stop() {
+    for (auto& stage : stages_) {
+      stage->stop();
+    }
+  }
+
+  size_t workers() const { return stages_.size(); }
+
+  // Fills an item for the worker of |key|, false when it was dropped
+  template <typename F>
+  bool post(size_t key, F&& fill) {
+    return stages_[key % stages_.size()]->post(std::forward<F>(fill));
+  }
+
+  // Items dropped because the ring of their worker was full
+  uint64_t dropped() const {
+    uint64_t dropped = 0;
+    for (auto& stage : stages_) {
+      dropped += stage->dropped();
+    }
+    return dropped;
+  }
+
+ private:
+  typedef SampleWorkerStage<T, Ring> Stage;
+  std::vector<std::unique_ptr<Stage>> stages_;
+};
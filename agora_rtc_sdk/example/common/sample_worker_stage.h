@@ -0,0 +1,92 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+#pragma once
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#include "sample_event.h"
+#include "sample_spsc_ring.h"
+
+// items handled by the worker before it looks at the stop flag again
+#define SAMPLE_WORKER_BATCH (32)
+// how long an idle worker sleeps; a posted item wakes it up earlier
+#define SAMPLE_WORKER_RETRY_MS (10)
+
+// Moves the work of an SDK callback to a thread of its own.
+//
+// The callback fills a preallocated item of the ring with post() and returns;
+// the worker thread hands the items to |handler| in batches. When the worker
+// falls behind and the ring is full, new items are dropped and counted rather
+// than blocking the callback. Use SampleMpscRing as |Ring| when several
+// callback threads post to the same stage.
+template <typename T, typename Ring = SampleSpscRing<T>>
+class SampleWorkerStage : public noncopyable {
+ public:
+  SampleWorkerStage(size_t capacity, std::function<void(T&)> handler)
+      : ring_(capacity), handler_(std::move(handler)) {}
+  ~SampleWorkerStage() { stop(); }
+
+  void start() {
+    if (!thread_.joinable()) {
+      stop_ = false;
+      thread_ = std::thread(&SampleWorkerStage::run, this);
+    }
+  }
+
+  // Handles the items already posted, then stops the worker
+  void stop() {
+    stop_ = true;
+    ready_.Set();
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  // Fills an item with |fill(T&)| and queues it, false when it was dropped
+  template <typename F>
+  bool post(F&& fill) {
+    if (!ring_.tryPush(std::forward<F>(fill))) {
+      ++dropped_;
+      return false;
+    }
+    if (waiting_) {
+      ready_.Set();
+    }
+    return true;
+  }
+
+  // Items dropped because the ring was full
+  uint64_t dropped() const { return dropped_; }
+
+ private:
+  void run() {
+    while (!stop_) {
+      if (ring_.consume(handler_, SAMPLE_WORKER_BATCH)) {
+        continue;
+      }
+      waiting_ = true;
+      // check again, an item may have been posted before we said we wait
+      if (!ring_.consume(handler_, SAMPLE_WORKER_BATCH)) {
+        ready_.Wait(SAMPLE_WORKER_RETRY_MS);
+      }
+      waiting_ = false;
+    }
+    while (ring_.consume(handler_, SAMPLE_WORKER_BATCH)) {
+    }
+  }
+
+  Ring ring_;
+  std::function<void(T&)> handler_;
+  std::thread thread_;
+  SampleEvent ready_;
+  std::atomic<bool> waiting_{false};
+  std::atomic<bool> stop_{false};
+  std::atomic<uint64_t> dropped_{0};
+};
@@ -9,6 +9,7 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "IAgoraService.h"
 #include "NGIAgoraRtcConnection.h"
@@ -16,6 +17,7 @@
 #include "common/opt_parser.h"
 #include "common/sample_common.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_worker_stage.h"
 #include "common/log.h"
 
 #include "NGIAgoraAudioTrack.h"
@@ -26,6 +28,7 @@
 
 #define DEFAULT_AUDIO_FILE "received_audio.aac"
 #define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_RECEIVED_FRAMES (64)
 
 struct SampleOptions
 {
@@ -35,23 +38,47 @@ struct SampleOptions
     std::string audioFile = DEFAULT_AUDIO_FILE;
 };
 
+// A received frame waiting for the writer thread
+struct EncodedAudioPacket
+{
+    std::vector<uint8_t> data; // keeps its capacity from one frame to the next
+};
+
 class EncodedAudioReceiver : public agora::rtc::IAudioEncodedFrameReceiver
 {
 public:
-    EncodedAudioReceiver(const std::string &outputFilePath) : outputFilePath_(outputFilePath) {}
+    EncodedAudioReceiver(const std::string &outputFilePath)
+        : outputFilePath_(outputFilePath),
+          writer_(DEFAULT_RECEIVED_FRAMES, [this](EncodedAudioPacket &packet) { writePacket(packet); })
+    {
+        writer_.start();
+    }
 
     bool onEncodedAudioFrameReceived(
         const uint8_t *packet, size_t length, const agora::media::base::AudioEncodedFrameInfo &info) override;
 
+    // Writes the packets still queued
+    void stop() { writer_.stop(); }
+
 private:
+    void writePacket(const EncodedAudioPacket &packet);
+
     std::string outputFilePath_;
     FILE *file_ = nullptr;
     int fileCount = 0;
-    int fileSize_;
+    int fileSize_ = 0;
+    // last member, so its thread stops before the file is released
+    SampleWorkerStage<EncodedAudioPacket> writer_;
 };
 
 bool EncodedAudioReceiver::onEncodedAudioFrameReceived(
     const uint8_t *packet, size_t length, const agora::media::base::AudioEncodedFrameInfo &info)
+{
+    // Copy the packet, it is written by the writer thread
+    return writer_.post([&](EncodedAudioPacket &queued) { queued.data.assign(packet, packet + length); });
+}
+
+void EncodedAudioReceiver::writePacket(const EncodedAudioPacket &packet)
 {
     if (!file_)
     {
@@ -62,18 +89,17 @@ bool EncodedAudioReceiver::onEncodedAudioFrameReceived(
         {
             AG_LOG(ERROR, "Failed to create received audio file %s",
                    fileName.c_str());
-            return false;
+            return;
         }
         AG_LOG(INFO, "Created file %s to save received PCM samples",
                fileName.c_str());
     }
 
-    printf("length is %d \n",length);
-
-    if (fwrite(packet, 1, length, file_) != length)
+    size_t length = packet.data.size();
+    if (fwrite(packet.data.data(), 1, length, file_) != length)
     {
         AG_LOG(ERROR, "Error writing encoded audio data: %s", std::strerror(errno));
-        return false;
+        return;
     }
     fileSize_ += length;
     if (fileSize_ >= DEFAULT_FILE_LIMIT)
@@ -82,7 +108,6 @@ bool EncodedAudioReceiver::onEncodedAudioFrameReceived(
         file_ = nullptr;
         fileSize_ = 0;
     }
-    return true;
 }
 
 static bool exitFlag = false;
@@ -175,6 +200,7 @@ int main(int argc, char *argv[])
     return -1;
   }
   AG_LOG(INFO, "Disconnected from Agora channel successfully");
+  audioReceiver->stop();
 
   // Destroy Agora connection and related resources
   localUserObserver.reset();
@@ -28,6 +28,8 @@
 
 #define DEFAULT_CONNECT_TIMEOUT_MS (3000)
 #define DEFAULT_AUDIO_FRAME_DURATION (20)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 #define DEFAULT_AUDIO_FILE "test_data/send_audio.aac"
 
 static int sendCount = 0;
@@ -45,20 +47,29 @@ struct SampleOptions {
 static void SampleSendAudioTask(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender, bool& exitFlag) {
-  std::unique_ptr<HelperAacFileParser> audioFileParser(
-      new HelperAacFileParser(options.audioFile.c_str()));
-  audioFileParser->initialize();
+  // Frames are read ahead on another thread
+  HelperPrefetchSource aacSource(
+      std::unique_ptr<HelperMediaSource>(
+          new HelperAacMediaSource(options.audioFile.c_str(), options.audio.frameDuration)),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!aacSource.start()) {
+    return;
+  }
   PacerInfo pacer = {0, 0,0,std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    if (auto audioFrame = audioFileParser->getAudioFrame(options.audio.frameDuration)) {
-      audioFrameSender->sendEncodedAudioFrame(audioFrame.get()->buffer, audioFrame.get()->bufferLen,
-                                              audioFrame.get()->audioFrameInfo);
-    // we should send one aac frame during 21.33333ms
-      if((sendCount++)%3 == 0) pacer.sendIntervalInMs = 22;
-      else pacer.sendIntervalInMs =21;
-      waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
+    // a late frame keeps its slot, it is sent as soon as it is read
+    const HelperMediaFrame* audioFrame = aacSource.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!audioFrame) {
+      continue;
     }
+    audioFrameSender->sendEncodedAudioFrame(audioFrame->data, audioFrame->length,
+                                            audioFrame->audioFrameInfo);
+    aacSource.release();
+    // we should send one aac frame during 21.33333ms
+    if((sendCount++)%3 == 0) pacer.sendIntervalInMs = 22;
+    else pacer.sendIntervalInMs =21;
+    waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   };
 }
 
@@ -29,6 +29,8 @@
 #define DEFAULT_FRAME_RATE (30)
 #define DEFAULT_AUDIO_FILE "test_data/send_audio.opus"
 #define DEFAULT_FRAME_SIZE_DURATION (20)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 
 struct SampleOptions {
   std::string appId;
@@ -44,20 +46,27 @@ struct SampleOptions {
 static void SampleSendAudioTask(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender, bool& exitFlag) {
-  std::unique_ptr<HelperOpusFileParser> opusFileParser(
-      new HelperOpusFileParser(options.audioFile.c_str()));
-  opusFileParser->initialize();
+  // Packets are read ahead on another thread
+  HelperPrefetchSource opusSource(
+      std::unique_ptr<HelperMediaSource>(new HelperOpusMediaSource(options.audioFile.c_str())),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!opusSource.start()) {
+    return;
+  }
 
   // Opus uses a 20 ms frame size by default. So Opus frames are sent at 20 ms interval
   PacerInfo pacer = {0, options.audio.frameSizeDuration, 0,std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    if (auto audioFrame = opusFileParser->getAudioFrame(options.audio.frameSizeDuration)) {
-      audioFrameSender->sendEncodedAudioFrame(
-          reinterpret_cast<uint8_t*>(audioFrame.get()->buffer.get()), audioFrame.get()->bufferLen,
-          audioFrame.get()->audioFrameInfo);
-      waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
+    // a late packet keeps its slot, it is sent as soon as it is read
+    const HelperMediaFrame* packet = opusSource.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!packet) {
+      continue;
     }
+    audioFrameSender->sendEncodedAudioFrame(packet->data, packet->length,
+                                            packet->audioFrameInfo);
+    opusSource.release();
+    waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   };
 }
 
@@ -71,8 +71,10 @@
 // Wish you have a great experience with Agora_SDK!
 
 
+#include <chrono>
 #include <csignal>
 #include <cstring>
+#include <map>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -82,8 +84,13 @@
 #include "NGIAgoraRtcConnection.h"
 #include "common/log.h"
 #include "common/opt_parser.h"
+#include "common/sample_audio_level.h"
+#include "common/file_parser/helper_ogg_opus_writer.h"
 #include "common/sample_common.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_receive_stats.h"
+#include "common/sample_recording_writer.h"
+#include "common/sample_worker_pool.h"
 
 #include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
@@ -94,10 +101,17 @@
 #define DEFAULT_SAMPLE_RATE (16000)
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_AUDIO_FILE "received_audio.pcm"
+#define DEFAULT_OPUS_AUDIO_FILE "received_audio.opus"
 #define DEFAULT_VIDEO_FILE "received_video.h264"
-#define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_FILE_LIMIT_MB (100)
 #define STREAM_TYPE_HIGH "high"
 #define STREAM_TYPE_LOW "low"
+#define AUDIO_FORMAT_PCM "pcm"
+#define AUDIO_FORMAT_OPUS "opus"
+#define DEFAULT_ENCODE_THREADS (2)
+// frames of 10 ms waiting for each encoding thread
+#define DEFAULT_ENCODE_QUEUE (256)
+#define DEFAULT_VAD_THRESHOLD (-50)
 
 struct SampleOptions {
   std::string appId;
@@ -107,6 +121,15 @@ struct SampleOptions {
   std::string streamType = STREAM_TYPE_HIGH;
   std::string audioFile = DEFAULT_AUDIO_FILE;
   std::string videoFile = DEFAULT_VIDEO_FILE;
+  int fileLimitMB = DEFAULT_FILE_LIMIT_MB;
+  int fileSeconds = 0;
+  std::string audioFormat = AUDIO_FORMAT_PCM;
+  int opusBitrate = 0;
+  int encodeThreads = DEFAULT_ENCODE_THREADS;
+  bool skipSilence = false;
+  double vadThreshold = DEFAULT_VAD_THRESHOLD;
+  int levelReportSeconds = 0;
+  int statsInterval = 0;
 
   struct {
     int sampleRate = DEFAULT_SAMPLE_RATE;
@@ -114,13 +137,78 @@ struct SampleOptions {
   } audio;
 };
 
+// PCM of one remote user waiting for its Opus encoder
+struct PcmRecordingFrame {
+  std::string user;
+  std::vector<int16_t> pcm;  // keeps its capacity from one frame to the next
+  int samplesPerChannel;
+  int sampleRate;
+  int channels;
+};
+
+// Records the audio of each remote user as Ogg Opus files.
+//
+// The audio callback only copies the PCM into the queue of an encoding
+// thread; the users are spread over the threads by their id and each thread
+// owns the encoders of its users. The pages go to the recording writer. When
+// a file reaches the limits its Ogg stream is ended and the next one starts a
+// new file, so every file plays on its own.
+class OpusRecordingPool {
+ public:
+  OpusRecordingPool(SampleRecordingWriter& writer, const std::string& outputFilePath,
+                    const SampleOptions& options)
+      : writer_(writer),
+        outputFilePath_(outputFilePath),
+        bitrateBps_(options.opusBitrate),
+        fileLimitBytes_(static_cast<uint64_t>(options.fileLimitMB) * 1024 * 1024),
+        fileLimitMs_(static_cast<int64_t>(options.fileSeconds) * 1000),
+        users_(std::max(options.encodeThreads, 1)),
+        pool_(users_.size(), DEFAULT_ENCODE_QUEUE,
+              [this](size_t worker, PcmRecordingFrame& frame) { encode(worker, frame); }) {}
+
+  void start() { pool_.start(); }
+
+  // Encodes what is queued and ends the Ogg streams
+  void stop();
+
+  // Called by the audio callback, false when the frame was dropped
+  bool post(const std::string& user, const agora::media::IAudioFrameObserverBase::AudioFrame& frame);
+
+  uint64_t dropped() const { return pool_.dropped(); }
+
+ private:
+  struct UserRecording {
+    std::shared_ptr<SampleRecordingStream> file;
+    std::unique_ptr<HelperOggOpusWriter> encoder;
+  };
+
+  void encode(size_t worker, PcmRecordingFrame& frame);
+
+  SampleRecordingWriter& writer_;
+  std::string outputFilePath_;
+  int bitrateBps_;
+  uint64_t fileLimitBytes_;
+  int64_t fileLimitMs_;
+  // the users of each encoding thread, only used by that thread
+  std::vector<std::map<std::string, UserRecording>> users_;
+  SampleWorkerPool<PcmRecordingFrame> pool_;
+};
+
 class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
  public:
-  PcmFrameObserver(const std::string& outputFilePath)
-      : outputFilePath_(outputFilePath),
-        pcmFile_(nullptr),
-        fileCount(0),
-        fileSize_(0) {}
+  // |opusPool|: encode the audio into Ogg Opus, or nullptr to save raw PCM
+  // |activity|: measures the level of each user, or nullptr
+  // |skipSilence|: only record the active segments found by |activity|
+  // |stats|: counts the arrival of the frames, or nullptr
+  PcmFrameObserver(SampleRecordingWriter& writer, const std::string& outputFilePath,
+                   OpusRecordingPool* opusPool, SampleAudioActivity* activity, bool skipSilence,
+                   SampleReceiveStats* stats)
+      : writer_(writer),
+        outputFilePath_(outputFilePath),
+        opusPool_(opusPool),
+        activity_(activity),
+        skipSilence_(skipSilence),
+        stats_(stats) {}
 
   bool onPlaybackAudioFrame(const char* channelId,AudioFrame& audioFrame) override { return true; };
 
@@ -144,92 +232,129 @@ class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
 
 
  private:
+  SampleRecordingWriter& writer_;
   std::string outputFilePath_;
-  FILE* pcmFile_;
-  int fileCount;
-  int fileSize_;
+  OpusRecordingPool* opusPool_;
+  SampleAudioActivity* activity_;
+  bool skipSilence_;
+  SampleReceiveStats* stats_;
+  // one file per remote user
+  std::map<std::string, std::shared_ptr<SampleRecordingStream>> pcmFiles_;
 };
 
 class H264FrameReceiver : public agora::media::IVideoEncodedFrameObserver {
  public:
-  H264FrameReceiver(const std::string& outputFilePath)
-      : outputFilePath_(outputFilePath),
-        h264File_(nullptr),
-        fileCount(0),
-        fileSize_(0) {}
+  H264FrameReceiver(SampleRecordingWriter& writer, const std::string& outputFilePath,
+                    SampleReceiveStats* stats)
+      : writer_(writer), outputFilePath_(outputFilePath), stats_(stats) {}
 
   bool onEncodedVideoFrameReceived(agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
                                    const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo)  override;
 
  private:
+  SampleRecordingWriter& writer_;
   std::string outputFilePath_;
-  FILE* h264File_;
-  int fileCount;
-  int fileSize_;
+  SampleReceiveStats* stats_;
+  // one file per remote user
+  std::map<agora::rtc::uid_t, std::shared_ptr<SampleRecordingStream>> h264Files_;
 };
 
+bool OpusRecordingPool::post(const std::string& user,
+                             const agora::media::IAudioFrameObserverBase::AudioFrame& frame) {
+  size_t key = std::hash<std::string>()(user);
+  return pool_.post(key, [&](PcmRecordingFrame& item) {
+    const int16_t* samples = static_cast<const int16_t*>(frame.buffer);
+    item.user = user;
+    item.pcm.assign(samples, samples + frame.samplesPerChannel * frame.channels);
+    item.samplesPerChannel = frame.samplesPerChannel;
+    item.sampleRate = frame.samplesPerSec;
+    item.channels = frame.channels;
+  });
+}
+
+void OpusRecordingPool::encode(size_t worker, PcmRecordingFrame& frame) {
+  // Create new file to save the audio received from this user
+  auto& recording = users_[worker][frame.user];
+  if (!recording.encoder) {
+    recording.file =
+        writer_.openStream(SampleRecordingWriter::userFilePath(outputFilePath_, frame.user));
+    SampleRecordingStream* file = recording.file.get();
+    recording.encoder.reset(new HelperOggOpusWriter(
+        [file](const uint8_t* data, size_t length, bool boundary) {
+          // one whole page per write, each Ogg stream is a file of its own
+          file->write(data, length, boundary, boundary);
+        },
+        bitrateBps_));
+  }
+
+  HelperOggOpusWriter& encoder = *recording.encoder;
+  encoder.write(frame.pcm.data(), frame.samplesPerChannel, frame.sampleRate, frame.channels);
+  if ((fileLimitBytes_ && encoder.streamBytes() >= fileLimitBytes_) ||
+      (fileLimitMs_ && encoder.streamMs() >= fileLimitMs_)) {
+    encoder.finish();
+  }
+}
+
+void OpusRecordingPool::stop() {
+  pool_.stop();
+  for (auto& users : users_) {
+    for (auto& user : users) {
+      user.second.encoder->finish();
+    }
+  }
+}
+
 bool PcmFrameObserver::onPlaybackAudioFrameBeforeMixing(const char* channelId, agora::media::base::user_id_t userId, AudioFrame& audioFrame) {
-  // Create new file to save received PCM samples
-  if (!pcmFile_) {
-    std::string fileName = (++fileCount > 1)
-                               ? (outputFilePath_ + to_string(fileCount))
-                               : outputFilePath_;
-    if (!(pcmFile_ = fopen(fileName.c_str(), "w"))) {
-      AG_LOG(ERROR, "Failed to create received audio file %s",
-             fileName.c_str());
-      return false;
+  std::string user = userId ? userId : "";
+  if (stats_) {
+    stats_->onFrame(SampleReceiveStats::kAudio, user,
+                    audioFrame.renderTimeMs > 0 ? audioFrame.renderTimeMs : -1);
+  }
+  if (activity_) {
+    bool active = activity_->update(user, static_cast<const int16_t*>(audioFrame.buffer),
+                                    audioFrame.samplesPerChannel, audioFrame.channels,
+                                    audioFrame.samplesPerSec);
+    if (!active && skipSilence_) {
+      // Nothing to hear, neither encoded nor written
+      return true;
     }
-    AG_LOG(INFO, "Created file %s to save received PCM samples",
-           fileName.c_str());
   }
 
-  // Write PCM samples
-  size_t writeBytes =
-      audioFrame.samplesPerChannel * audioFrame.channels * sizeof(int16_t);
-  if (fwrite(audioFrame.buffer, 1, writeBytes, pcmFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded audio data: %s", std::strerror(errno));
-    return false;
+  if (opusPool_) {
+    // Encoded by the thread of this user
+    return opusPool_->post(user, audioFrame);
   }
-  fileSize_ += writeBytes;
 
-  // Close the file if size limit is reached
-  if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(pcmFile_);
-    pcmFile_ = nullptr;
-    fileSize_ = 0;
+  // Create new file to save the PCM samples received from this user
+  auto& pcmFile = pcmFiles_[user];
+  if (!pcmFile) {
+    pcmFile = writer_.openStream(SampleRecordingWriter::userFilePath(outputFilePath_, user));
   }
-  return true;
+
+  // Queue PCM samples, the file is written by the writer thread
+  size_t writeBytes =
+      audioFrame.samplesPerChannel * audioFrame.channels * sizeof(int16_t);
+  return pcmFile->write(audioFrame.buffer, writeBytes);
 }
 
 bool H264FrameReceiver::onEncodedVideoFrameReceived(agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
                                    const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo) {
-  // Create new file to save received H264 frames
-  if (!h264File_) {
-    std::string fileName = (++fileCount > 1)
-                               ? (outputFilePath_ + to_string(fileCount))
-                               : outputFilePath_;
-    if (!(h264File_ = fopen(fileName.c_str(), "w+"))) {
-      AG_LOG(ERROR, "Failed to create received video file %s",
-             fileName.c_str());
-      return false;
-    }
-    AG_LOG(INFO, "Created file %s to save received H264 frames",
-           fileName.c_str());
+  if (stats_) {
+    stats_->onFrame(SampleReceiveStats::kVideo, std::to_string(uid),
+                    videoEncodedFrameInfo.captureTimeMs > 0 ? videoEncodedFrameInfo.captureTimeMs
+                                                            : -1,
+                    videoEncodedFrameInfo.width, videoEncodedFrameInfo.height);
   }
 
-  if (fwrite(imageBuffer, 1, length, h264File_) != length) {
-    AG_LOG(ERROR, "Error writing h264 data: %s", std::strerror(errno));
-    return false;
+  // Create new file to save the H264 frames received from this user
+  auto& h264File = h264Files_[uid];
+  if (!h264File) {
+    h264File = writer_.openStream(SampleRecordingWriter::userFilePath(outputFilePath_, std::to_string(uid)));
   }
-  fileSize_ += length;
 
-  // Close the file if size limit is reached
-  if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(h264File_);
-    h264File_ = nullptr;
-    fileSize_ = 0;
-  }
-  return true;
+  // A new file starts with a key frame so that it can be decoded on its own
+  return h264File->write(imageBuffer, length,
+                         videoEncodedFrameInfo.frameType == agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME);
 }
 
 static bool exitFlag = false;
@@ -247,11 +372,29 @@ int main(int argc, char* argv[]) {
                          "The remote user to receive stream from");
   optParser.add_long_opt("audioFile", &options.audioFile, "Output audio file");
   optParser.add_long_opt("videoFile", &options.videoFile, "Output video file");
+  optParser.add_long_opt("fileLimit", &options.fileLimitMB,
+                         "Start a new output file after this many MB / default is 100");
+  optParser.add_long_opt("fileSeconds", &options.fileSeconds,
+                         "Start a new output file after this many seconds / default is 0 (never)");
   optParser.add_long_opt("sampleRate", &options.audio.sampleRate,
                          "Sample rate for received audio");
   optParser.add_long_opt("numOfChannels", &options.audio.numOfChannels,
                          "Number of channels for received audio");
   optParser.add_long_opt("streamtype", &options.streamType, "the stream  type");
+  optParser.add_long_opt("audioFormat", &options.audioFormat,
+                         "Format of the received audio files, pcm or opus / default is pcm");
+  optParser.add_long_opt("opusBitrate", &options.opusBitrate,
+                         "Opus bitrate in bps / default is 0 (from the sample rate)");
+  optParser.add_long_opt("encodeThreads", &options.encodeThreads,
+                         "Threads encoding the received audio / default is 2");
+  optParser.add_long_opt("skipSilence", &options.skipSilence,
+                         "Do not record the silent segments of each user / default is false");
+  optParser.add_long_opt("vadThreshold", &options.vadThreshold,
+                         "Level in dBFS below which a user is silent / default is -50");
+  optParser.add_long_opt("levelReport", &options.levelReportSeconds,
+                         "Log the audio level of each user every N seconds / default is 0 (never)");
+  optParser.add_long_opt("statsInterval", &options.statsInterval,
+                         "Log the receive statistics of each user every N seconds / default is 0 (never)");
 
   if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
     std::ostringstream strStream;
@@ -270,6 +413,21 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  if (options.audioFormat == AUDIO_FORMAT_OPUS) {
+    int rate = options.audio.sampleRate;
+    if ((rate != 8000 && rate != 12000 && rate != 16000 && rate != 24000 && rate != 48000) ||
+        options.audio.numOfChannels < 1 || options.audio.numOfChannels > 2) {
+      AG_LOG(ERROR, "Opus needs 1 or 2 channels at 8, 12, 16, 24 or 48 kHz!");
+      return -1;
+    }
+    if (options.audioFile == DEFAULT_AUDIO_FILE) {
+      options.audioFile = DEFAULT_OPUS_AUDIO_FILE;
+    }
+  } else if (options.audioFormat != AUDIO_FORMAT_PCM) {
+    AG_LOG(ERROR, "Unknown audio format %s", options.audioFormat.c_str());
+    return -1;
+  }
+
   std::signal(SIGQUIT, SignalHandler);
   std::signal(SIGABRT, SignalHandler);
   std::signal(SIGINT, SignalHandler);
@@ -324,12 +482,42 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  // Start the writer thread saving the received data, one file per user
+  SampleRecordingWriter::Options writerOptions;
+  writerOptions.rotateBytes = static_cast<uint64_t>(options.fileLimitMB) * 1024 * 1024;
+  writerOptions.rotateSeconds = options.fileSeconds;
+  SampleRecordingWriter recordingWriter(writerOptions);
+  recordingWriter.start();
+
+  // Start the threads encoding the received audio into Opus
+  std::unique_ptr<OpusRecordingPool> opusPool;
+  if (options.audioFormat == AUDIO_FORMAT_OPUS) {
+    opusPool.reset(new OpusRecordingPool(recordingWriter, options.audioFile, options));
+    opusPool->start();
+  }
+
   // Create local user observer
   auto localUserObserver =
       std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
 
+  // Measure the audio level of each user to skip the silence or report it
+  std::unique_ptr<SampleAudioActivity> audioActivity;
+  if (options.skipSilence || options.levelReportSeconds > 0) {
+    SampleVoiceDetector::Options vadOptions;
+    vadOptions.thresholdDbfs = static_cast<float>(options.vadThreshold);
+    audioActivity.reset(new SampleAudioActivity(vadOptions));
+  }
+
+  // Count the arrival of the frames of each user
+  std::unique_ptr<SampleReceiveStats> receiveStats;
+  if (options.statsInterval > 0) {
+    receiveStats.reset(new SampleReceiveStats());
+  }
+
   // Register audio frame observer to receive audio stream
-  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(options.audioFile);
+  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(
+      recordingWriter, options.audioFile, opusPool.get(), audioActivity.get(),
+      options.skipSilence, receiveStats.get());
   if (connection->getLocalUser()->setPlaybackAudioFrameBeforeMixingParameters(
           options.audio.numOfChannels, options.audio.sampleRate)) {
     AG_LOG(ERROR, "Failed to set audio frame parameters!");
@@ -339,15 +527,34 @@ int main(int argc, char* argv[]) {
 
   // Register h264 frame receiver to receive video stream
   auto h264FrameReceiver =
-      std::make_shared<H264FrameReceiver>(options.videoFile);
+      std::make_shared<H264FrameReceiver>(recordingWriter, options.videoFile, receiveStats.get());
   localUserObserver->setVideoEncodedImageReceiver(h264FrameReceiver.get());
 
   // Start receiving incoming media data
   AG_LOG(INFO, "Start receiving audio & video data ...");
 
-  // Periodically check exit flag
+  // Periodically check exit flag and report the audio levels and statistics
+  auto lastReport = std::chrono::steady_clock::now();
+  auto lastStats = lastReport;
   while (!exitFlag) {
     usleep(10000);
+    if (receiveStats && std::chrono::steady_clock::now() - lastStats >=
+                            std::chrono::seconds(options.statsInterval)) {
+      lastStats = std::chrono::steady_clock::now();
+      receiveStats->report();
+    }
+    if (options.levelReportSeconds > 0 &&
+        std::chrono::steady_clock::now() - lastReport >=
+            std::chrono::seconds(options.levelReportSeconds)) {
+      lastReport = std::chrono::steady_clock::now();
+      for (auto& user : audioActivity->levels()) {
+        AG_LOG_REPORT(INFO,
+                      "User %s: %.1f dBFS, peak %d, noise floor %.1f dBFS, %s, %.0f%% silent",
+                      user.user.c_str(), user.level.dbfs, user.level.peak, user.noiseFloorDbfs,
+                      user.active ? "active" : "silent",
+                      user.frames ? 100.0 * user.silentFrames / user.frames : 0.0);
+      }
+    }
   }
 
   // Unregister audio & video frame observers
@@ -361,6 +568,18 @@ int main(int argc, char* argv[]) {
   }
   AG_LOG(INFO, "Disconnected from Agora channel successfully");
 
+  // Encode the queued audio and end the Opus streams
+  if (opusPool) {
+    opusPool->stop();
+    if (opusPool->dropped()) {
+      AG_LOG(ERROR, "%llu audio frames were dropped before encoding",
+             static_cast<unsigned long long>(opusPool->dropped()));
+    }
+  }
+
+  // Write what is still buffered and close the files
+  recordingWriter.stop();
+
   // Destroy Agora connection and related resources
   localUserObserver.reset();
   pcmFrameObserver.reset();
@@ -91,6 +91,8 @@
 #define DEFAULT_SAMPLE_RATE (16000)
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_FRAME_RATE (30)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 #define DEFAULT_AUDIO_FILE "test_data/send_audio_16k_1ch.pcm"
 #define DEFAULT_VIDEO_FILE "test_data/send_video.h264"
 
@@ -108,41 +110,15 @@ struct SampleOptions {
   struct {
     int frameRate = DEFAULT_FRAME_RATE;
     bool showBandwidthEstimation = false;
+    bool frameIndex = false;
   } video;
 };
 
-static void sendOnePcmFrame(const SampleOptions& options,
+static void sendOnePcmFrame(const SampleOptions& options, const HelperMediaFrame& frame,
                             agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioFrameSender) {
-  static FILE* file = nullptr;
-  const char* fileName = options.audioFile.c_str();
-
-  // Calculate byte size for 10ms audio samples
-  int sampleSize = sizeof(int16_t) * options.audio.numOfChannels;
   int samplesPer10ms = options.audio.sampleRate / 100;
-  int sendBytes = sampleSize * samplesPer10ms;
-
-  if (!file) {
-    if (!(file = fopen(fileName, "rb"))) {
-      AG_LOG(ERROR, "Failed to open audio file %s", fileName);
-      return;
-    }
-    AG_LOG(INFO, "Open audio file %s successfully", fileName);
-  }
-
-  uint8_t frameBuf[sendBytes];
-
-  if (fread(frameBuf, 1, sizeof(frameBuf), file) != sizeof(frameBuf)) {
-    if (feof(file)) {
-      fclose(file);
-      file = nullptr;
-      AG_LOG(INFO, "End of audio file");
-    } else {
-      AG_LOG(ERROR, "Error reading audio data: %s", std::strerror(errno));
-    }
-    return;
-  }
 
-  if (audioFrameSender->sendAudioPcmData(frameBuf, 0,0, samplesPer10ms,  agora::rtc::TWO_BYTES_PER_SAMPLE,
+  if (audioFrameSender->sendAudioPcmData(frame.data, 0,0, samplesPer10ms,  agora::rtc::TWO_BYTES_PER_SAMPLE,
                                          options.audio.numOfChannels,
                                          options.audio.sampleRate) < 0) {
     AG_LOG(ERROR, "Failed to send audio frame!");
@@ -150,33 +126,48 @@ static void sendOnePcmFrame(const SampleOptions& options,
 }
 
 static void sendOneH264Frame(
-    int frameRate, std::unique_ptr<HelperH264Frame> h264Frame,
+    int frameRate, const HelperMediaFrame& h264Frame,
     agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender) {
   agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
   videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
   videoEncodedFrameInfo.codecType = agora::rtc::VIDEO_CODEC_H264;
   videoEncodedFrameInfo.framesPerSecond = frameRate;
   videoEncodedFrameInfo.frameType =
-      (h264Frame.get()->isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
-                                   : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
+      (h264Frame.isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
+                            : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
 
   /*   AG_LOG(DEBUG, "sendEncodedVideoImage, buffer %p, len %d, frameType %d",
-           reinterpret_cast<uint8_t*>(h264Frame.get()->buffer.get()), h264Frame.get()->bufferLen,
-           videoEncodedFrameInfo.frameType); */
+           h264Frame.buffer, h264Frame.bufferLen, videoEncodedFrameInfo.frameType); */
 
-  videoH264FrameSender->sendEncodedVideoImage(
-      reinterpret_cast<uint8_t*>(h264Frame.get()->buffer.get()), h264Frame.get()->bufferLen,
-      videoEncodedFrameInfo);
+  videoH264FrameSender->sendEncodedVideoImage(h264Frame.data, h264Frame.length,
+                                              videoEncodedFrameInfo);
 }
 
 static void SampleSendAudioTask(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioFrameSender, bool& exitFlag) {
+  // Calculate byte size for 10ms audio samples
+  int sampleSize = sizeof(int16_t) * options.audio.numOfChannels;
+  int samplesPer10ms = options.audio.sampleRate / 100;
+  HelperPrefetchSource pcmSource(
+      std::unique_ptr<HelperMediaSource>(
+          new HelperRawFileSource(options.audioFile.c_str(), sampleSize * samplesPer10ms)),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!pcmSource.start()) {
+    return;
+  }
+
   // Currently only 10 ms PCM frame is supported. So PCM frames are sent at 10 ms interval
   PacerInfo pacer = {0, 10,0, std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    sendOnePcmFrame(options, audioFrameSender);
+    // a late frame keeps its slot, it is sent as soon as it is read
+    const HelperMediaFrame* frame = pcmSource.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!frame) {
+      continue;
+    }
+    sendOnePcmFrame(options, *frame, audioFrameSender);
+    pcmSource.release();
     waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   }
 }
@@ -185,18 +176,30 @@ static void SampleSendVideoH264Task(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH264FrameSender,
     bool& exitFlag) {
-  std::unique_ptr<HelperH264FileParser> h264FileParser(
-      new HelperH264FileParser(options.videoFile.c_str()));
-  h264FileParser->initialize();
+  // Frames are parsed ahead on another thread
+  HelperPrefetchSource h264Source(
+      std::unique_ptr<HelperMediaSource>(
+          new HelperH264MediaSource(options.videoFile.c_str(), options.video.frameIndex)),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!h264Source.start()) {
+    return;
+  }
 
   // Calculate send interval based on frame rate. H264 frames are sent at this interval
   PacerInfo pacer = {0, 1000 / options.video.frameRate, 0, std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    if (auto h264Frame = h264FileParser->getH264Frame()) {
-      sendOneH264Frame(options.video.frameRate, std::move(h264Frame), videoH264FrameSender);
-      waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
+    // a late frame keeps its slot, it is sent as soon as it is parsed
+    const HelperMediaFrame* h264Frame = h264Source.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!h264Frame) {
+      if (h264Source.isEnd()) {
+        break;  // a pipe has no start to loop back to
+      }
+      continue;
     }
+    sendOneH264Frame(options.video.frameRate, *h264Frame, videoH264FrameSender);
+    h264Source.release();
+    waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   };
 }
 
@@ -213,7 +216,7 @@ int main(int argc, char* argv[]) {
   optParser.add_long_opt("audioFile", &options.audioFile,
                          "The audio file in raw PCM format to be sent");
   optParser.add_long_opt("videoFile", &options.videoFile,
-                         "The video file in YUV420 format to be sent");
+                         "The video file (or pipe, - for stdin) in H264 format to be sent");
   optParser.add_long_opt("sampleRate", &options.audio.sampleRate,
                          "Sample rate for the PCM file to be sent");
   optParser.add_long_opt("numOfChannels", &options.audio.numOfChannels,
@@ -222,6 +225,8 @@ int main(int argc, char* argv[]) {
                          "Target frame rate for sending the video stream");
   optParser.add_long_opt("bwe", &options.video.showBandwidthEstimation,
                          "show or hide bandwidth estimation info");
+  optParser.add_long_opt("frameIndex", &options.video.frameIndex,
+                         "Locate frames with a cached index of the video file");
   optParser.add_long_opt("localIP", &options.localIP,
                          "Local IP");
 
@@ -29,6 +29,8 @@
 #define DEFAULT_CONNECT_TIMEOUT_MS (3000)
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_FRAME_RATE (30)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 #define DEFAULT_VIDEO_FILE "test_data/send_video.h265"
 
 struct SampleOptions {
@@ -44,41 +46,50 @@ struct SampleOptions {
 };
 
 static void sendOneH265Frame(
-    int frameRate, std::unique_ptr<HelperH265Frame> h265Frame,
+    int frameRate, const HelperMediaFrame& h265Frame,
     agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH265FrameSender) {
   agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
   videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
   videoEncodedFrameInfo.codecType = agora::rtc::VIDEO_CODEC_H265;
   videoEncodedFrameInfo.framesPerSecond = frameRate;
   videoEncodedFrameInfo.frameType =
-      (h265Frame.get()->isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
-                                   : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
+      (h265Frame.isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_KEY_FRAME
+                            : agora::rtc::VIDEO_FRAME_TYPE::VIDEO_FRAME_TYPE_DELTA_FRAME);
 
   /*   AG_LOG(DEBUG, "sendEncodedVideoImage, buffer %p, len %d, frameType %d",
-           reinterpret_cast<uint8_t*>(h265Frame.get()->buffer.get()), h265Frame.get()->bufferLen,
-           videoEncodedFrameInfo.frameType); */
+           h265Frame.buffer, h265Frame.bufferLen, videoEncodedFrameInfo.frameType); */
 
-  videoH265FrameSender->sendEncodedVideoImage(
-      reinterpret_cast<uint8_t*>(h265Frame.get()->buffer.get()), h265Frame.get()->bufferLen,
-      videoEncodedFrameInfo);
+  videoH265FrameSender->sendEncodedVideoImage(h265Frame.data, h265Frame.length,
+                                              videoEncodedFrameInfo);
 }
 
 static void SampleSendVideoH265Task(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoH265FrameSender,
     bool& exitFlag) {
-  std::unique_ptr<HelperH265FileParser> h265FileParser(
-      new HelperH265FileParser(options.videoFile.c_str()));
-  h265FileParser->initialize();
+  // Frames are parsed ahead on another thread
+  HelperPrefetchSource h265Source(
+      std::unique_ptr<HelperMediaSource>(new HelperH265MediaSource(options.videoFile.c_str())),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!h265Source.start()) {
+    return;
+  }
 
   // Calculate send interval based on frame rate. H265 frames are sent at this interval
   PacerInfo pacer = {0, 1000 / options.video.frameRate, 0, std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    if (auto h265Frame = h265FileParser->getH265Frame()) {
-      sendOneH265Frame(options.video.frameRate, std::move(h265Frame), videoH265FrameSender);
-      waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
+    // a late frame keeps its slot, it is sent as soon as it is parsed
+    const HelperMediaFrame* h265Frame = h265Source.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!h265Frame) {
+      if (h265Source.isEnd()) {
+        break;  // a pipe has no start to loop back to
+      }
+      continue;
     }
+    sendOneH265Frame(options.video.frameRate, *h265Frame, videoH265FrameSender);
+    h265Source.release();
+    waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   };
 }
 
@@ -93,7 +104,7 @@ int main(int argc, char* argv[]) {
   optParser.add_long_opt("channelId", &options.channelId, "Channel Id / must");
   optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
   optParser.add_long_opt("videoFile", &options.videoFile,
-                         "The video file in YUV420 format to be sent");
+                         "The video file (or pipe, - for stdin) in H265 format to be sent");
   optParser.add_long_opt("fps", &options.video.frameRate,
                          "Target frame rate for sending the video stream");
   optParser.add_long_opt("bwe", &options.video.showBandwidthEstimation,
@@ -0,0 +1,258 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+// This sample records the encoded H.264/H.265 video and AAC/Opus audio of a
+// remote user straight into a fragmented MP4 file, which can be played while
+// it is recorded and needs no remux afterwards. The SDK callbacks only copy
+// the frames; HelperMp4Muxer runs on a worker thread.
+
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IAgoraService.h"
+#include "NGIAgoraRtcConnection.h"
+#include "common/file_parser/helper_mp4_muxer.h"
+#include "common/helper.h"
+#include "common/log.h"
+#include "common/opt_parser.h"
+#include "common/sample_common.h"
+#include "common/sample_local_user_observer.h"
+#include "common/sample_worker_stage.h"
+
+#include "NGIAgoraAudioTrack.h"
+#include "NGIAgoraLocalUser.h"
+#include "NGIAgoraMediaNodeFactory.h"
+#include "NGIAgoraMediaNode.h"
+#include "NGIAgoraVideoTrack.h"
+
+#define DEFAULT_OUTPUT_FILE "received_media.mp4"
+#define DEFAULT_FRAGMENT_MS (1000)
+#define DEFAULT_RECEIVED_FRAMES (128)
+
+struct SampleOptions {
+  std::string appId;
+  std::string channelId;
+  std::string userId;
+  std::string remoteUserId;
+  std::string outputFile = DEFAULT_OUTPUT_FILE;
+  int fragmentMs = DEFAULT_FRAGMENT_MS;
+};
+
+// A received frame waiting for the muxer thread
+struct ReceivedMediaFrame {
+  bool isVideo;
+  std::vector<uint8_t> data;  // keeps its capacity from one frame to the next
+  agora::rtc::EncodedVideoFrameInfo videoInfo;
+  agora::rtc::AUDIO_CODEC_TYPE audioCodec;
+  int64_t timeMs;
+};
+
+// Audio and video are posted from different SDK threads
+typedef SampleWorkerStage<ReceivedMediaFrame, SampleMpscRing<ReceivedMediaFrame>> MuxerStage;
+
+class EncodedVideoReceiver : public agora::media::IVideoEncodedFrameObserver {
+ public:
+  EncodedVideoReceiver(MuxerStage& muxer, agora::rtc::uid_t uid) : muxer_(muxer), uid_(uid) {}
+
+  bool onEncodedVideoFrameReceived(agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
+                                   const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo) override;
+
+ private:
+  MuxerStage& muxer_;
+  agora::rtc::uid_t uid_;
+};
+
+class EncodedAudioReceiver : public agora::rtc::IAudioEncodedFrameReceiver {
+ public:
+  EncodedAudioReceiver(MuxerStage& muxer) : muxer_(muxer) {}
+
+  bool onEncodedAudioFrameReceived(const uint8_t* packet, size_t length,
+                                   const agora::media::base::AudioEncodedFrameInfo& info) override;
+
+ private:
+  MuxerStage& muxer_;
+};
+
+bool EncodedVideoReceiver::onEncodedVideoFrameReceived(
+    agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
+    const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo) {
+  // One file holds one user
+  if (uid != uid_) {
+    return true;
+  }
+
+  return muxer_.post([&](ReceivedMediaFrame& frame) {
+    frame.isVideo = true;
+    frame.data.assign(imageBuffer, imageBuffer + length);
+    frame.videoInfo = videoEncodedFrameInfo;
+    frame.timeMs = now_ms_t();
+  });
+}
+
+bool EncodedAudioReceiver::onEncodedAudioFrameReceived(
+    const uint8_t* packet, size_t length, const agora::media::base::AudioEncodedFrameInfo& info) {
+  return muxer_.post([&](ReceivedMediaFrame& frame) {
+    frame.isVideo = false;
+    frame.data.assign(packet, packet + length);
+    frame.audioCodec = static_cast<agora::rtc::AUDIO_CODEC_TYPE>(info.codec);
+    frame.timeMs = info.sendTs;
+  });
+}
+
+static void MuxFrame(HelperMp4Muxer& muxer, ReceivedMediaFrame& frame) {
+  if (!frame.isVideo) {
+    muxer.writeAudioFrame(frame.data.data(), frame.data.size(), frame.audioCodec, frame.timeMs);
+    return;
+  }
+
+  // Frames without timestamps are placed at the time they arrived
+  const agora::rtc::EncodedVideoFrameInfo& info = frame.videoInfo;
+  int64_t dtsMs = info.decodeTimeMs ? info.decodeTimeMs
+                                    : (info.captureTimeMs ? info.captureTimeMs : frame.timeMs);
+  int64_t ptsMs = info.presentationMs >= 0 ? info.presentationMs : dtsMs;
+  muxer.writeVideoFrame(frame.data.data(), frame.data.size(), info.codecType,
+                        info.frameType == agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME, info.width,
+                        info.height, dtsMs, ptsMs);
+}
+
+static bool exitFlag = false;
+static void SignalHandler(int sigNo) { exitFlag = true; }
+
+int main(int argc, char* argv[]) {
+  SampleOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("token", &options.appId, "The token for authentication");
+  optParser.add_long_opt("channelId", &options.channelId, "Channel Id");
+  optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
+  optParser.add_long_opt("remoteUserId", &options.remoteUserId,
+                         "The remote user to record / must");
+  optParser.add_long_opt("outputFile", &options.outputFile, "Output MP4 file");
+  optParser.add_long_opt("fragmentMs", &options.fragmentMs,
+                         "Duration of the MP4 fragments in ms / default is 1000");
+
+  if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+
+  if (options.appId.empty()) {
+    AG_LOG(ERROR, "Must provide appId!");
+    return -1;
+  }
+
+  if (options.channelId.empty()) {
+    AG_LOG(ERROR, "Must provide channelId!");
+    return -1;
+  }
+
+  // The encoded audio frames do not tell their user, so only one user is
+  // subscribed and recorded
+  if (options.remoteUserId.empty()) {
+    AG_LOG(ERROR, "Must provide remoteUserId!");
+    return -1;
+  }
+
+  std::signal(SIGQUIT, SignalHandler);
+  std::signal(SIGABRT, SignalHandler);
+  std::signal(SIGINT, SignalHandler);
+
+  // Create the MP4 file and the thread feeding it
+  HelperMp4Muxer mp4Muxer(options.outputFile.c_str(), true, true, options.fragmentMs);
+  if (!mp4Muxer.initialize()) {
+    return -1;
+  }
+  MuxerStage muxerStage(DEFAULT_RECEIVED_FRAMES,
+                        [&](ReceivedMediaFrame& frame) { MuxFrame(mp4Muxer, frame); });
+  muxerStage.start();
+
+  // Create Agora service
+  auto service = createAndInitAgoraService(false, true, true);
+  if (!service) {
+    AG_LOG(ERROR, "Failed to creating Agora service!");
+    return -1;
+  }
+
+  // Create Agora connection receiving encoded audio and video
+  agora::rtc::RtcConnectionConfiguration ccfg;
+  ccfg.clientRoleType = agora::rtc::CLIENT_ROLE_AUDIENCE;
+  ccfg.autoSubscribeAudio = false;
+  ccfg.autoSubscribeVideo = false;
+  ccfg.enableAudioRecordingOrPlayout = false;  // Subscribe audio but without playback
+  ccfg.audioRecvEncodedFrame = true;
+
+  agora::agora_refptr<agora::rtc::IRtcConnection> connection =
+      service->createRtcConnection(ccfg);
+  if (!connection) {
+    AG_LOG(ERROR, "Failed to creating Agora connection!");
+    return -1;
+  }
+
+  // Subcribe the streams of the remote user
+  agora::rtc::VideoSubscriptionOptions subscriptionOptions;
+  subscriptionOptions.encodedFrameOnly = true;
+  subscriptionOptions.type = agora::rtc::VIDEO_STREAM_HIGH;
+  connection->getLocalUser()->subscribeAudio(options.remoteUserId.c_str());
+  connection->getLocalUser()->subscribeVideo(options.remoteUserId.c_str(), subscriptionOptions);
+
+  // Connect to Agora channel
+  if (connection->connect(options.appId.c_str(), options.channelId.c_str(),
+                          options.userId.c_str())) {
+    AG_LOG(ERROR, "Failed to connect to Agora channel!");
+    return -1;
+  }
+
+  // Create local user observer
+  auto localUserObserver =
+      std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
+
+  // Register the receivers of encoded audio & video
+  auto audioReceiver = std::make_shared<EncodedAudioReceiver>(muxerStage);
+  localUserObserver->setEncodedAudioFrameObserver(audioReceiver.get());
+  auto videoReceiver = std::make_shared<EncodedVideoReceiver>(
+      muxerStage, static_cast<agora::rtc::uid_t>(strtoul(options.remoteUserId.c_str(), nullptr, 10)));
+  localUserObserver->setVideoEncodedImageReceiver(videoReceiver.get());
+
+  // Start receiving incoming media data
+  AG_LOG(INFO, "Start recording audio & video data to %s ...", options.outputFile.c_str());
+
+  // Periodically check exit flag
+  while (!exitFlag) {
+    usleep(10000);
+  }
+
+  // Disconnect from Agora channel
+  if (connection->disconnect()) {
+    AG_LOG(ERROR, "Failed to disconnect from Agora channel!");
+    return -1;
+  }
+  AG_LOG(INFO, "Disconnected from Agora channel successfully");
+
+  // Mux the frames still queued and write the last fragment
+  muxerStage.stop();
+  mp4Muxer.finish();
+  if (muxerStage.dropped()) {
+    AG_LOG(ERROR, "Dropped %llu frames, the muxer could not keep up",
+           static_cast<unsigned long long>(muxerStage.dropped()));
+  }
+
+  // Destroy Agora connection and related resources
+  localUserObserver.reset();
+  audioReceiver.reset();
+  videoReceiver.reset();
+  connection = nullptr;
+
+  // Destroy Agora Service
+  service->release();
+  service = nullptr;
+
+  return 0;
+}
@@ -0,0 +1,274 @@
+//  Agora RTC/MEDIA SDK
+//
+//  Copyright (c) 2020 Agora.io. All rights reserved.
+//
+
+// This sample sends the H.264/H.265 video and AAC audio of an MP4 or
+// fragmented MP4 file as encoded frames, without converting the file first.
+// HelperMp4Demuxer rewrites the video to Annex-B and adds ADTS headers to the
+// audio; the frames are paced by the timestamps of the file.
+
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "IAgoraService.h"
+#include "NGIAgoraRtcConnection.h"
+#include "common/file_parser/helper_mp4_demuxer.h"
+#include "common/helper.h"
+#include "common/log.h"
+#include "common/opt_parser.h"
+#include "common/sample_common.h"
+#include "common/sample_connection_observer.h"
+#include "common/sample_local_user_observer.h"
+
+#include "NGIAgoraAudioTrack.h"
+#include "NGIAgoraLocalUser.h"
+#include "NGIAgoraMediaNodeFactory.h"
+#include "NGIAgoraMediaNode.h"
+#include "NGIAgoraVideoTrack.h"
+
+#define DEFAULT_CONNECT_TIMEOUT_MS (3000)
+#define DEFAULT_VIDEO_FILE "test_data/send_video.mp4"
+
+struct SampleOptions {
+  std::string appId;
+  std::string channelId;
+  std::string userId;
+  std::string videoFile = DEFAULT_VIDEO_FILE;
+  bool showBandwidthEstimation = false;
+};
+
+// Waits until |timeMs| of the file is due
+static void waitUntilFrameTime(PacerInfo& pacer, int64_t timeMs) {
+  pacer.nextDurationInMs = timeMs;
+  pacer.sendIntervalInMs = 0;
+  waitBeforeNextSend(pacer);
+}
+
+static void SampleSendVideoTask(
+    std::shared_ptr<HelperMp4Demuxer> demuxer,
+    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender,
+    std::chrono::steady_clock::time_point startTime, bool& exitFlag) {
+  PacerInfo pacer = {0, 0, 0, startTime};
+
+  while (!exitFlag) {
+    HelperMp4Frame frame;
+    if (!demuxer->getVideoFrame(frame)) {
+      break;
+    }
+    waitUntilFrameTime(pacer, frame.dtsMs);
+
+    agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
+    videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
+    videoEncodedFrameInfo.codecType = demuxer->getVideoCodec();
+    videoEncodedFrameInfo.width = demuxer->getWidth();
+    videoEncodedFrameInfo.height = demuxer->getHeight();
+    videoEncodedFrameInfo.frameType = frame.isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME
+                                                       : agora::rtc::VIDEO_FRAME_TYPE_DELTA_FRAME;
+    videoEncodedFrameInfo.decodeTimeMs = frame.dtsMs;
+    videoEncodedFrameInfo.presentationMs = frame.ptsMs;
+    videoFrameSender->sendEncodedVideoImage(frame.buffer, frame.bufferLen, videoEncodedFrameInfo);
+  }
+}
+
+static void SampleSendAudioTask(
+    std::shared_ptr<HelperMp4Demuxer> demuxer,
+    agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender,
+    std::chrono::steady_clock::time_point startTime, bool& exitFlag) {
+  PacerInfo pacer = {0, 0, 0, startTime};
+
+  while (!exitFlag) {
+    HelperMp4Frame frame;
+    if (!demuxer->getAudioFrame(frame)) {
+      break;
+    }
+    waitUntilFrameTime(pacer, frame.dtsMs);
+
+    agora::rtc::EncodedAudioFrameInfo audioFrameInfo;
+    audioFrameInfo.codec = demuxer->getAudioCodec();
+    audioFrameInfo.sampleRateHz = demuxer->getSampleRate();
+    audioFrameInfo.numberOfChannels = demuxer->getChannels();
+    audioFrameInfo.samplesPerChannel = demuxer->getSamplesPerFrame();
+    audioFrameSender->sendEncodedAudioFrame(frame.buffer, frame.bufferLen, audioFrameInfo);
+  }
+}
+
+static bool exitFlag = false;
+static void SignalHandler(int sigNo) { exitFlag = true; }
+
+int main(int argc, char* argv[]) {
+  SampleOptions options;
+  opt_parser optParser;
+
+  optParser.add_long_opt("token", &options.appId, "The token for authentication / must");
+  optParser.add_long_opt("channelId", &options.channelId, "Channel Id / must");
+  optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
+  optParser.add_long_opt("videoFile", &options.videoFile,
+                         "The MP4 file (H264/H265 video, AAC audio) to be sent");
+  optParser.add_long_opt("bwe", &options.showBandwidthEstimation,
+                         "show or hide bandwidth estimation info");
+
+  if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
+    std::ostringstream strStream;
+    optParser.print_usage(argv[0], strStream);
+    std::cout << strStream.str() << std::endl;
+    return -1;
+  }
+
+  if (options.appId.empty()) {
+    AG_LOG(ERROR, "Must provide appId!");
+    return -1;
+  }
+
+  if (options.channelId.empty()) {
+    AG_LOG(ERROR, "Must provide channelId!");
+    return -1;
+  }
+
+  std::signal(SIGQUIT, SignalHandler);
+  std::signal(SIGABRT, SignalHandler);
+  std::signal(SIGINT, SignalHandler);
+
+  auto demuxer = std::make_shared<HelperMp4Demuxer>(options.videoFile.c_str());
+  if (!demuxer->initialize()) {
+    AG_LOG(ERROR, "Failed to open video file %s", options.videoFile.c_str());
+    return -1;
+  }
+
+  // Create Agora service
+  auto service = createAndInitAgoraService(false, true, true);
+  if (!service) {
+    AG_LOG(ERROR, "Failed to creating Agora service!");
+  }
+
+  // Create Agora connection
+  agora::rtc::RtcConnectionConfiguration ccfg;
+  ccfg.autoSubscribeAudio = false;
+  ccfg.autoSubscribeVideo = false;
+  ccfg.clientRoleType = agora::rtc::CLIENT_ROLE_BROADCASTER;
+  agora::agora_refptr<agora::rtc::IRtcConnection> connection = service->createRtcConnection(ccfg);
+  if (!connection) {
+    AG_LOG(ERROR, "Failed to creating Agora connection!");
+    return -1;
+  }
+
+  // Register connection observer to monitor connection event
+  auto connObserver = std::make_shared<SampleConnectionObserver>();
+  connection->registerObserver(connObserver.get());
+
+  // Register network observer to monitor bandwidth estimation result
+  if (options.showBandwidthEstimation) {
+    connection->registerNetworkObserver(connObserver.get());
+  }
+
+  // Create local user observer to monitor intra frame request
+  auto localUserObserver = std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
+
+  // Connect to Agora channel
+  if (connection->connect(options.appId.c_str(), options.channelId.c_str(),
+                          options.userId.c_str())) {
+    AG_LOG(ERROR, "Failed to connect to Agora channel!");
+    return -1;
+  }
+
+  // Create media node factory
+  agora::agora_refptr<agora::rtc::IMediaNodeFactory> factory = service->createMediaNodeFactory();
+  if (!factory) {
+    AG_LOG(ERROR, "Failed to create media node factory!");
+  }
+
+  // Create audio encoded frame sender
+  agora::agora_refptr<agora::rtc::IAudioEncodedFrameSender> audioFrameSender =
+      factory->createAudioEncodedFrameSender();
+  if (!audioFrameSender) {
+    AG_LOG(ERROR, "Failed to create audio encoded frame sender!");
+    return -1;
+  }
+
+  // Create audio track
+  agora::agora_refptr<agora::rtc::ILocalAudioTrack> customAudioTrack =
+      service->createCustomAudioTrack(audioFrameSender, agora::base::MIX_DISABLED);
+  if (!customAudioTrack) {
+    AG_LOG(ERROR, "Failed to create audio track!");
+    return -1;
+  }
+
+  // Create video frame sender
+  agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender =
+      factory->createVideoEncodedImageSender();
+  if (!videoFrameSender) {
+    AG_LOG(ERROR, "Failed to create video frame sender!");
+    return -1;
+  }
+
+  agora::rtc::SenderOptions option;
+  option.ccMode = agora::rtc::TCcMode::CC_ENABLED;
+  // Create video track
+  agora::agora_refptr<agora::rtc::ILocalVideoTrack> customVideoTrack =
+      service->createCustomVideoTrack(videoFrameSender, option);
+  if (!customVideoTrack) {
+    AG_LOG(ERROR, "Failed to create video track!");
+    return -1;
+  }
+  agora::rtc::VideoEncoderConfiguration encoder_config;
+  encoder_config.codecType = demuxer->getVideoCodec();
+  customVideoTrack->setVideoEncoderConfiguration(encoder_config);
+
+  // Publish the tracks found in the file
+  if (demuxer->hasAudio()) {
+    connection->getLocalUser()->publishAudio(customAudioTrack);
+  }
+  if (demuxer->hasVideo()) {
+    connection->getLocalUser()->publishVideo(customVideoTrack);
+  }
+
+  // Wait until connected before sending media stream
+  connObserver->waitUntilConnected(DEFAULT_CONNECT_TIMEOUT_MS);
+
+  // Start sending media data, audio and video share the time line of the file
+  AG_LOG(INFO, "Start sending audio & video data ...");
+  auto startTime = std::chrono::steady_clock::now();
+  std::thread sendAudioThread(SampleSendAudioTask, demuxer, audioFrameSender, startTime,
+                              std::ref(exitFlag));
+  std::thread sendVideoThread(SampleSendVideoTask, demuxer, videoFrameSender, startTime,
+                              std::ref(exitFlag));
+
+  sendAudioThread.join();
+  sendVideoThread.join();
+
+  // Unpublish audio & video track
+  connection->getLocalUser()->unpublishAudio(customAudioTrack);
+  connection->getLocalUser()->unpublishVideo(customVideoTrack);
+
+  // Unregister connection observer
+  connection->unregisterObserver(connObserver.get());
+
+  // Unregister network observer
+  connection->unregisterNetworkObserver(connObserver.get());
+
+  // Disconnect from Agora channel
+  if (connection->disconnect()) {
+    AG_LOG(ERROR, "Failed to disconnect from Agora channel!");
+    return -1;
+  }
+  AG_LOG(INFO, "Disconnected from Agora channel successfully");
+
+  // Destroy Agora connection and related resources
+  connObserver.reset();
+  localUserObserver.reset();
+  audioFrameSender = nullptr;
+  videoFrameSender = nullptr;
+  customAudioTrack = nullptr;
+  customVideoTrack = nullptr;
+  factory = nullptr;
+  connection = nullptr;
+
+  // Destroy Agora Service
+  service->release();
+  service = nullptr;
+
+  return 0;
+}
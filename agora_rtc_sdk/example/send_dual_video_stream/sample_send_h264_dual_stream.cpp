@@ -41,6 +41,7 @@ struct SampleOptions {
   struct {
     int frameRate = DEFAULT_FRAME_RATE;
     bool showBandwidthEstimation = false;
+    bool frameIndex = false;
   } video;
 };
 
@@ -81,6 +82,10 @@ static void SampleSendVideoH264Task(
   std::unique_ptr<HelperH264FileParser> h264FileParser(
       new HelperH264FileParser(filename));
   h264FileParser->initialize();
+  // both streams share the index when they send the same file
+  if (options.video.frameIndex && !h264FileParser->useFrameIndex()) {
+    AG_LOG(ERROR, "Failed to index %s, parsing it instead", filename);
+  }
 
   // Calculate send interval based on frame rate. H264 frames are sent at this
   // interval
@@ -115,6 +120,8 @@ int main(int argc, char* argv[]) {
                          "Target frame rate for sending the video stream");
   optParser.add_long_opt("bwe", &options.video.showBandwidthEstimation,
                          "show or hide bandwidth estimation info");
+  optParser.add_long_opt("frameIndex", &options.video.frameIndex,
+                         "Locate frames with a cached index of the video files");
 
   if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
     std::ostringstream strStream;
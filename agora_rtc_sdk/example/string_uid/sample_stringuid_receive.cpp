@@ -6,6 +6,7 @@
 
 #include <csignal>
 #include <cstring>
+#include <map>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -16,6 +17,7 @@
 #include "common/opt_parser.h"
 #include "common/sample_common.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_recording_writer.h"
 
 #include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
@@ -27,7 +29,7 @@
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_AUDIO_FILE "received_audio.pcm"
 #define DEFAULT_VIDEO_FILE "received_video.h264"
-#define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_FILE_LIMIT_MB (100)
 #define STREAM_TYPE_HIGH "high"
 #define STREAM_TYPE_LOW "low"
 
@@ -39,6 +41,8 @@ struct SampleOptions {
   std::string streamType = STREAM_TYPE_HIGH;
   std::string audioFile = DEFAULT_AUDIO_FILE;
   std::string videoFile = DEFAULT_VIDEO_FILE;
+  int fileLimitMB = DEFAULT_FILE_LIMIT_MB;
+  int fileSeconds = 0;
 
   struct {
     int sampleRate = DEFAULT_SAMPLE_RATE;
@@ -48,11 +52,8 @@ struct SampleOptions {
 
 class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
  public:
-  PcmFrameObserver(const std::string& outputFilePath)
-      : outputFilePath_(outputFilePath),
-        pcmFile_(nullptr),
-        fileCount(0),
-        fileSize_(0) {}
+  PcmFrameObserver(SampleRecordingWriter& writer, const std::string& outputFilePath)
+      : writer_(writer), outputFilePath_(outputFilePath) {}
 
   bool onPlaybackAudioFrame(const char* channelId,AudioFrame& audioFrame) override { return true; };
 
@@ -75,93 +76,52 @@ class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
   AudioParams getMixedAudioParams() override {return  AudioParams();};
 
  private:
+  SampleRecordingWriter& writer_;
   std::string outputFilePath_;
-  FILE* pcmFile_;
-  int fileCount;
-  int fileSize_;
+  // one file per remote user
+  std::map<std::string, std::shared_ptr<SampleRecordingStream>> pcmFiles_;
 };
 
 class H264FrameReceiver :public agora::media::IVideoEncodedFrameObserver {
  public:
-  H264FrameReceiver(const std::string& outputFilePath)
-      : outputFilePath_(outputFilePath),
-        h264File_(nullptr),
-        fileCount(0),
-        fileSize_(0) {}
+  H264FrameReceiver(SampleRecordingWriter& writer, const std::string& outputFilePath)
+      : writer_(writer), outputFilePath_(outputFilePath) {}
 
   bool onEncodedVideoFrameReceived(agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
                                    const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo)  override;
 
-
  private:
+  SampleRecordingWriter& writer_;
   std::string outputFilePath_;
-  FILE* h264File_;
-  int fileCount;
-  int fileSize_;
+  // one file per remote user
+  std::map<agora::rtc::uid_t, std::shared_ptr<SampleRecordingStream>> h264Files_;
 };
 
 bool PcmFrameObserver::onPlaybackAudioFrameBeforeMixing(const char* channelId, agora::media::base::user_id_t userId, AudioFrame& audioFrame) {
-  // Create new file to save received PCM samples
-  if (!pcmFile_) {
-    std::string fileName = (++fileCount > 1)
-                               ? (outputFilePath_ + to_string(fileCount))
-                               : outputFilePath_;
-    if (!(pcmFile_ = fopen(fileName.c_str(), "w"))) {
-      AG_LOG(ERROR, "Failed to create received audio file %s",
-             fileName.c_str());
-      return false;
-    }
-    AG_LOG(INFO, "Created file %s to save received PCM samples",
-           fileName.c_str());
+  // Create new file to save the PCM samples received from this user
+  std::string user = userId ? userId : "";
+  auto& pcmFile = pcmFiles_[user];
+  if (!pcmFile) {
+    pcmFile = writer_.openStream(SampleRecordingWriter::userFilePath(outputFilePath_, user));
   }
 
-  // Write PCM samples
+  // Queue PCM samples, the file is written by the writer thread
   size_t writeBytes =
       audioFrame.samplesPerChannel * audioFrame.channels * sizeof(int16_t);
-  if (fwrite(audioFrame.buffer, 1, writeBytes, pcmFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded audio data: %s", std::strerror(errno));
-    return false;
-  }
-  fileSize_ += writeBytes;
-
-  // Close the file if size limit is reached
-  if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(pcmFile_);
-    pcmFile_ = nullptr;
-    fileSize_ = 0;
-  }
-  return true;
+  return pcmFile->write(audioFrame.buffer, writeBytes);
 }
 
 bool H264FrameReceiver::onEncodedVideoFrameReceived(agora::rtc::uid_t uid, const uint8_t* imageBuffer, size_t length,
                                    const agora::rtc::EncodedVideoFrameInfo& videoEncodedFrameInfo) {
-  // Create new file to save received H264 frames
-  if (!h264File_) {
-    std::string fileName = (++fileCount > 1)
-                               ? (outputFilePath_ + to_string(fileCount))
-                               : outputFilePath_;
-    if (!(h264File_ = fopen(fileName.c_str(), "w+"))) {
-      AG_LOG(ERROR, "Failed to create received video file %s",
-             fileName.c_str());
-      return false;
-    }
-    AG_LOG(INFO, "Created file %s to save received H264 frames",
-           fileName.c_str());
+  // Create new file to save the H264 frames received from this user
+  auto& h264File = h264Files_[uid];
+  if (!h264File) {
+    h264File = writer_.openStream(SampleRecordingWriter::userFilePath(outputFilePath_, std::to_string(uid)));
   }
 
-  if (fwrite(imageBuffer, 1, length, h264File_) != length) {
-    AG_LOG(ERROR, "Error writing h264 data: %s", std::strerror(errno));
-    return false;
-  }
-  fileSize_ += length;
-
-  // Close the file if size limit is reached
-  if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(h264File_);
-    h264File_ = nullptr;
-    fileSize_ = 0;
-  }
-  return true;
+  // A new file starts with a key frame so that it can be decoded on its own
+  return h264File->write(imageBuffer, length,
+                         videoEncodedFrameInfo.frameType == agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME);
 }
 
 static bool exitFlag = false;
@@ -179,6 +139,10 @@ int main(int argc, char* argv[]) {
                          "The remote user to receive stream from");
   optParser.add_long_opt("audioFile", &options.audioFile, "Output audio file");
   optParser.add_long_opt("videoFile", &options.videoFile, "Output video file");
+  optParser.add_long_opt("fileLimit", &options.fileLimitMB,
+                         "Start a new output file after this many MB / default is 100");
+  optParser.add_long_opt("fileSeconds", &options.fileSeconds,
+                         "Start a new output file after this many seconds / default is 0 (never)");
   optParser.add_long_opt("sampleRate", &options.audio.sampleRate,
                          "Sample rate for received audio");
   optParser.add_long_opt("numOfChannels", &options.audio.numOfChannels,
@@ -259,13 +223,20 @@ int main(int argc, char* argv[]) {
     return -1;
   }
 
+  // Start the writer thread saving the received data, one file per user
+  SampleRecordingWriter::Options writerOptions;
+  writerOptions.rotateBytes = static_cast<uint64_t>(options.fileLimitMB) * 1024 * 1024;
+  writerOptions.rotateSeconds = options.fileSeconds;
+  SampleRecordingWriter recordingWriter(writerOptions);
+  recordingWriter.start();
+
   // Create local user observer
   auto localUserObserver =
       std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
   localUserObserver->setUseStringUid(true);
   localUserObserver->setSubscribeUserString(options.remoteUserId.c_str());
   // Register audio frame observer to receive audio stream
-  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(options.audioFile);
+  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(recordingWriter, options.audioFile);
   if (connection->getLocalUser()->setPlaybackAudioFrameBeforeMixingParameters(
           options.audio.numOfChannels, options.audio.sampleRate)) {
     AG_LOG(ERROR, "Failed to set audio frame parameters!");
@@ -275,7 +246,7 @@ int main(int argc, char* argv[]) {
 
   // Register h264 frame receiver to receive video stream
   auto h264FrameReceiver =
-      std::make_shared<H264FrameReceiver>(options.videoFile);
+      std::make_shared<H264FrameReceiver>(recordingWriter, options.videoFile);
   localUserObserver->setVideoEncodedImageReceiver(h264FrameReceiver.get());
 
   // Start receiving incoming media data
@@ -297,6 +268,9 @@ int main(int argc, char* argv[]) {
   }
   AG_LOG(INFO, "Disconnected from Agora channel successfully");
 
+  // Write what is still buffered and close the files
+  recordingWriter.stop();
+
   // Destroy Agora connection and related resources
   localUserObserver.reset();
   pcmFrameObserver.reset();
@@ -4,20 +4,25 @@
 //  Copyright (c) 2020 Agora.io. All rights reserved.
 //
 
+#include <chrono>
 #include <csignal>
 #include <cstring>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "AgoraRefCountedObject.h"
 #include "IAgoraService.h"
 #include "NGIAgoraRtcConnection.h"
 #include "common/log.h"
 #include "common/opt_parser.h"
+#include "common/sample_i420_compositor.h"
 #include "common/sample_common.h"
 #include "common/sample_connection_observer.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_recording_writer.h"
 
 #include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
@@ -26,9 +31,19 @@
 #include "NGIAgoraVideoTrack.h"
 
 #define DEFAULT_VIDEO_FILE "received_video.yuv"
+#define DEFAULT_ENCODED_VIDEO_FILE "received_video.h264"
 #define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_BUFFER_MB (32)
+#define MIXED_FORMAT_YUV "yuv"
+#define MIXED_FORMAT_H264 "h264"
+#define MIXED_FORMAT_NONE "none"
 #define STREAM_TYPE_HIGH "high"
 #define STREAM_TYPE_LOW "low"
+#define MIXER_WIDTH (1920)
+#define MIXER_HEIGHT (1080)
+#define DEFAULT_FRAME_RATE (15)
+#define COMPOSITOR_SDK "sdk"
+#define COMPOSITOR_SOFTWARE "software"
 
 struct SampleOptions {
 	std::string appId;
@@ -36,13 +51,40 @@ struct SampleOptions {
 	std::string userId;
 	std::string remoteUserId;
 	std::string streamType = STREAM_TYPE_HIGH;
-	std::string videoFile = DEFAULT_VIDEO_FILE;
+	std::string videoFile;
+	std::string mixedFormat = MIXED_FORMAT_YUV;
+	int bufferMB = DEFAULT_BUFFER_MB;
+	std::string compositor = COMPOSITOR_SDK;
+	int frameRate = DEFAULT_FRAME_RATE;
+	int timingInterval = 0;
 };
 
+// Gives the decoded frames of every remote user to the software compositor
+class CompositorFrameObserver : public agora::rtc::IVideoFrameObserver2 {
+public:
+	CompositorFrameObserver(SampleI420Compositor &compositor) : compositor_(compositor) {}
+
+	void onFrame(const char *channelId, agora::user_id_t remoteUid,
+				 const agora::media::base::VideoFrame *frame) override
+	{
+		if (remoteUid && frame) {
+			compositor_.onFrame(remoteUid, *frame);
+		}
+	}
+
+	virtual ~CompositorFrameObserver() = default;
+
+private:
+	SampleI420Compositor &compositor_;
+};
+
+// Records the mixed video before it is encoded. The frames are only copied
+// here, the recording writer saves them from a thread of its own and drops
+// them when the disk cannot keep up.
 class YuvFrameObserver : public agora::rtc::IVideoSinkBase {
 public:
-	YuvFrameObserver(const std::string &outputFilePath)
-			: outputFilePath_(outputFilePath), yuvFile_(nullptr), fileCount(0), fileSize_(0)
+	YuvFrameObserver(SampleRecordingWriter &writer, const std::string &outputFilePath)
+			: file_(writer.openStream(outputFilePath))
 	{
 	}
 
@@ -51,57 +93,51 @@ public:
 	virtual ~YuvFrameObserver() = default;
 
 private:
-	std::string outputFilePath_;
-	FILE *yuvFile_;
-	int fileCount;
-	int fileSize_;
+	std::shared_ptr<SampleRecordingStream> file_;
+	std::vector<uint8_t> frame_;
 };
 
 int YuvFrameObserver::onFrame(const agora::media::base::VideoFrame &videoFrame)
 {
-	// Create new file to save received YUV frames
-	// printf("it is %d %d\n",videoFrame.height,videoFrame.width);
-	if (!yuvFile_) {
-		std::string fileName =
-				(++fileCount > 1) ? (outputFilePath_ + to_string(fileCount)) : outputFilePath_;
-		if (!(yuvFile_ = fopen(fileName.c_str(), "w+"))) {
-			AG_LOG(ERROR, "Failed to create received video file %s", fileName.c_str());
-			return 0;
-		}
-		AG_LOG(INFO, "Created file %s to save received YUV frames", fileName.c_str());
+	// Pack the planes without their padding, a frame is written whole or dropped
+	int chromaWidth = (videoFrame.width + 1) / 2;
+	int chromaHeight = (videoFrame.height + 1) / 2;
+	frame_.resize(videoFrame.width * videoFrame.height + 2 * chromaWidth * chromaHeight);
+	uint8_t *dst = frame_.data();
+	for (int j = 0; j < videoFrame.height; j++, dst += videoFrame.width) {
+		memcpy(dst, videoFrame.yBuffer + j * videoFrame.yStride, videoFrame.width);
 	}
-
-	// Write Y planar
-	size_t writeBytes = videoFrame.yStride * videoFrame.height;
-	if (fwrite(videoFrame.yBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-		AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-		return 0;
+	for (int j = 0; j < chromaHeight; j++, dst += chromaWidth) {
+		memcpy(dst, videoFrame.uBuffer + j * videoFrame.uStride, chromaWidth);
 	}
-	fileSize_ += writeBytes;
-
-	// Write U planar
-	writeBytes = videoFrame.uStride * videoFrame.height / 2;
-	if (fwrite(videoFrame.uBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-		AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-		return 0;
+	for (int j = 0; j < chromaHeight; j++, dst += chromaWidth) {
+		memcpy(dst, videoFrame.vBuffer + j * videoFrame.vStride, chromaWidth);
 	}
-	fileSize_ += writeBytes;
+	file_->write(frame_.data(), frame_.size());
+	return 0;
+}
 
-	// Write V planar
-	writeBytes = videoFrame.vStride * videoFrame.height / 2;
-	if (fwrite(videoFrame.vBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-		AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-		return 0;
+// Records the mixed video as it is encoded for publishing, a fraction of the
+// size of the raw frames
+class H264FrameObserver : public agora::media::IVideoEncodedFrameObserver {
+public:
+	H264FrameObserver(SampleRecordingWriter &writer, const std::string &outputFilePath)
+			: file_(writer.openStream(outputFilePath))
+	{
 	}
-	fileSize_ += writeBytes;
 
-	// Close the file if size limit is reached
-	if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-		fclose(yuvFile_);
-		yuvFile_ = nullptr;
-		fileSize_ = 0;
+	bool onEncodedVideoFrameReceived(
+			agora::rtc::uid_t uid, const uint8_t *imageBuffer, size_t length,
+			const agora::rtc::EncodedVideoFrameInfo &videoEncodedFrameInfo) override
+	{
+		// A new file starts with a key frame so that it can be decoded on its own
+		file_->write(imageBuffer, length,
+					 videoEncodedFrameInfo.frameType == agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME);
+		return true;
 	}
-	return 0;
+
+private:
+	std::shared_ptr<SampleRecordingStream> file_;
 };
 
 static bool exitFlag = false;
@@ -110,6 +146,22 @@ static void SignalHandler(int sigNo)
 	exitFlag = true;
 }
 
+// Composes and sends the canvas at the frame rate of the encoder
+static void SampleComposeTask(SampleI420Compositor &compositor,
+							  agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender,
+							  int frameRate)
+{
+	auto interval = std::chrono::microseconds(1000000 / frameRate);
+	auto next = std::chrono::steady_clock::now();
+	while (!exitFlag) {
+		if (compositor.send(videoFrameSender.get()) < 0) {
+			AG_LOG(ERROR, "Failed to send video frame!");
+		}
+		next += interval;
+		std::this_thread::sleep_until(next);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	SampleOptions options;
@@ -120,8 +172,19 @@ int main(int argc, char *argv[])
 	optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
 	optParser.add_long_opt("remoteUserId", &options.remoteUserId,
 						   "The remote user to receive stream from");
-	optParser.add_long_opt("videoFile", &options.videoFile, "Output video file");
+	optParser.add_long_opt("videoFile", &options.videoFile,
+						   "Output video file / default is " DEFAULT_VIDEO_FILE " or " DEFAULT_ENCODED_VIDEO_FILE);
+	optParser.add_long_opt("mixedFormat", &options.mixedFormat,
+						   "Record the mixed video raw, as encoded or not at all: yuv/h264/none");
+	optParser.add_long_opt("bufferMB", &options.bufferMB,
+						   "Recorded video waiting for the disk before frames are dropped");
 	optParser.add_long_opt("streamtype", &options.streamType, "the stream type");
+	optParser.add_long_opt("compositor", &options.compositor,
+						   "Compose with the mixer of the SDK or in software: sdk/software");
+	optParser.add_long_opt("frameRate", &options.frameRate, "Frame rate of the mixed video");
+	optParser.add_long_opt("timingInterval", &options.timingInterval,
+						   "Seconds between compositing timing reports of the software "
+						   "compositor / default 0 is off");
 
 	if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
 		std::ostringstream strStream;
@@ -140,6 +203,26 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	if (options.compositor != COMPOSITOR_SDK && options.compositor != COMPOSITOR_SOFTWARE) {
+		AG_LOG(ERROR, "Unknown compositor %s", options.compositor.c_str());
+		return -1;
+	}
+
+	if (options.frameRate <= 0) {
+		AG_LOG(ERROR, "Invalid frame rate %d", options.frameRate);
+		return -1;
+	}
+
+	if (options.mixedFormat != MIXED_FORMAT_YUV && options.mixedFormat != MIXED_FORMAT_H264 &&
+		options.mixedFormat != MIXED_FORMAT_NONE) {
+		AG_LOG(ERROR, "Unknown mixed video format %s", options.mixedFormat.c_str());
+		return -1;
+	}
+	if (options.videoFile.empty()) {
+		options.videoFile = options.mixedFormat == MIXED_FORMAT_H264 ? DEFAULT_ENCODED_VIDEO_FILE
+																	 : DEFAULT_VIDEO_FILE;
+	}
+
 	std::signal(SIGQUIT, SignalHandler);
 	std::signal(SIGABRT, SignalHandler);
 	std::signal(SIGINT, SignalHandler);
@@ -195,37 +278,76 @@ int main(int argc, char *argv[])
 		AG_LOG(ERROR, "Failed to create media node factory!");
 	}
 
-	agora::agora_refptr<agora::rtc::IVideoMixerSource> videoMixer = factory->createVideoMixer();
-	if (!videoMixer) {
-		AG_LOG(ERROR, "Failed to create video frame sender!");
-		return -1;
+	agora::agora_refptr<agora::rtc::IVideoMixerSource> videoMixer;
+	agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender;
+	agora::agora_refptr<agora::rtc::ILocalVideoTrack> mixVideoTrack;
+	std::unique_ptr<SampleI420Compositor> compositor;
+	std::shared_ptr<CompositorFrameObserver> compositorObserver;
+	if (options.compositor == COMPOSITOR_SOFTWARE) {
+		// Compose the decoded frames here and send the canvas on a custom track
+		videoFrameSender = factory->createVideoFrameSender();
+		if (!videoFrameSender) {
+			AG_LOG(ERROR, "Failed to create video frame sender!");
+			return -1;
+		}
+		mixVideoTrack = service->createCustomVideoTrack(videoFrameSender);
+		compositor.reset(new SampleI420Compositor(MIXER_WIDTH, MIXER_HEIGHT));
+		compositorObserver = std::make_shared<CompositorFrameObserver>(*compositor);
+		localUserObserver->setVideoFrameObserver(compositorObserver.get());
+		AG_LOG(INFO, "Software compositor scales with %s", SampleI420Compositor::simdName());
+	} else {
+		videoMixer = factory->createVideoMixer();
+		if (!videoMixer) {
+			AG_LOG(ERROR, "Failed to create video mixer!");
+			return -1;
+		}
+		videoMixer->setBackground(MIXER_WIDTH, MIXER_HEIGHT, options.frameRate);
+		mixVideoTrack = service->createMixedVideoTrack(videoMixer);
 	}
-	videoMixer->setBackground(1920, 1080, 15);
-
-	agora::agora_refptr<agora::rtc::ILocalVideoTrack> mixVideoTrack =
-			service->createMixedVideoTrack(videoMixer);
 	if (!mixVideoTrack) {
 		AG_LOG(ERROR, "Failed to create video track!");
 		return -1;
 	}
 	agora::rtc::VideoEncoderConfiguration encoderConfig;
 	encoderConfig.codecType = agora::rtc::VIDEO_CODEC_H264;
-	encoderConfig.dimensions.width = 1920;
-	encoderConfig.dimensions.height = 1080;
-	encoderConfig.frameRate = 15;
+	encoderConfig.dimensions.width = MIXER_WIDTH;
+	encoderConfig.dimensions.height = MIXER_HEIGHT;
+	encoderConfig.frameRate = options.frameRate;
 	//encoderConfig.bitrate = options.video.targetBitrate + 1000;
 
 	mixVideoTrack->setVideoEncoderConfiguration(encoderConfig);
 
-	// // Register video frame observer to receive video stream
-	agora::agora_refptr<agora::rtc::IVideoSinkBase> yuvFrameObserver =
-			new agora::RefCountedObject<YuvFrameObserver>(options.videoFile);
-
-	mixVideoTrack->addRenderer(yuvFrameObserver.get(),agora::media::base::VIDEO_MODULE_POSITION::POSITION_PRE_ENCODER);
-	//printf("it is %d \n",b);
+	// Record the mixed video from the thread of the writer
+	SampleRecordingWriter::Options writerOptions;
+	writerOptions.rotateBytes = DEFAULT_FILE_LIMIT;
+	writerOptions.maxBufferedBytes = static_cast<size_t>(options.bufferMB) * 1024 * 1024;
+	if (options.mixedFormat == MIXED_FORMAT_YUV) {
+		// a chunk per raw frame, reused from one frame to the next
+		writerOptions.chunkBytes = MIXER_WIDTH * MIXER_HEIGHT * 3 / 2;
+	}
+	SampleRecordingWriter recordingWriter(writerOptions);
+
+	agora::agora_refptr<agora::rtc::IVideoSinkBase> yuvFrameObserver;
+	std::unique_ptr<H264FrameObserver> h264FrameObserver;
+	if (options.mixedFormat == MIXED_FORMAT_YUV) {
+		recordingWriter.start();
+		yuvFrameObserver =
+				new agora::RefCountedObject<YuvFrameObserver>(recordingWriter, options.videoFile);
+		mixVideoTrack->addRenderer(yuvFrameObserver.get(),
+								   agora::media::base::VIDEO_MODULE_POSITION::POSITION_PRE_ENCODER);
+	} else if (options.mixedFormat == MIXED_FORMAT_H264) {
+		recordingWriter.start();
+		h264FrameObserver.reset(new H264FrameObserver(recordingWriter, options.videoFile));
+		if (mixVideoTrack->registerVideoEncodedFrameObserver(h264FrameObserver.get())) {
+			AG_LOG(ERROR, "Failed to register the encoded video observer of the mixed track!");
+			return -1;
+		}
+	}
 	mixVideoTrack->setEnabled(true);
-	localUserObserver->setEnableVideoMix(true);
-	localUserObserver->setVideoMixer(videoMixer);
+	if (videoMixer) {
+		localUserObserver->setEnableVideoMix(true);
+		localUserObserver->setVideoMixer(videoMixer, MIXER_WIDTH, MIXER_HEIGHT);
+	}
   // add a Image to video mixer
 	// {
 	// 	agora::rtc::MixerLayoutConfig mixConfig;
@@ -248,10 +370,39 @@ int main(int argc, char *argv[])
 	// Start receiving incoming media data
 	AG_LOG(INFO, "Start receiving audio & video data ...");
 
-	// Periodically check exit flag
+	std::thread composeThread;
+	if (compositor) {
+		composeThread = std::thread(SampleComposeTask, std::ref(*compositor), videoFrameSender,
+									options.frameRate);
+	}
+
+	// Periodically check exit flag and report the compositing timings
+	auto lastReport = std::chrono::steady_clock::now();
 	while (!exitFlag) {
 		usleep(10000);
+		if (compositor && options.timingInterval > 0 &&
+			std::chrono::steady_clock::now() - lastReport >=
+					std::chrono::seconds(options.timingInterval)) {
+			lastReport = std::chrono::steady_clock::now();
+			compositor->report();
+		}
+	}
+
+	if (composeThread.joinable()) {
+		composeThread.join();
+	}
+	localUserObserver->unsetVideoFrameObserver();
+
+	// Stop recording the mixed video
+	if (yuvFrameObserver) {
+		mixVideoTrack->removeRenderer(yuvFrameObserver.get(),
+									  agora::media::base::VIDEO_MODULE_POSITION::POSITION_PRE_ENCODER);
+	}
+	if (h264FrameObserver) {
+		mixVideoTrack->unregisterVideoEncodedFrameObserver(h264FrameObserver.get());
 	}
+	// logs the bytes it had to drop
+	recordingWriter.stop();
 
 	// Unregister connection observer
 	connection->unregisterObserver(connObserver.get());
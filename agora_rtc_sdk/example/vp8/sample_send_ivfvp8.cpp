@@ -4,13 +4,6 @@
 //  Copyright (c) 2020 Agora.io. All rights reserved.
 //
 
-#include <fcntl.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <unistd.h>
-
 #include <csignal>
 #include <cstring>
 #include <iostream>
@@ -20,6 +13,7 @@
 
 #include "IAgoraService.h"
 #include "NGIAgoraRtcConnection.h"
+#include "common/file_parser/helper_ivf_parser.h"
 #include "common/helper.h"
 #include "common/log.h"
 #include "common/opt_parser.h"
@@ -37,50 +31,11 @@
 #define DEFAULT_SAMPLE_RATE (16000)
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_FRAME_RATE (30)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 #define DEFAULT_VIDEO_FILE "test_data/test.vp8.ivf"
 
 
-struct IVF_PAYLOAD {
-  uint32_t size;
-  char timestamp[8];
- // uint32_t frame_type;
-  //uint64_t timestamp;
-};
-
-struct IVF_HEADER {
-  uint32_t signature;
-  uint16_t version;
-  uint16_t head_len;
-  uint32_t codec;
-  uint16_t width;
-  uint16_t height;
-  uint32_t time_scale;
-  uint32_t frame_rate;
-  uint32_t frames;
-  uint32_t unused;
-};
-
-char* frame;
-IVF_HEADER* ivf_header_;
-int fd;
-struct stat sb;
-void* mapped;
-int offsetsize = 0;
-
-void reset() {
-  frame = (char*)mapped;
-  ivf_header_ = (IVF_HEADER*)frame;
-  frame += sizeof(IVF_HEADER);
-  offsetsize = sizeof(IVF_HEADER);
-  AG_LOG(INFO, "Reset the videoFile !");
-}
-
-bool IsKeyFrame(const uint8_t * buf ){
-int tmp = (buf[2] << 16) | (buf[1]<< 8) |buf[0];
-int key_frame = tmp & 0x1;
-return !key_frame;
-}
-
 struct SampleOptions {
   std::string appId;
   std::string channelId;
@@ -92,35 +47,25 @@ struct SampleOptions {
   } video;
 };
 
-static void sendOneFrame(agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender) {
-  IVF_PAYLOAD* payload = (IVF_PAYLOAD*)frame;
-  const uint8_t* buf = (uint8_t*)frame;
-  agora::rtc::VIDEO_FRAME_TYPE frame_type;
-  if (IsKeyFrame(buf+ sizeof(IVF_PAYLOAD))) {
-    frame_type = agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME;
-  } else {
-    frame_type = agora::rtc::VIDEO_FRAME_TYPE_DELTA_FRAME;
-  } 
+static void sendOneFrame(
+    const HelperIvfMediaSource* ivfSource, const HelperMediaFrame& frame,
+    agora::agora_refptr<agora::rtc::IVideoEncodedImageSender> videoFrameSender) {
 
   agora::rtc::EncodedVideoFrameInfo videoEncodedFrameInfo;
   videoEncodedFrameInfo.rotation = agora::rtc::VIDEO_ORIENTATION_0;
-  videoEncodedFrameInfo.codecType = agora::rtc::VIDEO_CODEC_VP8;
-  videoEncodedFrameInfo.frameType = frame_type;
-  videoEncodedFrameInfo.width = ivf_header_->width;
-  videoEncodedFrameInfo.height = ivf_header_->height;
-  
-  videoFrameSender->sendEncodedVideoImage(
-      buf + sizeof(IVF_PAYLOAD), payload->size, videoEncodedFrameInfo);
-
-  frame += (payload->size + sizeof(IVF_PAYLOAD));
-  offsetsize += payload->size + sizeof(IVF_PAYLOAD);
-  if (offsetsize >= sb.st_size) {
-    reset();
-  }
+  videoEncodedFrameInfo.codecType = ivfSource->getCodecType();
+  videoEncodedFrameInfo.frameType = frame.isKeyFrame ? agora::rtc::VIDEO_FRAME_TYPE_KEY_FRAME
+                                                     : agora::rtc::VIDEO_FRAME_TYPE_DELTA_FRAME;
+  videoEncodedFrameInfo.width = ivfSource->getWidth();
+  videoEncodedFrameInfo.height = ivfSource->getHeight();
+
+  videoFrameSender->sendEncodedVideoImage(frame.data, frame.length,
+                                          videoEncodedFrameInfo);
 }
 
 static void SampleSendVideoTask(
-    const SampleOptions& options,
+    const SampleOptions& options, const HelperIvfMediaSource* ivfSource,
+    std::shared_ptr<HelperPrefetchSource> prefetchSource,
     agora::agora_refptr<agora::rtc::IVideoEncodedImageSender>
         videoFrameSender,
     bool& exitFlag) {
@@ -129,7 +74,13 @@ static void SampleSendVideoTask(
                      std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-      sendOneFrame(videoFrameSender);
+      // a late frame keeps its slot, it is sent as soon as it is read
+      const HelperMediaFrame* frame = prefetchSource->next(DEFAULT_LATE_FRAME_WAIT_MS);
+      if (!frame) {
+        continue;
+      }
+      sendOneFrame(ivfSource, *frame, videoFrameSender);
+      prefetchSource->release();
       waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
     }
   };
@@ -147,7 +98,7 @@ int main(int argc, char* argv[]) {
   optParser.add_long_opt("channelId", &options.channelId, "Channel Id / must");
   optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
   optParser.add_long_opt("videoFile", &options.videoFile,
-                         "The video file in YUV420 format to be sent");
+                         "The IVF file (VP8, VP9 or AV1) to be sent");
   optParser.add_long_opt("fps", &options.video.frameRate,
                          "Target frame rate for sending the video stream");
   optParser.add_long_opt("bwe", &options.video.showBandwidthEstimation,
@@ -174,25 +125,16 @@ int main(int argc, char* argv[]) {
   std::signal(SIGABRT, SignalHandler);
   std::signal(SIGINT, SignalHandler);
 
-  //if ((fd = open("test_data/test.vp8.ivf", O_RDONLY)) < 0) {
-  if ((fd = open(options.videoFile.c_str(), O_RDONLY)) < 0) {
-
-    return -1;
-  }
-
-  // get the file property
-  if ((fstat(fd, &sb)) == -1) {
+  // VP8, VP9 or AV1, from the fourcc of the file. Frames are read ahead on
+  // another thread.
+  HelperIvfMediaSource* ivfSource = new HelperIvfMediaSource(options.videoFile.c_str());
+  auto prefetchSource = std::make_shared<HelperPrefetchSource>(
+      std::unique_ptr<HelperMediaSource>(ivfSource), DEFAULT_PREFETCH_FRAMES);
+  if (!prefetchSource->start()) {
+    AG_LOG(ERROR, "Failed to open video file %s", options.videoFile.c_str());
     return -1;
   }
 
-  // map the file to process address space
-  if ((mapped = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
-      (void*)-1) {
-    close(fd);
-    return -1;
-  }
-  reset();
-  
   // Create Agora service
   auto service = createAndInitAgoraService(false, true, true);
   if (!service) {
@@ -255,7 +197,7 @@ int main(int argc, char* argv[]) {
     return -1;
   }
   agora::rtc::VideoEncoderConfiguration encoder_config;
-  encoder_config.codecType = agora::rtc::VIDEO_CODEC_VP8;
+  encoder_config.codecType = ivfSource->getCodecType();
   customVideoTrack->setVideoEncoderConfiguration(encoder_config);
 
   // Publish video track
@@ -266,7 +208,7 @@ int main(int argc, char* argv[]) {
 
   // Start sending media data
   AG_LOG(INFO, "Start sending video data ...");
-  std::thread sendVideoThread(SampleSendVideoTask, options,
+  std::thread sendVideoThread(SampleSendVideoTask, options, ivfSource, prefetchSource,
                               videoFrameSender, std::ref(exitFlag));
 
   sendVideoThread.join();
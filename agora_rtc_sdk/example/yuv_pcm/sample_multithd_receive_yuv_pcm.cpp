@@ -17,22 +17,30 @@
 #include "NGIAgoraRtcConnection.h"
 #include "common/log.h"
 #include "common/opt_parser.h"
+#include "common/sample_active_speaker.h"
 #include "common/sample_common.h"
 #include "common/sample_connection_observer.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_snapshot_encoder.h"
 
 #include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
 #include "NGIAgoraMediaNodeFactory.h"
 #include "NGIAgoraMediaNode.h"
 #include "NGIAgoraVideoTrack.h"
-#include "jpeglib.h"
 
 #define DEFAULT_SAMPLE_RATE (16000)
 #define DEFAULT_NUM_OF_CHANNELS (1)
 #define DEFAULT_AUDIO_FILE "received_audio.pcm"
 #define DEFAULT_VIDEO_FILE "video/received_video"
 #define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_SNAPSHOT_ENCODER "libjpeg"
+#define DEFAULT_SNAPSHOT_QUALITY (40)
+#define SNAPSHOT_MODE_FIRST "first"
+#define SNAPSHOT_MODE_SPEAKER "speaker"
+#define DEFAULT_SPEAKER_COOLDOWN (5)
+#define DEFAULT_SPEAKER_VOLUME (30)
+#define DEFAULT_VOLUME_INTERVAL_MS (200)
 #define STREAM_TYPE_HIGH "high"
 #define STREAM_TYPE_LOW "low"
 
@@ -53,6 +61,12 @@ struct SampleOptions
   std::string audioFile = DEFAULT_AUDIO_FILE;
   std::string videoFile = DEFAULT_VIDEO_FILE;
   int multiChannels = 1;
+  std::string snapshotEncoder = DEFAULT_SNAPSHOT_ENCODER;
+  int snapshotQuality = DEFAULT_SNAPSHOT_QUALITY;
+  std::string snapshotMode = SNAPSHOT_MODE_FIRST;
+  int speakerCooldown = DEFAULT_SPEAKER_COOLDOWN;
+  int speakerVolume = DEFAULT_SPEAKER_VOLUME;
+  int volumeInterval = DEFAULT_VOLUME_INTERVAL_MS;
 
   struct
   {
@@ -106,13 +120,18 @@ private:
 class YuvFrameObserver : public agora::rtc::IVideoFrameObserver2
 {
 public:
-  YuvFrameObserver(const std::string &outputFilePath, bool *video_frame_saved_flag)
+  // |activeSpeaker|: capture the frames of the speaker it selects instead of
+  // the first frame
+  YuvFrameObserver(const std::string &outputFilePath, bool *video_frame_saved_flag,
+                   SampleActiveSpeaker *activeSpeaker)
       : outputFilePath_(outputFilePath),
         yuvFile_(nullptr),
         jpgFile_(nullptr),
         fileCount(0),
         fileSize_(0),
-        video_frame_saved_flag_(video_frame_saved_flag) {}
+        video_frame_saved_flag_(video_frame_saved_flag),
+        activeSpeaker_(activeSpeaker),
+        snapshotEncoder_(createSnapshotEncoder(options.snapshotEncoder)) {}
 
   void onFrame(const char *channelId, agora::user_id_t remoteUid, const agora::media::base::VideoFrame *frame) override;
 
@@ -125,6 +144,9 @@ private:
   int fileCount;
   int fileSize_;
   bool *video_frame_saved_flag_;
+  SampleActiveSpeaker *activeSpeaker_;
+  std::unique_ptr<SampleSnapshotEncoder> snapshotEncoder_;
+  std::vector<uint8_t> jpegData_;
 };
 
 static int connectWorker(agora::base::IAgoraService *service, int channel_index, bool &exitFlag)
@@ -135,6 +157,7 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
   agora::agora_refptr<agora::rtc::IRtcConnection> connection;
   bool save_file_flag;
   saveVideoControl.video_frame_saved_flag = &save_file_flag;
+  bool speakerMode = options.snapshotMode == SNAPSHOT_MODE_SPEAKER;
 
   // AG_LOG(INFO, "!!!!!channel index: %d", channel_index);
   while (!exitFlag)
@@ -177,9 +200,25 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
     auto connObserver = std::make_shared<SampleConnectionObserver>();
     connection->registerObserver(connObserver.get());
 
+    // Follow the speaker of the channel from the audio volume indications
+    std::unique_ptr<SampleActiveSpeaker> activeSpeaker;
+    if (speakerMode)
+    {
+      activeSpeaker.reset(new SampleActiveSpeaker(options.speakerVolume,
+                                                  options.speakerCooldown * 1000,
+                                                  options.volumeInterval * 3));
+      if (connection->getLocalUser()->setAudioVolumeIndicationParameters(options.volumeInterval,
+                                                                         3, false))
+      {
+        AG_LOG(ERROR, "Failed to enable audio volume indication!");
+        return -1;
+      }
+    }
+
     // Create local user observer
     auto localUserObserver =
         std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
+    localUserObserver->setActiveSpeaker(activeSpeaker.get());
 #if 0
     // Register audio frame observer to receive audio stream
     auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(options.audioFile);
@@ -196,7 +235,8 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
     // Register video frame observer to receive video stream
     std::shared_ptr<YuvFrameObserver> yuvFrameObserver =
         // std::make_shared<YuvFrameObserver>(options.videoFile);
-        std::make_shared<YuvFrameObserver>(options.videoFile, saveVideoControl.video_frame_saved_flag);
+        std::make_shared<YuvFrameObserver>(options.videoFile, saveVideoControl.video_frame_saved_flag,
+                                           activeSpeaker.get());
     localUserObserver->setVideoFrameObserver(yuvFrameObserver.get());
 
     // Connect to Agora channel
@@ -210,8 +250,11 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
     // reset timer and flag
     current_conn_time = time(0);
 
-    // Periodically check if in the channel for 2s
-    while ((!*saveVideoControl.video_frame_saved_flag || (time(0) - current_conn_time <= time_2_s)) && (!exitFlag))
+    // Periodically check if in the channel for 2s, the speakers are followed
+    // until the end
+    while ((speakerMode || !*saveVideoControl.video_frame_saved_flag ||
+            (time(0) - current_conn_time <= time_2_s)) &&
+           (!exitFlag))
     {
       usleep(500000);
     }
@@ -288,8 +331,16 @@ bool PcmFrameObserver::onPlaybackAudioFrameBeforeMixing(const char *channelId, a
 
 void YuvFrameObserver::onFrame(const char *channelId, agora::user_id_t remoteUid, const agora::media::base::VideoFrame *videoFrame)
 {
+  // only the speaker's frames, when the cooldown of the channel allows
+  if (activeSpeaker_)
+  {
+    if (!activeSpeaker_->shouldCapture(remoteUid))
+    {
+      return;
+    }
+  }
   // check to see if frame is already saved
-  if (*video_frame_saved_flag_)
+  else if (*video_frame_saved_flag_)
   {
     AG_LOG(INFO, "jpeg already saved, channe index %s", channelId);
     return;
@@ -358,13 +409,28 @@ void YuvFrameObserver::onFrame(const char *channelId, agora::user_id_t remoteUid
   //AG_LOG(INFO, "ffmpeg conver YUV to jpeg, command: %s", command.c_str());
 
 #else
-  struct jpeg_compress_struct cinfo;
-  struct jpeg_error_mgr jerr;
+  SampleSnapshotPicture picture = {videoFrame->yBuffer, videoFrame->uBuffer, videoFrame->vBuffer,
+                                   videoFrame->yStride, videoFrame->uStride, videoFrame->vStride,
+                                   videoFrame->width, videoFrame->height};
+  if (!snapshotEncoder_->encode(picture, options.snapshotQuality, jpegData_))
+  {
+    AG_LOG(ERROR, "Failed to encode %dx%d frame with %s", videoFrame->width,
+           videoFrame->height, snapshotEncoder_->name());
+    return;
+  }
   if (!jpgFile_)
   {
-    fileName = (++fileCount > 1)
-                   ? (outputFilePath_ + "_" + channelId + "_" + to_string(fileCount))
-                   : outputFilePath_ + "_" + channelId + "_" + to_string(time(0));
+    if (activeSpeaker_)
+    {
+      fileName = outputFilePath_ + "_" + channelId + "_" + remoteUid + "_" + to_string(time(0)) +
+                 "_" + to_string(++fileCount);
+    }
+    else
+    {
+      fileName = (++fileCount > 1)
+                     ? (outputFilePath_ + "_" + channelId + "_" + to_string(fileCount))
+                     : outputFilePath_ + "_" + channelId + "_" + to_string(time(0));
+    }
     fileNameJpg = fileName + ".jpg";
     if (!(jpgFile_ = fopen(fileNameJpg.c_str(), "wb")))
     {
@@ -375,66 +441,12 @@ void YuvFrameObserver::onFrame(const char *channelId, agora::user_id_t remoteUid
     AG_LOG(INFO, "Created file %s to save received JPEG frames",
            fileNameJpg.c_str());
   }
-  int width = videoFrame->yStride;
-  unsigned char *yuvbuf = NULL;
-  if ((yuvbuf = (unsigned char *)malloc(width * 3)) == NULL)
+  if (fwrite(jpegData_.data(), 1, jpegData_.size(), jpgFile_) != jpegData_.size())
   {
-    AG_LOG(ERROR, "yuv buf malloc failed: %s", std::strerror(errno));
-    return;
+    AG_LOG(ERROR, "Error writing JPEG data: %s", std::strerror(errno));
   }
-  // memset(yuvbuf, 0, width * 3);
-
-  cinfo.err = jpeg_std_error(&jerr);
-  jpeg_create_compress(&cinfo);
-  /* save to a file */
-  jpeg_stdio_dest(&cinfo, jpgFile_);
-  cinfo.image_width = videoFrame->yStride;
-  cinfo.image_height = videoFrame->height;
-  cinfo.input_components = 3;
-  cinfo.in_color_space = JCS_YCbCr; /*  YUV444  */
-  cinfo.dct_method = JDCT_FLOAT;
-  jpeg_set_defaults(&cinfo);
-
-  /* set jpeg image quality，range [0,100] */
-  jpeg_set_quality(&cinfo, 40, TRUE);
-
-  /* start */
-  jpeg_start_compress(&cinfo, TRUE);
-
-  unsigned char *ybase, *ubase, *vbase;
-  ybase = videoFrame->yBuffer;
-  ubase = videoFrame->uBuffer;
-  vbase = videoFrame->vBuffer;
-  /* process data */
-  JSAMPROW row_pointer[1];
-  int j = 0;
-  int idx;
-  while (cinfo.next_scanline < cinfo.image_height)
-  {
-    idx = 0;
-    for (int i = 0; i < width; i++) /* convert yuv420p to yuv444 */
-    {
-      yuvbuf[idx++] = ybase[i + j * width];
-      yuvbuf[idx++] = ubase[j / 4 * width + (i / 2)];
-      yuvbuf[idx++] = vbase[j / 4 * width + (i / 2)];
-    }
-    row_pointer[0] = yuvbuf;
-    jpeg_write_scanlines(&cinfo, row_pointer, 1);
-    j++;
-  }
-
-  /* stop */
-  jpeg_finish_compress(&cinfo);
-  /* destroy */
-  jpeg_destroy_compress(&cinfo);
   fclose(jpgFile_);
   jpgFile_ = nullptr;
-  if (yuvbuf)
-  {
-    free(yuvbuf);
-    yuvbuf = NULL;
-  }
-  // AG_LOG(INFO, "libjpeg convert YUV to jpeg");
 #endif
   *video_frame_saved_flag_ = 1;
   return;
@@ -461,6 +473,20 @@ int main(int argc, char *argv[])
   optParser.add_long_opt("numOfChannels", &options.audio.numOfChannels,
                          "Number of channels for received audio");
   optParser.add_long_opt("streamtype", &options.streamType, "the stream type");
+  optParser.add_long_opt("snapshotEncoder", &options.snapshotEncoder,
+                         "JPEG encoder of the snapshots: " SAMPLE_SNAPSHOT_ENCODERS
+                         " / default is libjpeg, builtin is faster in optimized builds only");
+  optParser.add_long_opt("snapshotQuality", &options.snapshotQuality,
+                         "JPEG quality of the snapshots, 1..100 / default is 40");
+  optParser.add_long_opt("snapshotMode", &options.snapshotMode,
+                         "first: the first frame of each channel every 20 s, speaker: the frames "
+                         "of the active speaker / default is first");
+  optParser.add_long_opt("speakerCooldown", &options.speakerCooldown,
+                         "Seconds between two snapshots of a channel in speaker mode / default is 5");
+  optParser.add_long_opt("speakerVolume", &options.speakerVolume,
+                         "Volume 0..255 from which a user is speaking / default is 30");
+  optParser.add_long_opt("volumeInterval", &options.volumeInterval,
+                         "Milliseconds between two audio volume indications / default is 200");
 
   if ((argc <= 1) || !optParser.parse_opts(argc, argv))
   {
@@ -482,6 +508,24 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  if (options.snapshotMode != SNAPSHOT_MODE_FIRST && options.snapshotMode != SNAPSHOT_MODE_SPEAKER)
+  {
+    AG_LOG(ERROR, "Unknown snapshot mode %s!", options.snapshotMode.c_str());
+    return -1;
+  }
+
+  if (options.volumeInterval <= 10 || options.speakerCooldown < 1)
+  {
+    AG_LOG(ERROR, "volumeInterval must be above 10 ms and speakerCooldown at least 1 s!");
+    return -1;
+  }
+
+  if (!createSnapshotEncoder(options.snapshotEncoder))
+  {
+    AG_LOG(ERROR, "Unknown snapshot encoder %s!", options.snapshotEncoder.c_str());
+    return -1;
+  }
+
   std::signal(SIGQUIT, SignalHandler);
   std::signal(SIGABRT, SignalHandler);
   std::signal(SIGINT, SignalHandler);
@@ -22,6 +22,9 @@
 #include "common/opt_parser.h"
 #include "common/sample_common.h"
 #include "common/sample_connection_observer.h"
+#include "common/sample_encoder_controller.h"
+#include "common/sample_local_user_observer.h"
+#include "common/sample_media_clock.h"
 
 #define DEFAULT_CONNECT_TIMEOUT_MS (3000)
 #define DEFAULT_SAMPLE_RATE (16000)
@@ -43,6 +46,7 @@ struct SampleOptions
     std::string audioFile = DEFAULT_AUDIO_FILE;
     std::string videoFile = DEFAULT_VIDEO_FILE;
     int multiChannels = 1;
+    bool enableAudio = false;
     struct
     {
         int sampleRate = DEFAULT_SAMPLE_RATE;
@@ -55,6 +59,7 @@ struct SampleOptions
         int height = DEFAULT_VIDEO_HEIGHT;
         int frameRate = DEFAULT_FRAME_RATE;
         bool enable_hw_encoder = false;
+        bool adaptiveEncoder = false;
     } video;
 };
 
@@ -62,9 +67,9 @@ SampleOptions options;
 
 static void sendOnePcmFrame(
     const SampleOptions &options,
-    agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender)
+    agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender,
+    FILE *&file, SampleMediaClock &clock)
 {
-    static FILE *file = nullptr;
     const char *fileName = options.audioFile.c_str();
 
     // Calculate byte size for 10ms audio samples
@@ -99,8 +104,13 @@ static void sendOnePcmFrame(
         return;
     }
 
+    // Stamp the frame from the shared channel clock so audio stays aligned
+    // with video even if this thread is scheduled late
+    int64_t timestampMs = clock.nextAudioTimestampMs(samplesPer10ms, options.audio.sampleRate);
+
     if (audioPcmDataSender->sendAudioPcmData(
-            frameBuf, 0, 0, samplesPer10ms, agora::rtc::TWO_BYTES_PER_SAMPLE,
+            frameBuf, static_cast<uint32_t>(timestampMs), timestampMs, samplesPer10ms,
+            agora::rtc::TWO_BYTES_PER_SAMPLE,
             options.audio.numOfChannels, options.audio.sampleRate) < 0)
     {
         AG_LOG(ERROR, "Failed to send audio frame!");
@@ -109,9 +119,9 @@ static void sendOnePcmFrame(
 
 static void sendOneYuvFrame(
     const SampleOptions &options,
-    agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender)
+    agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender,
+    FILE *&file, SampleMediaClock &clock)
 {
-    static FILE *file = nullptr;
     const char *fileName = options.videoFile.c_str();
 
     // Calculate byte size for YUV420 image
@@ -156,7 +166,7 @@ static void sendOneYuvFrame(
     videoFrame.cropRight = 0;
     videoFrame.cropBottom = 0;
     videoFrame.rotation = 0;
-    videoFrame.timestamp = 0;
+    videoFrame.timestamp = clock.nextVideoTimestampMs(options.video.frameRate);
 
     if (videoFrameSender->sendVideoFrame(videoFrame) < 0)
     {
@@ -167,24 +177,33 @@ static void sendOneYuvFrame(
 static void SampleSendAudioTask(
     const SampleOptions &options,
     agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender,
-    bool &exitFlag)
+    SampleMediaClock &clock, bool &exitFlag)
 {
+    // Each channel thread reads its own copy of the file
+    FILE *file = nullptr;
+
     // Currently only 10 ms PCM frame is supported. So PCM frames are sent at 10
     // ms interval
     PacerInfo pacer = {0, 10, 0, std::chrono::steady_clock::now()};
 
     while (!exitFlag)
     {
-        sendOnePcmFrame(options, audioPcmDataSender);
+        sendOnePcmFrame(options, audioPcmDataSender, file, clock);
         waitBeforeNextSend(pacer); // sleep for a while before sending next frame
     }
+    if (file)
+    {
+        fclose(file);
+    }
 }
 
 static void SampleSendVideoTask(
     const SampleOptions &options,
     agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender,
-    bool &exitFlag)
+    SampleMediaClock &clock, bool &exitFlag)
 {
+    FILE *file = nullptr;
+
     // Calculate send interval based on frame rate. H264 frames are sent at this
     // interval
     PacerInfo pacer = {0, 1000 / options.video.frameRate, 0,
@@ -192,9 +211,13 @@ static void SampleSendVideoTask(
 
     while (!exitFlag)
     {
-        sendOneYuvFrame(options, videoFrameSender);
+        sendOneYuvFrame(options, videoFrameSender, file, clock);
         waitBeforeNextSend(pacer); // sleep for a while before sending next frame
     }
+    if (file)
+    {
+        fclose(file);
+    }
 }
 
 static int connectWorker(agora::base::IAgoraService *service, int channel_index, bool &exitFlag)
@@ -218,8 +241,13 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
     auto connObserver = std::make_shared<SampleConnectionObserver>();
     connection->registerObserver(connObserver.get());
 
-    // Connect to Agora channel
-    if (connection->connect(options.appId.c_str(), options.channelId.c_str(),
+    // Local user observer delivers the local video track statistics
+    auto localUserObserver =
+        std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
+
+    // Connect to Agora channel, one channel per worker as the receiver expects
+    if (connection->connect(options.appId.c_str(),
+                            (options.channelId + to_string(channel_index)).c_str(),
                             options.userId.c_str()))
     {
         AG_LOG(ERROR, "Failed to connect to Agora channel!");
@@ -234,22 +262,26 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
         AG_LOG(ERROR, "Failed to create media node factory!");
     }
 
-    // Create audio data sender
-    /* agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender =
-        factory->createAudioPcmDataSender();
-  if (!audioPcmDataSender) {
-        AG_LOG(ERROR, "Failed to create audio data sender!");
-        return -1;
-    }
+    agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender;
+    agora::agora_refptr<agora::rtc::ILocalAudioTrack> customAudioTrack;
+    if (options.enableAudio)
+    {
+        // Create audio data sender
+        audioPcmDataSender = factory->createAudioPcmDataSender();
+        if (!audioPcmDataSender)
+        {
+            AG_LOG(ERROR, "Failed to create audio data sender!");
+            return -1;
+        }
 
-    // Create audio track
-    agora::agora_refptr<agora::rtc::ILocalAudioTrack> customAudioTrack =
-        service->createCustomAudioTrack(audioPcmDataSender);
-  if (!customAudioTrack) {
-        AG_LOG(ERROR, "Failed to create audio track!");
-        return -1;
+        // Create audio track
+        customAudioTrack = service->createCustomAudioTrack(audioPcmDataSender);
+        if (!customAudioTrack)
+        {
+            AG_LOG(ERROR, "Failed to create audio track!");
+            return -1;
+        }
     }
-    */
     // Create video frame sender
     agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender =
         factory->createVideoFrameSender();
@@ -274,13 +306,30 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
     encoderConfig.dimensions.width = options.video.width;
     encoderConfig.dimensions.height = options.video.height;
     encoderConfig.frameRate = options.video.frameRate;
-    encoderConfig.bitrate = options.video.targetBitrate;
+    encoderConfig.bitrate = options.video.targetBitrate / 1000;  // Kbps
 
-    customVideoTrack->setVideoEncoderConfiguration(encoderConfig);
+    std::unique_ptr<SampleEncoderController> encoderController;
+    if (options.video.adaptiveEncoder)
+    {
+        // Let the uplink estimate and encoder statistics drive the encoder
+        encoderController.reset(new SampleEncoderController(
+            customVideoTrack, encoderConfig, options.video.targetBitrate));
+        encoderController->start();
+        connObserver->setEncoderController(encoderController.get());
+        localUserObserver->setEncoderController(encoderController.get());
+        connection->registerNetworkObserver(connObserver.get());
+    }
+    else
+    {
+        customVideoTrack->setVideoEncoderConfiguration(encoderConfig);
+    }
 
     // Publish audio & video track
-    // customAudioTrack->setEnabled(true);
-    // connection->getLocalUser()->publishAudio(customAudioTrack);
+    if (customAudioTrack)
+    {
+        customAudioTrack->setEnabled(true);
+        connection->getLocalUser()->publishAudio(customAudioTrack);
+    }
     customVideoTrack->setEnabled(true);
     connection->getLocalUser()->publishVideo(customVideoTrack);
 
@@ -289,21 +338,38 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
 
     // Start sending media data
     AG_LOG(INFO, "Start sending audio & video data ...");
-    //std::thread sendAudioThread(SampleSendAudioTask, options, audioPcmDataSender,
-    //                            std::ref(exitFlag));
-    std::thread sendVideoThread(SampleSendVideoTask, options, videoFrameSender,
-                                std::ref(exitFlag));
+    // Audio and video of this channel share one clock so they stay in sync
+    SampleMediaClock mediaClock;
+    std::thread sendAudioThread;
+    if (audioPcmDataSender)
+    {
+        sendAudioThread = std::thread(SampleSendAudioTask, std::cref(options), audioPcmDataSender,
+                                      std::ref(mediaClock), std::ref(exitFlag));
+    }
+    std::thread sendVideoThread(SampleSendVideoTask, std::cref(options), videoFrameSender,
+                                std::ref(mediaClock), std::ref(exitFlag));
 
-    // sendAudioThread.join();
+    if (sendAudioThread.joinable())
+    {
+        sendAudioThread.join();
+    }
     sendVideoThread.join();
 
     // Unpublish audio & video track
-    // connection->getLocalUser()->unpublishAudio(customAudioTrack);
+    if (customAudioTrack)
+    {
+        connection->getLocalUser()->unpublishAudio(customAudioTrack);
+    }
     connection->getLocalUser()
         ->unpublishVideo(customVideoTrack);
 
     // Unregister connection observer
     connection->unregisterObserver(connObserver.get());
+    if (encoderController)
+    {
+        connection->unregisterNetworkObserver(connObserver.get());
+        localUserObserver->setEncoderController(nullptr);
+    }
 
     // Disconnect from Agora channel
     if (connection->disconnect())
@@ -315,9 +381,11 @@ static int connectWorker(agora::base::IAgoraService *service, int channel_index,
 
     // Destroy Agora connection and related resources
     connObserver.reset();
-    // audioPcmDataSender = nullptr;
+    localUserObserver.reset();
+    encoderController.reset();
+    audioPcmDataSender = nullptr;
     videoFrameSender = nullptr;
-    // customAudioTrack = nullptr;
+    customAudioTrack = nullptr;
     customVideoTrack = nullptr;
     factory = nullptr;
     connection = nullptr;
@@ -330,7 +398,6 @@ static void SignalHandler(int sigNo) { exitFlag = true; }
 
 int main(int argc, char *argv[])
 {
-    SampleOptions options;
     opt_parser optParser;
     std::thread *th_array = new std::thread[MAX_NUM_OF_THREAD];
 
@@ -340,6 +407,10 @@ int main(int argc, char *argv[])
     optParser.add_long_opt("userId", &options.userId, "User Id / default is 0");
     optParser.add_long_opt("audioFile", &options.audioFile,
                            "The audio file in raw PCM format to be sent");
+    optParser.add_long_opt("enableAudio", &options.enableAudio,
+                           "Send the PCM file together with the YUV file on each channel");
+    optParser.add_long_opt("multiChannels", &options.multiChannels,
+                           "Num multithread channels, no more than 100");
     optParser.add_long_opt("videoFile", &options.videoFile,
                            "The video file in YUV420 format to be sent");
     optParser.add_long_opt("sampleRate", &options.audio.sampleRate,
@@ -356,6 +427,9 @@ int main(int argc, char *argv[])
                            "Target bitrate (bps) for encoding the YUV stream");
     optParser.add_long_opt("hwencoder", &options.video.enable_hw_encoder,
                            "Target bitrate (bps) for encoding the YUV stream");
+    optParser.add_long_opt("adaptiveEncoder", &options.video.adaptiveEncoder,
+                           "Adapt bitrate/framerate/resolution to the uplink estimate, "
+                           "bitrate is the upper bound");
 
     if ((argc <= 1) || !optParser.parse_opts(argc, argv))
     {
@@ -395,7 +469,7 @@ int main(int argc, char *argv[])
     for (int i = 0; i < options.multiChannels; ++i)
     {
         // th_array[i] = std::thread(connectWorker, service, std::ref(i), std::ref(exitFlag));
-        AG_LOG(INFO, "!!!!!!!!!! index: %d", i);
+        AG_LOG_REPORT(INFO, "Starting channel %d", i);
         th_array[i] = std::thread(connectWorker, service, i, std::ref(exitFlag));
         // th_array[i] = std::thread(connectWorker, service, i);
         /*std::thread workerthobj1(connectWorkerObj, service, std::ref(channel_index));
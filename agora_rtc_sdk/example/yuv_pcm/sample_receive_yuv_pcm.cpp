@@ -4,11 +4,13 @@
 //  Copyright (c) 2020 Agora.io. All rights reserved.
 //
 
+#include <chrono>
 #include <csignal>
 #include <cstring>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "AgoraRefCountedObject.h"
 #include "IAgoraService.h"
@@ -18,6 +20,8 @@
 #include "common/sample_common.h"
 #include "common/sample_connection_observer.h"
 #include "common/sample_local_user_observer.h"
+#include "common/sample_receive_stats.h"
+#include "common/sample_worker_stage.h"
 
 #include "NGIAgoraAudioTrack.h"
 #include "NGIAgoraLocalUser.h"
@@ -30,6 +34,7 @@
 #define DEFAULT_AUDIO_FILE "received_audio.pcm"
 #define DEFAULT_VIDEO_FILE "received_video.yuv"
 #define DEFAULT_FILE_LIMIT (100 * 1024 * 1024)
+#define DEFAULT_RECORDING_FRAMES (64)
 #define STREAM_TYPE_HIGH "high"
 #define STREAM_TYPE_LOW "low"
 
@@ -41,6 +46,7 @@ struct SampleOptions {
   std::string streamType = STREAM_TYPE_HIGH;
   std::string audioFile = DEFAULT_AUDIO_FILE;
   std::string videoFile = DEFAULT_VIDEO_FILE;
+  int statsInterval = 0;
 
   struct {
     int sampleRate = DEFAULT_SAMPLE_RATE;
@@ -48,13 +54,43 @@ struct SampleOptions {
   } audio;
 };
 
-class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
+// A received frame waiting for the recording thread
+struct ReceivedFrame {
+  bool isVideo;
+  std::vector<uint8_t> data;  // keeps its capacity from one frame to the next
+};
+
+// Audio and video are posted from different SDK threads
+typedef SampleWorkerStage<ReceivedFrame, SampleMpscRing<ReceivedFrame>> RecordingStage;
+
+// Saves received frames to files of at most DEFAULT_FILE_LIMIT bytes
+class FrameFileWriter {
  public:
-  PcmFrameObserver(const std::string& outputFilePath)
+  FrameFileWriter(const std::string& outputFilePath)
       : outputFilePath_(outputFilePath),
-        pcmFile_(nullptr),
+        file_(nullptr),
         fileCount(0),
         fileSize_(0) {}
+  ~FrameFileWriter() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  bool write(const std::vector<uint8_t>& data);
+
+ private:
+  std::string outputFilePath_;
+  FILE* file_;
+  int fileCount;
+  int fileSize_;
+};
+
+class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
+ public:
+  // |stats|: counts the arrival of the frames, or nullptr
+  PcmFrameObserver(RecordingStage& recorder, SampleReceiveStats* stats)
+      : recorder_(recorder), stats_(stats) {}
 
   bool onPlaybackAudioFrame(const char* channelId,AudioFrame& audioFrame) override { return true; };
 
@@ -78,110 +114,88 @@ class PcmFrameObserver : public agora::media::IAudioFrameObserverBase {
 
 
  private:
-  std::string outputFilePath_;
-  FILE* pcmFile_;
-  int fileCount;
-  int fileSize_;
+  RecordingStage& recorder_;
+  SampleReceiveStats* stats_;
 };
 
 class YuvFrameObserver : public agora::rtc::IVideoFrameObserver2 {
  public:
-  YuvFrameObserver(const std::string& outputFilePath)
-      : outputFilePath_(outputFilePath),
-        yuvFile_(nullptr),
-        fileCount(0),
-        fileSize_(0) {}
+  YuvFrameObserver(RecordingStage& recorder, SampleReceiveStats* stats)
+      : recorder_(recorder), stats_(stats) {}
 
   void onFrame(const char* channelId, agora::user_id_t remoteUid, const agora::media::base::VideoFrame* frame) override;
 
   virtual ~YuvFrameObserver() = default;
 
  private:
-  std::string outputFilePath_;
-  FILE* yuvFile_;
-  int fileCount;
-  int fileSize_;
+  RecordingStage& recorder_;
+  SampleReceiveStats* stats_;
 };
 
-bool PcmFrameObserver::onPlaybackAudioFrameBeforeMixing(const char* channelId, agora::media::base::user_id_t userId, AudioFrame& audioFrame) {
-  // Create new file to save received PCM samples
-  if (!pcmFile_) {
+bool FrameFileWriter::write(const std::vector<uint8_t>& data) {
+  // Create new file to save received frames
+  if (!file_) {
     std::string fileName = (++fileCount > 1)
                                ? (outputFilePath_ + to_string(fileCount))
                                : outputFilePath_;
-    if (!(pcmFile_ = fopen(fileName.c_str(), "w"))) {
-      AG_LOG(ERROR, "Failed to create received audio file %s",
+    if (!(file_ = fopen(fileName.c_str(), "w+"))) {
+      AG_LOG(ERROR, "Failed to create received file %s",
              fileName.c_str());
       return false;
     }
-    AG_LOG(INFO, "Created file %s to save received PCM samples",
+    AG_LOG(INFO, "Created file %s to save received frames",
            fileName.c_str());
   }
 
-  // Write PCM samples
-  size_t writeBytes =
-      audioFrame.samplesPerChannel * audioFrame.channels * sizeof(int16_t);
-  if (fwrite(audioFrame.buffer, 1, writeBytes, pcmFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded audio data: %s", std::strerror(errno));
+  if (fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+    AG_LOG(ERROR, "Error writing decoded data: %s", std::strerror(errno));
     return false;
   }
-  fileSize_ += writeBytes;
+  fileSize_ += data.size();
 
   // Close the file if size limit is reached
   if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(pcmFile_);
-    pcmFile_ = nullptr;
+    fclose(file_);
+    file_ = nullptr;
     fileSize_ = 0;
   }
   return true;
 }
 
-void YuvFrameObserver::onFrame(const char* channelId, agora::user_id_t remoteUid, const agora::media::base::VideoFrame* videoFrame) {
-  // Create new file to save received YUV frames
-  if (!yuvFile_) {
-    std::string fileName = (++fileCount > 1)
-                               ? (outputFilePath_ + to_string(fileCount))
-                               : outputFilePath_;
-    if (!(yuvFile_ = fopen(fileName.c_str(), "w+"))) {
-      AG_LOG(ERROR, "Failed to create received video file %s",
-             fileName.c_str());
-      return ;
-    }
-    AG_LOG(INFO, "Created file %s to save received YUV frames",
-           fileName.c_str());
-  }
-
-  // Write Y planar
-  size_t writeBytes = videoFrame->yStride * videoFrame->height;
-  if (fwrite(videoFrame->yBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-    return ;
+bool PcmFrameObserver::onPlaybackAudioFrameBeforeMixing(const char* channelId, agora::media::base::user_id_t userId, AudioFrame& audioFrame) {
+  if (stats_) {
+    stats_->onFrame(SampleReceiveStats::kAudio, userId ? userId : "",
+                    audioFrame.renderTimeMs > 0 ? audioFrame.renderTimeMs : -1);
   }
-  fileSize_ += writeBytes;
 
-  // Write U planar
-  writeBytes = videoFrame->uStride * videoFrame->height / 2;
-  if (fwrite(videoFrame->uBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-    return ;
-  }
-  fileSize_ += writeBytes;
+  // Copy PCM samples, they are written by the recording thread
+  size_t writeBytes =
+      audioFrame.samplesPerChannel * audioFrame.channels * sizeof(int16_t);
+  const uint8_t* samples = static_cast<const uint8_t*>(audioFrame.buffer);
+  return recorder_.post([&](ReceivedFrame& frame) {
+    frame.isVideo = false;
+    frame.data.assign(samples, samples + writeBytes);
+  });
+}
 
-  // Write V planar
-  writeBytes = videoFrame->vStride * videoFrame->height / 2;
-  if (fwrite(videoFrame->vBuffer, 1, writeBytes, yuvFile_) != writeBytes) {
-    AG_LOG(ERROR, "Error writing decoded video data: %s", std::strerror(errno));
-    return ;
+void YuvFrameObserver::onFrame(const char* channelId, agora::user_id_t remoteUid, const agora::media::base::VideoFrame* videoFrame) {
+  if (stats_) {
+    stats_->onFrame(SampleReceiveStats::kVideo, remoteUid ? remoteUid : "",
+                    videoFrame->renderTimeMs > 0 ? videoFrame->renderTimeMs : -1,
+                    videoFrame->width, videoFrame->height);
   }
-  fileSize_ += writeBytes;
 
-  // Close the file if size limit is reached
-  if (fileSize_ >= DEFAULT_FILE_LIMIT) {
-    fclose(yuvFile_);
-    yuvFile_ = nullptr;
-    fileSize_ = 0;
-  }
-  return ;
+  // Copy Y, U and V planars, they are written by the recording thread
+  size_t ySize = videoFrame->yStride * videoFrame->height;
+  size_t uSize = videoFrame->uStride * videoFrame->height / 2;
+  size_t vSize = videoFrame->vStride * videoFrame->height / 2;
+  recorder_.post([&](ReceivedFrame& frame) {
+    frame.isVideo = true;
+    frame.data.resize(ySize + uSize + vSize);
+    memcpy(frame.data.data(), videoFrame->yBuffer, ySize);
+    memcpy(frame.data.data() + ySize, videoFrame->uBuffer, uSize);
+    memcpy(frame.data.data() + ySize + uSize, videoFrame->vBuffer, vSize);
+  });
 };
 
 static bool exitFlag = false;
@@ -204,6 +218,8 @@ int main(int argc, char* argv[]) {
   optParser.add_long_opt("numOfChannels", &options.audio.numOfChannels,
                          "Number of channels for received audio");
   optParser.add_long_opt("streamtype", &options.streamType, "the stream type");
+  optParser.add_long_opt("statsInterval", &options.statsInterval,
+                         "Log the receive statistics of each user every N seconds / default is 0 (never)");
 
   if ((argc <= 1) || !optParser.parse_opts(argc, argv)) {
     std::ostringstream strStream;
@@ -275,8 +291,22 @@ int main(int argc, char* argv[]) {
   auto localUserObserver =
       std::make_shared<SampleLocalUserObserver>(connection->getLocalUser());
 
+  // Start the recording thread, the observers only copy the frames
+  FrameFileWriter audioWriter(options.audioFile);
+  FrameFileWriter videoWriter(options.videoFile);
+  RecordingStage recorder(DEFAULT_RECORDING_FRAMES, [&](ReceivedFrame& frame) {
+    (frame.isVideo ? videoWriter : audioWriter).write(frame.data);
+  });
+  recorder.start();
+
+  // Count the arrival of the frames of each user
+  std::unique_ptr<SampleReceiveStats> receiveStats;
+  if (options.statsInterval > 0) {
+    receiveStats.reset(new SampleReceiveStats());
+  }
+
   // Register audio frame observer to receive audio stream
-  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(options.audioFile);
+  auto pcmFrameObserver = std::make_shared<PcmFrameObserver>(recorder, receiveStats.get());
   if (connection->getLocalUser()->setPlaybackAudioFrameBeforeMixingParameters(
           options.audio.numOfChannels, options.audio.sampleRate)) {
     AG_LOG(ERROR, "Failed to set audio frame parameters!");
@@ -286,7 +316,7 @@ int main(int argc, char* argv[]) {
 
   // Register video frame observer to receive video stream
   std::shared_ptr<YuvFrameObserver> yuvFrameObserver =
-      std::make_shared<YuvFrameObserver>(options.videoFile);
+      std::make_shared<YuvFrameObserver>(recorder, receiveStats.get());
   localUserObserver->setVideoFrameObserver(yuvFrameObserver.get());
 
   // Connect to Agora channel
@@ -299,9 +329,15 @@ int main(int argc, char* argv[]) {
   // Start receiving incoming media data
   AG_LOG(INFO, "Start receiving audio & video data ...");
 
-  // Periodically check exit flag
+  // Periodically check exit flag and report the receive statistics
+  auto lastReport = std::chrono::steady_clock::now();
   while (!exitFlag) {
     usleep(10000);
+    if (receiveStats && std::chrono::steady_clock::now() - lastReport >=
+                            std::chrono::seconds(options.statsInterval)) {
+      lastReport = std::chrono::steady_clock::now();
+      receiveStats->report();
+    }
   }
 
   // Unregister audio & video frame observers
@@ -318,6 +354,13 @@ int main(int argc, char* argv[]) {
   }
   AG_LOG(INFO, "Disconnected from Agora channel successfully");
 
+  // Write the frames still queued
+  recorder.stop();
+  if (recorder.dropped()) {
+    AG_LOG(ERROR, "Dropped %llu frames, the disk could not keep up",
+           static_cast<unsigned long long>(recorder.dropped()));
+  }
+
   // Destroy Agora connection and related resources
   localUserObserver.reset();
   pcmFrameObserver.reset();
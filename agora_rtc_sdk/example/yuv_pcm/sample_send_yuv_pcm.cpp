@@ -17,6 +17,7 @@
 #include "NGIAgoraMediaNodeFactory.h"
 #include "NGIAgoraRtcConnection.h"
 #include "NGIAgoraVideoTrack.h"
+#include "common/file_parser/helper_media_source.h"
 #include "common/helper.h"
 #include "common/log.h"
 #include "common/opt_parser.h"
@@ -30,6 +31,8 @@
 #define DEFAULT_VIDEO_WIDTH (352)
 #define DEFAULT_VIDEO_HEIGHT (288)
 #define DEFAULT_FRAME_RATE (15)
+#define DEFAULT_PREFETCH_FRAMES (8)
+#define DEFAULT_LATE_FRAME_WAIT_MS (100)
 #define DEFAULT_AUDIO_FILE "test_data/send_audio_16k_1ch.pcm"
 #define DEFAULT_VIDEO_FILE "test_data/send_video_cif.yuv"
 
@@ -53,79 +56,25 @@ struct SampleOptions {
 };
 
 static void sendOnePcmFrame(
-    const SampleOptions& options,
+    const SampleOptions& options, const HelperMediaFrame& frame,
     agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender) {
-  static FILE* file = nullptr;
-  const char* fileName = options.audioFile.c_str();
-
-  // Calculate byte size for 10ms audio samples
-  int sampleSize = sizeof(int16_t) * options.audio.numOfChannels;
   int samplesPer10ms = options.audio.sampleRate / 100;
-  int sendBytes = sampleSize * samplesPer10ms;
-
-  if (!file) {
-    if (!(file = fopen(fileName, "rb"))) {
-      AG_LOG(ERROR, "Failed to open audio file %s", fileName);
-      return;
-    }
-    AG_LOG(INFO, "Open audio file %s successfully", fileName);
-  }
-
-  uint8_t frameBuf[sendBytes];
-
-  if (fread(frameBuf, 1, sizeof(frameBuf), file) != sizeof(frameBuf)) {
-    if (feof(file)) {
-      fclose(file);
-      file = nullptr;
-      AG_LOG(INFO, "End of audio file");
-    } else {
-      AG_LOG(ERROR, "Error reading audio data: %s", std::strerror(errno));
-    }
-    return;
-  }
 
   if (audioPcmDataSender->sendAudioPcmData(
-          frameBuf, 0,0, samplesPer10ms, agora::rtc::TWO_BYTES_PER_SAMPLE,
+          frame.data, 0, 0, samplesPer10ms, agora::rtc::TWO_BYTES_PER_SAMPLE,
           options.audio.numOfChannels, options.audio.sampleRate) < 0) {
     AG_LOG(ERROR, "Failed to send audio frame!");
   }
 }
 
 static void sendOneYuvFrame(
-    const SampleOptions& options,
+    const SampleOptions& options, const HelperMediaFrame& frame,
     agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender) {
-  static FILE* file = nullptr;
-  const char* fileName = options.videoFile.c_str();
-
-  // Calculate byte size for YUV420 image
-  int sendBytes = options.video.width * options.video.height * 3 / 2;
-
-  if (!file) {
-    if (!(file = fopen(fileName, "rb"))) {
-      AG_LOG(ERROR, "Failed to open video file %s", fileName);
-      return;
-    }
-    AG_LOG(INFO, "Open video file %s successfully", fileName);
-  }
-
-  uint8_t frameBuf[sendBytes];
-
-  if (fread(frameBuf, 1, sizeof(frameBuf), file) != sizeof(frameBuf)) {
-    if (feof(file)) {
-      fclose(file);
-      file = nullptr;
-      AG_LOG(INFO, "End of video file");
-    } else {
-      AG_LOG(ERROR, "Error reading video data: %s", std::strerror(errno));
-    }
-    return;
-  }
-
   agora::media::base::ExternalVideoFrame videoFrame;
   videoFrame.type =
       agora::media::base::ExternalVideoFrame::VIDEO_BUFFER_RAW_DATA;
   videoFrame.format = agora::media::base::VIDEO_PIXEL_I420;
-  videoFrame.buffer = frameBuf;
+  videoFrame.buffer = const_cast<uint8_t*>(frame.data);
   videoFrame.stride = options.video.width;
   videoFrame.height = options.video.height;
   videoFrame.cropLeft = 0;
@@ -144,12 +93,29 @@ static void SampleSendAudioTask(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IAudioPcmDataSender> audioPcmDataSender,
     bool& exitFlag) {
+  // Calculate byte size for 10ms audio samples
+  int sampleSize = sizeof(int16_t) * options.audio.numOfChannels;
+  int samplesPer10ms = options.audio.sampleRate / 100;
+  HelperPrefetchSource pcmSource(
+      std::unique_ptr<HelperMediaSource>(
+          new HelperRawFileSource(options.audioFile.c_str(), sampleSize * samplesPer10ms)),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!pcmSource.start()) {
+    return;
+  }
+
   // Currently only 10 ms PCM frame is supported. So PCM frames are sent at 10
   // ms interval
   PacerInfo pacer = {0, 10, 0, std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    sendOnePcmFrame(options, audioPcmDataSender);
+    // a late frame keeps its slot, it is sent as soon as it is read
+    const HelperMediaFrame* frame = pcmSource.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!frame) {
+      continue;
+    }
+    sendOnePcmFrame(options, *frame, audioPcmDataSender);
+    pcmSource.release();
     waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   }
 }
@@ -158,13 +124,29 @@ static void SampleSendVideoTask(
     const SampleOptions& options,
     agora::agora_refptr<agora::rtc::IVideoFrameSender> videoFrameSender,
     bool& exitFlag) {
+  // Calculate byte size for YUV420 image
+  int sendBytes = options.video.width * options.video.height * 3 / 2;
+  HelperPrefetchSource yuvSource(
+      std::unique_ptr<HelperMediaSource>(
+          new HelperRawFileSource(options.videoFile.c_str(), sendBytes)),
+      DEFAULT_PREFETCH_FRAMES);
+  if (!yuvSource.start()) {
+    return;
+  }
+
   // Calculate send interval based on frame rate. H264 frames are sent at this
   // interval
   PacerInfo pacer = {0, 1000 / options.video.frameRate, 0,
                      std::chrono::steady_clock::now()};
 
   while (!exitFlag) {
-    sendOneYuvFrame(options, videoFrameSender);
+    // a late frame keeps its slot, it is sent as soon as it is read
+    const HelperMediaFrame* frame = yuvSource.next(DEFAULT_LATE_FRAME_WAIT_MS);
+    if (!frame) {
+      continue;
+    }
+    sendOneYuvFrame(options, *frame, videoFrameSender);
+    yuvSource.release();
     waitBeforeNextSend(pacer);  // sleep for a while before sending next frame
   }
 }